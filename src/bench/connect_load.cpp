@@ -0,0 +1,118 @@
+#include "connect_load.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int connect_loopback(int port) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    const int enabled = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+    // A proxy that stops answering must not hang the run.
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+class ConnectWorker {
+public:
+    ConnectWorker(const ConnectLoadOptions& options, const std::atomic<bool>& stop)
+        : options_(options), stop_(stop) {
+        request_ = "GET " + options.path + " HTTP/1.1\r\nHost: " + options.host + "\r\nConnection: close\r\n\r\n";
+    }
+
+    void run() {
+        while (!stop_.load(std::memory_order_relaxed)) {
+            if (exchange()) {
+                ++connections_;
+            } else {
+                ++errors_;
+            }
+        }
+    }
+
+    uint64_t connections() const { return connections_; }
+    uint64_t errors() const { return errors_; }
+
+private:
+    // Connects, sends the request and reads until the server closes; true on a 200.
+    bool exchange() {
+        const int fd = connect_loopback(options_.port);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = send(fd, request_.data(), request_.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request_.size());
+        std::string status_line;
+        char buffer[16384];
+        while (ok) {
+            const ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received < 0) {
+                ok = false;
+            }
+            if (received <= 0) {
+                break;
+            }
+            if (status_line.size() < 12) {
+                status_line.append(buffer, std::min<size_t>(static_cast<size_t>(received), 12 - status_line.size()));
+            }
+        }
+        close(fd);
+        return ok && status_line.size() == 12 && status_line.compare(9, 3, "200") == 0;
+    }
+
+    const ConnectLoadOptions& options_;
+    const std::atomic<bool>& stop_;
+    std::string request_;
+    uint64_t connections_ = 0;
+    uint64_t errors_ = 0;
+};
+
+}  // namespace
+
+ConnectLoadResult run_connect_load(const ConnectLoadOptions& options) {
+    std::atomic<bool> stop = false;
+    std::vector<std::unique_ptr<ConnectWorker>> workers;
+    for (size_t i = 0; i < std::max<size_t>(options.threads, 1); ++i) {
+        workers.push_back(std::make_unique<ConnectWorker>(options, stop));
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back([&worker] { worker->run(); });
+    }
+    std::this_thread::sleep_for(options.duration);
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ConnectLoadResult result;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    for (const auto& worker : workers) {
+        result.connections += worker->connections();
+        result.errors += worker->errors();
+    }
+    return result;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Closed-loop load where every request pays for a new connection: each thread
+// connects, sends one request with "Connection: close", reads the response and closes,
+// so the accept path dominates rather than request handling.
+struct ConnectLoadOptions {
+    int port = 0;              // 127.0.0.1
+    std::string host;          // Host header, selects the proxy route
+    std::string path = "/bench";
+    size_t threads = 8;
+    std::chrono::seconds duration{5};
+};
+
+struct ConnectLoadResult {
+    uint64_t connections = 0;  // answered with status 200
+    uint64_t errors = 0;       // refused or reset connections, other statuses
+    double seconds = 0.0;
+};
+
+ConnectLoadResult run_connect_load(const ConnectLoadOptions& options);
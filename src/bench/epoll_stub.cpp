@@ -0,0 +1,304 @@
+#include "epoll_stub.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "../proxy/http_wire.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t kListenerId = 0;
+constexpr uint64_t kWakeId = 1;
+constexpr uint64_t kTimerId = 2;
+constexpr uint64_t kUnixListenerId = 3;
+constexpr uint64_t kFirstConnectionId = 4;
+
+struct PendingResponse {
+    Clock::time_point due;
+    size_t body_bytes;
+};
+
+struct StubConnection {
+    int fd = -1;
+    std::string in;
+    std::string out;
+    size_t out_offset = 0;
+    std::deque<PendingResponse> pending;  // in request order
+};
+
+struct StubTimer {
+    Clock::time_point due;
+    uint64_t connection_id;
+
+    bool operator>(const StubTimer& other) const { return due > other.due; }
+};
+
+bool flush(StubConnection& connection) {
+    while (connection.out_offset < connection.out.size()) {
+        const ssize_t sent = send(connection.fd,
+                                  connection.out.data() + connection.out_offset,
+                                  connection.out.size() - connection.out_offset,
+                                  MSG_NOSIGNAL);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection.out_offset += static_cast<size_t>(sent);
+    }
+    connection.out.clear();
+    connection.out_offset = 0;
+    return true;
+}
+
+// steady_clock is CLOCK_MONOTONIC, so its time points can arm an absolute timerfd.
+void arm_timer(int timer_fd, Clock::time_point due) {
+    const auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(due.time_since_epoch());
+    itimerspec spec{};
+    spec.it_value.tv_sec = static_cast<time_t>(since_epoch.count() / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(std::max<int64_t>(since_epoch.count() % 1000000000, 1));
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+}  // namespace
+
+EpollStubUpstream::EpollStubUpstream(EpollStubOptions options) : options_(options) {
+    options_.payload_max = std::max(options_.payload_min, options_.payload_max);
+    payload_.assign(options_.payload_max, 'x');
+}
+
+EpollStubUpstream::~EpollStubUpstream() {
+    stop();
+}
+
+bool EpollStubUpstream::start() {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (listen_fd_ < 0 || epoll_fd_ < 0 || wake_fd_ < 0 || timer_fd_ < 0) {
+        return false;
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+        listen(listen_fd_, SOMAXCONN) != 0 ||
+        getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        return false;
+    }
+    port_ = ntohs(address.sin_port);
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    if (!options_.unix_path.empty()) {
+        sockaddr_un unix_address{};
+        if (options_.unix_path.size() >= sizeof(unix_address.sun_path)) {
+            return false;
+        }
+        unix_address.sun_family = AF_UNIX;
+        std::memcpy(unix_address.sun_path, options_.unix_path.data(), options_.unix_path.size());
+        unlink(options_.unix_path.c_str());
+        unix_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (unix_fd_ < 0 ||
+            bind(unix_fd_, reinterpret_cast<sockaddr*>(&unix_address), sizeof(unix_address)) != 0 ||
+            listen(unix_fd_, SOMAXCONN) != 0) {
+            return false;
+        }
+        event.data.u64 = kUnixListenerId;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, unix_fd_, &event);
+    }
+    event.data.u64 = kListenerId;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+    event.data.u64 = kWakeId;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+    event.data.u64 = kTimerId;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event);
+
+    thread_ = std::thread([this] { run(); });
+    return true;
+}
+
+void EpollStubUpstream::stop() {
+    stopping_ = true;
+    if (wake_fd_ >= 0) {
+        const uint64_t one = 1;
+        [[maybe_unused]] const ssize_t written = write(wake_fd_, &one, sizeof(one));
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    for (int* fd : {&listen_fd_, &unix_fd_, &epoll_fd_, &wake_fd_, &timer_fd_}) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+    if (!options_.unix_path.empty()) {
+        unlink(options_.unix_path.c_str());
+    }
+}
+
+void EpollStubUpstream::run() {
+    std::unordered_map<uint64_t, std::unique_ptr<StubConnection>> connections;
+    std::priority_queue<StubTimer, std::vector<StubTimer>, std::greater<>> timers;
+    std::optional<Clock::time_point> armed;
+    uint64_t next_id = kFirstConnectionId;
+    std::vector<epoll_event> events(256);
+    notiman::RequestHead head;
+    char buf[16 * 1024];
+
+    std::mt19937_64 random(42);
+    std::uniform_int_distribution<size_t> payload_size(options_.payload_min, options_.payload_max);
+    std::uniform_int_distribution<int64_t> jitter(0, options_.jitter.count());
+    const bool delayed = options_.latency.count() > 0 || options_.jitter.count() > 0;
+
+    auto append_response = [&](StubConnection& connection, size_t body_bytes) {
+        connection.out += "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: ";
+        connection.out += std::to_string(body_bytes);
+        connection.out += "\r\n\r\n";
+        connection.out.append(payload_, 0, body_bytes);
+    };
+
+    // Moves due responses into the output buffer; later ones must wait behind them.
+    auto release_due = [&](StubConnection& connection, Clock::time_point now) {
+        while (!connection.pending.empty() && connection.pending.front().due <= now) {
+            append_response(connection, connection.pending.front().body_bytes);
+            connection.pending.pop_front();
+        }
+    };
+
+    auto drop = [&](uint64_t id) {
+        const auto it = connections.find(id);
+        if (it != connections.end()) {
+            close(it->second->fd);
+            connections.erase(it);
+        }
+    };
+
+    while (!stopping_) {
+        const int count = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), 500);
+        for (int i = 0; i < count; ++i) {
+            const uint64_t id = events[static_cast<size_t>(i)].data.u64;
+            if (id == kWakeId) {
+                continue;
+            }
+            if (id == kListenerId || id == kUnixListenerId) {
+                const int listener = id == kListenerId ? listen_fd_ : unix_fd_;
+                for (;;) {
+                    const int client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (client < 0) {
+                        break;
+                    }
+                    if (id == kListenerId) {
+                        const int enabled = 1;
+                        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+                    }
+                    const uint64_t connection_id = next_id++;
+                    epoll_event event{};
+                    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    event.data.u64 = connection_id;
+                    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client, &event);
+                    auto connection = std::make_unique<StubConnection>();
+                    connection->fd = client;
+                    connections.emplace(connection_id, std::move(connection));
+                    accepted_.fetch_add(1, std::memory_order_relaxed);
+                }
+                continue;
+            }
+            if (id == kTimerId) {
+                uint64_t expirations = 0;
+                [[maybe_unused]] const ssize_t drained = read(timer_fd_, &expirations, sizeof(expirations));
+                armed.reset();
+                const auto now = Clock::now();
+                while (!timers.empty() && timers.top().due <= now) {
+                    const uint64_t connection_id = timers.top().connection_id;
+                    timers.pop();
+                    const auto it = connections.find(connection_id);
+                    if (it == connections.end()) {
+                        continue;
+                    }
+                    release_due(*it->second, now);
+                    if (!flush(*it->second)) {
+                        drop(connection_id);
+                    }
+                }
+                continue;
+            }
+
+            const auto it = connections.find(id);
+            if (it == connections.end()) {
+                continue;
+            }
+            StubConnection& connection = *it->second;
+
+            bool closed = false;
+            for (;;) {
+                const ssize_t received = recv(connection.fd, buf, sizeof(buf), 0);
+                if (received > 0) {
+                    connection.in.append(buf, static_cast<size_t>(received));
+                    continue;
+                }
+                closed = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                break;
+            }
+
+            // Bodies are skipped by Content-Length; benchmarks only send small requests.
+            const auto now = Clock::now();
+            size_t offset = 0;
+            while (notiman::parse_request_head(std::string_view(connection.in).substr(offset), head) ==
+                   notiman::ParseStatus::Complete) {
+                uint64_t body = 0;
+                notiman::BodyFramer::Mode mode = notiman::BodyFramer::Mode::None;
+                notiman::request_body_framing(head.headers, mode, body);
+                if (connection.in.size() - offset < head.head_bytes + body) {
+                    break;
+                }
+                offset += head.head_bytes + static_cast<size_t>(body);
+
+                const size_t body_bytes = payload_size(random);
+                if (!delayed && connection.pending.empty()) {
+                    append_response(connection, body_bytes);
+                    continue;
+                }
+                const auto due = now + options_.latency + std::chrono::microseconds(jitter(random));
+                connection.pending.push_back(PendingResponse{due, body_bytes});
+                timers.push(StubTimer{due, id});
+            }
+            connection.in.erase(0, offset);
+
+            if (closed || !flush(connection)) {
+                drop(id);
+            }
+        }
+
+        if (!timers.empty() && (!armed || timers.top().due < *armed)) {
+            armed = timers.top().due;
+            arm_timer(timer_fd_, *armed);
+        }
+    }
+
+    for (auto& [id, connection] : connections) {
+        close(connection->fd);
+    }
+}
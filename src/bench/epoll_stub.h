@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+struct EpollStubOptions {
+    // Body size of every response, drawn uniformly from [payload_min, payload_max].
+    size_t payload_min = 256;
+    size_t payload_max = 256;
+    // Each response is held for latency plus a uniform draw from [0, jitter].
+    std::chrono::microseconds latency{0};
+    std::chrono::microseconds jitter{0};
+    // Also serves on a Unix domain socket at this path when set, replacing any file there.
+    std::string unix_path;
+};
+
+// Event-driven loopback upstream for benchmarks where a thread-per-connection stub
+// would be the bottleneck. Answers every request with a generated body and keeps
+// connections open for as long as the client does. Delayed responses wait on a
+// timer, not a thread, so slow upstreams can be simulated at any concurrency.
+class EpollStubUpstream {
+public:
+    explicit EpollStubUpstream(EpollStubOptions options);
+    EpollStubUpstream(const EpollStubUpstream&) = delete;
+    EpollStubUpstream& operator=(const EpollStubUpstream&) = delete;
+    ~EpollStubUpstream();
+
+    // Binds 127.0.0.1 on a free port, and unix_path if set, and starts serving.
+    bool start();
+    void stop();
+
+    int port() const { return port_; }
+    const std::string& unix_path() const { return options_.unix_path; }
+    uint64_t accepted() const { return accepted_.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+
+    EpollStubOptions options_;
+    std::string payload_;
+    int listen_fd_ = -1;
+    int unix_fd_ = -1;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    int timer_fd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> stopping_ = false;
+    std::atomic<uint64_t> accepted_ = 0;
+    std::thread thread_;
+};
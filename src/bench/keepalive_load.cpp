@@ -0,0 +1,367 @@
+#include "keepalive_load.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <barrier>
+#include <cerrno>
+#include <cmath>
+#include <deque>
+#include <thread>
+
+#include "../proxy/http_wire.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadConnection {
+    int fd = -1;
+    uint32_t generation = 0;   // tells events for a replaced socket apart
+    bool connected = false;
+    bool queued = false;       // in the idle queue
+    bool busy = false;         // request outstanding
+    size_t sent = 0;
+    Clock::time_point sent_at;
+    std::string in;
+    bool head_done = false;
+    bool close_after = false;
+    notiman::ResponseHead head;
+    notiman::BodyFramer body;
+};
+
+struct WorkerResult {
+    size_t connected = 0;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint64_t reconnects = 0;
+    uint64_t unanswered = 0;
+    std::vector<uint32_t> latencies_us;
+};
+
+class LoadWorker {
+public:
+    LoadWorker(const KeepAliveLoadOptions& options, size_t connections, size_t in_flight)
+        : options_(options), connections_(connections), in_flight_(in_flight) {
+        request_ = "GET " + options.path + " HTTP/1.1\r\nHost: " + options.host + "\r\n\r\n";
+        address_.sin_family = AF_INET;
+        address_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address_.sin_port = htons(static_cast<uint16_t>(options.port));
+    }
+
+    void run(std::barrier<>& start_line) {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+
+        for (size_t i = 0; i < connections_.size(); ++i) {
+            open(i);
+        }
+        const auto connect_deadline = Clock::now() + options_.connect_timeout;
+        while (connected_ < connections_.size() && Clock::now() < connect_deadline && pending_ > 0) {
+            poll(50);
+        }
+
+        start_line.arrive_and_wait();
+        result_.connected = connected_;
+        measuring_ = true;
+        const auto deadline = Clock::now() + options_.duration;
+        for (size_t i = 0; i < connections_.size(); ++i) {
+            if (connections_[i].connected) {
+                enqueue(i);
+            }
+        }
+        dispatch();
+        while (Clock::now() < deadline) {
+            poll(10);
+        }
+
+        for (auto& connection : connections_) {
+            if (connection.busy) {
+                ++result_.unanswered;
+            }
+            if (connection.fd >= 0) {
+                close(connection.fd);
+            }
+        }
+        close(epoll_fd_);
+    }
+
+    WorkerResult& result() { return result_; }
+
+private:
+    void open(size_t index) {
+        LoadConnection& connection = connections_[index];
+        const uint32_t generation = connection.generation + 1;
+        connection = LoadConnection{};
+        connection.generation = generation;
+        connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (connection.fd < 0) {
+            ++result_.errors;
+            return;
+        }
+        const int enabled = 1;
+        setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+        if (connect(connection.fd, reinterpret_cast<const sockaddr*>(&address_), sizeof(address_)) != 0 &&
+            errno != EINPROGRESS) {
+            close(connection.fd);
+            connection.fd = -1;
+            ++result_.errors;
+            return;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.u64 = (static_cast<uint64_t>(generation) << 32) | index;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection.fd, &event);
+        ++pending_;
+    }
+
+    void reopen(size_t index) {
+        LoadConnection& connection = connections_[index];
+        if (connection.fd >= 0) {
+            close(connection.fd);
+        }
+        if (connection.connected) {
+            --connected_;
+        }
+        ++result_.reconnects;
+        open(index);
+    }
+
+    void enqueue(size_t index) {
+        if (!connections_[index].queued) {
+            connections_[index].queued = true;
+            idle_.push_back(index);
+        }
+    }
+
+    void dispatch() {
+        while (outstanding_ < in_flight_ && !idle_.empty()) {
+            const size_t index = idle_.front();
+            idle_.pop_front();
+            LoadConnection& connection = connections_[index];
+            connection.queued = false;
+            if (!connection.connected || connection.busy) {
+                continue;
+            }
+            connection.busy = true;
+            connection.sent = 0;
+            connection.head_done = false;
+            connection.sent_at = Clock::now();
+            ++outstanding_;
+            if (!flush(connection)) {
+                fail(index);
+            }
+        }
+    }
+
+    bool flush(LoadConnection& connection) {
+        while (connection.busy && connection.sent < request_.size()) {
+            const ssize_t sent = send(connection.fd, request_.data() + connection.sent,
+                                      request_.size() - connection.sent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            connection.sent += static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    // Drops an outstanding request and replaces its connection.
+    void fail(size_t index) {
+        if (connections_[index].busy) {
+            --outstanding_;
+            if (measuring_) {
+                ++result_.errors;
+            }
+        }
+        reopen(index);
+    }
+
+    // False when the server asked to close and the connection was replaced.
+    bool complete(size_t index) {
+        LoadConnection& connection = connections_[index];
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - connection.sent_at);
+        if (connection.head.status == 200) {
+            ++result_.requests;
+            result_.latencies_us.push_back(static_cast<uint32_t>(std::min<int64_t>(elapsed.count(), UINT32_MAX)));
+        } else {
+            ++result_.errors;
+        }
+        connection.busy = false;
+        --outstanding_;
+        if (connection.close_after) {
+            reopen(index);
+            return false;
+        }
+        enqueue(index);
+        return true;
+    }
+
+    void on_event(size_t index, uint32_t events) {
+        LoadConnection& connection = connections_[index];
+        if (connection.fd < 0) {
+            return;
+        }
+
+        if (!connection.connected) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                --pending_;
+                close(connection.fd);
+                connection.fd = -1;
+                ++result_.errors;
+                return;
+            }
+            if ((events & EPOLLOUT) == 0) {
+                return;
+            }
+            --pending_;
+            connection.connected = true;
+            ++connected_;
+            if (measuring_) {
+                enqueue(index);
+            }
+        }
+
+        if (!flush(connection)) {
+            fail(index);
+            return;
+        }
+
+        char buf[16 * 1024];
+        bool closed = false;
+        for (;;) {
+            const ssize_t received = recv(connection.fd, buf, sizeof(buf), 0);
+            if (received > 0) {
+                connection.in.append(buf, static_cast<size_t>(received));
+                continue;
+            }
+            closed = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
+        }
+
+        while (connection.busy && !connection.in.empty()) {
+            if (!connection.head_done) {
+                const auto status = notiman::parse_response_head(connection.in, connection.head);
+                if (status == notiman::ParseStatus::Incomplete) {
+                    break;
+                }
+                notiman::BodyFramer::Mode mode = notiman::BodyFramer::Mode::None;
+                uint64_t length = 0;
+                if (status == notiman::ParseStatus::Invalid ||
+                    notiman::response_body_framing("GET", connection.head, mode, length) != notiman::FramingStatus::Ok) {
+                    fail(index);
+                    return;
+                }
+                const std::string_view connection_header = notiman::find_header(connection.head.headers, "Connection");
+                connection.close_after = notiman::header_has_token(connection_header, "close") ||
+                                         mode == notiman::BodyFramer::Mode::UntilClose;
+                connection.in.erase(0, connection.head.head_bytes);
+                connection.body.reset(mode, length);
+                connection.head_done = true;
+            }
+            const size_t used = connection.body.consume(connection.in.data(), connection.in.size());
+            connection.in.erase(0, used);
+            if (connection.body.failed()) {
+                fail(index);
+                return;
+            }
+            if (!connection.body.done()) {
+                break;
+            }
+            if (!complete(index)) {
+                return;
+            }
+        }
+
+        if (closed || (events & (EPOLLHUP | EPOLLERR)) != 0) {
+            if (connection.busy) {
+                fail(index);
+            } else if (measuring_) {
+                reopen(index);
+            } else {
+                close(connection.fd);
+                connection.fd = -1;
+                connection.connected = false;
+                --connected_;
+            }
+        }
+    }
+
+    void poll(int timeout_ms) {
+        epoll_event events[256];
+        const int count = epoll_wait(epoll_fd_, events, 256, timeout_ms);
+        for (int i = 0; i < count; ++i) {
+            const auto index = static_cast<size_t>(events[i].data.u64 & 0xffffffffu);
+            if (connections_[index].generation == static_cast<uint32_t>(events[i].data.u64 >> 32)) {
+                on_event(index, events[i].events);
+            }
+        }
+        if (measuring_) {
+            dispatch();
+        }
+    }
+
+    const KeepAliveLoadOptions& options_;
+    std::vector<LoadConnection> connections_;
+    size_t in_flight_;
+    std::string request_;
+    sockaddr_in address_{};
+    int epoll_fd_ = -1;
+    size_t pending_ = 0;       // connects in progress
+    size_t connected_ = 0;
+    size_t outstanding_ = 0;
+    bool measuring_ = false;
+    std::deque<size_t> idle_;
+    WorkerResult result_;
+};
+
+}  // namespace
+
+uint32_t KeepAliveLoadResult::percentile_us(double q) const {
+    if (latencies_us.empty()) {
+        return 0;
+    }
+    const auto rank = static_cast<size_t>(std::ceil(q * static_cast<double>(latencies_us.size())));
+    return latencies_us[std::clamp<size_t>(rank, 1, latencies_us.size()) - 1];
+}
+
+KeepAliveLoadResult run_keepalive_load(const KeepAliveLoadOptions& options) {
+    const size_t threads = std::max<size_t>(1, std::min(options.threads, options.connections));
+    std::vector<std::unique_ptr<LoadWorker>> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        const size_t connections = options.connections / threads + (t < options.connections % threads ? 1 : 0);
+        const size_t in_flight = std::max<size_t>(1, options.in_flight / threads + (t < options.in_flight % threads ? 1 : 0));
+        workers.push_back(std::make_unique<LoadWorker>(options, connections, std::min(in_flight, connections)));
+    }
+
+    // Every worker finishes connecting before its clock starts.
+    std::barrier<> start_line(static_cast<std::ptrdiff_t>(threads));
+
+    std::vector<std::thread> runners;
+    for (auto& worker : workers) {
+        runners.emplace_back([&, raw = worker.get()] { raw->run(start_line); });
+    }
+    for (auto& runner : runners) {
+        runner.join();
+    }
+
+    KeepAliveLoadResult result;
+    result.seconds = std::chrono::duration<double>(options.duration).count();
+    for (auto& worker : workers) {
+        WorkerResult& part = worker->result();
+        result.connected += part.connected;
+        result.requests += part.requests;
+        result.errors += part.errors;
+        result.reconnects += part.reconnects;
+        result.unanswered += part.unanswered;
+        result.latencies_us.insert(result.latencies_us.end(), part.latencies_us.begin(), part.latencies_us.end());
+    }
+    std::sort(result.latencies_us.begin(), result.latencies_us.end());
+    return result;
+}
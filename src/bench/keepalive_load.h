@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Closed-loop HTTP/1.1 load over many persistent connections: connects them all up
+// front, then keeps in_flight requests outstanding spread round-robin across them so
+// most connections sit idle between requests, like browser tabs and dev tools do.
+struct KeepAliveLoadOptions {
+    int port = 0;              // 127.0.0.1
+    std::string host;          // Host header, selects the proxy route
+    std::string path = "/bench";
+    size_t connections = 10000;
+    size_t in_flight = 256;
+    size_t threads = 1;        // client event loops; connections are split between them
+    std::chrono::seconds duration{10};
+    std::chrono::seconds connect_timeout{10};
+};
+
+struct KeepAliveLoadResult {
+    size_t connected = 0;      // connections open when measuring started
+    uint64_t requests = 0;     // completed with status 200
+    uint64_t errors = 0;       // other statuses, resets and malformed responses
+    uint64_t reconnects = 0;   // server closed a keep-alive connection
+    uint64_t unanswered = 0;   // still outstanding when the run ended
+    double seconds = 0.0;
+    std::vector<uint32_t> latencies_us;  // sorted
+
+    uint32_t percentile_us(double q) const;
+};
+
+KeepAliveLoadResult run_keepalive_load(const KeepAliveLoadOptions& options);
@@ -0,0 +1,1043 @@
+#include <CLI11/CLI11.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <httplib/httplib.h>
+
+#include "../proxy/route_table.h"
+#include "../proxy/upstream_pool.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../proxy/forwarding.h"
+#include "../proxy/proxy_engine.h"
+#include "../proxy/traffic_capture.h"
+#include "connect_load.h"
+#include "epoll_stub.h"
+#include "keepalive_load.h"
+#include "open_loop_load.h"
+#include "transfer_load.h"
+#endif
+
+struct StubUpstream {
+    httplib::Server server;
+    std::thread thread;
+    int port = 0;
+};
+
+// Starts a loopback HTTP server answering every GET with a fixed-size body.
+static std::unique_ptr<StubUpstream> start_stub_upstream(size_t payload_bytes) {
+    auto stub = std::make_unique<StubUpstream>();
+    const std::string payload(payload_bytes, 'x');
+    stub->server.Get(R"(/.*)", [payload](const httplib::Request&, httplib::Response& res) {
+        res.set_content(payload, "text/plain");
+    });
+
+    // Behave like a typical dev server: no Nagle delays, long-lived keep-alive.
+    stub->server.set_tcp_nodelay(true);
+    stub->server.set_keep_alive_max_count(1000);
+
+    stub->port = stub->server.bind_to_any_port("127.0.0.1");
+    if (stub->port <= 0) {
+        return nullptr;
+    }
+
+    StubUpstream* raw = stub.get();
+    stub->thread = std::thread([raw] { raw->server.listen_after_bind(); });
+    stub->server.wait_until_ready();
+    return stub;
+}
+
+static void stop_stub_upstream(StubUpstream& stub) {
+    stub.server.stop();
+    if (stub.thread.joinable()) {
+        stub.thread.join();
+    }
+}
+
+struct PoolRunResult {
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    double seconds = 0.0;
+    notiman::UpstreamPoolStats stats;
+};
+
+static PoolRunResult run_pool_pass(int port, size_t max_idle, int threads, int requests_per_thread) {
+    notiman::UpstreamPoolOptions options;
+    options.max_idle = max_idle;
+    auto pool = std::make_shared<notiman::UpstreamPool>("127.0.0.1", port, options);
+
+    std::atomic<uint64_t> errors = 0;
+    std::vector<std::thread> workers;
+    workers.reserve(static_cast<size_t>(threads));
+
+    const auto started_at = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            for (int i = 0; i < requests_per_thread; ++i) {
+                auto lease = pool->acquire();
+                auto result = lease.client().Get("/bench");
+                if (!result || result->status != 200) {
+                    errors.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const auto ended_at = std::chrono::steady_clock::now();
+
+    PoolRunResult result;
+    result.requests = static_cast<uint64_t>(threads) * static_cast<uint64_t>(requests_per_thread);
+    result.errors = errors.load();
+    result.seconds = std::chrono::duration<double>(ended_at - started_at).count();
+    result.stats = pool->stats();
+    return result;
+}
+
+static void print_pool_result(const std::string& label, const PoolRunResult& result) {
+    const double rps = result.seconds > 0.0 ? static_cast<double>(result.requests) / result.seconds : 0.0;
+    std::cout << std::left << std::setw(14) << label
+              << std::right << std::setw(10) << result.requests
+              << std::setw(8) << result.errors
+              << std::setw(12) << std::fixed << std::setprecision(3) << result.seconds
+              << std::setw(12) << std::setprecision(0) << rps
+              << std::setw(10) << result.stats.connects
+              << "\n";
+}
+
+static int run_pool_benchmark(int requests, int threads, size_t payload_bytes) {
+    auto stub = start_stub_upstream(payload_bytes);
+    if (!stub) {
+        std::cerr << "Error: failed to start stub upstream\n";
+        return 1;
+    }
+
+    const int per_thread = std::max(1, requests / std::max(1, threads));
+    std::cout << "stub upstream on 127.0.0.1:" << stub->port
+              << ", " << threads << " threads, " << payload_bytes << " byte bodies\n\n";
+    std::cout << std::left << std::setw(14) << "mode"
+              << std::right << std::setw(10) << "requests"
+              << std::setw(8) << "errors"
+              << std::setw(12) << "seconds"
+              << std::setw(12) << "req/s"
+              << std::setw(10) << "connects"
+              << "\n";
+
+    // Same code path as the proxy; max_idle = 0 reproduces a fresh connection per request.
+    print_pool_result("no-pool", run_pool_pass(stub->port, 0, threads, per_thread));
+    print_pool_result("pool", run_pool_pass(stub->port, static_cast<size_t>(threads), threads, per_thread));
+
+    stop_stub_upstream(*stub);
+    return 0;
+}
+
+// Route i of a synthetic config: a quarter each are path prefixes behind one gateway
+// host, plain hosts, "*" hosts and "**" hosts. request_for(i) is a request it matches.
+static std::string route_name_for(size_t i) {
+    const std::string n = std::to_string(i);
+    switch (i % 4) {
+    case 0: return "gateway/api/svc" + n + "/**";
+    case 1: return "svc" + n;
+    case 2: return "*.pr" + n;
+    default: return "**.team" + n;
+    }
+}
+
+static std::pair<std::string, std::string> request_for(size_t i) {
+    const std::string n = std::to_string(i);
+    switch (i % 4) {
+    case 0: return {"gateway.localhost:8080", "/api/svc" + n + "/items/42"};
+    case 1: return {"svc" + n + ".localhost:8080", "/v1/items"};
+    case 2: return {"feature-x.pr" + n + ".localhost:8080", "/"};
+    default: return {"web.app.team" + n + ".localhost:8080", "/static/app.js"};
+    }
+}
+
+// Build time and lookup cost of the compiled route table as the number of routes grows.
+// Requests go to 16 of the routes, which stay in cache, and then to all of them, which
+// adds the cache misses of a large table. One request in eight matches nothing.
+static int run_routes_benchmark(size_t max_routes, size_t lookups) {
+    std::vector<size_t> counts;
+    for (size_t count = 10; count < max_routes; count *= 10) {
+        counts.push_back(count);
+    }
+    counts.push_back(max_routes);
+
+    std::cout << lookups << " lookups per table\n\n";
+    std::cout << std::right << std::setw(8) << "routes"
+              << std::setw(11) << "build ms"
+              << std::setw(10) << "ns (16)"
+              << std::setw(11) << "ns (all)"
+              << "\n";
+
+    for (const size_t count : counts) {
+        notiman::ProxyConfig config;
+        for (size_t i = 0; i < count; ++i) {
+            notiman::ProxyRoute route;
+            route.name = route_name_for(i);
+            route.target_base_urls.push_back("http://127.0.0.1:3000");
+            config.routes.push_back(std::move(route));
+        }
+        const auto build_started = std::chrono::steady_clock::now();
+        const auto table = notiman::RouteTable::build(config, nullptr);
+        const double build_ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_started).count();
+
+        const auto ns_per_lookup = [&](size_t spread) {
+            std::mt19937 random(42);
+            std::uniform_int_distribution<size_t> pick(0, std::min(spread, count) - 1);
+            std::vector<std::pair<std::string, std::string>> requests;
+            for (size_t i = 0; i < 4096; ++i) {
+                requests.push_back(i % 8 == 7 ? std::pair<std::string, std::string>{"gateway.localhost", "/api/unknown"}
+                                              : request_for(pick(random) * std::max<size_t>(count / spread, 1)));
+            }
+
+            size_t matched = 0;
+            const auto started = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < lookups; ++i) {
+                const auto& [host, path] = requests[i % requests.size()];
+                matched += table->find(host, path) != nullptr ? 1 : 0;
+            }
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            // Keeps the lookups from being optimised away.
+            if (matched == 0) {
+                std::cerr << "Warning: no lookup matched\n";
+            }
+            return seconds * 1e9 / static_cast<double>(lookups);
+        };
+
+        std::cout << std::setw(8) << table->routes().size()
+                  << std::setw(11) << std::fixed << std::setprecision(1) << build_ms
+                  << std::setw(10) << ns_per_lookup(16)
+                  << std::setw(11) << ns_per_lookup(count)
+                  << "\n";
+    }
+    return 0;
+}
+
+#ifdef __linux__
+// Every benchmark connection costs one descriptor in the client and one in the proxy.
+static void raise_fd_limit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+static void print_engine_result(const std::string& label, const KeepAliveLoadResult& result) {
+    const double rps = result.seconds > 0.0 ? static_cast<double>(result.requests) / result.seconds : 0.0;
+    std::cout << std::left << std::setw(10) << label
+              << std::right << std::setw(11) << result.connected
+              << std::setw(12) << result.requests
+              << std::setw(8) << result.errors
+              << std::setw(11) << result.unanswered
+              << std::setw(12) << result.reconnects
+              << std::setw(11) << std::fixed << std::setprecision(0) << rps
+              << std::setw(10) << std::setprecision(2) << result.percentile_us(0.50) / 1000.0
+              << std::setw(10) << result.percentile_us(0.99) / 1000.0
+              << "\n";
+}
+
+static int run_engine_benchmark(const std::string& engines,
+                                size_t connections,
+                                size_t in_flight,
+                                int seconds,
+                                size_t client_threads,
+                                int workers,
+                                size_t payload_bytes) {
+    raise_fd_limit();
+
+    EpollStubOptions stub_options;
+    stub_options.payload_min = payload_bytes;
+    stub_options.payload_max = payload_bytes;
+    EpollStubUpstream stub(stub_options);
+    if (!stub.start()) {
+        std::cerr << "Error: failed to start stub upstream\n";
+        return 1;
+    }
+
+    notiman::ProxyConfig config;
+    config.workers = workers;
+    config.pool_max_idle = static_cast<int>(in_flight);
+    notiman::ProxyRoute route;
+    route.name = "bench";
+    route.target_base_urls.push_back("http://127.0.0.1:" + std::to_string(stub.port()));
+    config.routes.push_back(std::move(route));
+
+    std::cout << "stub upstream on 127.0.0.1:" << stub.port() << ", " << connections << " keep-alive connections, "
+              << in_flight << " in flight, " << seconds << "s per engine, " << payload_bytes << " byte bodies\n\n";
+    std::cout << std::left << std::setw(10) << "engine"
+              << std::right << std::setw(11) << "connected"
+              << std::setw(12) << "requests"
+              << std::setw(8) << "errors"
+              << std::setw(11) << "unanswered"
+              << std::setw(12) << "reconnects"
+              << std::setw(11) << "req/s"
+              << std::setw(10) << "p50 ms"
+              << std::setw(10) << "p99 ms"
+              << "\n";
+
+    for (const char* name : {"httplib", "epoll"}) {
+        if (engines != "both" && engines != name) {
+            continue;
+        }
+        config.engine = name;
+        notiman::RouteTablePublisher routes;
+        routes.publish(notiman::RouteTable::build(config, nullptr));
+        auto engine = notiman::make_proxy_engine(config, routes, nullptr, nullptr, nullptr);
+        if (std::string(engine->name()) != name) {
+            std::cerr << "Error: " << name << " engine is not available\n";
+            continue;
+        }
+        if (!engine->start("127.0.0.1", 0)) {
+            std::cerr << "Error: failed to start the " << name << " engine\n";
+            return 1;
+        }
+
+        KeepAliveLoadOptions options;
+        options.port = engine->port();
+        options.host = "bench.localhost";
+        options.connections = connections;
+        options.in_flight = in_flight;
+        options.threads = client_threads;
+        options.duration = std::chrono::seconds(seconds);
+        print_engine_result(name, run_keepalive_load(options));
+
+        engine->stop();
+        routes.publish(nullptr);
+    }
+
+    stub.stop();
+    return 0;
+}
+struct AcceptSettings {
+    std::string engines = "both";
+    size_t max_listeners = 0;
+    size_t client_threads = 8;
+    int seconds = 5;
+    int workers = 0;
+};
+
+// Connection rate with 1, 2, 4, ... listening sockets up to max_listeners, each request on
+// a fresh connection. The engines' worker counts stay the same across the sweep, so what
+// changes is only how many accept queues the kernel spreads connections over.
+static int run_accept_benchmark(const AcceptSettings& settings) {
+    raise_fd_limit();
+
+    EpollStubOptions stub_options;
+    stub_options.payload_min = 64;
+    stub_options.payload_max = 64;
+    EpollStubUpstream stub(stub_options);
+    if (!stub.start()) {
+        std::cerr << "Error: failed to start stub upstream\n";
+        return 1;
+    }
+
+    const size_t max_listeners =
+        settings.max_listeners > 0 ? settings.max_listeners : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<size_t> counts;
+    for (size_t count = 1; count < max_listeners; count *= 2) {
+        counts.push_back(count);
+    }
+    counts.push_back(max_listeners);
+
+    notiman::ProxyConfig config;
+    config.workers = settings.workers;
+    notiman::ProxyRoute route;
+    route.name = "bench";
+    route.target_base_urls.push_back("http://127.0.0.1:" + std::to_string(stub.port()));
+    config.routes.push_back(std::move(route));
+
+    std::cout << "stub upstream on 127.0.0.1:" << stub.port() << ", " << settings.client_threads
+              << " client threads, one request per connection, " << settings.seconds << "s per run\n\n";
+    std::cout << std::left << std::setw(10) << "engine"
+              << std::right << std::setw(11) << "listeners"
+              << std::setw(13) << "connections"
+              << std::setw(8) << "errors"
+              << std::setw(10) << "conn/s"
+              << std::setw(9) << "scaling"
+              << "\n";
+
+    for (const char* name : {"httplib", "epoll"}) {
+        if (settings.engines != "both" && settings.engines != name) {
+            continue;
+        }
+        config.engine = name;
+        double single_rate = 0.0;
+        for (const size_t count : counts) {
+            config.listeners = static_cast<int>(count);
+            notiman::RouteTablePublisher routes;
+            routes.publish(notiman::RouteTable::build(config, nullptr));
+            auto engine = notiman::make_proxy_engine(config, routes, nullptr, nullptr, nullptr);
+            if (std::string(engine->name()) != name || !engine->start("127.0.0.1", 0)) {
+                std::cerr << "Error: failed to start the " << name << " engine\n";
+                return 1;
+            }
+
+            ConnectLoadOptions options;
+            options.port = engine->port();
+            options.host = "bench.localhost";
+            options.threads = settings.client_threads;
+            options.duration = std::chrono::seconds(settings.seconds);
+            const ConnectLoadResult result = run_connect_load(options);
+            engine->stop();
+            routes.publish(nullptr);
+
+            const double rate = result.seconds > 0.0 ? static_cast<double>(result.connections) / result.seconds : 0.0;
+            if (count == 1) {
+                single_rate = rate;
+            }
+            std::cout << std::left << std::setw(10) << name
+                      << std::right << std::setw(11) << count
+                      << std::setw(13) << result.connections
+                      << std::setw(8) << result.errors
+                      << std::setw(10) << std::fixed << std::setprecision(0) << rate
+                      << std::setw(8) << std::setprecision(2) << (single_rate > 0.0 ? rate / single_rate : 0.0) << "x"
+                      << "\n";
+        }
+    }
+
+    stub.stop();
+    return 0;
+}
+
+struct LoadSettings {
+    std::string engines = "both";
+    size_t routes = 32;
+    double rate = 5000.0;
+    int seconds = 10;
+    size_t max_connections = 1024;
+    int workers = 0;
+    double latency_ms = 1.0;
+    double jitter_ms = 0.0;
+    size_t payload_min = 256;
+    size_t payload_max = 4096;
+};
+
+static void print_load_result(const std::string& label, const OpenLoopLoadResult& result, uint32_t direct_p50_us) {
+    const double rps = result.seconds > 0.0 ? static_cast<double>(result.completed) / result.seconds : 0.0;
+    const uint32_t p50 = result.percentile_us(0.50);
+    std::cout << std::left << std::setw(10) << label
+              << std::right << std::setw(11) << std::fixed << std::setprecision(0) << rps
+              << std::setw(8) << result.errors
+              << std::setw(11) << result.unanswered
+              << std::setw(7) << result.connections
+              << std::setw(10) << std::setprecision(2) << p50 / 1000.0
+              << std::setw(10) << result.percentile_us(0.99) / 1000.0
+              << std::setw(10) << result.percentile_us(0.999) / 1000.0
+              << std::setw(10) << (result.latencies_us.empty() ? 0.0 : result.latencies_us.back() / 1000.0);
+    if (direct_p50_us > 0 && !result.latencies_us.empty()) {
+        std::cout << std::setw(12) << (static_cast<double>(p50) - direct_p50_us) / 1000.0;
+    }
+    std::cout << "\n";
+}
+
+// Offers the same fixed-rate load to the stub directly and then through each engine,
+// so the difference in latency is what the proxy adds.
+static int run_load_benchmark(const LoadSettings& settings) {
+    raise_fd_limit();
+
+    EpollStubOptions stub_options;
+    stub_options.payload_min = settings.payload_min;
+    stub_options.payload_max = settings.payload_max;
+    stub_options.latency = std::chrono::microseconds(static_cast<int64_t>(settings.latency_ms * 1000.0));
+    stub_options.jitter = std::chrono::microseconds(static_cast<int64_t>(settings.jitter_ms * 1000.0));
+    EpollStubUpstream stub(stub_options);
+    if (!stub.start()) {
+        std::cerr << "Error: failed to start stub upstream\n";
+        return 1;
+    }
+
+    notiman::ProxyConfig config;
+    config.workers = settings.workers;
+    config.pool_max_idle = static_cast<int>(std::min<size_t>(settings.max_connections, 256));
+    OpenLoopLoadOptions options;
+    options.rate = settings.rate;
+    options.duration = std::chrono::seconds(settings.seconds);
+    options.max_connections = settings.max_connections;
+    for (size_t i = 0; i < std::max<size_t>(settings.routes, 1); ++i) {
+        const std::string subdomain = "r" + std::to_string(i);
+        notiman::ProxyRoute route;
+        route.name = subdomain;
+        route.target_base_urls.push_back("http://127.0.0.1:" + std::to_string(stub.port()));
+        config.routes.push_back(std::move(route));
+        options.hosts.push_back(subdomain + ".localhost");
+    }
+
+    std::cout << "stub upstream on 127.0.0.1:" << stub.port() << ", " << std::setprecision(2) << std::fixed
+              << settings.latency_ms << " ms + up to " << settings.jitter_ms << " ms latency, "
+              << settings.payload_min << "-" << settings.payload_max << " byte bodies\n"
+              << std::setprecision(0) << settings.rate << " req/s open loop over " << config.routes.size()
+              << " routes, " << settings.seconds << "s per target, at most " << settings.max_connections
+              << " connections\n\n";
+    std::cout << std::left << std::setw(10) << "target"
+              << std::right << std::setw(11) << "req/s"
+              << std::setw(8) << "errors"
+              << std::setw(11) << "unanswered"
+              << std::setw(7) << "conns"
+              << std::setw(10) << "p50 ms"
+              << std::setw(10) << "p99 ms"
+              << std::setw(10) << "p99.9 ms"
+              << std::setw(10) << "max ms"
+              << std::setw(12) << "+p50 ms"
+              << "\n";
+
+    options.port = stub.port();
+    const OpenLoopLoadResult direct = run_open_loop_load(options);
+    print_load_result("direct", direct, 0);
+    const uint32_t direct_p50 = std::max<uint32_t>(direct.percentile_us(0.50), 1);
+
+    // Recording metrics is on by default, so the proxy is measured with it on.
+    notiman::ProxyMetrics metrics;
+    for (const char* name : {"httplib", "epoll"}) {
+        if (settings.engines != "both" && settings.engines != name) {
+            continue;
+        }
+        config.engine = name;
+        notiman::RouteTablePublisher routes;
+        routes.publish(notiman::RouteTable::build(config, nullptr));
+        auto engine = notiman::make_proxy_engine(config, routes, nullptr, &metrics, nullptr);
+        if (std::string(engine->name()) != name) {
+            std::cerr << "Error: " << name << " engine is not available\n";
+            continue;
+        }
+        if (!engine->start("127.0.0.1", 0)) {
+            std::cerr << "Error: failed to start the " << name << " engine\n";
+            return 1;
+        }
+
+        options.port = engine->port();
+        print_load_result(name, run_open_loop_load(options), direct_p50);
+
+        engine->stop();
+        routes.publish(nullptr);
+    }
+
+    stub.stop();
+    return 0;
+}
+
+struct ReplaySettings {
+    std::string file;
+    int port = 0;
+    double speed = 1.0;
+    size_t max_connections = 1024;
+    int drain_seconds = 10;
+};
+
+// What the capture recorded for one request, next to the request rebuilt from it.
+struct CapturedRequest {
+    uint64_t started_unix_us = 0;
+    uint32_t duration_us = 0;
+    int status = 0;
+    std::string route;
+    bool truncated = false;
+    ScheduledRequest request;
+};
+
+static uint32_t sorted_percentile_us(const std::vector<uint32_t>& sorted, double q) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    const auto rank = static_cast<size_t>(std::ceil(q * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+// Rebuilds the request as the client sent it: captured headers minus framing and hop-by-hop
+// ones, the kept body prefix with its own Content-Length, on a keep-alive connection.
+static std::string rebuild_request(const notiman::CaptureRecordView& record) {
+    std::string out;
+    out.append(record.method).append(" ").append(record.target).append(" HTTP/1.1\r\n");
+    out.append("Host: ").append(record.host).append("\r\n");
+    std::string_view headers = record.headers;
+    while (!headers.empty()) {
+        const size_t end = headers.find("\r\n");
+        const std::string_view line = headers.substr(0, end);
+        headers = end == std::string_view::npos ? std::string_view{} : headers.substr(end + 2);
+        const size_t colon = line.find(':');
+        if (colon == std::string_view::npos || notiman::is_excluded_header(line.substr(0, colon))) {
+            continue;
+        }
+        out.append(line).append("\r\n");
+    }
+    if (!record.request_body.empty() || record.header.request_body_bytes > 0) {
+        out.append("Content-Length: ").append(std::to_string(record.request_body.size())).append("\r\n");
+    }
+    out.append("\r\n");
+    out.append(record.request_body);
+    return out;
+}
+
+static bool load_capture(const std::string& file, std::vector<CapturedRequest>& requests) {
+    const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info{};
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    const auto size = static_cast<size_t>(info.st_size);
+    void* image = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return false;
+    }
+
+    const bool ok = notiman::read_capture(
+        std::string_view(static_cast<const char*>(image), size), [&](const notiman::CaptureRecordView& record) {
+            CapturedRequest captured;
+            captured.started_unix_us = record.header.started_unix_us;
+            captured.duration_us = static_cast<uint32_t>(std::min<uint64_t>(record.header.duration_us, UINT32_MAX));
+            captured.status = record.header.status;
+            captured.route = record.route.empty() ? "-" : std::string(record.route);
+            captured.truncated = (record.header.flags & notiman::kCaptureRequestBodyTruncated) != 0;
+            captured.request.method = record.method;
+            captured.request.request = rebuild_request(record);
+            requests.push_back(std::move(captured));
+        });
+    munmap(image, size);
+    return ok;
+}
+
+struct ReplayRow {
+    uint64_t requests = 0;
+    uint64_t captured_errors = 0;
+    uint64_t replay_errors = 0;
+    std::vector<uint32_t> captured_us;
+    std::vector<uint32_t> replay_us;
+};
+
+static void print_replay_row(const std::string& route, const char* source, uint64_t requests, uint64_t errors,
+                             std::vector<uint32_t>& latencies_us) {
+    std::sort(latencies_us.begin(), latencies_us.end());
+    std::cout << std::left << std::setw(16) << route << std::setw(10) << source
+              << std::right << std::setw(10) << requests
+              << std::setw(8) << errors
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << sorted_percentile_us(latencies_us, 0.50) / 1000.0
+              << std::setw(10) << sorted_percentile_us(latencies_us, 0.90) / 1000.0
+              << std::setw(10) << sorted_percentile_us(latencies_us, 0.99) / 1000.0
+              << std::setw(10) << sorted_percentile_us(latencies_us, 0.999) / 1000.0
+              << std::setw(10) << (latencies_us.empty() ? 0.0 : latencies_us.back() / 1000.0)
+              << "\n";
+}
+
+// Re-issues a traffic capture against a running proxy on its original schedule, scaled
+// by --speed, and puts the replayed latency next to the captured one per route.
+static int run_replay(const ReplaySettings& settings) {
+    if (settings.speed <= 0.0) {
+        std::cerr << "Error: --speed must be positive\n";
+        return 1;
+    }
+    std::vector<CapturedRequest> captured;
+    if (!load_capture(settings.file, captured)) {
+        std::cerr << "Error: " << settings.file << " is not a readable capture file\n";
+        return 1;
+    }
+    if (captured.empty()) {
+        std::cerr << "Error: " << settings.file << " holds no requests\n";
+        return 1;
+    }
+    raise_fd_limit();
+
+    // Records are written as exchanges finish; replay them in the order they started.
+    std::stable_sort(captured.begin(), captured.end(), [](const CapturedRequest& a, const CapturedRequest& b) {
+        return a.started_unix_us < b.started_unix_us;
+    });
+    const uint64_t first = captured.front().started_unix_us;
+    OpenLoopLoadOptions options;
+    options.port = settings.port;
+    options.max_connections = settings.max_connections;
+    options.drain = std::chrono::seconds(settings.drain_seconds);
+    size_t truncated = 0;
+    for (auto& request : captured) {
+        request.request.at = std::chrono::microseconds(
+            static_cast<int64_t>(static_cast<double>(request.started_unix_us - first) / settings.speed));
+        truncated += request.truncated ? 1 : 0;
+        options.schedule.push_back(std::move(request.request));
+    }
+
+    std::cout << "replaying " << captured.size() << " requests from " << settings.file << " against 127.0.0.1:"
+              << settings.port << " at " << std::setprecision(2) << std::fixed << settings.speed << "x, "
+              << std::setprecision(1) << std::chrono::duration<double>(options.schedule.back().at).count()
+              << "s of traffic\n\n";
+
+    const OpenLoopLoadResult result = run_open_loop_load(options);
+
+    std::map<std::string, ReplayRow> rows;
+    ReplayRow& total = rows["(all)"];
+    uint64_t mismatched = 0;
+    for (const ScheduledResponse& response : result.responses) {
+        const CapturedRequest& request = captured[response.request];
+        for (ReplayRow* row : {&total, &rows[request.route]}) {
+            row->replay_errors += response.status >= 500 ? 1 : 0;
+            row->replay_us.push_back(response.latency_us);
+        }
+        mismatched += response.status != request.status ? 1 : 0;
+    }
+    for (const CapturedRequest& request : captured) {
+        for (ReplayRow* row : {&total, &rows[request.route]}) {
+            ++row->requests;
+            row->captured_errors += request.status >= 500 ? 1 : 0;
+            row->captured_us.push_back(request.duration_us);
+        }
+    }
+
+    std::cout << std::left << std::setw(16) << "route" << std::setw(10) << "source"
+              << std::right << std::setw(10) << "requests"
+              << std::setw(8) << "5xx"
+              << std::setw(10) << "p50 ms"
+              << std::setw(10) << "p90 ms"
+              << std::setw(10) << "p99 ms"
+              << std::setw(10) << "p99.9 ms"
+              << std::setw(10) << "max ms"
+              << "\n";
+    for (auto& [route, row] : rows) {
+        print_replay_row(route, "captured", row.requests, row.captured_errors, row.captured_us);
+        print_replay_row(route, "replay", row.replay_us.size(), row.replay_errors, row.replay_us);
+    }
+
+    std::cout << "\n" << result.completed << " answered, " << result.errors << " failed, " << result.unanswered
+              << " unanswered; " << mismatched << " answered with another status than captured\n";
+    if (truncated > 0) {
+        std::cout << truncated << " request bodies were cut to the capture's capture_body_bytes\n";
+    }
+    return 0;
+}
+#endif
+
+struct TransferSettings {
+    std::string direction = "both";
+    size_t body_mb = 16;
+    size_t total_mb = 2048;
+    size_t connections = 4;
+    int workers = 0;
+};
+
+static void print_transfer_result(const std::string& label, const TransferLoadResult& result, double direct_cpu_per_gb) {
+    const double gigabytes = static_cast<double>(result.bytes) / 1e9;
+    const double cpu_per_gb = gigabytes > 0.0 ? result.cpu_seconds / gigabytes : 0.0;
+    std::cout << std::left << std::setw(14) << label
+              << std::right << std::setw(8) << std::fixed << std::setprecision(2) << gigabytes
+              << std::setw(8) << result.errors
+              << std::setw(9) << (result.seconds > 0.0 ? gigabytes / result.seconds : 0.0)
+              << std::setw(9) << result.cpu_seconds
+              << std::setw(11) << std::setprecision(3) << cpu_per_gb;
+    if (direct_cpu_per_gb > 0.0) {
+        std::cout << std::setw(13) << cpu_per_gb - direct_cpu_per_gb;
+    }
+    std::cout << "\n";
+}
+
+// Moves the same number of bytes to the stub directly and through each proxy path. The
+// whole process is measured, stub and client included, so the CPU the proxy adds per GB
+// is the difference to the direct run.
+static int run_transfer_benchmark(const TransferSettings& settings) {
+    const size_t body_bytes = std::max<size_t>(settings.body_mb, 1) << 20;
+    std::cout << body_bytes / (1 << 20) << " MiB bodies, " << settings.total_mb << " MiB per target over "
+              << settings.connections << " keep-alive connections\n";
+
+    for (const bool upload : {false, true}) {
+        if (settings.direction != "both" && settings.direction != (upload ? "up" : "down")) {
+            continue;
+        }
+
+        EpollStubOptions stub_options;
+        stub_options.payload_min = upload ? 0 : body_bytes;
+        stub_options.payload_max = stub_options.payload_min;
+        EpollStubUpstream stub(stub_options);
+        if (!stub.start()) {
+            std::cerr << "Error: failed to start stub upstream\n";
+            return 1;
+        }
+
+        notiman::ProxyConfig config;
+        config.workers = settings.workers;
+        notiman::ProxyRoute route;
+        route.name = "bulk";
+        route.target_base_urls.push_back("http://127.0.0.1:" + std::to_string(stub.port()));
+        config.routes.push_back(std::move(route));
+
+        TransferLoadOptions options;
+        options.host = "bulk.localhost";
+        options.body_bytes = body_bytes;
+        options.total_bytes = static_cast<uint64_t>(settings.total_mb) << 20;
+        options.connections = settings.connections;
+        options.upload = upload;
+
+        std::cout << "\n" << (upload ? "upload" : "download") << "\n";
+        std::cout << std::left << std::setw(14) << "target"
+                  << std::right << std::setw(8) << "GB"
+                  << std::setw(8) << "errors"
+                  << std::setw(9) << "GB/s"
+                  << std::setw(9) << "CPU s"
+                  << std::setw(11) << "CPU s/GB"
+                  << std::setw(13) << "+CPU s/GB"
+                  << "\n";
+
+        options.port = stub.port();
+        const TransferLoadResult direct = run_transfer_load(options);
+        print_transfer_result("direct", direct, 0.0);
+        const double direct_cpu_per_gb = direct.bytes > 0 ? direct.cpu_seconds / (static_cast<double>(direct.bytes) / 1e9) : 0.0;
+
+        struct Target {
+            const char* label;
+            const char* engine;
+            bool splice;
+        };
+        for (const Target& target : {Target{"httplib", "httplib", false},
+                                     Target{"epoll copy", "epoll", false},
+                                     Target{"epoll splice", "epoll", true}}) {
+            config.engine = target.engine;
+            config.splice = target.splice;
+            notiman::RouteTablePublisher routes;
+            routes.publish(notiman::RouteTable::build(config, nullptr));
+            auto engine = notiman::make_proxy_engine(config, routes, nullptr, nullptr, nullptr);
+            if (std::string(engine->name()) != target.engine || !engine->start("127.0.0.1", 0)) {
+                std::cerr << "Error: failed to start the " << target.engine << " engine\n";
+                return 1;
+            }
+            options.port = engine->port();
+            print_transfer_result(target.label, run_transfer_load(options), direct_cpu_per_gb);
+            engine->stop();
+            routes.publish(nullptr);
+        }
+        stub.stop();
+    }
+    return 0;
+}
+
+#ifdef __linux__
+struct SocketSettings {
+    std::string engines = "both";
+    // Few enough for the httplib engine's worker pool to serve every connection at once.
+    size_t connections = 8;
+    size_t in_flight = 8;
+    int seconds = 5;
+    int workers = 0;
+    size_t payload_bytes = 256;
+};
+
+// The same keep-alive load through each engine to one stub, over a loopback TCP target and
+// then over a Unix domain socket target, so the difference is what the upstream hop costs.
+static int run_socket_benchmark(const SocketSettings& settings) {
+    raise_fd_limit();
+
+    EpollStubOptions stub_options;
+    stub_options.payload_min = settings.payload_bytes;
+    stub_options.payload_max = settings.payload_bytes;
+    stub_options.unix_path =
+        (std::filesystem::temp_directory_path() / ("notiman-bench-" + std::to_string(getpid()) + ".sock")).string();
+    EpollStubUpstream stub(stub_options);
+    if (!stub.start()) {
+        std::cerr << "Error: failed to start stub upstream\n";
+        return 1;
+    }
+
+    notiman::ProxyConfig config;
+    config.workers = settings.workers;
+    config.pool_max_idle = static_cast<int>(settings.in_flight);
+    notiman::ProxyRoute tcp_route;
+    tcp_route.name = "tcp";
+    tcp_route.target_base_urls.push_back("http://127.0.0.1:" + std::to_string(stub.port()));
+    config.routes.push_back(std::move(tcp_route));
+    notiman::ProxyRoute unix_route;
+    unix_route.name = "uds";
+    unix_route.target_base_urls.push_back("unix:" + stub.unix_path());
+    config.routes.push_back(std::move(unix_route));
+
+    std::cout << "stub upstream on 127.0.0.1:" << stub.port() << " and " << stub.unix_path() << ", "
+              << settings.connections << " keep-alive connections, " << settings.in_flight << " in flight, "
+              << settings.seconds << "s per run, " << settings.payload_bytes << " byte bodies\n\n";
+    std::cout << std::left << std::setw(10) << "engine"
+              << std::setw(10) << "upstream"
+              << std::right << std::setw(12) << "requests"
+              << std::setw(8) << "errors"
+              << std::setw(11) << "req/s"
+              << std::setw(10) << "p50 ms"
+              << std::setw(10) << "p99 ms"
+              << std::setw(13) << "p50 vs tcp"
+              << "\n";
+
+    for (const char* name : {"httplib", "epoll"}) {
+        if (settings.engines != "both" && settings.engines != name) {
+            continue;
+        }
+        config.engine = name;
+        notiman::RouteTablePublisher routes;
+        routes.publish(notiman::RouteTable::build(config, nullptr));
+        auto engine = notiman::make_proxy_engine(config, routes, nullptr, nullptr, nullptr);
+        if (std::string(engine->name()) != name || !engine->start("127.0.0.1", 0)) {
+            std::cerr << "Error: failed to start the " << name << " engine\n";
+            return 1;
+        }
+
+        uint32_t tcp_p50_us = 0;
+        for (const char* upstream : {"tcp", "uds"}) {
+            KeepAliveLoadOptions options;
+            options.port = engine->port();
+            options.host = std::string(upstream) + ".localhost";
+            options.connections = settings.connections;
+            options.in_flight = settings.in_flight;
+            options.duration = std::chrono::seconds(settings.seconds);
+            const KeepAliveLoadResult result = run_keepalive_load(options);
+
+            const double rps = result.seconds > 0.0 ? static_cast<double>(result.requests) / result.seconds : 0.0;
+            const uint32_t p50 = result.percentile_us(0.50);
+            if (tcp_p50_us == 0) {
+                tcp_p50_us = p50;
+            }
+            std::cout << std::left << std::setw(10) << name
+                      << std::setw(10) << upstream
+                      << std::right << std::setw(12) << result.requests
+                      << std::setw(8) << result.errors
+                      << std::setw(11) << std::fixed << std::setprecision(0) << rps
+                      << std::setw(10) << std::setprecision(3) << p50 / 1000.0
+                      << std::setw(10) << result.percentile_us(0.99) / 1000.0
+                      << std::setw(13) << (static_cast<double>(p50) - tcp_p50_us) / 1000.0
+                      << "\n";
+        }
+        engine->stop();
+        routes.publish(nullptr);
+    }
+
+    stub.stop();
+    return 0;
+}
+#endif
+
+int main(int argc, char** argv) {
+    CLI::App app{"Notiman proxy benchmarks"};
+    app.require_subcommand(1);
+
+    int requests = 20000;
+    int threads = 8;
+    size_t payload_bytes = 256;
+
+    auto* pool_cmd = app.add_subcommand("pool", "Upstream requests/s with and without connection pooling");
+    pool_cmd->add_option("-n,--requests", requests, "Total requests per mode")->default_str("20000");
+    pool_cmd->add_option("-t,--threads", threads, "Concurrent client threads")->default_str("8");
+    pool_cmd->add_option("-p,--payload", payload_bytes, "Stub response body size in bytes")->default_str("256");
+
+    size_t max_routes = 10000;
+    size_t lookups = 2000000;
+    auto* routes_cmd = app.add_subcommand("routes", "Route table build time and lookup cost by number of routes");
+    routes_cmd->add_option("-n,--routes", max_routes, "Largest route count")->default_str("10000");
+    routes_cmd->add_option("-l,--lookups", lookups, "Lookups per table")->default_str("2000000");
+
+#ifdef __linux__
+    std::string engines = "both";
+    size_t connections = 10000;
+    size_t in_flight = 256;
+    int seconds = 10;
+    size_t client_threads = 1;
+    int workers = 0;
+
+    auto* engine_cmd = app.add_subcommand("engine", "Proxy requests/s and latency over many keep-alive connections");
+    engine_cmd->add_option("-e,--engine", engines, "httplib, epoll or both")->default_str("both");
+    engine_cmd->add_option("-c,--connections", connections, "Open keep-alive connections")->default_str("10000");
+    engine_cmd->add_option("-i,--in-flight", in_flight, "Requests outstanding at any time")->default_str("256");
+    engine_cmd->add_option("-d,--duration", seconds, "Seconds per engine")->default_str("10");
+    engine_cmd->add_option("-t,--threads", client_threads, "Client event loops")->default_str("1");
+    engine_cmd->add_option("-w,--workers", workers, "epoll engine event loops, 0 = one per core")->default_str("0");
+    engine_cmd->add_option("-p,--payload", payload_bytes, "Stub response body size in bytes")->default_str("256");
+
+    AcceptSettings accept;
+    auto* accept_cmd = app.add_subcommand("accept", "New connections/s through the proxy by number of listening sockets");
+    accept_cmd->add_option("-e,--engine", accept.engines, "httplib, epoll or both")->default_str("both");
+    accept_cmd->add_option("-l,--max-listeners", accept.max_listeners, "Largest listener count, 0 = one per core")->default_str("0");
+    accept_cmd->add_option("-t,--threads", accept.client_threads, "Client threads, each one connection at a time")->default_str("8");
+    accept_cmd->add_option("-d,--duration", accept.seconds, "Seconds per run")->default_str("5");
+    accept_cmd->add_option("-w,--workers", accept.workers, "epoll engine event loops, 0 = one per core")->default_str("0");
+
+    LoadSettings load;
+    auto* load_cmd = app.add_subcommand("load", "Open-loop latency through the proxy versus hitting the stub directly");
+    load_cmd->add_option("-e,--engine", load.engines, "httplib, epoll or both")->default_str("both");
+    load_cmd->add_option("-r,--rate", load.rate, "Requests per second offered")->default_str("5000");
+    load_cmd->add_option("-n,--routes", load.routes, "Subdomain routes the requests rotate over")->default_str("32");
+    load_cmd->add_option("-d,--duration", load.seconds, "Seconds per target")->default_str("10");
+    load_cmd->add_option("-c,--max-connections", load.max_connections, "Client connection limit")->default_str("1024");
+    load_cmd->add_option("-w,--workers", load.workers, "epoll engine event loops, 0 = one per core")->default_str("0");
+    load_cmd->add_option("--latency", load.latency_ms, "Stub response delay in ms")->default_str("1");
+    load_cmd->add_option("--jitter", load.jitter_ms, "Extra uniform stub delay in ms")->default_str("0");
+    load_cmd->add_option("--payload-min", load.payload_min, "Smallest stub body in bytes")->default_str("256");
+    load_cmd->add_option("--payload-max", load.payload_max, "Largest stub body in bytes")->default_str("4096");
+
+    ReplaySettings replay;
+    auto* replay_cmd = app.add_subcommand("replay", "Re-issue a proxy traffic capture and compare latencies");
+    replay_cmd->add_option("file", replay.file, "Capture file written by capture_path")->required();
+    replay_cmd->add_option("-P,--port", replay.port, "Proxy port on 127.0.0.1")->required();
+    replay_cmd->add_option("-s,--speed", replay.speed, "Pacing factor, 2 replays twice as fast")->default_str("1");
+    replay_cmd->add_option("-c,--max-connections", replay.max_connections, "Client connection limit")->default_str("1024");
+    replay_cmd->add_option("--drain", replay.drain_seconds, "Seconds to wait for late answers")->default_str("10");
+
+    SocketSettings sockets;
+    auto* uds_cmd = app.add_subcommand("uds", "Proxy latency to a Unix domain socket upstream versus loopback TCP");
+    uds_cmd->add_option("-e,--engine", sockets.engines, "httplib, epoll or both")->default_str("both");
+    uds_cmd->add_option("-c,--connections", sockets.connections, "Open keep-alive connections")->default_str("8");
+    uds_cmd->add_option("-i,--in-flight", sockets.in_flight, "Requests outstanding at any time")->default_str("8");
+    uds_cmd->add_option("-d,--duration", sockets.seconds, "Seconds per run")->default_str("5");
+    uds_cmd->add_option("-w,--workers", sockets.workers, "epoll engine event loops, 0 = one per core")->default_str("0");
+    uds_cmd->add_option("-p,--payload", sockets.payload_bytes, "Stub response body size in bytes")->default_str("256");
+
+    TransferSettings transfer;
+    auto* transfer_cmd = app.add_subcommand("transfer", "CPU per GB of large bodies, copied versus spliced");
+    transfer_cmd->add_option("--direction", transfer.direction, "down, up or both")->default_str("both");
+    transfer_cmd->add_option("-b,--body", transfer.body_mb, "Body size in MiB")->default_str("16");
+    transfer_cmd->add_option("-n,--total", transfer.total_mb, "MiB moved per target")->default_str("2048");
+    transfer_cmd->add_option("-c,--connections", transfer.connections, "Concurrent transfers")->default_str("4");
+    transfer_cmd->add_option("-w,--workers", transfer.workers, "epoll engine event loops, 0 = one per core")->default_str("0");
+#endif
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (pool_cmd->parsed()) {
+        return run_pool_benchmark(requests, threads, payload_bytes);
+    }
+    if (routes_cmd->parsed()) {
+        return run_routes_benchmark(std::max<size_t>(max_routes, 1), std::max<size_t>(lookups, 1));
+    }
+#ifdef __linux__
+    if (engine_cmd->parsed()) {
+        return run_engine_benchmark(engines, connections, in_flight, seconds, client_threads, workers, payload_bytes);
+    }
+    if (accept_cmd->parsed()) {
+        return run_accept_benchmark(accept);
+    }
+    if (load_cmd->parsed()) {
+        return run_load_benchmark(load);
+    }
+    if (replay_cmd->parsed()) {
+        return run_replay(replay);
+    }
+    if (transfer_cmd->parsed()) {
+        return run_transfer_benchmark(transfer);
+    }
+    if (uds_cmd->parsed()) {
+        return run_socket_benchmark(sockets);
+    }
+#endif
+    return 0;
+}
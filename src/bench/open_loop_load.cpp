@@ -0,0 +1,385 @@
+#include "open_loop_load.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <deque>
+
+#include "../proxy/http_wire.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t kTimerData = UINT64_MAX;
+// Arrivals closer together than this are sent in batches by one timer tick.
+constexpr std::chrono::microseconds kMinTick{200};
+
+struct Arrival {
+    Clock::time_point intended;
+    size_t request;  // index into the runner's requests
+};
+
+struct OpenConnection {
+    int fd = -1;
+    uint32_t generation = 0;   // tells events for a replaced socket apart
+    bool connected = false;
+    bool busy = false;         // request assigned, possibly waiting for the connect
+    Arrival arrival{};
+    size_t sent = 0;
+    std::string in;
+    bool head_done = false;
+    bool close_after = false;
+    notiman::ResponseHead head;
+    notiman::BodyFramer body;
+};
+
+class OpenLoopRunner {
+public:
+    explicit OpenLoopRunner(const OpenLoopLoadOptions& options) : options_(options) {
+        if (replaying()) {
+            // Scheduled arrivals may be arbitrarily close; the tick only bounds how late they go out.
+            interval_ = kMinTick;
+            run_for_ = std::chrono::duration_cast<Clock::duration>(options.schedule.back().at) + kMinTick;
+        } else {
+            for (const auto& host : options.hosts) {
+                requests_.push_back("GET " + options.path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n");
+            }
+            if (requests_.empty()) {
+                requests_.push_back("GET " + options.path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+            }
+            interval_ = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.rate));
+            run_for_ = options.duration;
+        }
+        address_.sin_family = AF_INET;
+        address_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address_.sin_port = htons(static_cast<uint16_t>(options.port));
+    }
+
+    OpenLoopLoadResult run() {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = kTimerData;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event);
+
+        const auto tick = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::max<Clock::duration>(interval_, kMinTick));
+        itimerspec spec{};
+        spec.it_value.tv_nsec = 1;
+        spec.it_interval.tv_sec = static_cast<time_t>(tick.count() / 1000000000);
+        spec.it_interval.tv_nsec = static_cast<long>(tick.count() % 1000000000);
+        timerfd_settime(timer_fd_, 0, &spec, nullptr);
+
+        start_ = Clock::now();
+        const auto last_arrival = start_ + run_for_;
+        while (Clock::now() < last_arrival) {
+            poll(10);
+        }
+        const itimerspec disarm{};
+        timerfd_settime(timer_fd_, 0, &disarm, nullptr);
+
+        const auto drain_deadline = Clock::now() + options_.drain;
+        while (outstanding_ > 0 && Clock::now() < drain_deadline) {
+            poll(10);
+        }
+
+        result_.unanswered = outstanding_;
+        for (auto& connection : connections_) {
+            if (connection.fd >= 0) {
+                close(connection.fd);
+            }
+        }
+        close(timer_fd_);
+        close(epoll_fd_);
+        result_.seconds = std::chrono::duration<double>(run_for_).count();
+        return std::move(result_);
+    }
+
+private:
+    bool replaying() const { return !options_.schedule.empty(); }
+
+    const std::string& request_for(const Arrival& arrival) const {
+        return replaying() ? options_.schedule[arrival.request].request : requests_[arrival.request];
+    }
+
+    // Issues every arrival whose scheduled time has passed, however late the tick was.
+    void on_tick() {
+        uint64_t expirations = 0;
+        [[maybe_unused]] const ssize_t drained = read(timer_fd_, &expirations, sizeof(expirations));
+        const auto now = std::min(Clock::now(), start_ + run_for_);
+        if (replaying()) {
+            const auto& schedule = options_.schedule;
+            while (result_.scheduled < schedule.size() && start_ + schedule[result_.scheduled].at <= now) {
+                backlog_.push_back(Arrival{start_ + schedule[result_.scheduled].at, result_.scheduled});
+                ++result_.scheduled;
+                ++outstanding_;
+            }
+            dispatch();
+            return;
+        }
+        while (start_ + interval_ * static_cast<int64_t>(result_.scheduled) <= now) {
+            const Arrival arrival{start_ + interval_ * static_cast<int64_t>(result_.scheduled),
+                                  static_cast<size_t>(result_.scheduled % requests_.size())};
+            ++result_.scheduled;
+            ++outstanding_;
+            backlog_.push_back(arrival);
+        }
+        dispatch();
+    }
+
+    // Hands queued arrivals to idle connections, opening new ones up to the limit.
+    void dispatch() {
+        while (!backlog_.empty()) {
+            size_t index = 0;
+            if (!idle_.empty()) {
+                index = idle_.back();
+                idle_.pop_back();
+            } else if (!closed_.empty()) {
+                index = closed_.back();
+                closed_.pop_back();
+                open(index);
+            } else if (connections_.size() < options_.max_connections) {
+                index = connections_.size();
+                connections_.emplace_back();
+                open(index);
+                result_.connections = std::max(result_.connections, connections_.size());
+            } else {
+                return;
+            }
+
+            OpenConnection& connection = connections_[index];
+            connection.busy = true;
+            connection.arrival = backlog_.front();
+            connection.sent = 0;
+            connection.head_done = false;
+            backlog_.pop_front();
+            if (connection.fd < 0) {
+                fail(index);
+            } else if (connection.connected && !flush(connection)) {
+                fail(index);
+            }
+        }
+    }
+
+    void open(size_t index) {
+        OpenConnection& connection = connections_[index];
+        const uint32_t generation = connection.generation + 1;
+        connection = OpenConnection{};
+        connection.generation = generation;
+        connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (connection.fd < 0) {
+            return;
+        }
+        const int enabled = 1;
+        setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+        if (connect(connection.fd, reinterpret_cast<const sockaddr*>(&address_), sizeof(address_)) != 0 &&
+            errno != EINPROGRESS) {
+            close(connection.fd);
+            connection.fd = -1;
+            return;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.u64 = (static_cast<uint64_t>(generation) << 32) | index;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection.fd, &event);
+    }
+
+    void retire(size_t index) {
+        OpenConnection& connection = connections_[index];
+        if (connection.fd >= 0) {
+            close(connection.fd);
+            connection.fd = -1;
+        }
+        connection.connected = false;
+        closed_.push_back(index);
+    }
+
+    bool flush(OpenConnection& connection) {
+        const std::string& request = request_for(connection.arrival);
+        while (connection.busy && connection.sent < request.size()) {
+            const ssize_t sent = send(connection.fd, request.data() + connection.sent,
+                                      request.size() - connection.sent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            connection.sent += static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    // Counts the assigned request as an error and closes its connection.
+    void fail(size_t index) {
+        if (connections_[index].busy) {
+            connections_[index].busy = false;
+            --outstanding_;
+            ++result_.errors;
+        }
+        retire(index);
+    }
+
+    void complete(size_t index) {
+        OpenConnection& connection = connections_[index];
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - connection.arrival.intended);
+        const auto latency_us = static_cast<uint32_t>(std::min<int64_t>(elapsed.count(), UINT32_MAX));
+        if (replaying()) {
+            ++result_.completed;
+            result_.latencies_us.push_back(latency_us);
+            result_.responses.push_back(ScheduledResponse{connection.arrival.request, connection.head.status, latency_us});
+        } else if (connection.head.status == 200) {
+            ++result_.completed;
+            result_.latencies_us.push_back(latency_us);
+        } else {
+            ++result_.errors;
+        }
+        connection.busy = false;
+        --outstanding_;
+        if (connection.close_after) {
+            retire(index);
+        } else {
+            idle_.push_back(index);
+        }
+    }
+
+    void on_event(size_t index, uint32_t events) {
+        OpenConnection& connection = connections_[index];
+        if (connection.fd < 0) {
+            return;
+        }
+
+        if (!connection.connected) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                fail(index);
+                return;
+            }
+            if ((events & EPOLLOUT) == 0) {
+                return;
+            }
+            connection.connected = true;
+        }
+
+        if (!flush(connection)) {
+            fail(index);
+            return;
+        }
+
+        char buf[16 * 1024];
+        bool closed = false;
+        for (;;) {
+            const ssize_t received = recv(connection.fd, buf, sizeof(buf), 0);
+            if (received > 0) {
+                connection.in.append(buf, static_cast<size_t>(received));
+                continue;
+            }
+            closed = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
+        }
+
+        while (connection.busy && !connection.in.empty()) {
+            if (!connection.head_done) {
+                const auto status = notiman::parse_response_head(connection.in, connection.head);
+                if (status == notiman::ParseStatus::Incomplete) {
+                    break;
+                }
+                notiman::BodyFramer::Mode mode = notiman::BodyFramer::Mode::None;
+                uint64_t length = 0;
+                const std::string_view method =
+                    replaying() ? std::string_view(options_.schedule[connection.arrival.request].method) : "GET";
+                if (status == notiman::ParseStatus::Invalid ||
+                    notiman::response_body_framing(method, connection.head, mode, length) != notiman::FramingStatus::Ok) {
+                    fail(index);
+                    return;
+                }
+                const std::string_view connection_header = notiman::find_header(connection.head.headers, "Connection");
+                connection.close_after = notiman::header_has_token(connection_header, "close") ||
+                                         mode == notiman::BodyFramer::Mode::UntilClose;
+                connection.in.erase(0, connection.head.head_bytes);
+                connection.body.reset(mode, length);
+                connection.head_done = true;
+            }
+            const size_t used = connection.body.consume(connection.in.data(), connection.in.size());
+            connection.in.erase(0, used);
+            if (connection.body.failed()) {
+                fail(index);
+                return;
+            }
+            if (!connection.body.done()) {
+                break;
+            }
+            complete(index);
+            if (connection.fd < 0) {
+                return;
+            }
+        }
+
+        if (closed || (events & (EPOLLHUP | EPOLLERR)) != 0) {
+            if (connection.busy) {
+                fail(index);
+            } else {
+                // Idle and closed by the server: forget it so dispatch opens a fresh one.
+                idle_.erase(std::remove(idle_.begin(), idle_.end(), index), idle_.end());
+                retire(index);
+            }
+        }
+    }
+
+    void poll(int timeout_ms) {
+        epoll_event events[256];
+        const int count = epoll_wait(epoll_fd_, events, 256, timeout_ms);
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.u64 == kTimerData) {
+                on_tick();
+                continue;
+            }
+            const auto index = static_cast<size_t>(events[i].data.u64 & 0xffffffffu);
+            if (connections_[index].generation == static_cast<uint32_t>(events[i].data.u64 >> 32)) {
+                on_event(index, events[i].events);
+            }
+        }
+        dispatch();
+    }
+
+    const OpenLoopLoadOptions& options_;
+    std::vector<std::string> requests_;   // one per host, unless replaying a schedule
+    sockaddr_in address_{};
+    Clock::duration interval_{};
+    Clock::duration run_for_{};           // arrivals stop after this
+    Clock::time_point start_;
+    int epoll_fd_ = -1;
+    int timer_fd_ = -1;
+    std::vector<OpenConnection> connections_;
+    std::vector<size_t> idle_;     // most recently used on top, so few connections stay warm
+    std::vector<size_t> closed_;   // slots whose socket can be reopened
+    std::deque<Arrival> backlog_;  // arrived but waiting for a connection
+    uint64_t outstanding_ = 0;     // scheduled but not yet answered or failed
+    OpenLoopLoadResult result_;
+};
+
+}  // namespace
+
+uint32_t OpenLoopLoadResult::percentile_us(double q) const {
+    if (latencies_us.empty()) {
+        return 0;
+    }
+    const auto rank = static_cast<size_t>(std::ceil(q * static_cast<double>(latencies_us.size())));
+    return latencies_us[std::clamp<size_t>(rank, 1, latencies_us.size()) - 1];
+}
+
+OpenLoopLoadResult run_open_loop_load(const OpenLoopLoadOptions& options) {
+    OpenLoopRunner runner(options);
+    OpenLoopLoadResult result = runner.run();
+    std::sort(result.latencies_us.begin(), result.latencies_us.end());
+    return result;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Open-loop HTTP/1.1 load: requests arrive at a fixed rate whether or not earlier
+// ones have been answered, so a slow server builds a queue instead of slowing the
+// client down. Latency is measured from each request's scheduled arrival, which
+// keeps queueing delay in the percentiles rather than hiding it.
+
+// One request of a replayed schedule, such as a traffic capture.
+struct ScheduledRequest {
+    std::chrono::microseconds at{0};  // arrival, relative to the start of the run
+    std::string method;               // framing of the response depends on it
+    std::string request;              // complete request bytes
+};
+
+struct OpenLoopLoadOptions {
+    int port = 0;                     // 127.0.0.1
+    std::vector<std::string> hosts;   // Host headers, used round-robin; selects the proxy routes
+    std::string path = "/bench";
+    double rate = 1000.0;             // requests per second
+    std::chrono::seconds duration{10};
+    std::chrono::milliseconds drain{2000};  // wait for stragglers after the last arrival
+    size_t max_connections = 1024;    // arrivals queue in the client once all are busy
+    // When set, requests are sent as listed (sorted by `at`) instead of hosts/path/rate/duration.
+    std::vector<ScheduledRequest> schedule;
+};
+
+// How one scheduled request was answered, for comparing a replay with its capture.
+struct ScheduledResponse {
+    size_t request = 0;  // index into OpenLoopLoadOptions::schedule
+    int status = 0;
+    uint32_t latency_us = 0;
+};
+
+struct OpenLoopLoadResult {
+    uint64_t scheduled = 0;    // arrivals during the run
+    uint64_t completed = 0;    // answered with status 200, or with any status when replaying a schedule
+    uint64_t errors = 0;       // other statuses, refused connects, resets
+    uint64_t unanswered = 0;   // sent or queued but not answered before the drain ended
+    size_t connections = 0;    // most connections open at once
+    double seconds = 0.0;
+    std::vector<uint32_t> latencies_us;  // sorted
+    std::vector<ScheduledResponse> responses;  // schedule runs only, in completion order
+
+    uint32_t percentile_us(double q) const;
+};
+
+OpenLoopLoadResult run_open_loop_load(const OpenLoopLoadOptions& options);
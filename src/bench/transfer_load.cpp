@@ -0,0 +1,200 @@
+#include "transfer_load.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../proxy/http_wire.h"
+
+namespace {
+
+constexpr size_t kChunkBytes = 256 * 1024;
+
+double cpu_seconds_used() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    const auto seconds = [](const timeval& time) {
+        return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_usec) / 1e6;
+    };
+    return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+int connect_loopback(int port) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    const int enabled = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+    return fd;
+}
+
+bool send_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+class TransferWorker {
+public:
+    TransferWorker(const TransferLoadOptions& options, std::atomic<uint64_t>& claimed)
+        : options_(options), claimed_(claimed), scratch_(kChunkBytes) {
+        if (options.upload) {
+            request_ = "POST " + options.path + " HTTP/1.1\r\nHost: " + options.host +
+                       "\r\nContent-Length: " + std::to_string(options.body_bytes) + "\r\n\r\n";
+            upload_chunk_.assign(std::min(kChunkBytes, options.body_bytes), 'x');
+        } else {
+            request_ = "GET " + options.path + " HTTP/1.1\r\nHost: " + options.host + "\r\n\r\n";
+        }
+    }
+
+    void run() {
+        while (claimed_.fetch_add(options_.body_bytes, std::memory_order_relaxed) < options_.total_bytes) {
+            if (fd_ < 0) {
+                fd_ = connect_loopback(options_.port);
+            }
+            if (fd_ < 0 || !transfer()) {
+                ++errors_;
+                if (fd_ >= 0) {
+                    close(fd_);
+                    fd_ = -1;
+                }
+            }
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    uint64_t bytes() const { return bytes_; }
+    uint64_t transfers() const { return transfers_; }
+    uint64_t errors() const { return errors_; }
+
+private:
+    // One request and its whole response; false when the connection is no longer usable.
+    bool transfer() {
+        if (!send_all(fd_, request_.data(), request_.size())) {
+            return false;
+        }
+        if (options_.upload) {
+            for (size_t left = options_.body_bytes; left > 0;) {
+                const size_t size = std::min(left, upload_chunk_.size());
+                if (!send_all(fd_, upload_chunk_.data(), size)) {
+                    return false;
+                }
+                left -= size;
+            }
+        }
+
+        std::string in;
+        notiman::ResponseHead head;
+        for (;;) {
+            const notiman::ParseStatus status = notiman::parse_response_head(in, head);
+            if (status == notiman::ParseStatus::Complete) {
+                break;
+            }
+            if (status == notiman::ParseStatus::Invalid) {
+                return false;
+            }
+            const ssize_t received = recv(fd_, scratch_.data(), scratch_.size(), 0);
+            if (received <= 0) {
+                return false;
+            }
+            in.append(scratch_.data(), static_cast<size_t>(received));
+        }
+        notiman::BodyFramer::Mode mode = notiman::BodyFramer::Mode::None;
+        uint64_t length = 0;
+        const notiman::FramingStatus framing =
+            notiman::response_body_framing(options_.upload ? "POST" : "GET", head, mode, length);
+        if (framing != notiman::FramingStatus::Ok || mode == notiman::BodyFramer::Mode::Chunked ||
+            mode == notiman::BodyFramer::Mode::UntilClose) {
+            return false;
+        }
+        const int status = head.status;
+        const bool close_after = notiman::header_has_token(notiman::find_header(head.headers, "Connection"), "close");
+
+        uint64_t left = length - std::min<uint64_t>(length, in.size() - head.head_bytes);
+        while (left > 0) {
+            const ssize_t received = recv(fd_, scratch_.data(), static_cast<size_t>(std::min<uint64_t>(left, scratch_.size())), 0);
+            if (received <= 0) {
+                return false;
+            }
+            left -= static_cast<uint64_t>(received);
+        }
+
+        if (status != 200) {
+            ++errors_;
+        } else {
+            ++transfers_;
+            bytes_ += options_.upload ? options_.body_bytes : length;
+        }
+        if (close_after) {
+            close(fd_);
+            fd_ = -1;
+        }
+        return true;
+    }
+
+    const TransferLoadOptions& options_;
+    std::atomic<uint64_t>& claimed_;
+    std::string request_;
+    std::string upload_chunk_;
+    std::vector<char> scratch_;
+    int fd_ = -1;
+    uint64_t bytes_ = 0;
+    uint64_t transfers_ = 0;
+    uint64_t errors_ = 0;
+};
+
+}  // namespace
+
+TransferLoadResult run_transfer_load(const TransferLoadOptions& options) {
+    std::atomic<uint64_t> claimed = 0;
+    std::vector<std::unique_ptr<TransferWorker>> workers;
+    for (size_t i = 0; i < std::max<size_t>(options.connections, 1); ++i) {
+        workers.push_back(std::make_unique<TransferWorker>(options, claimed));
+    }
+
+    const double cpu_before = cpu_seconds_used();
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back([&worker] { worker->run(); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    TransferLoadResult result;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    result.cpu_seconds = cpu_seconds_used() - cpu_before;
+    for (const auto& worker : workers) {
+        result.bytes += worker->bytes();
+        result.transfers += worker->transfers();
+        result.errors += worker->errors();
+    }
+    return result;
+}
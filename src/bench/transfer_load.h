@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Bulk transfers over a few keep-alive connections, for measuring what moving a byte
+// costs rather than what a request costs: every connection repeats one large download
+// (GET) or upload (POST) on its own thread until the byte budget is used up.
+struct TransferLoadOptions {
+    int port = 0;                      // 127.0.0.1
+    std::string host;                  // Host header, selects the proxy route
+    std::string path = "/transfer";
+    size_t body_bytes = 16 << 20;      // per upload; downloads take whatever the server sends
+    uint64_t total_bytes = 1ull << 30;
+    size_t connections = 4;
+    bool upload = false;
+};
+
+struct TransferLoadResult {
+    uint64_t bytes = 0;        // body bytes moved in the measured direction
+    uint64_t transfers = 0;    // answered with status 200
+    uint64_t errors = 0;       // other statuses, resets and malformed responses
+    double seconds = 0.0;
+    double cpu_seconds = 0.0;  // user and system time of the whole process during the run
+};
+
+TransferLoadResult run_transfer_load(const TransferLoadOptions& options);
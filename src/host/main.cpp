@@ -244,7 +244,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)
             g_watcher_dir_handle,
             hwnd,
             WM_CONFIG_CHANGED,
-            g_config_path.filename().wstring());
+            g_config_path.filename().wstring(),
+            0);
     }
 
     // Create toast manager
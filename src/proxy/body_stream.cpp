@@ -0,0 +1,75 @@
+#include "body_stream.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace notiman {
+
+BoundedBodyBuffer::BoundedBodyBuffer(size_t capacity) : ring_(std::max<size_t>(capacity, 1)) {}
+
+bool BoundedBodyBuffer::write(const char* data, size_t length) {
+    std::unique_lock lock(mutex_);
+    while (length > 0) {
+        space_available_.wait(lock, [this] { return aborted_ || size_ < ring_.size(); });
+        if (aborted_) {
+            return false;
+        }
+
+        const size_t tail = (head_ + size_) % ring_.size();
+        const size_t contiguous = std::min(ring_.size() - size_, ring_.size() - tail);
+        const size_t count = std::min(length, contiguous);
+        std::memcpy(ring_.data() + tail, data, count);
+        size_ += count;
+        data += count;
+        length -= count;
+        data_available_.notify_one();
+    }
+    return true;
+}
+
+void BoundedBodyBuffer::finish(bool success) {
+    {
+        std::lock_guard lock(mutex_);
+        finished_ = true;
+        succeeded_ = success;
+    }
+    data_available_.notify_all();
+}
+
+size_t BoundedBodyBuffer::read(char* out, size_t capacity) {
+    std::unique_lock lock(mutex_);
+    data_available_.wait(lock, [this] { return aborted_ || finished_ || size_ > 0; });
+    if (aborted_) {
+        return 0;
+    }
+
+    size_t copied = 0;
+    while (copied < capacity && size_ > 0) {
+        const size_t contiguous = std::min(size_, ring_.size() - head_);
+        const size_t count = std::min(capacity - copied, contiguous);
+        std::memcpy(out + copied, ring_.data() + head_, count);
+        head_ = (head_ + count) % ring_.size();
+        size_ -= count;
+        copied += count;
+    }
+    if (copied > 0) {
+        space_available_.notify_one();
+    }
+    return copied;
+}
+
+void BoundedBodyBuffer::abort() {
+    {
+        std::lock_guard lock(mutex_);
+        aborted_ = true;
+    }
+    space_available_.notify_all();
+    data_available_.notify_all();
+}
+
+bool BoundedBodyBuffer::completed() const {
+    std::lock_guard lock(mutex_);
+    return finished_ && succeeded_ && size_ == 0 && !aborted_;
+}
+
+}  // namespace notiman
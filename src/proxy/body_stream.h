@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace notiman {
+
+// Fixed-capacity byte ring between one producer (the upstream reader) and one
+// consumer (the downstream writer). Memory use is the capacity, whatever the body size.
+class BoundedBodyBuffer {
+public:
+    explicit BoundedBodyBuffer(size_t capacity);
+
+    // Producer side. Blocks while the ring is full. Returns false once the consumer aborted.
+    bool write(const char* data, size_t length);
+
+    // Producer side. Marks the end of the body; success=false reports a truncated body.
+    void finish(bool success);
+
+    // Consumer side. Blocks until bytes are available or the producer finished, then copies
+    // up to capacity bytes into out. Returns 0 at the end of the body or after abort().
+    size_t read(char* out, size_t capacity);
+
+    // Consumer side. Unblocks and fails any pending or future write.
+    void abort();
+
+    // True once the producer finished successfully and every byte was read.
+    bool completed() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable data_available_;
+    std::condition_variable space_available_;
+    std::vector<char> ring_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+    bool finished_ = false;
+    bool succeeded_ = false;
+    bool aborted_ = false;
+};
+
+}  // namespace notiman
@@ -0,0 +1,143 @@
+#include "circuit_breaker.h"
+
+#include <algorithm>
+
+namespace notiman {
+
+namespace {
+
+std::string seconds_text(std::chrono::milliseconds duration) {
+    return std::to_string(std::max<long long>(1, std::chrono::ceil<std::chrono::seconds>(duration).count())) + "s";
+}
+
+}  // namespace
+
+CircuitBreaker::CircuitBreaker(CircuitBreakerOptions options)
+    : options_(options),
+      bucket_ms_(std::max<int64_t>(1, options.window.count() / static_cast<int64_t>(kWindowBuckets))),
+      open_for_(options.open_for) {}
+
+int64_t CircuitBreaker::window_slot(Clock::time_point now) const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() / bucket_ms_;
+}
+
+BreakerAdmission CircuitBreaker::admit(Clock::time_point now) {
+    if (state_.load(std::memory_order_acquire) == BreakerState::Closed) {
+        return {};
+    }
+
+    std::lock_guard lock(mutex_);
+    BreakerAdmission admission;
+    switch (state_.load(std::memory_order_relaxed)) {
+    case BreakerState::Closed:
+        return admission;
+    case BreakerState::Open:
+        if (now < opened_at_ + open_for_) {
+            admission.allowed = false;
+            admission.retry_after = std::chrono::ceil<std::chrono::milliseconds>(opened_at_ + open_for_ - now);
+            return admission;
+        }
+        state_.store(BreakerState::HalfOpen, std::memory_order_release);
+        admission.transition = BreakerTransition{BreakerState::HalfOpen, "Sending a probe request"};
+        break;
+    case BreakerState::HalfOpen:
+        if (probe_in_flight_ && now - probe_started_at_ < kProbeLease) {
+            admission.allowed = false;
+            admission.retry_after = std::chrono::seconds(1);
+            return admission;
+        }
+        break;
+    }
+    probe_in_flight_ = true;
+    probe_started_at_ = now;
+    admission.probe = true;
+    return admission;
+}
+
+std::optional<BreakerTransition> CircuitBreaker::record(bool probe, bool success, Clock::time_point now) {
+    if (!probe) {
+        // Requests admitted before the circuit opened say nothing about the probe.
+        if (state_.load(std::memory_order_acquire) != BreakerState::Closed) {
+            return std::nullopt;
+        }
+        count(now, !success);
+        if (success) {
+            if (streak_.load(std::memory_order_relaxed) != 0) {
+                streak_.store(0, std::memory_order_relaxed);
+            }
+            return std::nullopt;
+        }
+        return trip_if_needed(streak_.fetch_add(1, std::memory_order_relaxed) + 1, now);
+    }
+
+    std::lock_guard lock(mutex_);
+    probe_in_flight_ = false;
+    if (state_.load(std::memory_order_relaxed) != BreakerState::HalfOpen) {
+        return std::nullopt;
+    }
+    if (!success) {
+        open_for_ = std::min<std::chrono::milliseconds>(open_for_ * 2, kMaxOpenFor);
+        opened_at_ = now;
+        state_.store(BreakerState::Open, std::memory_order_release);
+        return BreakerTransition{BreakerState::Open, "Probe failed; failing fast for " + seconds_text(open_for_)};
+    }
+    open_for_ = options_.open_for;
+    streak_.store(0, std::memory_order_relaxed);
+    for (auto& bucket : window_) {
+        bucket.slot.store(-1, std::memory_order_relaxed);
+    }
+    state_.store(BreakerState::Closed, std::memory_order_release);
+    return BreakerTransition{BreakerState::Closed, "Upstream recovered"};
+}
+
+void CircuitBreaker::count(Clock::time_point now, bool failed) {
+    const int64_t slot = window_slot(now);
+    WindowBucket& bucket = window_[static_cast<size_t>(slot) % kWindowBuckets];
+    int64_t seen = bucket.slot.load(std::memory_order_acquire);
+    if (seen != slot && bucket.slot.compare_exchange_strong(seen, slot, std::memory_order_acq_rel)) {
+        bucket.requests.store(0, std::memory_order_relaxed);
+        bucket.failures.store(0, std::memory_order_relaxed);
+    }
+    bucket.requests.fetch_add(1, std::memory_order_relaxed);
+    if (failed) {
+        bucket.failures.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::optional<BreakerTransition> CircuitBreaker::trip_if_needed(uint32_t streak, Clock::time_point now) {
+    if (options_.consecutive_failures > 0 && streak >= static_cast<uint32_t>(options_.consecutive_failures)) {
+        return open(std::to_string(streak) + " failures in a row", now);
+    }
+    if (options_.error_percent <= 0) {
+        return std::nullopt;
+    }
+    const int64_t current = window_slot(now);
+    uint64_t requests = 0;
+    uint64_t failures = 0;
+    for (const auto& bucket : window_) {
+        const int64_t slot = bucket.slot.load(std::memory_order_acquire);
+        if (slot > current - static_cast<int64_t>(kWindowBuckets) && slot <= current) {
+            requests += bucket.requests.load(std::memory_order_relaxed);
+            failures += bucket.failures.load(std::memory_order_relaxed);
+        }
+    }
+    if (requests < kMinWindowRequests || failures * 100 < static_cast<uint64_t>(options_.error_percent) * requests) {
+        return std::nullopt;
+    }
+    return open(std::to_string(failures) + " of " + std::to_string(requests) + " requests failed in " +
+                    seconds_text(options_.window),
+                now);
+}
+
+std::optional<BreakerTransition> CircuitBreaker::open(std::string reason, Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    if (state_.load(std::memory_order_relaxed) != BreakerState::Closed) {
+        return std::nullopt;  // another thread's failure opened it first
+    }
+    opened_at_ = now;
+    open_for_ = options_.open_for;
+    state_.store(BreakerState::Open, std::memory_order_release);
+    return BreakerTransition{BreakerState::Open, std::move(reason) + "; failing fast for " + seconds_text(open_for_)};
+}
+
+}  // namespace notiman
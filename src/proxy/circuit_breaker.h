@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace notiman {
+
+// Upstream answers that count as failures, like not getting an answer at all: the
+// upstream is itself a gateway that could not do its job, or is overloaded.
+inline bool is_gateway_error(int status) {
+    return status == 502 || status == 503 || status == 504;
+}
+
+struct CircuitBreakerOptions {
+    int consecutive_failures = 5;  // failures in a row that open the circuit, 0 ignores streaks
+    int error_percent = 50;        // failure share in the window that opens it, 0 ignores the rate
+    std::chrono::milliseconds window{10000};
+    std::chrono::milliseconds open_for{5000};  // doubles after each failed probe, up to a minute
+
+    bool operator==(const CircuitBreakerOptions&) const = default;
+};
+
+enum class BreakerState : uint8_t {
+    Closed,   // requests go upstream
+    Open,     // requests are refused until open_for has passed
+    HalfOpen  // one probe request goes upstream; its result closes or reopens the circuit
+};
+
+struct BreakerTransition {
+    BreakerState state = BreakerState::Closed;
+    std::string reason;
+};
+
+// What admit() decided for one request.
+struct BreakerAdmission {
+    bool allowed = true;
+    bool probe = false;  // report its result with probe=true
+    std::chrono::milliseconds retry_after{0};  // when refused
+    std::optional<BreakerTransition> transition;
+};
+
+// Per-route circuit breaker. While closed, admit() and successful results only touch
+// atomics; locking is left to failures and to the open and half-open states, where
+// requests are cheap because they never reach the upstream. Counts in the rolling
+// window may lose an update when threads race into a new bucket.
+class CircuitBreaker {
+public:
+    static constexpr size_t kWindowBuckets = 10;
+    // The error rate is only judged once the window holds this many results.
+    static constexpr uint32_t kMinWindowRequests = 10;
+    static constexpr auto kMaxOpenFor = std::chrono::seconds(60);
+    // A probe that never reports back (its client went away) stops blocking new probes after this.
+    static constexpr auto kProbeLease = std::chrono::seconds(30);
+
+    using Clock = std::chrono::steady_clock;
+
+    explicit CircuitBreaker(CircuitBreakerOptions options);
+
+    CircuitBreaker(const CircuitBreaker&) = delete;
+    CircuitBreaker& operator=(const CircuitBreaker&) = delete;
+
+    const CircuitBreakerOptions& options() const { return options_; }
+    BreakerState state() const { return state_.load(std::memory_order_acquire); }
+
+    BreakerAdmission admit(Clock::time_point now);
+
+    // Result of an admitted request: success means the upstream answered with anything but
+    // a gateway error. Returns the transition this result caused, if any.
+    std::optional<BreakerTransition> record(bool probe, bool success, Clock::time_point now);
+
+private:
+    struct WindowBucket {
+        std::atomic<int64_t> slot = -1;
+        std::atomic<uint32_t> requests = 0;
+        std::atomic<uint32_t> failures = 0;
+    };
+
+    void count(Clock::time_point now, bool failed);
+    std::optional<BreakerTransition> trip_if_needed(uint32_t streak, Clock::time_point now);
+    std::optional<BreakerTransition> open(std::string reason, Clock::time_point now);
+    int64_t window_slot(Clock::time_point now) const;
+
+    const CircuitBreakerOptions options_;
+    const int64_t bucket_ms_;
+
+    std::atomic<BreakerState> state_ = BreakerState::Closed;
+    std::atomic<uint32_t> streak_ = 0;
+    std::array<WindowBucket, kWindowBuckets> window_;
+
+    std::mutex mutex_;  // guards the fields below and every state change
+    Clock::time_point opened_at_;
+    std::chrono::milliseconds open_for_;
+    bool probe_in_flight_ = false;
+    Clock::time_point probe_started_at_;
+};
+
+}  // namespace notiman
@@ -0,0 +1,151 @@
+#include "concurrency_limiter.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace notiman {
+
+ConcurrencyPermit::ConcurrencyPermit(std::shared_ptr<ConcurrencyLimiter> limiter, Clock::time_point admitted_at)
+    : limiter_(std::move(limiter)), admitted_at_(admitted_at) {}
+
+ConcurrencyPermit::ConcurrencyPermit(ConcurrencyPermit&& other) noexcept
+    : limiter_(std::move(other.limiter_)), admitted_at_(other.admitted_at_), recorded_(other.recorded_) {}
+
+ConcurrencyPermit& ConcurrencyPermit::operator=(ConcurrencyPermit&& other) noexcept {
+    if (this != &other) {
+        release();
+        limiter_ = std::move(other.limiter_);
+        admitted_at_ = other.admitted_at_;
+        recorded_ = other.recorded_;
+    }
+    return *this;
+}
+
+void ConcurrencyPermit::record(bool success, Clock::time_point now) {
+    if (limiter_ == nullptr || recorded_) {
+        return;
+    }
+    recorded_ = true;
+    limiter_->record(std::chrono::duration_cast<std::chrono::microseconds>(now - admitted_at_), success, admitted_at_);
+}
+
+void ConcurrencyPermit::release() {
+    if (limiter_ != nullptr) {
+        std::exchange(limiter_, nullptr)->release();
+    }
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(ConcurrencyLimitOptions options)
+    : options_(options),
+      limit_(std::clamp(options.initial_limit, options.min_limit, options.max_limit)) {}
+
+size_t ConcurrencyLimiter::limit() const {
+    std::lock_guard lock(mutex_);
+    return capacity();
+}
+
+size_t ConcurrencyLimiter::in_flight() const {
+    std::lock_guard lock(mutex_);
+    return in_flight_;
+}
+
+std::chrono::seconds ConcurrencyLimiter::retry_after() const {
+    return std::max<std::chrono::seconds>(std::chrono::seconds(1),
+                                          std::chrono::ceil<std::chrono::seconds>(options_.queue_timeout));
+}
+
+ConcurrencyLimiter::Admission ConcurrencyLimiter::acquire(Grant grant, uint64_t& ticket) {
+    std::lock_guard lock(mutex_);
+    if (in_flight_ < capacity() && queue_.empty()) {
+        ++in_flight_;
+        return Admission::Admitted;
+    }
+    if (queue_.size() >= static_cast<size_t>(options_.queue_size)) {
+        return Admission::Refused;
+    }
+    ticket = next_ticket_++;
+    queue_.push_back(Waiter{ticket, std::move(grant)});
+    return Admission::Queued;
+}
+
+bool ConcurrencyLimiter::cancel(uint64_t ticket) {
+    std::lock_guard lock(mutex_);
+    const auto it = std::find_if(queue_.begin(), queue_.end(), [ticket](const Waiter& waiter) {
+        return waiter.ticket == ticket;
+    });
+    if (it == queue_.end()) {
+        return false;
+    }
+    queue_.erase(it);
+    return true;
+}
+
+ConcurrencyPermit ConcurrencyLimiter::try_acquire() {
+    {
+        std::lock_guard lock(mutex_);
+        if (in_flight_ >= capacity() || !queue_.empty()) {
+            return {};
+        }
+        ++in_flight_;
+    }
+    return ConcurrencyPermit(shared_from_this(), Clock::now());
+}
+
+void ConcurrencyLimiter::record(std::chrono::microseconds latency, bool success, Clock::time_point admitted_at) {
+    std::vector<Grant> grants;
+    {
+        std::lock_guard lock(mutex_);
+        if (success) {
+            window_min_ = window_samples_ == 0 ? latency : std::min(window_min_, latency);
+            if (++window_samples_ >= kBaselineWindow) {
+                baseline_ = window_min_;
+                window_samples_ = 0;
+            } else if (baseline_.count() == 0 || latency < baseline_) {
+                baseline_ = latency;
+            }
+        }
+
+        const auto tolerated = std::chrono::duration_cast<std::chrono::microseconds>(baseline_ * kLatencyTolerance) +
+                               std::chrono::microseconds(kLatencySlack);
+        if (!success || latency > tolerated) {
+            if (admitted_at >= last_decrease_) {
+                limit_ = std::max<double>(options_.min_limit, limit_ * kBackoff);
+                last_decrease_ = Clock::now();
+            }
+        } else if (in_flight_ * 2 >= capacity()) {
+            limit_ = std::min<double>(options_.max_limit, limit_ + 1.0 / limit_);
+            grants = take_grants();
+        }
+    }
+    run(grants);
+}
+
+void ConcurrencyLimiter::release() {
+    std::vector<Grant> grants;
+    {
+        std::lock_guard lock(mutex_);
+        if (in_flight_ > 0) {
+            --in_flight_;
+        }
+        grants = take_grants();
+    }
+    run(grants);
+}
+
+std::vector<ConcurrencyLimiter::Grant> ConcurrencyLimiter::take_grants() {
+    std::vector<Grant> grants;
+    while (in_flight_ < capacity() && !queue_.empty()) {
+        ++in_flight_;
+        grants.push_back(std::move(queue_.front().grant));
+        queue_.pop_front();
+    }
+    return grants;
+}
+
+void ConcurrencyLimiter::run(std::vector<Grant>& grants) {
+    for (auto& grant : grants) {
+        grant();
+    }
+}
+
+}  // namespace notiman
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace notiman {
+
+struct ConcurrencyLimitOptions {
+    int min_limit = 1;
+    int max_limit = 100;
+    int initial_limit = 10;
+    int queue_size = 50;  // requests waiting for a slot before new ones are refused, 0 refuses at once
+    std::chrono::milliseconds queue_timeout{1000};
+
+    bool operator==(const ConcurrencyLimitOptions&) const = default;
+};
+
+class ConcurrencyLimiter;
+
+// One slot of a route's concurrency limit, freed when the permit is released or destroyed.
+class ConcurrencyPermit {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    ConcurrencyPermit() = default;
+    // Takes over a slot the limiter already counts as in flight.
+    ConcurrencyPermit(std::shared_ptr<ConcurrencyLimiter> limiter, Clock::time_point admitted_at);
+    ~ConcurrencyPermit() { release(); }
+
+    ConcurrencyPermit(ConcurrencyPermit&& other) noexcept;
+    ConcurrencyPermit& operator=(ConcurrencyPermit&& other) noexcept;
+    ConcurrencyPermit(const ConcurrencyPermit&) = delete;
+    ConcurrencyPermit& operator=(const ConcurrencyPermit&) = delete;
+
+    explicit operator bool() const { return limiter_ != nullptr; }
+
+    // How the upstream answered, as for the circuit breaker: success is any response but a
+    // gateway error. Latency counts from admission, so it leaves out the time queued. Only
+    // the first call counts.
+    void record(bool success, Clock::time_point now);
+    void release();
+
+private:
+    std::shared_ptr<ConcurrencyLimiter> limiter_;
+    Clock::time_point admitted_at_;
+    bool recorded_ = false;
+};
+
+// Per-route bulkhead: caps the requests a route has in flight upstream, so a slow upstream
+// ties up at most that many connections and threads. The cap adapts AIMD-style to the
+// latency the route sees. It grows by one per round of requests that use at least half of
+// it, and shrinks by a quarter when a request fails or takes more than twice the route's
+// baseline latency: the fastest recent answer, which is where the upstream is not queueing.
+// It shrinks at most once per round trip, since the requests already in flight when it
+// shrank say nothing about the new cap. Requests over the cap wait in a FIFO queue and are
+// handed the next free slot, or are refused once the queue is full.
+class ConcurrencyLimiter : public std::enable_shared_from_this<ConcurrencyLimiter> {
+public:
+    using Clock = std::chrono::steady_clock;
+    // Called once a queued request holds a slot, on the thread that freed it.
+    using Grant = std::function<void()>;
+
+    // Requests after which the baseline is re-taken, so it can rise if the upstream got slower for good.
+    static constexpr uint32_t kBaselineWindow = 250;
+    static constexpr double kLatencyTolerance = 2.0;
+    static constexpr double kBackoff = 0.75;
+    // Latency jitter below this never counts as queueing, however fast the baseline.
+    static constexpr auto kLatencySlack = std::chrono::milliseconds(1);
+
+    enum class Admission : uint8_t {
+        Admitted,  // holds a slot now
+        Queued,    // grant will be called, unless cancelled first
+        Refused    // queue full
+    };
+
+    explicit ConcurrencyLimiter(ConcurrencyLimitOptions options);
+
+    ConcurrencyLimiter(const ConcurrencyLimiter&) = delete;
+    ConcurrencyLimiter& operator=(const ConcurrencyLimiter&) = delete;
+
+    const ConcurrencyLimitOptions& options() const { return options_; }
+    size_t limit() const;
+    size_t in_flight() const;
+    // What a refused request is told in Retry-After.
+    std::chrono::seconds retry_after() const;
+
+    // Takes a slot when one is free; otherwise queues grant, and sets ticket for cancel().
+    Admission acquire(Grant grant, uint64_t& ticket);
+    // Takes a queued request back. False once its grant was taken off the queue: it holds a
+    // slot then, even if grant has not run yet.
+    bool cancel(uint64_t ticket);
+    // For a thread per request, which must not wait on a shared worker: a slot now, or an
+    // empty permit when the route is at its limit. Never queues.
+    ConcurrencyPermit try_acquire();
+
+    void record(std::chrono::microseconds latency, bool success, Clock::time_point admitted_at);
+    void release();
+
+private:
+    struct Waiter {
+        uint64_t ticket;
+        Grant grant;
+    };
+
+    size_t capacity() const { return static_cast<size_t>(limit_); }
+    // Moves queued requests into free slots; their grants are run after unlocking.
+    std::vector<Grant> take_grants();
+    static void run(std::vector<Grant>& grants);
+
+    const ConcurrencyLimitOptions options_;
+
+    mutable std::mutex mutex_;  // guards everything below
+    double limit_;
+    size_t in_flight_ = 0;
+    std::deque<Waiter> queue_;
+    uint64_t next_ticket_ = 1;
+    std::chrono::microseconds baseline_{0};
+    std::chrono::microseconds window_min_{0};
+    uint32_t window_samples_ = 0;
+    Clock::time_point last_decrease_;
+};
+
+}  // namespace notiman
@@ -0,0 +1,2851 @@
+#include "epoll_engine.h"
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "circuit_breaker.h"
+#include "fault_injector.h"
+#include "forwarding.h"
+#include "http_wire.h"
+#include "listen_sockets.h"
+#include "mock_store.h"
+#include "proxy_metrics.h"
+#include "request_coalescer.h"
+#include "response_cache.h"
+#include "upstream_pool.h"
+#include "upstream_resolver.h"
+
+namespace notiman {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kMaxHeadBytes = 64 * 1024;
+constexpr size_t kReadChunk = 16 * 1024;
+constexpr size_t kRetainedBufferBytes = 16 * 1024;
+constexpr int kMaxEvents = 256;
+constexpr int kAcceptBatch = 64;
+// Content-Length bodies at least this large are spliced rather than copied.
+constexpr uint64_t kSpliceMinBody = 64 * 1024;
+constexpr int kSplicePipeBytes = 256 * 1024;
+constexpr size_t kMaxSparePipes = 16;
+// Mock bodies at least this large are sent straight from the store's memory, not copied
+// into client_out.
+constexpr uint64_t kDirectMockMinBody = 16 * 1024;
+constexpr size_t kDirectMockChunk = 1024 * 1024;
+constexpr auto kHousekeepingInterval = std::chrono::seconds(1);
+constexpr auto kLingerTimeout = std::chrono::seconds(2);
+// While draining, an idle keep-alive connection gets this long to send one more request
+// (answered with Connection: close); closing it at once races a client that is mid-send.
+constexpr auto kDrainIdleTimeout = std::chrono::seconds(1);
+// Dev server sockets such as hot-reload WebSockets can sit quiet for a long time.
+constexpr auto kTunnelIdleTimeout = std::chrono::hours(1);
+const UpstreamPoolOptions kDefaultPoolOptions;
+
+// Byte queue that sockets read into and write from directly. Consumed space at the
+// front is reclaimed when more room is needed rather than on every read.
+class ByteBuffer {
+public:
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    const char* data() const { return storage_.get() + begin_; }
+    std::string_view view() const { return {data(), size()}; }
+
+    // Room for at least count more bytes at the tail; follow with commit().
+    char* prepare(size_t count) {
+        if (capacity_ - end_ >= count) {
+            return storage_.get() + end_;
+        }
+        const size_t used = size();
+        if (capacity_ - used >= count) {
+            std::memmove(storage_.get(), storage_.get() + begin_, used);
+        } else {
+            size_t next = std::max<size_t>(capacity_ * 2, 4096);
+            while (next - used < count) {
+                next *= 2;
+            }
+            auto grown = std::make_unique_for_overwrite<char[]>(next);
+            if (used > 0) {
+                std::memcpy(grown.get(), storage_.get() + begin_, used);
+            }
+            storage_ = std::move(grown);
+            capacity_ = next;
+        }
+        begin_ = 0;
+        end_ = used;
+        return storage_.get() + end_;
+    }
+
+    void commit(size_t count) { end_ += count; }
+
+    void consume(size_t count) {
+        begin_ += count;
+        if (begin_ == end_) {
+            begin_ = end_ = 0;
+        }
+    }
+
+    // Takes back the last count committed bytes.
+    void truncate_back(size_t count) {
+        end_ -= count;
+        if (begin_ == end_) {
+            begin_ = end_ = 0;
+        }
+    }
+
+    void append(std::string_view bytes) {
+        std::memcpy(prepare(bytes.size()), bytes.data(), bytes.size());
+        commit(bytes.size());
+    }
+
+    void clear() { begin_ = end_ = 0; }
+
+    // Idle keep-alive connections should not hold on to a large response's buffer.
+    void trim() {
+        if (empty() && capacity_ > kRetainedBufferBytes) {
+            storage_.reset();
+            capacity_ = 0;
+        }
+    }
+
+private:
+    std::unique_ptr<char[]> storage_;
+    size_t capacity_ = 0;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+};
+
+struct IdleUpstream {
+    int fd = -1;
+    Clock::time_point since;
+};
+
+// One loop's view of an UpstreamPool: its idle sockets. Connections are never shared
+// between loops, so none of this needs a lock; addresses come from the pool's resolver.
+struct UpstreamSlot {
+    std::shared_ptr<UpstreamPool> pool;  // keeps the map key alive and supplies the options
+    std::vector<IdleUpstream> idle;      // back() is the most recently used
+    size_t active = 0;                   // sessions currently using this slot
+};
+
+// Pipe a spliced body passes through on its way between the two sockets.
+struct SplicePipe {
+    int read_fd = -1;
+    int write_fd = -1;
+    size_t capacity = 0;
+};
+
+enum class SpliceDirection : uint8_t {
+    None,
+    Request,  // client to upstream
+    Response  // upstream to client
+};
+
+struct Session;
+
+enum class HandleKind : uint8_t {
+    Listener,
+    Wakeup,
+    Client,
+    Upstream,
+    UpstreamRace  // second connect of a happy-eyeballs race, until it wins or fails
+};
+
+// epoll user data for every registered descriptor.
+struct Handle {
+    HandleKind kind;
+    Session* session = nullptr;
+};
+
+enum class Phase : uint8_t {
+    RequestHead,  // waiting for the next request head
+    Exchange,     // relaying one request and its response
+    Closing,      // flushing the last response
+    Lingering,    // write side shut down, discarding input until the client closes
+    Tunnel        // relaying raw bytes both ways after a 101 or a CONNECT
+};
+
+// One downstream connection and, while a request is in flight, its upstream connection.
+struct Session {
+    explicit Session(uint64_t session_id) : id(session_id) {}
+
+    const uint64_t id;
+    Handle client_handle{HandleKind::Client, this};
+    Handle upstream_handle{HandleKind::Upstream, this};
+    Handle race_handle{HandleKind::UpstreamRace, this};
+
+    int client_fd = -1;
+    bool client_readable = true;
+    bool client_writable = true;
+    bool client_eof = false;
+    bool closed = false;
+    bool parse_pending = false;
+    Phase phase = Phase::RequestHead;
+
+    ByteBuffer client_in;     // request bytes not yet parsed
+    ByteBuffer client_out;    // response bytes for the client
+    ByteBuffer upstream_in;   // response head being parsed
+    ByteBuffer upstream_out;  // request bytes for the upstream
+
+    // Current exchange.
+    int upstream_fd = -1;
+    bool upstream_readable = false;
+    bool upstream_writable = false;
+    bool upstream_connecting = false;
+    bool upstream_reused = false;
+    UpstreamSlot* slot = nullptr;
+    UpstreamTarget* target = nullptr;  // holds one of its in-flight counts while set
+    size_t connect_attempt = 0;
+    UpstreamResolution resolution;  // addresses of the current connect, in the order tried
+    int race_fd = -1;               // connect to the other address family, racing upstream_fd
+    size_t race_index = 0;          // its address, skipped by the attempts that follow
+    bool race_ready = false;
+    std::shared_ptr<const RouteTable> table;  // keeps route valid between events
+    const CompiledRoute* route = nullptr;
+    BodyFramer request_body;
+    BodyFramer response_body;
+    std::string method;
+    std::string path;
+    std::string replay;  // request head kept for one retry after a stale pooled socket
+    bool retried = false;
+    bool client_keep_alive = true;
+    bool keep_alive_announced = false;  // the response head already told the client client_keep_alive
+    bool client_http10 = false;
+    bool upstream_keep_alive = true;
+    bool response_started = false;
+    int status = 0;
+    Clock::time_point started_at;
+    Clock::time_point connect_started_at;
+    std::chrono::microseconds connect_time{-1};
+    std::chrono::microseconds ttfb{-1};
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    std::optional<CapturedExchange> capture;  // set while capture is on; bodies kept for Content-Length framing only
+    bool coalesced = false;  // answered from another session's upstream exchange
+    bool breaker_pending = false;  // admitted by the route's circuit breaker, result not reported yet
+    bool breaker_probe = false;
+    // Concurrency limit: the slot this exchange holds, or the queue entry it waits in. A
+    // queued request leaves its head in client_in, to be parsed again once granted.
+    ConcurrencyPermit permit;
+    uint64_t queued_ticket = 0;
+    size_t queued_head_bytes = 0;
+
+    // Request coalescing: the session leading a flight goes upstream; sessions waiting on
+    // it keep their request head so they can forward it themselves if the leader fails.
+    std::string coalesce_key;     // set while leading or waiting
+    bool coalesce_leader = false;
+    std::string coalesce_head;    // waiting only
+    bool coalesce_bypass = false; // re-issued after a failed flight: forward without coalescing
+
+    // Response cache: a stale entry being validated with If-None-Match, and the entry
+    // being filled from the relayed response. Only Content-Length bodies are stored.
+    CacheResult cache_result = CacheResult::None;
+    CacheRequest cache_request;
+    std::string cache_key;
+    CacheHeaders cache_request_headers;  // GET only, for the Vary values of a new entry
+    std::shared_ptr<const CachedResponse> cache_stale;
+    std::shared_ptr<CachedResponse> cache_fill;
+
+    // Zero-copy relay of one Content-Length body, one direction at a time.
+    SpliceDirection splice = SpliceDirection::None;
+    SplicePipe pipe;
+    size_t pipe_bytes = 0;  // spliced into the pipe, not yet out of it
+
+    // Mock body going out straight from its file once the head in client_out has been sent.
+    std::shared_ptr<const MappedFile> mock_file;
+    uint64_t mock_offset = 0;
+    uint64_t mock_remaining = 0;
+
+    // Fault injection, drawn once per request. A delayed request leaves its head in
+    // client_in until fault_until and is then parsed again, like a queued one.
+    bool fault_drawn = false;
+    bool fault_held = false;
+    FaultAction fault_action = FaultAction::None;
+    Clock::time_point fault_until;
+    BandwidthThrottle throttle;  // paces writes to the client while the route limits bandwidth
+    bool throttled = false;      // out of allowance until throttle.next_allowance()
+
+    // Tunnel: set up by an Upgrade request the upstream answered with 101, or by CONNECT
+    // once the upstream is connected. bytes_in and bytes_out go on counting its traffic.
+    bool upgrade = false;         // Upgrade request, forwarded with Connection: Upgrade
+    bool connect_tunnel = false;  // CONNECT: answered with 200 as soon as the upstream connects
+    bool upstream_eof = false;
+    bool client_shut = false;     // write sides shut down after the other peer finished sending
+    bool upstream_shut = false;
+    Clock::time_point tunnel_opened_at;
+
+    // Timeouts: deadline moves freely; the heap holds one entry at timer_at.
+    Clock::time_point deadline;
+    Clock::time_point timer_at;
+    bool timer_armed = false;
+};
+
+struct TimerEntry {
+    Clock::time_point when;
+    uint64_t session_id;
+
+    bool operator>(const TimerEntry& other) const { return when > other.when; }
+};
+
+// Responses above this are not held for coalesced waiters; they forward on their own.
+constexpr size_t kMaxCoalescedResponse = 1024 * 1024;
+
+// Identical requests on one loop sharing the leader's upstream exchange. The leader's
+// response is copied as it is relayed, minus the headers that depend on the connection.
+struct CoalescedFlight {
+    bool accepting = true;          // until the leader's response head arrives
+    std::vector<uint64_t> waiters;  // session ids
+    std::string head;               // status line and headers, without Connection or the blank line
+    std::string body;               // as relayed, chunk framing included
+    bool shareable = true;
+};
+
+void set_nodelay(int fd) {
+    const int enabled = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+}
+
+bool would_block(int error) {
+    return error == EAGAIN || error == EWOULDBLOCK;
+}
+
+// Starts a non-blocking connect; -1 when it failed straight away.
+int start_connect(const ResolvedAddress& address, bool& connected) {
+    const int fd = socket(address.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (address.family() != AF_UNIX) {
+        set_nodelay(fd);
+    }
+    const int result = connect(fd, reinterpret_cast<const sockaddr*>(&address.address), address.length);
+    if (result != 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    connected = result == 0;
+    return fd;
+}
+
+// 0 once a connecting socket is connected, ENOTCONN while it is still connecting
+// (a stale event), otherwise why the connect failed.
+int connect_status(int fd) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0) {
+        return errno;
+    }
+    if (error != 0) {
+        return error;
+    }
+    sockaddr_storage peer{};
+    socklen_t peer_length = sizeof(peer);
+    return getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &peer_length) == 0 ? 0 : errno;
+}
+
+// A pooled socket the upstream closed reads as EOF; a healthy idle one has nothing to read.
+bool is_idle_socket_alive(int fd) {
+    char byte;
+    const ssize_t result = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return result < 0 && would_block(errno);
+}
+
+std::string_view reason_phrase(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 307: return "Temporary Redirect";
+    case 308: return "Permanent Redirect";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 416: return "Range Not Satisfiable";
+    case 422: return "Unprocessable Content";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default: return "Error";
+    }
+}
+
+CacheHeaders cache_headers(const std::vector<HeaderField>& headers) {
+    CacheHeaders fields;
+    for (const auto& field : headers) {
+        if (!is_excluded_header(field.name)) {
+            fields.emplace_back(field.name, field.value);
+        }
+    }
+    return fields;
+}
+
+}  // namespace
+
+class EpollEngine::Loop {
+public:
+    Loop(const EpollEngineOptions& options,
+         RouteTablePublisher& routes,
+         NotificationDispatcher* notifications,
+         ProxyMetrics* metrics,
+         TrafficCapture* capture,
+         int listen_fd,
+         size_t listener)
+        : options_(options),
+          routes_(routes),
+          notifications_(notifications),
+          metrics_(metrics),
+          capture_(capture),
+          listen_fd_(listen_fd),
+          listener_(listener) {}
+
+    ~Loop() {
+        stop();
+        if (wake_fd_ >= 0) {
+            close(wake_fd_);
+        }
+        if (epoll_fd_ >= 0) {
+            close(epoll_fd_);
+        }
+    }
+
+    bool open() {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd_ < 0 || wake_fd_ < 0) {
+            return false;
+        }
+        epoll_event wake_event{};
+        wake_event.events = EPOLLIN;
+        wake_event.data.ptr = &wake_handle_;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &wake_event) == 0 && watch_listener();
+    }
+
+    void start() {
+        thread_ = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        stopping_.store(true, std::memory_order_release);
+        wake();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    // Stops accepting; connections close once idle.
+    void drain() {
+        draining_.store(true, std::memory_order_release);
+        wake();
+    }
+
+    // Connections still open, or nullopt while the loop may still accept new ones.
+    std::optional<size_t> session_count() const {
+        if (!drain_started_.load(std::memory_order_acquire)) {
+            return std::nullopt;
+        }
+        return session_count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    void wake() {
+        if (wake_fd_ >= 0) {
+            const uint64_t one = 1;
+            [[maybe_unused]] const ssize_t written = write(wake_fd_, &one, sizeof(one));
+        }
+    }
+
+    // The listener stays level-triggered; EPOLLEXCLUSIVE wakes one loop per new connection.
+    bool watch_listener() {
+        epoll_event listen_event{};
+        listen_event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        listen_event.data.ptr = &listener_handle_;
+        listener_paused_ = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &listen_event) != 0;
+        return !listener_paused_;
+    }
+
+    void run() {
+        std::vector<epoll_event> events(kMaxEvents);
+        now_ = Clock::now();
+        auto next_housekeeping = now_ + kHousekeepingInterval;
+
+        while (!stopping_.load(std::memory_order_acquire)) {
+            auto wait_until = next_housekeeping;
+            if (!timers_.empty() && timers_.top().when < wait_until) {
+                wait_until = timers_.top().when;
+            }
+            const auto wait_ms = std::chrono::ceil<std::chrono::milliseconds>(wait_until - Clock::now()).count();
+            const int count = epoll_wait(
+                epoll_fd_, events.data(), kMaxEvents, static_cast<int>(std::clamp<long long>(wait_ms, 0, 1000)));
+            if (count < 0 && errno != EINTR) {
+                break;
+            }
+
+            now_ = Clock::now();
+            for (int i = 0; i < count; ++i) {
+                handle_event(*static_cast<Handle*>(events[static_cast<size_t>(i)].data.ptr),
+                             events[static_cast<size_t>(i)].events);
+            }
+
+            now_ = Clock::now();
+            expire_timers();
+            if (!drain_started_.load(std::memory_order_relaxed) && draining_.load(std::memory_order_acquire)) {
+                begin_drain();
+            }
+            if (now_ >= next_housekeeping) {
+                sweep_idle_upstreams();
+                if (listener_paused_ && !drain_started_.load(std::memory_order_relaxed)) {
+                    watch_listener();
+                }
+                next_housekeeping = now_ + kHousekeepingInterval;
+            }
+            graveyard_.clear();
+            session_count_.store(sessions_.size(), std::memory_order_relaxed);
+        }
+
+        std::vector<Session*> open_sessions;
+        open_sessions.reserve(sessions_.size());
+        for (auto& [id, session] : sessions_) {
+            open_sessions.push_back(session.get());
+        }
+        for (Session* session : open_sessions) {
+            close_session(*session);
+        }
+        graveyard_.clear();
+        {
+            std::lock_guard lock(grants_mutex_);
+            grants_closed_ = true;
+        }
+        resume_granted();
+        for (auto& [pool, slot] : slots_) {
+            for (const auto& idle : slot.idle) {
+                close(idle.fd);
+            }
+        }
+        slots_.clear();
+        for (const SplicePipe& pipe : spare_pipes_) {
+            close(pipe.read_fd);
+            close(pipe.write_fd);
+        }
+        spare_pipes_.clear();
+    }
+
+    void handle_event(Handle& handle, uint32_t events) {
+        switch (handle.kind) {
+        case HandleKind::Listener:
+            accept_connections();
+            return;
+        case HandleKind::Wakeup: {
+            uint64_t value;
+            [[maybe_unused]] const ssize_t drained = read(wake_fd_, &value, sizeof(value));
+            resume_granted();
+            return;
+        }
+        case HandleKind::Client: {
+            Session& session = *handle.session;
+            if (session.closed) {
+                return;
+            }
+            if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
+                session.client_readable = true;
+            }
+            if ((events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0) {
+                session.client_writable = true;
+            }
+            drive(session);
+            return;
+        }
+        case HandleKind::UpstreamRace: {
+            Session& session = *handle.session;
+            if (session.closed || session.race_fd < 0) {
+                return;
+            }
+            session.race_ready = true;
+            drive(session);
+            return;
+        }
+        case HandleKind::Upstream: {
+            Session& session = *handle.session;
+            if (session.closed || session.upstream_fd < 0) {
+                return;
+            }
+            if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
+                session.upstream_readable = true;
+            }
+            if ((events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0) {
+                session.upstream_writable = true;
+            }
+            drive(session);
+            return;
+        }
+        }
+    }
+
+    // Leaves the listener to the other loops and any successor, and lets every connection
+    // close after its current or next response.
+    void begin_drain() {
+        if (!listener_paused_) {
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+            listener_paused_ = true;
+        }
+        for (auto& [id, session] : sessions_) {
+            if (session->phase == Phase::RequestHead) {
+                if (session->client_in.empty()) {
+                    arm_timer(*session, now_ + idle_timeout());
+                }
+            } else if (!session->keep_alive_announced) {
+                session->client_keep_alive = false;
+            }
+        }
+        session_count_.store(sessions_.size(), std::memory_order_relaxed);
+        drain_started_.store(true, std::memory_order_release);
+    }
+
+    void accept_connections() {
+        for (int i = 0; i < kAcceptBatch; ++i) {
+            const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno == EMFILE || errno == ENFILE) {
+                    // Out of descriptors: stop polling the listener until housekeeping
+                    // instead of spinning on a connection we cannot take.
+                    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+                    listener_paused_ = true;
+                }
+                return;
+            }
+            set_nodelay(fd);
+            if (metrics_ != nullptr) {
+                metrics_->record_connection(listener_);
+            }
+
+            auto session = std::make_unique<Session>(next_session_id_++);
+            session->client_fd = fd;
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.ptr = &session->client_handle;
+            if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+                close(fd);
+                continue;
+            }
+            arm_timer(*session, now_ + options_.keep_alive_timeout);
+            sessions_.emplace(session->id, std::move(session));
+        }
+    }
+
+    // Edge-triggered: keep doing whatever the readiness flags allow until nothing moves.
+    void drive(Session& s) {
+        bool any_progress = false;
+        for (;;) {
+            if (s.phase == Phase::Tunnel) {
+                if (!pump_tunnel(s)) {
+                    break;
+                }
+                if (s.closed) {
+                    return;
+                }
+                any_progress = true;
+                continue;
+            }
+            bool progress = pump_client_read(s);
+            if (!s.closed) {
+                progress |= pump_upstream_write(s);
+            }
+            if (!s.closed) {
+                progress |= pump_upstream_read(s);
+            }
+            if (!s.closed) {
+                progress |= pump_client_write(s);
+            }
+            if (!s.closed) {
+                progress |= pump_splice(s);
+            }
+            if (!s.closed) {
+                progress |= pump_mock_body(s);
+            }
+            if (!s.closed && s.parse_pending) {
+                s.parse_pending = false;
+                progress |= parse_request(s);
+            }
+            if (s.closed) {
+                return;
+            }
+            if (!progress) {
+                break;
+            }
+            any_progress = true;
+        }
+
+        if (any_progress && s.fault_held) {
+            arm_timer(s, s.fault_until);
+        } else if (any_progress && s.throttled) {
+            arm_timer(s, s.throttle.next_allowance());
+        } else if (any_progress) {
+            switch (s.phase) {
+            case Phase::RequestHead:
+                arm_timer(s, now_ + idle_timeout());
+                break;
+            case Phase::Exchange:
+            case Phase::Closing:
+                arm_timer(s, now_ + io_timeout(s));
+                break;
+            case Phase::Tunnel:
+                arm_timer(s, now_ + kTunnelIdleTimeout);
+                break;
+            case Phase::Lingering:
+                break;
+            }
+        }
+    }
+
+    size_t buffer_limit(const Session& s) const {
+        const size_t configured = s.table ? s.table->stream_buffer_bytes() : 0;
+        return configured > 0 ? configured : 64 * 1024;
+    }
+
+    static std::chrono::milliseconds io_timeout(const Session& s) {
+        if (s.queued_ticket != 0) {
+            return s.route->limiter->options().queue_timeout;
+        }
+        const UpstreamPoolOptions& options = s.slot != nullptr ? s.slot->pool->options() : kDefaultPoolOptions;
+        return s.upstream_connecting ? options.connection_timeout : options.io_timeout;
+    }
+
+    bool pump_client_read(Session& s) {
+        if (!s.client_readable || s.client_eof) {
+            return false;
+        }
+
+        ByteBuffer* target = nullptr;
+        size_t limit = 0;
+        switch (s.phase) {
+        case Phase::RequestHead:
+            target = &s.client_in;
+            limit = kMaxHeadBytes;
+            break;
+        case Phase::Exchange:
+            // Pipelined requests wait in the kernel until this exchange is done, and a queued
+            // or delayed request's body until it goes ahead.
+            if (s.request_body.done() || s.splice == SpliceDirection::Request || s.queued_ticket != 0 ||
+                s.fault_held) {
+                return false;
+            }
+            target = &s.upstream_out;
+            limit = buffer_limit(s);
+            break;
+        case Phase::Closing:
+        case Phase::Tunnel:
+            return false;
+        case Phase::Lingering:
+            return discard_client_input(s);
+        }
+
+        if (target->size() >= limit) {
+            return false;
+        }
+        const size_t want = std::min(limit - target->size(), std::max(kReadChunk, limit / 4));
+        const ssize_t received = recv(s.client_fd, target->prepare(want), want, 0);
+        if (received > 0) {
+            target->commit(static_cast<size_t>(received));
+            if (s.phase == Phase::RequestHead) {
+                s.parse_pending = true;
+            } else {
+                absorb_request_body(s, static_cast<size_t>(received));
+            }
+            return true;
+        }
+        if (received == 0) {
+            s.client_eof = true;
+            s.client_keep_alive = false;
+            // A client may half-close once its request is complete; anything else ends the session.
+            if (s.phase != Phase::Exchange || !s.request_body.done()) {
+                close_session(s);
+            }
+            return true;
+        }
+        if (would_block(errno)) {
+            s.client_readable = false;
+            return false;
+        }
+        if (errno != EINTR) {
+            close_session(s);
+        }
+        return true;
+    }
+
+    bool discard_client_input(Session& s) {
+        char scratch[4096];
+        for (;;) {
+            const ssize_t received = recv(s.client_fd, scratch, sizeof(scratch), 0);
+            if (received > 0) {
+                continue;
+            }
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received < 0 && would_block(errno)) {
+                s.client_readable = false;
+                return false;
+            }
+            close_session(s);
+            return true;
+        }
+    }
+
+    // The newest `count` bytes of upstream_out came from the client; keep only the body.
+    void absorb_request_body(Session& s, size_t count) {
+        const char* fresh = s.upstream_out.data() + s.upstream_out.size() - count;
+        const size_t used = s.request_body.consume(fresh, count);
+        if (s.request_body.failed()) {
+            close_session(s);
+            return;
+        }
+        s.bytes_in += used;
+        if (s.capture && s.request_body.mode() == BodyFramer::Mode::Length) {
+            keep_body_prefix(s.capture->request_body, std::string_view(fresh, used));
+        }
+        if (used < count) {
+            s.client_in.append(std::string_view(fresh + used, count - used));
+            s.upstream_out.truncate_back(count - used);
+        }
+    }
+
+    bool pump_client_write(Session& s) {
+        if (s.client_out.empty()) {
+            if (s.phase == Phase::Closing) {
+                begin_linger(s);
+                return true;
+            }
+            return false;
+        }
+        if (!s.client_writable || s.throttled) {
+            return false;
+        }
+        const size_t want = static_cast<size_t>(std::min<uint64_t>(s.client_out.size(), throttle_allowance(s)));
+        if (want == 0) {
+            return false;
+        }
+        const ssize_t sent = send(s.client_fd, s.client_out.data(), want, MSG_NOSIGNAL);
+        if (sent > 0) {
+            s.throttle.consume(static_cast<uint64_t>(sent));
+            s.client_out.consume(static_cast<size_t>(sent));
+            s.client_out.trim();
+            return true;
+        }
+        if (sent < 0 && would_block(errno)) {
+            s.client_writable = false;
+            return false;
+        }
+        if (sent < 0 && errno == EINTR) {
+            return true;
+        }
+        close_session(s);
+        return true;
+    }
+
+    // Bytes the route's bandwidth limit lets go to the client now. At zero the session
+    // sleeps until the throttle has credit again.
+    uint64_t throttle_allowance(Session& s) {
+        if (!s.throttle.active()) {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        const uint64_t allowance = s.throttle.allowance(Clock::now());
+        if (allowance == 0) {
+            s.throttled = true;
+            arm_timer(s, s.throttle.next_allowance());
+        }
+        return allowance;
+    }
+
+    // Closing straight after the last response would reset the connection if the client
+    // still has unread bytes in flight, which can destroy the response on its side.
+    void begin_linger(Session& s) {
+        if (s.client_eof) {
+            close_session(s);
+            return;
+        }
+        shutdown(s.client_fd, SHUT_WR);
+        s.phase = Phase::Lingering;
+        s.client_readable = true;
+        arm_timer(s, now_ + kLingerTimeout);
+    }
+
+    bool parse_request(Session& s) {
+        if (s.phase != Phase::RequestHead || s.client_in.empty()) {
+            return false;
+        }
+        const ParseStatus status = parse_request_head(s.client_in.view(), request_head_);
+        if (status == ParseStatus::Incomplete) {
+            if (s.client_in.size() < kMaxHeadBytes) {
+                return false;
+            }
+            s.client_keep_alive = false;
+            respond_locally(s, 431, "Request head too large");
+            return true;
+        }
+        if (status == ParseStatus::Invalid) {
+            s.client_keep_alive = false;
+            respond_locally(s, 400, "Malformed request");
+            return true;
+        }
+        begin_exchange(s, request_head_);
+        return true;
+    }
+
+    void begin_exchange(Session& s, const RequestHead& head) {
+        const bool coalesce_bypass = std::exchange(s.coalesce_bypass, false);
+        const bool granted = static_cast<bool>(s.permit);
+        if (!coalesce_bypass && !granted && !s.fault_drawn) {
+            // A re-issued waiter, or a request granted a slot after queueing or let through
+            // after an injected delay, keeps its original start, so its latency includes the wait.
+            s.started_at = Clock::now();
+            s.throttle.reset(0, now_);
+        }
+        s.phase = Phase::Exchange;
+        s.coalesced = false;
+        s.breaker_pending = false;
+        reset_cache_state(s);
+        s.status = 0;
+        s.connect_time = std::chrono::microseconds(-1);
+        s.ttfb = std::chrono::microseconds(-1);
+        s.bytes_in = 0;
+        s.bytes_out = 0;
+        s.retried = false;
+        s.response_started = false;
+        s.upstream_keep_alive = true;
+        s.client_http10 = head.minor_version == 0;
+        const std::string_view connection = find_header(head.headers, "Connection");
+        s.client_keep_alive = s.client_http10 ? header_has_token(connection, "keep-alive")
+                                              : !header_has_token(connection, "close");
+        s.keep_alive_announced = false;
+        if (draining_.load(std::memory_order_relaxed)) {
+            s.client_keep_alive = false;
+        }
+        s.method.assign(head.method);
+        s.upgrade = !s.client_http10 && is_upgrade_request(connection, find_header(head.headers, "Upgrade"));
+        s.connect_tunnel = false;
+
+        // Absolute-form targets ("http://host/path") are reduced to origin-form.
+        std::string_view target = head.target;
+        if (const size_t scheme = target.find("://"); scheme != std::string_view::npos && target.front() != '/') {
+            const size_t path_start = target.find('/', scheme + 3);
+            target = path_start == std::string_view::npos ? std::string_view("/") : target.substr(path_start);
+        }
+        const size_t query_start = target.find('?');
+        const std::string_view path = target.substr(0, query_start);
+        const std::string_view query = query_start == std::string_view::npos ? std::string_view{}
+                                                                             : target.substr(query_start + 1);
+        s.path.assign(path);
+
+        BodyFramer::Mode body_mode = BodyFramer::Mode::None;
+        uint64_t body_length = 0;
+        const FramingStatus framing = request_body_framing(head.headers, body_mode, body_length);
+        s.request_body.reset(framing == FramingStatus::Ok ? body_mode : BodyFramer::Mode::None, body_length);
+
+        const std::string_view host_header = find_header(head.headers, "Host");
+        if (capture_ != nullptr) {
+            s.capture.emplace();
+            s.capture->method = s.method;
+            s.capture->host = host_header;
+            s.capture->target = head.target;
+            for (const auto& field : head.headers) {
+                s.capture->headers.append(field.name).append(": ").append(field.value).append("\r\n");
+            }
+        }
+        s.table = routes_.snapshot();
+        // A CONNECT target is the authority itself, which clients normally repeat in Host;
+        // it has no path, so only routes without a path prefix take it.
+        s.route = s.method == "CONNECT" ? s.table->find(host_header.empty() ? head.target : host_header, {})
+                                        : s.table->find(host_header, path);
+
+        if (framing != FramingStatus::Ok) {
+            s.client_in.consume(head.head_bytes);
+            s.client_keep_alive = false;
+            respond_locally(s, framing == FramingStatus::Invalid ? 400 : 501, "Unsupported request body framing");
+            return;
+        }
+
+        if (metrics_ != nullptr && path == kMetricsPath && (s.method == "GET" || s.method == "HEAD")) {
+            s.client_in.consume(head.head_bytes);
+            const bool json = metrics_wants_json(query, find_header(head.headers, "Accept"));
+            const MetricsSnapshot snapshot = metrics_->snapshot();
+            write_response(s,
+                           200,
+                           json ? "application/json" : "text/plain; version=0.0.4",
+                           json ? format_json(snapshot) : format_prometheus(snapshot));
+            return;
+        }
+
+        if (s.route == nullptr) {
+            const std::string request = std::string(host_header) + std::string(path);
+            s.client_in.consume(head.head_bytes);
+            respond_locally(s, 500, "No route configured for host");
+            notify(NotificationIcon::Error, "Proxy error", "No route configured for " + request, "route-match", "");
+            return;
+        }
+
+        const CompiledRoute& route = *s.route;
+        if (route.faults.active() && inject_fault(s, head)) {
+            return;
+        }
+        if (route.mock) {
+            serve_mock(s, head);
+            return;
+        }
+        if (route.balancer.empty()) {
+            s.client_in.consume(head.head_bytes);
+            if (const auto outcome = request_notification(route, 500, s.started_at)) {
+                notify(NotificationIcon::Error,
+                       "Proxy error",
+                       "Invalid target URL for route " + route.route.name,
+                       "target-url",
+                       route.route.name,
+                       *outcome);
+            }
+            respond_locally(s, 500, "Invalid route target URL");
+            return;
+        }
+
+        if (s.method == "CONNECT") {
+            s.client_in.consume(head.head_bytes);
+            begin_connect_tunnel(s);
+            return;
+        }
+
+        // Fresh stored responses are served here. A stale one with an ETag is validated with
+        // a conditional request, and a 304 answer serves it again.
+        if (route.cache && body_mode == BodyFramer::Mode::None && !s.upgrade) {
+            const auto header = [&head](std::string_view name) { return find_header(head.headers, name); };
+            s.cache_request = cache_request(s.method, header);
+            if (s.cache_request.usable) {
+                auto cached = route.cache->find(target, header);
+                if (cached && is_fresh(*cached, s.cache_request, s.started_at)) {
+                    s.client_in.consume(head.head_bytes);
+                    serve_from_cache(s, *cached, CacheResult::Hit);
+                    return;
+                }
+                s.cache_result = CacheResult::Miss;
+                s.cache_key.assign(target);
+                if (cached && !cached->etag.empty()) {
+                    s.cache_stale = std::move(cached);
+                }
+                if (s.method == "GET") {
+                    for (const auto& field : head.headers) {
+                        s.cache_request_headers.emplace_back(field.name, field.value);
+                    }
+                }
+            }
+        }
+
+        if (route.route.coalesce && !coalesce_bypass && !granted && !s.client_http10 && body_mode == BodyFramer::Mode::None &&
+            !s.upgrade && is_coalescable_method(s.method)) {
+            const auto header = [&head](std::string_view name) { return find_header(head.headers, name); };
+            const auto [flight, created] = flights_.try_emplace(coalescing_key(route.route, s.method, head.target, header));
+            if (created) {
+                s.coalesce_key = flight->first;
+                s.coalesce_leader = true;
+            } else if (flight->second.accepting) {
+                flight->second.waiters.push_back(s.id);
+                s.coalesce_key = flight->first;
+                s.coalesce_head.assign(s.client_in.data(), head.head_bytes);
+                s.client_in.consume(head.head_bytes);
+                return;
+            }
+            // A flight already relaying its response cannot be joined; forward this one alone.
+        }
+
+        if (!acquire_concurrency(s, head.head_bytes)) {
+            return;
+        }
+        if (!admit_upstream(s, head.head_bytes)) {
+            return;
+        }
+        s.target = route.balancer.pick().get();
+        s.target->begin_request();
+        const TargetEndpoint& endpoint = s.target->endpoint();
+        ByteBuffer& out = s.upstream_out;
+        out.append(head.method);
+        out.append(" ");
+        out.append(build_forward_path(path, query, endpoint.base_path));
+        out.append(" HTTP/1.1\r\nHost: ");
+        out.append(endpoint.host);
+        if (endpoint.port != 80) {
+            out.append(":");
+            out.append(std::to_string(endpoint.port));
+        }
+        out.append("\r\n");
+        for (const auto& field : head.headers) {
+            if (is_excluded_header(field.name) || (s.cache_stale && iequals(field.name, "If-None-Match"))) {
+                continue;
+            }
+            out.append(field.name);
+            out.append(": ");
+            out.append(field.value);
+            out.append("\r\n");
+        }
+        if (s.cache_stale) {
+            out.append("If-None-Match: ");
+            out.append(s.cache_stale->etag);
+            out.append("\r\n");
+        }
+        if (s.upgrade) {
+            out.append("Connection: Upgrade\r\n");
+        }
+        if (body_mode == BodyFramer::Mode::Length) {
+            out.append("Content-Length: ");
+            out.append(std::to_string(body_length));
+            out.append("\r\n");
+        } else if (body_mode == BodyFramer::Mode::Chunked) {
+            out.append("Transfer-Encoding: chunked\r\n");
+        }
+        out.append("\r\n");
+
+        // Expect is not forwarded, so answer it here rather than stall the client.
+        if (!s.client_http10 && body_mode != BodyFramer::Mode::None &&
+            header_has_token(find_header(head.headers, "Expect"), "100-continue")) {
+            s.client_out.append("HTTP/1.1 100 Continue\r\n\r\n");
+        }
+
+        s.client_in.consume(head.head_bytes);
+        if (!s.request_body.done() && !s.client_in.empty()) {
+            const size_t used = s.request_body.consume(s.client_in.data(), s.client_in.size());
+            if (s.request_body.failed()) {
+                out.clear();
+                s.client_keep_alive = false;
+                respond_locally(s, 400, "Malformed chunked request body");
+                return;
+            }
+            out.append(std::string_view(s.client_in.data(), used));
+            if (s.capture && body_mode == BodyFramer::Mode::Length) {
+                keep_body_prefix(s.capture->request_body, std::string_view(s.client_in.data(), used));
+            }
+            s.client_in.consume(used);
+            s.bytes_in += used;
+        }
+        if (can_splice(s, s.request_body)) {
+            begin_splice(s, SpliceDirection::Request);
+        }
+
+        if (!acquire_upstream(s)) {
+            fail_upstream(s);
+            return;
+        }
+        if (s.upstream_reused && body_mode == BodyFramer::Mode::None && is_idempotent_method(s.method)) {
+            s.replay.assign(out.view());
+        }
+    }
+
+    UpstreamSlot& slot_for(const UpstreamTarget& target) {
+        auto [it, inserted] = slots_.try_emplace(target.pool().get());
+        UpstreamSlot& slot = it->second;
+        if (inserted) {
+            slot.pool = target.pool();
+        }
+        return slot;
+    }
+
+    bool acquire_upstream(Session& s, bool reuse_idle = true) {
+        s.slot = &slot_for(*s.target);
+        ++s.slot->active;
+        s.connect_attempt = 0;
+
+        auto& idle = s.slot->idle;
+        if (!reuse_idle) {
+            return connect_upstream(s);
+        }
+        const auto idle_timeout = s.slot->pool->options().idle_timeout;
+        while (!idle.empty()) {
+            const IdleUpstream candidate = idle.back();
+            idle.pop_back();
+            if (now_ - candidate.since > idle_timeout || !is_idle_socket_alive(candidate.fd)) {
+                close(candidate.fd);
+                continue;
+            }
+            if (!watch_upstream(s, candidate.fd)) {
+                close(candidate.fd);
+                return false;
+            }
+            s.upstream_fd = candidate.fd;
+            s.upstream_reused = true;
+            s.upstream_connecting = false;
+            s.upstream_readable = false;
+            s.upstream_writable = true;
+            return true;
+        }
+        return connect_upstream(s);
+    }
+
+    bool watch_upstream(Session& s, int fd) {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = &s.upstream_handle;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    // Starts a non-blocking connect, trying the resolved addresses in order. Until an address
+    // family has connected, the first address of the other family races the first one.
+    bool connect_upstream(Session& s) {
+        UpstreamResolver& resolver = s.slot->pool->resolver();
+        if (s.connect_attempt == 0) {
+            s.connect_started_at = Clock::now();
+            s.resolution = resolver.resolve(s.connect_started_at);
+            s.race_index = 0;
+        }
+        const auto& addresses = *s.resolution.addresses;
+        while (s.connect_attempt < addresses.size()) {
+            if (s.race_index != 0 && s.connect_attempt == s.race_index) {
+                ++s.connect_attempt;  // already raced
+                continue;
+            }
+            const ResolvedAddress& address = addresses[s.connect_attempt];
+            bool connected = false;
+            const int fd = start_connect(address, connected);
+            if (fd < 0) {
+                ++s.connect_attempt;
+                continue;
+            }
+            if (!watch_upstream(s, fd)) {
+                close(fd);
+                return false;
+            }
+            s.upstream_fd = fd;
+            s.upstream_reused = false;
+            s.upstream_connecting = !connected;
+            s.upstream_readable = false;
+            s.upstream_writable = connected;
+            if (connected) {
+                upstream_connected(s, address.family());
+            } else if (s.connect_attempt == 0 && s.resolution.race) {
+                start_race(s);
+            }
+            return true;
+        }
+        resolver.failed();
+        return false;
+    }
+
+    void start_race(Session& s) {
+        const auto& addresses = *s.resolution.addresses;
+        const auto other = std::find_if(addresses.begin() + 1, addresses.end(), [&](const ResolvedAddress& address) {
+            return address.family() != addresses.front().family();
+        });
+        if (other == addresses.end()) {
+            return;
+        }
+        bool connected = false;
+        const int fd = start_connect(*other, connected);
+        if (fd < 0) {
+            return;  // left to the attempts that follow
+        }
+        epoll_event event{};
+        event.events = EPOLLOUT | EPOLLET;
+        event.data.ptr = &s.race_handle;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            return;
+        }
+        s.race_fd = fd;
+        s.race_index = static_cast<size_t>(other - addresses.begin());
+        s.race_ready = false;
+    }
+
+    void drop_race(Session& s) {
+        if (s.race_fd >= 0) {
+            close(s.race_fd);
+            s.race_fd = -1;
+        }
+        s.race_ready = false;
+    }
+
+    void upstream_connected(Session& s, int family) {
+        drop_race(s);
+        s.upstream_connecting = false;
+        s.connect_attempt = 0;
+        s.connect_time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - s.connect_started_at);
+        s.slot->pool->resolver().connected(family);
+    }
+
+    // Called once the connecting socket reports writable or an error.
+    bool finish_connect(Session& s) {
+        const int error = connect_status(s.upstream_fd);
+        if (error == ENOTCONN) {
+            s.upstream_writable = false;  // stale event from a previous socket
+            return false;
+        }
+
+        if (error != 0) {
+            close(s.upstream_fd);
+            s.upstream_fd = -1;
+            s.upstream_writable = false;
+            if (s.race_fd >= 0) {
+                return true;  // the raced connect decides
+            }
+            ++s.connect_attempt;
+            if (!connect_upstream(s)) {
+                fail_upstream(s);
+            }
+            return true;
+        }
+
+        upstream_connected(s, (*s.resolution.addresses)[s.connect_attempt].family());
+        return true;
+    }
+
+    // Called once the raced socket reports writable or an error. The winner becomes the
+    // session's upstream socket; a loser leaves the other connect to carry on alone.
+    bool settle_race(Session& s) {
+        s.race_ready = false;
+        const int error = connect_status(s.race_fd);
+        if (error == ENOTCONN) {
+            return false;
+        }
+        if (error != 0) {
+            drop_race(s);
+            if (s.upstream_fd < 0) {
+                ++s.connect_attempt;  // the first connect has failed already
+                if (!connect_upstream(s)) {
+                    fail_upstream(s);
+                }
+            }
+            return true;
+        }
+
+        if (s.upstream_fd >= 0) {
+            close(s.upstream_fd);
+        }
+        s.upstream_fd = std::exchange(s.race_fd, -1);
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = &s.upstream_handle;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, s.upstream_fd, &event) != 0) {
+            fail_upstream(s);
+            return true;
+        }
+        s.upstream_readable = false;
+        s.upstream_writable = true;
+        upstream_connected(s, (*s.resolution.addresses)[s.race_index].family());
+        return true;
+    }
+
+    bool pump_upstream_write(Session& s) {
+        if (s.race_ready && settle_race(s)) {
+            return true;
+        }
+        if (s.upstream_fd < 0 || !s.upstream_writable) {
+            return false;
+        }
+        if (s.upstream_connecting) {
+            return finish_connect(s);
+        }
+        if (s.connect_tunnel && s.phase == Phase::Exchange) {
+            establish_connect_tunnel(s);
+            return true;
+        }
+        if (s.upstream_out.empty()) {
+            return false;
+        }
+        const ssize_t sent = send(s.upstream_fd, s.upstream_out.data(), s.upstream_out.size(), MSG_NOSIGNAL);
+        if (sent > 0) {
+            s.upstream_out.consume(static_cast<size_t>(sent));
+            return true;
+        }
+        if (sent < 0 && would_block(errno)) {
+            s.upstream_writable = false;
+            return false;
+        }
+        if (sent < 0 && errno == EINTR) {
+            return true;
+        }
+        fail_upstream(s);
+        return true;
+    }
+
+    bool pump_upstream_read(Session& s) {
+        if (s.upstream_fd < 0 || s.upstream_connecting || !s.upstream_readable ||
+            s.splice == SpliceDirection::Response) {
+            return false;
+        }
+
+        ByteBuffer& target = s.response_started ? s.client_out : s.upstream_in;
+        const size_t limit = s.response_started ? buffer_limit(s) : kMaxHeadBytes;
+        if (target.size() >= limit) {
+            return false;
+        }
+        const size_t want = std::min(limit - target.size(), std::max(kReadChunk, limit / 4));
+        const ssize_t received = recv(s.upstream_fd, target.prepare(want), want, 0);
+        if (received > 0) {
+            target.commit(static_cast<size_t>(received));
+            if (s.response_started) {
+                absorb_response_body(s, static_cast<size_t>(received));
+            } else {
+                parse_response(s);
+            }
+            return true;
+        }
+        if (received < 0 && would_block(errno)) {
+            s.upstream_readable = false;
+            return false;
+        }
+        if (received < 0 && errno == EINTR) {
+            return true;
+        }
+
+        if (!s.response_started) {
+            fail_upstream(s);
+        } else if (received == 0 && s.response_body.mode() == BodyFramer::Mode::UntilClose) {
+            s.upstream_keep_alive = false;
+            complete_exchange(s);
+        } else {
+            // Truncated response: the client can only learn about it from the connection closing.
+            close_session(s);
+        }
+        return true;
+    }
+
+    // The newest `count` bytes of client_out came from the upstream; keep only the body.
+    void absorb_response_body(Session& s, size_t count) {
+        const char* fresh = s.client_out.data() + s.client_out.size() - count;
+        const size_t used = s.response_body.consume(fresh, count);
+        if (s.response_body.failed()) {
+            close_session(s);
+            return;
+        }
+        s.bytes_out += used;
+        if (s.capture && s.response_body.mode() == BodyFramer::Mode::Length) {
+            keep_body_prefix(s.capture->response_body, std::string_view(fresh, used));
+        }
+        share_response(s, std::string_view(fresh, used));
+        if (s.cache_fill) {
+            s.cache_fill->body.append(fresh, used);
+        }
+        if (used < count) {
+            s.client_out.truncate_back(count - used);
+            s.upstream_keep_alive = false;
+        }
+        if (s.response_body.done()) {
+            complete_exchange(s);
+        }
+    }
+
+    void parse_response(Session& s) {
+        for (;;) {
+            const ParseStatus status = parse_response_head(s.upstream_in.view(), response_head_);
+            if (status == ParseStatus::Incomplete) {
+                if (s.upstream_in.size() >= kMaxHeadBytes) {
+                    fail_upstream(s);
+                }
+                return;
+            }
+            if (status == ParseStatus::Invalid || (response_head_.status == 101 && !s.upgrade)) {
+                fail_upstream(s);
+                return;
+            }
+            if (response_head_.status >= 200 || response_head_.status == 101) {
+                break;
+            }
+            // Interim responses (100, 103) are not relayed.
+            s.upstream_in.consume(response_head_.head_bytes);
+            if (s.upstream_in.empty()) {
+                return;
+            }
+        }
+
+        s.ttfb = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - s.started_at);
+        report_upstream(s, !is_gateway_error(response_head_.status));
+        const ResponseHead& head = response_head_;
+        if (head.status == 101) {
+            switch_protocols(s, head);
+            return;
+        }
+        BodyFramer::Mode body_mode = BodyFramer::Mode::None;
+        uint64_t body_length = 0;
+        if (response_body_framing(s.method, head, body_mode, body_length) != FramingStatus::Ok) {
+            fail_upstream(s);
+            return;
+        }
+        s.response_body.reset(body_mode, body_length);
+
+        const std::string_view connection = find_header(head.headers, "Connection");
+        s.upstream_keep_alive = head.minor_version >= 1 ? !header_has_token(connection, "close")
+                                                        : header_has_token(connection, "keep-alive");
+        // Close-delimited bodies, and chunked ones an HTTP/1.0 client cannot parse, end with the connection.
+        if (body_mode == BodyFramer::Mode::UntilClose ||
+            (s.client_http10 && body_mode == BodyFramer::Mode::Chunked)) {
+            s.client_keep_alive = false;
+        }
+        s.status = head.status;
+
+        if (s.cache_stale && head.status == 304) {
+            serve_revalidated(s, head);
+            return;
+        }
+        if (s.cache_result == CacheResult::Miss && s.method == "GET" &&
+            (body_mode == BodyFramer::Mode::None ||
+             (body_mode == BodyFramer::Mode::Length && body_length <= s.route->cache->max_entry_bytes()))) {
+            const auto request_header = [&s](std::string_view name) {
+                for (const auto& [key, value] : s.cache_request_headers) {
+                    if (iequals(key, name)) {
+                        return std::string_view(value);
+                    }
+                }
+                return std::string_view{};
+            };
+            s.cache_fill = make_cache_entry(
+                s.cache_request, request_header, head.status, head.reason, cache_headers(head.headers), Clock::now());
+        }
+
+        ByteBuffer& out = s.client_out;
+        const size_t head_start = out.size();
+        out.append("HTTP/1.1 ");
+        out.append(std::to_string(head.status));
+        out.append(" ");
+        out.append(head.reason);
+        out.append("\r\n");
+        for (const auto& field : head.headers) {
+            if (is_excluded_header(field.name)) {
+                continue;
+            }
+            out.append(field.name);
+            out.append(": ");
+            out.append(field.value);
+            out.append("\r\n");
+        }
+        if (body_mode == BodyFramer::Mode::Length) {
+            out.append("Content-Length: ");
+            out.append(std::to_string(body_length));
+            out.append("\r\n");
+        } else if (body_mode == BodyFramer::Mode::Chunked) {
+            out.append("Transfer-Encoding: chunked\r\n");
+        } else if (body_mode == BodyFramer::Mode::None && has_header(head.headers, "Content-Length")) {
+            // HEAD and 304 responses describe the representation without sending it.
+            out.append("Content-Length: ");
+            out.append(find_header(head.headers, "Content-Length"));
+            out.append("\r\n");
+        }
+        if (CoalescedFlight* flight = led_flight(s)) {
+            if (flight->waiters.empty()) {
+                land_flight(s);
+            } else {
+                flight->accepting = false;
+                flight->head.assign(out.data() + head_start, out.size() - head_start);
+                flight->shareable = body_mode != BodyFramer::Mode::UntilClose;
+            }
+        }
+        append_connection_header(s);
+        out.append("\r\n");
+
+        s.response_started = true;
+        s.replay.clear();
+        s.upstream_in.consume(head.head_bytes);
+
+        if (!s.upstream_in.empty()) {
+            const size_t used = s.response_body.consume(s.upstream_in.data(), s.upstream_in.size());
+            if (s.response_body.failed()) {
+                close_session(s);
+                return;
+            }
+            out.append(std::string_view(s.upstream_in.data(), used));
+            if (s.capture && body_mode == BodyFramer::Mode::Length) {
+                keep_body_prefix(s.capture->response_body, std::string_view(s.upstream_in.data(), used));
+            }
+            share_response(s, std::string_view(s.upstream_in.data(), used));
+            if (s.cache_fill) {
+                s.cache_fill->body.append(s.upstream_in.data(), used);
+            }
+            s.upstream_in.consume(used);
+            s.bytes_out += used;
+            if (!s.upstream_in.empty()) {
+                s.upstream_keep_alive = false;
+                s.upstream_in.clear();
+            }
+        }
+        if (s.response_body.done()) {
+            complete_exchange(s);
+        } else if (can_splice(s, s.response_body) && led_flight(s) == nullptr && !s.cache_fill) {
+            begin_splice(s, SpliceDirection::Response);
+        }
+    }
+
+    // Splicing is for bodies nothing in the proxy has to look at.
+    bool can_splice(const Session& s, const BodyFramer& body) const {
+        return options_.splice_bodies && s.splice == SpliceDirection::None && !s.throttle.active() &&
+               body.remaining_length() >= kSpliceMinBody && (!s.capture || capture_->body_limit() == 0);
+    }
+
+    void begin_splice(Session& s, SpliceDirection direction) {
+        if (spare_pipes_.empty()) {
+            int fds[2];
+            if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+                return;  // out of descriptors: relay through the buffers instead
+            }
+            fcntl(fds[1], F_SETPIPE_SZ, kSplicePipeBytes);
+            const int capacity = fcntl(fds[1], F_GETPIPE_SZ);
+            spare_pipes_.push_back(SplicePipe{fds[0], fds[1], static_cast<size_t>(capacity > 0 ? capacity : 4096)});
+        }
+        s.pipe = spare_pipes_.back();
+        spare_pipes_.pop_back();
+        s.pipe_bytes = 0;
+        s.splice = direction;
+    }
+
+    void end_splice(Session& s) {
+        if (s.pipe.read_fd < 0) {
+            return;
+        }
+        // A pipe still holding bytes of an abandoned body cannot be reused.
+        if (s.pipe_bytes == 0 && spare_pipes_.size() < kMaxSparePipes) {
+            spare_pipes_.push_back(s.pipe);
+        } else {
+            close(s.pipe.read_fd);
+            close(s.pipe.write_fd);
+        }
+        s.pipe = SplicePipe{};
+        s.pipe_bytes = 0;
+        s.splice = SpliceDirection::None;
+    }
+
+    // Moves the spliced body from its source socket into the pipe and from the pipe to
+    // the other socket, once the bytes buffered ahead of it (the head) have been sent.
+    bool pump_splice(Session& s) {
+        if (s.splice == SpliceDirection::None) {
+            return false;
+        }
+        const bool upload = s.splice == SpliceDirection::Request;
+        BodyFramer& body = upload ? s.request_body : s.response_body;
+        const int source = upload ? s.client_fd : s.upstream_fd;
+        const int sink = upload ? s.upstream_fd : s.client_fd;
+        bool& readable = upload ? s.client_readable : s.upstream_readable;
+        bool& writable = upload ? s.upstream_writable : s.client_writable;
+        const bool sink_ready = upload ? s.upstream_fd >= 0 && !s.upstream_connecting && s.upstream_out.empty()
+                                       : s.client_out.empty();
+        bool progress = false;
+
+        if (readable && body.remaining_length() > 0 && s.pipe_bytes < s.pipe.capacity) {
+            const size_t want = static_cast<size_t>(
+                std::min<uint64_t>(body.remaining_length(), s.pipe.capacity - s.pipe_bytes));
+            const ssize_t moved = splice(source, nullptr, s.pipe.write_fd, nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved > 0) {
+                body.skip(static_cast<uint64_t>(moved));
+                s.pipe_bytes += static_cast<size_t>(moved);
+                (upload ? s.bytes_in : s.bytes_out) += static_cast<uint64_t>(moved);
+                progress = true;
+            } else if (moved < 0 && would_block(errno)) {
+                // With bytes in the pipe, EAGAIN may mean its buffers are full rather than
+                // the socket empty; draining the pipe retries the read.
+                if (s.pipe_bytes == 0) {
+                    readable = false;
+                }
+            } else if (moved == 0 || errno != EINTR) {
+                // The body ended early: the client gave up on its request, or the upstream
+                // cut the response short and only closing tells the client.
+                close_session(s);
+                return true;
+            }
+        }
+
+        if (sink_ready && writable && s.pipe_bytes > 0) {
+            const ssize_t moved = splice(s.pipe.read_fd, nullptr, sink, nullptr, s.pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved > 0) {
+                s.pipe_bytes -= static_cast<size_t>(moved);
+                progress = true;
+            } else if (moved < 0 && would_block(errno)) {
+                writable = false;
+            } else if (moved < 0 && errno != EINTR) {
+                if (upload) {
+                    fail_upstream(s);
+                } else {
+                    close_session(s);
+                }
+                return true;
+            }
+        }
+
+        if (body.done() && s.pipe_bytes == 0) {
+            end_splice(s);
+            if (!upload) {
+                complete_exchange(s);
+            }
+            return true;
+        }
+        return progress;
+    }
+
+    // The upstream accepted the Upgrade: relay its 101 and any bytes after it, then tunnel.
+    void switch_protocols(Session& s, const ResponseHead& head) {
+        ByteBuffer& out = s.client_out;
+        out.append("HTTP/1.1 101 ");
+        out.append(head.reason);
+        out.append("\r\n");
+        for (const auto& field : head.headers) {
+            if (is_excluded_header(field.name)) {
+                continue;
+            }
+            out.append(field.name);
+            out.append(": ");
+            out.append(field.value);
+            out.append("\r\n");
+        }
+        out.append("Connection: Upgrade\r\n\r\n");
+        s.status = 101;
+        s.response_started = true;
+        s.upstream_in.consume(head.head_bytes);
+        out.append(s.upstream_in.view());
+        s.bytes_out += s.upstream_in.size();
+        s.upstream_in.clear();
+        open_tunnel(s);
+    }
+
+    // CONNECT tunnels to the route's target, whatever port the client named, on a
+    // connection of its own: a pooled one may be part way through an HTTP session.
+    void begin_connect_tunnel(Session& s) {
+        if (!admit_upstream(s, 0)) {
+            return;
+        }
+        s.connect_tunnel = true;
+        s.target = s.route->balancer.pick().get();
+        s.target->begin_request();
+        if (!acquire_upstream(s, false)) {
+            fail_upstream(s);
+        }
+    }
+
+    void establish_connect_tunnel(Session& s) {
+        s.ttfb = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - s.started_at);
+        report_upstream(s, true);
+        s.status = 200;
+        s.response_started = true;
+        s.client_out.append("HTTP/1.1 200 Connection Established\r\n\r\n");
+        open_tunnel(s);
+    }
+
+    void open_tunnel(Session& s) {
+        s.phase = Phase::Tunnel;
+        // A tunnel's lifetime says nothing about upstream latency; it stops counting against the limit.
+        s.permit.release();
+        s.tunnel_opened_at = Clock::now();
+        s.replay.clear();
+        s.upstream_eof = false;
+        s.client_shut = false;
+        s.upstream_shut = false;
+        // Whatever the client sent after its request head already belongs to the tunnel.
+        s.upstream_out.append(s.client_in.view());
+        s.bytes_in += s.client_in.size();
+        s.client_in.clear();
+        notify(NotificationIcon::Info,
+               "Tunnel opened",
+               s.method + " " + s.path,
+               "tunnel",
+               s.route->route.name);
+    }
+
+    // The relay loop of a tunnel: each direction reads into one buffer and writes it out,
+    // and a peer that stops sending has the other peer's write side shut down once its
+    // bytes are delivered. The tunnel ends when both directions are finished.
+    bool pump_tunnel(Session& s) {
+        bool progress = relay_tunnel(
+            s, s.client_fd, s.client_readable, s.client_eof, s.upstream_out, s.upstream_fd, s.upstream_writable,
+            s.upstream_shut, s.bytes_in);
+        if (!s.closed) {
+            progress |= relay_tunnel(
+                s, s.upstream_fd, s.upstream_readable, s.upstream_eof, s.client_out, s.client_fd, s.client_writable,
+                s.client_shut, s.bytes_out);
+        }
+        if (!s.closed && s.client_shut && s.upstream_shut) {
+            close_session(s);
+            return true;
+        }
+        return progress;
+    }
+
+    bool relay_tunnel(Session& s,
+                      int source,
+                      bool& readable,
+                      bool& source_eof,
+                      ByteBuffer& buffer,
+                      int sink,
+                      bool& writable,
+                      bool& sink_shut,
+                      uint64_t& relayed) {
+        bool progress = false;
+        const size_t limit = buffer_limit(s);
+        if (readable && !source_eof && buffer.size() < limit) {
+            const size_t want = limit - buffer.size();
+            const ssize_t received = recv(source, buffer.prepare(want), want, 0);
+            if (received > 0) {
+                buffer.commit(static_cast<size_t>(received));
+                relayed += static_cast<uint64_t>(received);
+                progress = true;
+            } else if (received == 0) {
+                source_eof = true;
+                progress = true;
+            } else if (would_block(errno)) {
+                readable = false;
+            } else if (errno != EINTR) {
+                close_session(s);
+                return true;
+            }
+        }
+        if (!buffer.empty() && writable) {
+            const ssize_t sent = send(sink, buffer.data(), buffer.size(), MSG_NOSIGNAL);
+            if (sent > 0) {
+                buffer.consume(static_cast<size_t>(sent));
+                buffer.trim();
+                progress = true;
+            } else if (sent < 0 && would_block(errno)) {
+                writable = false;
+            } else if (sent < 0 && errno != EINTR) {
+                close_session(s);
+                return true;
+            }
+        }
+        if (source_eof && buffer.empty() && !sink_shut) {
+            shutdown(sink, SHUT_WR);
+            sink_shut = true;
+            progress = true;
+        }
+        return progress;
+    }
+
+    void complete_exchange(Session& s) {
+        const bool reusable = s.upstream_keep_alive && s.request_body.done() &&
+                              s.response_body.mode() != BodyFramer::Mode::UntilClose;
+        release_upstream(s, reusable);
+        if (s.cache_fill) {
+            s.route->cache->store(s.cache_key, std::move(s.cache_fill));
+        }
+        record_exchange(s);
+
+        const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            Clock::now() - s.started_at).count();
+        if (const auto outcome = request_notification(*s.route, s.status, s.started_at)) {
+            notify(icon_for_status(s.status),
+                   build_request_title(s.method, elapsed_ms),
+                   "",
+                   s.path,
+                   s.route->route.name,
+                   *outcome);
+        }
+        finish_exchange(s);
+    }
+
+    // Upstream connect, write or read failed before the response could be relayed.
+    void fail_upstream(Session& s) {
+        const bool retry = s.upstream_reused && !s.retried && !s.response_started && !s.replay.empty();
+        release_upstream(s, false);
+
+        if (retry) {
+            // The upstream may close an idle keep-alive socket between our probe and the write.
+            s.retried = true;
+            s.upstream_in.clear();
+            s.upstream_out.clear();
+            s.upstream_out.append(s.replay);
+            s.replay.clear();
+            s.connect_attempt = 0;
+            if (connect_upstream(s)) {
+                return;
+            }
+        }
+
+        report_upstream(s, false);
+        if (s.response_started) {
+            close_session(s);
+            return;
+        }
+        if (const auto outcome = request_notification(*s.route, 502, s.started_at)) {
+            notify(NotificationIcon::Error,
+                   "Proxy error",
+                   "Failed to connect to " + s.target->url(),
+                   "upstream",
+                   s.route->route.name,
+                   *outcome);
+        }
+        respond_locally(s, 502, "Failed to reach upstream target");
+    }
+
+    void release_upstream(Session& s, bool reusable) {
+        drop_race(s);
+        if (s.upstream_fd < 0) {
+            s.upstream_connecting = false;
+            return;
+        }
+        const size_t max_idle = s.slot != nullptr ? s.slot->pool->options().max_idle : 0;
+        if (reusable && max_idle > 0 && !s.upstream_connecting) {
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, s.upstream_fd, nullptr);
+            auto& idle = s.slot->idle;
+            idle.push_back(IdleUpstream{s.upstream_fd, now_});
+            if (idle.size() > max_idle) {
+                close(idle.front().fd);
+                idle.erase(idle.begin());
+            }
+        } else {
+            close(s.upstream_fd);
+        }
+        s.upstream_fd = -1;
+        s.upstream_connecting = false;
+        s.upstream_readable = false;
+        s.upstream_writable = false;
+    }
+
+    // Takes a slot under the route's concurrency limit unless s already holds one. False when
+    // the request waits in the route's queue, or was answered with 503 because it is full.
+    bool acquire_concurrency(Session& s, size_t head_bytes) {
+        const std::shared_ptr<ConcurrencyLimiter>& limiter = s.route->limiter;
+        if (!limiter || s.permit) {
+            return true;
+        }
+        uint64_t ticket = 0;
+        switch (limiter->acquire([this, id = s.id, limiter] { post_grant(id, limiter); }, ticket)) {
+        case ConcurrencyLimiter::Admission::Admitted:
+            s.permit = ConcurrencyPermit(limiter, Clock::now());
+            return true;
+        case ConcurrencyLimiter::Admission::Queued:
+            s.queued_ticket = ticket;
+            s.queued_head_bytes = head_bytes;
+            return false;
+        case ConcurrencyLimiter::Admission::Refused:
+            break;
+        }
+        refuse_concurrency(s, head_bytes);
+        return false;
+    }
+
+    void refuse_concurrency(Session& s, size_t head_bytes) {
+        const auto retry_after = s.route->limiter->retry_after().count();
+        s.client_in.consume(head_bytes);
+        respond_locally(
+            s, 503, "Route over its concurrency limit", "Retry-After: " + std::to_string(retry_after) + "\r\n");
+    }
+
+    // Runs on whichever thread freed the slot; the session is resumed on this loop.
+    void post_grant(uint64_t session_id, std::shared_ptr<ConcurrencyLimiter> limiter) {
+        {
+            std::lock_guard lock(grants_mutex_);
+            if (!grants_closed_) {
+                grants_.emplace_back(session_id, std::move(limiter));
+                wake();
+                return;
+            }
+        }
+        limiter->release();
+    }
+
+    // Parses each granted request again, now holding its slot. A slot granted to a session
+    // that has gone away is handed back.
+    void resume_granted() {
+        std::vector<std::pair<uint64_t, std::shared_ptr<ConcurrencyLimiter>>> grants;
+        {
+            std::lock_guard lock(grants_mutex_);
+            grants.swap(grants_);
+        }
+        for (auto& [id, limiter] : grants) {
+            const auto it = sessions_.find(id);
+            if (it == sessions_.end() || it->second->queued_ticket == 0) {
+                limiter->release();
+                continue;
+            }
+            Session& s = *it->second;
+            s.queued_ticket = 0;
+            s.permit = ConcurrencyPermit(std::move(limiter), Clock::now());
+            s.capture.reset();
+            s.table.reset();
+            s.route = nullptr;
+            s.phase = Phase::RequestHead;
+            s.parse_pending = true;
+            drive(s);
+        }
+    }
+
+    // Asks the route's circuit breaker whether the request may go upstream, and answers it
+    // with 503 when the circuit is open; head_bytes of client_in are the request head still unconsumed.
+    bool admit_upstream(Session& s, size_t head_bytes) {
+        s.breaker_pending = false;
+        CircuitBreaker* breaker = s.route->breaker.get();
+        if (breaker == nullptr) {
+            return true;
+        }
+        const BreakerAdmission admission = breaker->admit(Clock::now());
+        if (admission.transition) {
+            notify_breaker(s, *admission.transition);
+        }
+        if (!admission.allowed) {
+            const auto retry_after = std::chrono::ceil<std::chrono::seconds>(admission.retry_after).count();
+            s.client_in.consume(head_bytes);
+            respond_locally(s, 503, "Upstream circuit open", "Retry-After: " + std::to_string(retry_after) + "\r\n");
+            return false;
+        }
+        s.breaker_pending = true;
+        s.breaker_probe = admission.probe;
+        return true;
+    }
+
+    // Reports how the upstream answered an admitted request: any response but a gateway
+    // error counts as success.
+    void report_upstream(Session& s, bool success) {
+        s.permit.record(success, Clock::now());
+        if (!s.breaker_pending) {
+            return;
+        }
+        s.breaker_pending = false;
+        if (auto transition = s.route->breaker->record(s.breaker_probe, success, Clock::now())) {
+            notify_breaker(s, *transition);
+        }
+    }
+
+    // Runs the route's notification policy over a finished request. The outcome to attach to
+    // its notification, or nullopt when it is not to be reported; build nothing else before.
+    std::optional<RequestOutcome> request_notification(const CompiledRoute& route,
+                                                       int status,
+                                                       Clock::time_point started_at) {
+        if (notifications_ == nullptr) {
+            return std::nullopt;
+        }
+        const RequestOutcome outcome = request_outcome(route.route, status, started_at);
+        if (!route.notify_policy) {
+            return outcome;
+        }
+        const NotificationVerdict verdict = route.notify_policy->evaluate(status, outcome.elapsed);
+        if (verdict.anomaly) {
+            notifications_->post(anomaly_notification(route.route, *verdict.anomaly));
+        }
+        return verdict.report ? std::optional<RequestOutcome>(outcome) : std::nullopt;
+    }
+
+    void notify_breaker(const Session& s, const BreakerTransition& transition) {
+        if (notifications_ != nullptr) {
+            notifications_->post(breaker_notification(s.route->route, transition));
+        }
+    }
+
+    void respond_locally(Session& s, int status, std::string_view message, std::string_view extra_headers = {}) {
+        if (s.phase == Phase::Exchange) {
+            s.status = status;
+            s.bytes_out = s.method != "HEAD" ? message.size() : 0;
+            if (s.capture) {
+                s.capture->response_body.clear();
+                keep_body_prefix(s.capture->response_body, s.method != "HEAD" ? message : std::string_view{});
+            }
+            record_exchange(s);
+        }
+        write_response(s, status, "text/plain", message, extra_headers);
+    }
+
+    // extra_headers are complete header lines, each ending in CRLF.
+    void write_response(Session& s,
+                        int status,
+                        std::string_view content_type,
+                        std::string_view body,
+                        std::string_view extra_headers = {}) {
+        release_upstream(s, false);
+        if (!s.request_body.done()) {
+            s.client_keep_alive = false;
+        }
+
+        ByteBuffer& out = s.client_out;
+        out.append("HTTP/1.1 ");
+        out.append(std::to_string(status));
+        out.append(" ");
+        out.append(reason_phrase(status));
+        out.append("\r\nContent-Type: ");
+        out.append(content_type);
+        out.append("\r\nContent-Length: ");
+        out.append(std::to_string(body.size()));
+        out.append("\r\n");
+        out.append(extra_headers);
+        append_connection_header(s);
+        out.append("\r\n");
+        if (s.method != "HEAD") {
+            out.append(body);
+        }
+        s.status = status;
+        finish_exchange(s);
+    }
+
+    void append_connection_header(Session& s) {
+        s.keep_alive_announced = true;
+        if (!s.client_keep_alive) {
+            s.client_out.append("Connection: close\r\n");
+        } else if (s.client_http10) {
+            s.client_out.append("Connection: keep-alive\r\n");
+        }
+    }
+
+    // Draws the route's faults for a new request. True when the request is held back for its
+    // delay (its head stays in client_in) or answered by the fault itself.
+    bool inject_fault(Session& s, const RequestHead& head) {
+        const FaultOptions& faults = s.route->faults;
+        if (!s.fault_drawn) {
+            const FaultPlan plan = plan_fault(faults);
+            s.fault_drawn = true;
+            s.fault_action = plan.action;
+            s.throttle.reset(faults.bytes_per_second, now_);
+            if (plan.delay.count() > 0) {
+                s.fault_held = true;
+                s.fault_until = now_ + plan.delay;
+                arm_timer(s, s.fault_until);
+                return true;
+            }
+        }
+        if (s.fault_action == FaultAction::None) {
+            return false;
+        }
+
+        s.client_in.consume(head.head_bytes);
+        const bool reset = s.fault_action == FaultAction::Reset;
+        // A dropped connection counts as a 502 for the route's notification policy.
+        if (const auto outcome = request_notification(*s.route, reset ? 502 : faults.error_status, s.started_at)) {
+            notify(NotificationIcon::Warning,
+                   "Injected fault",
+                   reset ? "Connection reset for " + s.path
+                         : "Answered " + std::to_string(faults.error_status) + " to " + s.path,
+                   "fault",
+                   s.route->route.name,
+                   *outcome);
+        }
+        if (reset) {
+            // A zero linger makes close() send RST rather than FIN.
+            const linger abort{1, 0};
+            setsockopt(s.client_fd, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+            close_session(s);
+        } else {
+            respond_locally(s, faults.error_status, "Injected fault");
+        }
+        return true;
+    }
+
+    // Answers from the route's mock store. Large bodies are left to pump_mock_body.
+    void serve_mock(Session& s, const RequestHead& head) {
+        s.client_in.consume(head.head_bytes);
+        if (!s.request_body.done() && !s.client_in.empty()) {
+            const size_t used = s.request_body.consume(s.client_in.data(), s.client_in.size());
+            s.client_in.consume(used);
+            s.bytes_in += used;
+        }
+        if (!s.request_body.done()) {
+            s.client_keep_alive = false;  // the rest of the body is not worth reading
+        }
+
+        const std::shared_ptr<const MockResponse> mock = s.route->mock->find(s.method, s.path);
+        const std::string_view body = mock->body();
+        s.status = mock->status;
+        ByteRange range{0, body.size()};
+        RangeStatus ranged = RangeStatus::Whole;
+        if (mock->status == 200) {
+            ranged = parse_byte_range(find_header(head.headers, "Range"), body.size(), range);
+            if (ranged == RangeStatus::Partial) {
+                s.status = 206;
+            } else if (ranged == RangeStatus::Unsatisfiable) {
+                s.status = 416;
+                range = ByteRange{0, 0};
+            }
+        }
+        const bool bodyless = s.status == 204 || s.status == 304;
+        const bool with_body = !bodyless && s.method != "HEAD" && range.length > 0;
+
+        ByteBuffer& out = s.client_out;
+        out.append("HTTP/1.1 ");
+        out.append(std::to_string(s.status));
+        out.append(" ");
+        out.append(reason_phrase(s.status));
+        out.append("\r\nContent-Type: ");
+        out.append(mock->content_type);
+        out.append("\r\n");
+        for (const auto& [name, value] : mock->headers) {
+            out.append(name);
+            out.append(": ");
+            out.append(value);
+            out.append("\r\n");
+        }
+        if (mock->status == 200) {
+            out.append("Accept-Ranges: bytes\r\n");
+        }
+        if (ranged == RangeStatus::Partial) {
+            out.append("Content-Range: bytes ");
+            out.append(std::to_string(range.first));
+            out.append("-");
+            out.append(std::to_string(range.first + range.length - 1));
+            out.append("/");
+            out.append(std::to_string(body.size()));
+            out.append("\r\n");
+        } else if (ranged == RangeStatus::Unsatisfiable) {
+            out.append("Content-Range: bytes */");
+            out.append(std::to_string(body.size()));
+            out.append("\r\n");
+        }
+        if (!bodyless) {
+            out.append("Content-Length: ");
+            out.append(std::to_string(range.length));
+            out.append("\r\n");
+        }
+        append_connection_header(s);
+        out.append("\r\n");
+        s.response_started = true;
+        s.bytes_out = with_body ? range.length : 0;
+
+        const std::string_view sent = with_body ? body.substr(range.first, range.length) : std::string_view{};
+        if (s.capture) {
+            keep_body_prefix(s.capture->response_body, sent);
+        }
+        if (mock->file && sent.size() >= kDirectMockMinBody) {
+            s.mock_file = mock->file;
+            s.mock_offset = range.first;
+            s.mock_remaining = range.length;
+            return;
+        }
+        out.append(sent);
+        complete_mock(s);
+    }
+
+    bool pump_mock_body(Session& s) {
+        if (!s.mock_file || !s.client_out.empty() || !s.client_writable || s.throttled) {
+            return false;
+        }
+        const size_t want = static_cast<size_t>(
+            std::min({s.mock_remaining, static_cast<uint64_t>(kDirectMockChunk), throttle_allowance(s)}));
+        if (want == 0) {
+            return false;
+        }
+        const ssize_t sent =
+            send(s.client_fd, s.mock_file->data().data() + s.mock_offset, want, MSG_NOSIGNAL);
+        if (sent > 0) {
+            s.throttle.consume(static_cast<uint64_t>(sent));
+            s.mock_offset += static_cast<uint64_t>(sent);
+            s.mock_remaining -= static_cast<uint64_t>(sent);
+            if (s.mock_remaining == 0) {
+                s.mock_file.reset();
+                complete_mock(s);
+            }
+            return true;
+        }
+        if (sent < 0 && would_block(errno)) {
+            s.client_writable = false;
+            return false;
+        }
+        if (sent < 0 && errno == EINTR) {
+            return true;
+        }
+        // The file shrank under its mapping, or the client went away.
+        close_session(s);
+        return true;
+    }
+
+    void complete_mock(Session& s) {
+        record_exchange(s);
+        const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            Clock::now() - s.started_at).count();
+        if (const auto outcome = request_notification(*s.route, s.status, s.started_at)) {
+            notify(icon_for_status(s.status),
+                   build_request_title(s.method, elapsed_ms),
+                   "",
+                   s.path,
+                   s.route->route.name,
+                   *outcome);
+        }
+        finish_exchange(s);
+    }
+
+    // Answers from a stored response: a 304 when the client already holds it.
+    void serve_from_cache(Session& s, const CachedResponse& entry, CacheResult result) {
+        const bool not_modified = matches_if_none_match(s.cache_request.if_none_match, entry.etag);
+        const bool with_body = !not_modified && s.method != "HEAD";
+        s.status = not_modified ? 304 : entry.status;
+        s.cache_result = result;
+        s.bytes_out = with_body ? entry.body.size() : 0;
+
+        ByteBuffer& out = s.client_out;
+        out.append("HTTP/1.1 ");
+        out.append(std::to_string(s.status));
+        out.append(" ");
+        out.append(not_modified ? reason_phrase(304) : std::string_view(entry.reason));
+        out.append("\r\n");
+        for (const auto& [name, value] : entry.headers) {
+            out.append(name);
+            out.append(": ");
+            out.append(value);
+            out.append("\r\n");
+        }
+        out.append("Age: ");
+        out.append(std::to_string(entry.age(Clock::now()).count()));
+        out.append("\r\n");
+        if (s.status != 204 && s.status != 304) {
+            out.append("Content-Length: ");
+            out.append(std::to_string(entry.body.size()));
+            out.append("\r\n");
+        }
+        append_connection_header(s);
+        out.append("\r\n");
+        if (with_body) {
+            out.append(entry.body);
+        }
+        if (s.capture) {
+            keep_body_prefix(s.capture->response_body, with_body ? std::string_view(entry.body) : std::string_view{});
+        }
+        record_exchange(s);
+
+        const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            Clock::now() - s.started_at).count();
+        if (const auto outcome = request_notification(*s.route, s.status, s.started_at)) {
+            notify(icon_for_status(s.status),
+                   build_request_title(s.method, elapsed_ms),
+                   "",
+                   s.path,
+                   s.route->route.name,
+                   *outcome);
+        }
+        finish_exchange(s);
+    }
+
+    // The upstream confirmed the stale entry with a 304: store it as fresh again and serve it.
+    void serve_revalidated(Session& s, const ResponseHead& head) {
+        auto refreshed = refresh_cache_entry(*s.cache_stale, cache_headers(head.headers), Clock::now());
+        s.route->cache->store(s.cache_key, refreshed);
+        s.upstream_in.consume(head.head_bytes);
+        release_upstream(s, s.upstream_keep_alive && s.upstream_in.empty());
+        serve_from_cache(s, *refreshed, CacheResult::Revalidated);
+    }
+
+    void reset_cache_state(Session& s) {
+        s.cache_result = CacheResult::None;
+        s.cache_request = {};
+        s.cache_key.clear();
+        s.cache_request_headers.clear();
+        s.cache_stale.reset();
+        s.cache_fill.reset();
+    }
+
+    CoalescedFlight* led_flight(const Session& s) {
+        if (!s.coalesce_leader) {
+            return nullptr;
+        }
+        const auto it = flights_.find(s.coalesce_key);
+        return it != flights_.end() ? &it->second : nullptr;
+    }
+
+    // Keeps a copy of the relayed response body for the waiters of the flight s leads.
+    void share_response(const Session& s, std::string_view body) {
+        CoalescedFlight* flight = led_flight(s);
+        if (flight == nullptr || !flight->shareable) {
+            return;
+        }
+        if (flight->body.size() + body.size() > kMaxCoalescedResponse) {
+            // Too large to hold: let the waiters go now rather than after the whole body.
+            flight->shareable = false;
+            std::string().swap(flight->body);
+            reissue_waiters(std::exchange(flight->waiters, {}));
+            return;
+        }
+        flight->body.append(body);
+    }
+
+    // Ends the flight s leads: waiters get its response when it was relayed whole and
+    // kept, otherwise their requests are parsed again and forwarded on their own.
+    void land_flight(Session& s) {
+        auto node = flights_.extract(s.coalesce_key);
+        s.coalesce_key.clear();
+        s.coalesce_leader = false;
+        if (node.empty()) {
+            return;
+        }
+        CoalescedFlight& flight = node.mapped();
+        if (!flight.shareable || !s.response_started || !s.response_body.done()) {
+            reissue_waiters(std::move(flight.waiters));
+            return;
+        }
+        for (const uint64_t id : flight.waiters) {
+            if (Session* waiter = waiting_session(id)) {
+                serve_waiter(*waiter, flight, s);
+                drive(*waiter);
+            }
+        }
+    }
+
+    Session* waiting_session(uint64_t id) {
+        const auto it = sessions_.find(id);
+        if (it == sessions_.end() || stopping_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return it->second.get();
+    }
+
+    // Parses each waiter's request again, to be forwarded on its own.
+    void reissue_waiters(std::vector<uint64_t> waiters) {
+        for (const uint64_t id : waiters) {
+            if (Session* waiter = waiting_session(id)) {
+                reissue_waiter(*waiter);
+                drive(*waiter);
+            }
+        }
+    }
+
+    void serve_waiter(Session& w, const CoalescedFlight& flight, const Session& leader) {
+        w.coalesce_key.clear();
+        w.coalesce_head.clear();
+        w.coalesced = true;
+        w.status = leader.status;
+        w.bytes_out = leader.bytes_out;
+        w.client_out.append(flight.head);
+        append_connection_header(w);
+        w.client_out.append("\r\n");
+        w.client_out.append(flight.body);
+        record_exchange(w);
+
+        const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            Clock::now() - w.started_at).count();
+        if (const auto outcome = request_notification(*w.route, w.status, w.started_at)) {
+            notify(icon_for_status(w.status),
+                   build_request_title(w.method, elapsed_ms),
+                   "",
+                   w.path,
+                   w.route->route.name,
+                   *outcome);
+        }
+        finish_exchange(w);
+    }
+
+    void reissue_waiter(Session& w) {
+        ByteBuffer pending;
+        pending.append(w.coalesce_head);
+        pending.append(w.client_in.view());
+        w.client_in = std::move(pending);
+        w.coalesce_key.clear();
+        w.coalesce_head.clear();
+        w.coalesce_bypass = true;
+        w.capture.reset();
+        w.table.reset();
+        w.route = nullptr;
+        w.phase = Phase::RequestHead;
+        w.parse_pending = true;
+    }
+
+    void finish_exchange(Session& s) {
+        if (s.coalesce_leader) {
+            land_flight(s);
+        }
+        s.permit.release();
+        if (s.slot != nullptr) {
+            --s.slot->active;
+            s.slot = nullptr;
+        }
+        if (s.target != nullptr) {
+            s.target->end_request();
+            s.target = nullptr;
+        }
+        s.cache_stale.reset();
+        s.cache_fill.reset();
+        s.cache_request_headers.clear();
+        end_splice(s);
+        s.mock_file.reset();
+        s.fault_drawn = false;
+        s.fault_action = FaultAction::None;
+        s.table.reset();
+        s.route = nullptr;
+        s.capture.reset();
+        s.replay.clear();
+        s.upstream_in.clear();
+        s.upstream_in.trim();
+        s.upstream_out.clear();
+        s.upstream_out.trim();
+        s.client_in.trim();
+        if (!s.request_body.done()) {
+            s.client_keep_alive = false;
+        }
+        s.request_body.reset(BodyFramer::Mode::None);
+        s.response_body.reset(BodyFramer::Mode::None);
+
+        if (s.client_keep_alive && !s.client_eof) {
+            s.phase = Phase::RequestHead;
+            s.parse_pending = !s.client_in.empty();
+        } else {
+            s.phase = Phase::Closing;
+        }
+    }
+
+    void close_session(Session& s) {
+        if (s.closed) {
+            return;
+        }
+        s.closed = true;
+        if (s.phase == Phase::Tunnel) {
+            close_tunnel(s);
+        }
+        if (s.coalesce_leader) {
+            land_flight(s);
+        }
+        if (s.queued_ticket != 0) {
+            // When the cancel loses to a grant, resume_granted hands the slot back.
+            s.route->limiter->cancel(s.queued_ticket);
+        }
+        s.permit.release();
+        end_splice(s);
+        s.mock_file.reset();
+        drop_race(s);
+        if (s.upstream_fd >= 0) {
+            close(s.upstream_fd);
+            s.upstream_fd = -1;
+        }
+        if (s.slot != nullptr) {
+            --s.slot->active;
+            s.slot = nullptr;
+        }
+        if (s.target != nullptr) {
+            s.target->end_request();
+            s.target = nullptr;
+        }
+        if (s.client_fd >= 0) {
+            close(s.client_fd);
+            s.client_fd = -1;
+        }
+        // Events later in this batch may still point at the session; free it after the batch.
+        const auto it = sessions_.find(s.id);
+        if (it != sessions_.end()) {
+            graveyard_.push_back(std::move(it->second));
+            sessions_.erase(it);
+        }
+    }
+
+    // One notification and one metrics sample per tunnel, when it closes.
+    void close_tunnel(Session& s) {
+        record_exchange(s);
+        const auto open_for = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - s.tunnel_opened_at);
+        notify(NotificationIcon::Info,
+               "Tunnel closed",
+               build_tunnel_summary(s.path, s.bytes_in, s.bytes_out, open_for),
+               "tunnel",
+               s.route->route.name);
+    }
+
+    std::chrono::milliseconds idle_timeout() const {
+        if (draining_.load(std::memory_order_relaxed)) {
+            return std::min<std::chrono::milliseconds>(options_.keep_alive_timeout, kDrainIdleTimeout);
+        }
+        return options_.keep_alive_timeout;
+    }
+
+    void arm_timer(Session& s, Clock::time_point deadline) {
+        s.deadline = deadline;
+        if (!s.timer_armed || deadline < s.timer_at) {
+            timers_.push(TimerEntry{deadline, s.id});
+            s.timer_at = deadline;
+            s.timer_armed = true;
+        }
+    }
+
+    // Deadlines move on every bit of progress without touching the heap; an entry that
+    // comes due early is pushed again at the session's current deadline.
+    void expire_timers() {
+        while (!timers_.empty() && timers_.top().when <= now_) {
+            const TimerEntry entry = timers_.top();
+            timers_.pop();
+            const auto it = sessions_.find(entry.session_id);
+            if (it == sessions_.end()) {
+                continue;
+            }
+            Session& s = *it->second;
+            if (!s.timer_armed || entry.when != s.timer_at) {
+                continue;
+            }
+            if (s.deadline > now_) {
+                timers_.push(TimerEntry{s.deadline, s.id});
+                s.timer_at = s.deadline;
+                continue;
+            }
+            s.timer_armed = false;
+            on_timeout(s);
+        }
+    }
+
+    void on_timeout(Session& s) {
+        if (s.fault_held) {
+            // Parsed again, the request goes ahead with its fault already drawn.
+            s.fault_held = false;
+            s.capture.reset();
+            s.table.reset();
+            s.route = nullptr;
+            s.phase = Phase::RequestHead;
+            s.parse_pending = true;
+            drive(s);
+            return;
+        }
+        if (s.throttled) {
+            s.throttled = false;
+            drive(s);
+            if (!s.closed && !s.timer_armed) {
+                arm_timer(s, now_ + (s.phase == Phase::RequestHead ? idle_timeout() : io_timeout(s)));
+            }
+            return;
+        }
+        if (s.queued_ticket != 0) {
+            if (!s.route->limiter->cancel(s.queued_ticket)) {
+                // Granted as the wait ran out; resume_granted picks it up.
+                arm_timer(s, now_ + io_timeout(s));
+                return;
+            }
+            s.queued_ticket = 0;
+            refuse_concurrency(s, s.queued_head_bytes);
+            drive(s);
+            if (!s.closed) {
+                arm_timer(s, now_ + io_timeout(s));
+            }
+            return;
+        }
+        if (s.phase == Phase::Exchange && !s.coalesce_key.empty() && !s.coalesce_leader) {
+            // Waiting on a coalesced flight: the leader's own timeouts bound the wait.
+            arm_timer(s, now_ + io_timeout(s));
+            return;
+        }
+        if (s.phase == Phase::Exchange && !s.response_started) {
+            if (s.upstream_connecting) {
+                s.slot->pool->resolver().failed();
+                fail_upstream(s);
+            } else {
+                report_upstream(s, false);
+                if (const auto outcome = request_notification(*s.route, 504, s.started_at)) {
+                    notify(NotificationIcon::Error,
+                           "Proxy error",
+                           "Timed out waiting for " + s.target->url(),
+                           "upstream",
+                           s.route->route.name,
+                           *outcome);
+                }
+                respond_locally(s, 504, "Upstream timed out");
+            }
+            drive(s);
+            if (!s.closed) {
+                arm_timer(s, now_ + io_timeout(s));
+            }
+            return;
+        }
+        close_session(s);
+    }
+
+    void sweep_idle_upstreams() {
+        for (auto it = slots_.begin(); it != slots_.end();) {
+            UpstreamSlot& slot = it->second;
+            const auto idle_timeout = slot.pool->options().idle_timeout;
+            size_t expired = 0;
+            while (expired < slot.idle.size() && now_ - slot.idle[expired].since > idle_timeout) {
+                close(slot.idle[expired].fd);
+                ++expired;
+            }
+            slot.idle.erase(slot.idle.begin(), slot.idle.begin() + static_cast<std::ptrdiff_t>(expired));
+
+            // A reload dropped this upstream: let go of it once no session uses it.
+            if (slot.active == 0 && slot.pool->retired()) {
+                for (const auto& idle : slot.idle) {
+                    close(idle.fd);
+                }
+                it = slots_.erase(it);
+                continue;
+            }
+            ++it;
+        }
+    }
+
+    void record_exchange(Session& s) {
+        // A tunnel's duration is its handshake; how long it stayed open goes in its notification.
+        const Clock::time_point ended_at = s.phase == Phase::Tunnel ? s.tunnel_opened_at : Clock::now();
+        if (s.capture) {
+            CapturedExchange& exchange = *s.capture;
+            exchange.started_at = capture_wall_clock(s.started_at);
+            exchange.duration = std::chrono::duration_cast<std::chrono::microseconds>(ended_at - s.started_at);
+            exchange.status = s.status;
+            if (s.route != nullptr) {
+                exchange.route = s.route->route.name;
+            }
+            exchange.request_body_bytes = s.bytes_in;
+            exchange.response_body_bytes = s.bytes_out;
+            capture_->record(std::move(exchange));
+            s.capture.reset();
+        }
+        if (metrics_ == nullptr) {
+            return;
+        }
+        RequestSample sample;
+        sample.route = s.route != nullptr ? std::string_view(s.route->route.name) : std::string_view{};
+        sample.path = s.path;
+        sample.status = s.status;
+        sample.bytes_in = s.bytes_in;
+        sample.bytes_out = s.bytes_out;
+        sample.total = std::chrono::duration_cast<std::chrono::microseconds>(ended_at - s.started_at);
+        sample.connect = s.connect_time;
+        sample.resolver_hit = s.resolution.hit;
+        sample.ttfb = s.ttfb;
+        sample.coalesced = s.coalesced;
+        sample.tunnel = s.phase == Phase::Tunnel;
+        sample.cache = s.cache_result;
+        metrics_->record(sample);
+    }
+
+    void keep_body_prefix(std::string& kept, std::string_view data) const {
+        const size_t limit = capture_->body_limit();
+        if (kept.size() < limit) {
+            kept.append(data.substr(0, limit - kept.size()));
+        }
+    }
+
+    void notify(NotificationIcon icon,
+                std::string title,
+                std::string body,
+                std::string code,
+                std::string project,
+                std::optional<RequestOutcome> request = std::nullopt) {
+        if (notifications_ == nullptr) {
+            return;
+        }
+        notifications_->post(ProxyNotification{
+            icon, std::move(title), std::move(body), std::move(code), std::move(project), request});
+    }
+
+    const EpollEngineOptions options_;
+    RouteTablePublisher& routes_;
+    NotificationDispatcher* notifications_;
+    ProxyMetrics* metrics_;
+    TrafficCapture* capture_;
+    const int listen_fd_;
+    const size_t listener_;  // index of listen_fd_ among the engine's listening sockets
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    bool listener_paused_ = false;
+    std::thread thread_;
+    std::atomic<bool> stopping_ = false;
+    std::atomic<bool> draining_ = false;
+    std::atomic<bool> drain_started_ = false;  // the listener is unwatched; only the loop thread sets it
+    std::atomic<size_t> session_count_ = 0;
+    Handle listener_handle_{HandleKind::Listener};
+    Handle wake_handle_{HandleKind::Wakeup};
+
+    Clock::time_point now_;
+    uint64_t next_session_id_ = 1;
+    std::unordered_map<uint64_t, std::unique_ptr<Session>> sessions_;
+    std::vector<std::unique_ptr<Session>> graveyard_;
+    std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<>> timers_;
+    std::unordered_map<const UpstreamPool*, UpstreamSlot> slots_;
+    std::unordered_map<std::string, CoalescedFlight> flights_;
+    std::vector<SplicePipe> spare_pipes_;
+
+    // Concurrency slots granted to queued sessions by other threads, or by this one.
+    std::mutex grants_mutex_;
+    std::vector<std::pair<uint64_t, std::shared_ptr<ConcurrencyLimiter>>> grants_;
+    bool grants_closed_ = false;  // the loop has stopped; grants go straight back
+
+    // Parse scratch reused across requests so steady state does not allocate for headers.
+    RequestHead request_head_;
+    ResponseHead response_head_;
+};
+
+EpollEngine::EpollEngine(EpollEngineOptions options,
+                         RouteTablePublisher& routes,
+                         NotificationDispatcher* notifications,
+                         ProxyMetrics* metrics,
+                         TrafficCapture* capture)
+    : options_(options), routes_(routes), notifications_(notifications), metrics_(metrics), capture_(capture) {}
+
+EpollEngine::~EpollEngine() {
+    stop();
+}
+
+bool EpollEngine::start(const std::string& host, int port) {
+    listen_fds_ = open_listen_sockets(host, port, std::max<size_t>(options_.listeners, 1));
+    if (listen_fds_.empty()) {
+        return false;
+    }
+    return start_loops();
+}
+
+bool EpollEngine::start_inherited(const std::vector<int>& listen_fds) {
+    // Loops rely on accept4 failing with EAGAIN once a socket is empty.
+    for (const int fd : listen_fds) {
+        const int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+            return false;
+        }
+    }
+    listen_fds_ = listen_fds;
+    return !listen_fds_.empty() && start_loops();
+}
+
+bool EpollEngine::start_loops() {
+    port_ = bound_port(listen_fds_.front());
+
+    size_t workers = options_.workers;
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // Every socket needs a loop accepting on it; loops beyond that share sockets.
+    workers = std::max(workers, listen_fds_.size());
+    for (size_t i = 0; i < workers; ++i) {
+        const size_t listener = i % listen_fds_.size();
+        auto loop = std::make_unique<Loop>(
+            options_, routes_, notifications_, metrics_, capture_, listen_fds_[listener], listener);
+        if (!loop->open()) {
+            stop();
+            return false;
+        }
+        loops_.push_back(std::move(loop));
+    }
+    for (auto& loop : loops_) {
+        loop->start();
+    }
+    return true;
+}
+
+size_t EpollEngine::drain(std::chrono::milliseconds timeout) {
+    for (auto& loop : loops_) {
+        loop->drain();
+    }
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+        size_t open = 0;
+        bool settled = true;
+        for (const auto& loop : loops_) {
+            const std::optional<size_t> sessions = loop->session_count();
+            settled = settled && sessions.has_value();
+            open += sessions.value_or(0);
+        }
+        if ((settled && open == 0) || std::chrono::steady_clock::now() >= deadline) {
+            return open;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+void EpollEngine::stop() {
+    for (auto& loop : loops_) {
+        loop->stop();
+    }
+    loops_.clear();
+    close_listen_sockets(listen_fds_);
+}
+
+}  // namespace notiman
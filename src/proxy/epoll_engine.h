@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "proxy_engine.h"
+#include "traffic_capture.h"
+
+namespace notiman {
+
+struct EpollEngineOptions {
+    // Event loops, each on its own thread with its own epoll set. 0 = one per core.
+    size_t workers = 0;
+    // Listening sockets in one SO_REUSEPORT group. Loop i accepts on socket i % listeners,
+    // and there are at least as many loops as sockets.
+    size_t listeners = 1;
+    // Idle downstream keep-alive connections are closed after this long.
+    std::chrono::milliseconds keep_alive_timeout{60000};
+    // Move large Content-Length bodies socket to socket with splice() instead of through
+    // user-space buffers, whenever the proxy does not need to see the bytes.
+    bool splice_bodies = true;
+};
+
+// Linux engine: non-blocking sockets on edge-triggered epoll, one event loop per core.
+// Every loop accepts from its listening socket and owns its connections, so an idle
+// keep-alive client costs a few hundred bytes instead of a thread.
+class EpollEngine : public ProxyEngine {
+public:
+    EpollEngine(EpollEngineOptions options,
+                RouteTablePublisher& routes,
+                NotificationDispatcher* notifications,
+                ProxyMetrics* metrics,
+                TrafficCapture* capture);
+    ~EpollEngine() override;
+
+    bool start(const std::string& host, int port) override;
+    bool start_inherited(const std::vector<int>& listen_fds) override;
+    std::vector<int> listen_sockets() const override { return listen_fds_; }
+    size_t drain(std::chrono::milliseconds timeout) override;
+    void stop() override;
+    int port() const override { return port_; }
+    const char* name() const override { return "epoll"; }
+
+private:
+    class Loop;
+
+    bool start_loops();
+
+    EpollEngineOptions options_;
+    RouteTablePublisher& routes_;
+    NotificationDispatcher* notifications_;
+    ProxyMetrics* metrics_;
+    TrafficCapture* capture_;
+    std::vector<int> listen_fds_;
+    int port_ = 0;
+    std::vector<std::unique_ptr<Loop>> loops_;
+};
+
+}  // namespace notiman
@@ -0,0 +1,73 @@
+#include "fault_injector.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <random>
+#include <thread>
+
+namespace notiman {
+
+namespace {
+
+// Per-thread generator: drawing faults never shares state between workers.
+uint32_t next_random() {
+    thread_local std::minstd_rand generator(
+        static_cast<std::minstd_rand::result_type>(std::hash<std::thread::id>{}(std::this_thread::get_id())));
+    return static_cast<uint32_t>(generator());
+}
+
+bool roll(uint32_t percent) {
+    return percent > 0 && (percent >= 100 || next_random() % 100 < percent);
+}
+
+}  // namespace
+
+FaultPlan plan_fault(const FaultOptions& options) {
+    FaultPlan plan;
+    if (roll(options.delay_percent)) {
+        plan.delay = options.delay;
+        if (options.jitter.count() > 0) {
+            plan.delay += std::chrono::milliseconds(next_random() % (static_cast<uint32_t>(options.jitter.count()) + 1));
+        }
+    }
+    const uint32_t draw = next_random() % 100;
+    if (draw < options.reset_percent) {
+        plan.action = FaultAction::Reset;
+    } else if (draw < options.reset_percent + options.error_percent) {
+        plan.action = FaultAction::Error;
+    }
+    return plan;
+}
+
+void BandwidthThrottle::reset(uint64_t bytes_per_second, Clock::time_point now) {
+    rate_ = bytes_per_second;
+    credit_ = std::max(1.0, static_cast<double>(rate_) / 10);  // a full burst to start with
+    refilled_at_ = now;
+}
+
+uint64_t BandwidthThrottle::allowance(Clock::time_point now) {
+    if (rate_ == 0) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    const double burst = std::max(1.0, static_cast<double>(rate_) / 10);
+    const double elapsed = std::chrono::duration<double>(now - refilled_at_).count();
+    credit_ = std::min(burst, credit_ + elapsed * static_cast<double>(rate_));
+    refilled_at_ = now;
+    return static_cast<uint64_t>(credit_);
+}
+
+void BandwidthThrottle::consume(uint64_t bytes) {
+    if (rate_ > 0) {
+        credit_ -= static_cast<double>(bytes);
+    }
+}
+
+BandwidthThrottle::Clock::time_point BandwidthThrottle::next_allowance() const {
+    const double burst = std::max(1.0, static_cast<double>(rate_) / 10);
+    const double missing = std::max(0.0, burst - credit_);
+    return refilled_at_ + std::chrono::duration_cast<Clock::duration>(
+                              std::chrono::duration<double>(missing / static_cast<double>(rate_)));
+}
+
+}  // namespace notiman
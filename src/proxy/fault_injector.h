@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace notiman {
+
+// Faults a route injects into its own traffic, for seeing how clients cope with a slow or
+// flaky upstream without touching it. Percentages are of the route's requests.
+struct FaultOptions {
+    std::chrono::milliseconds delay{0};   // added before the request is handled
+    std::chrono::milliseconds jitter{0};  // up to this much more, uniformly
+    uint32_t delay_percent = 100;         // requests delayed
+    uint32_t error_percent = 0;           // requests answered with error_status instead
+    int error_status = 503;
+    uint32_t reset_percent = 0;           // requests whose connection is dropped instead
+    uint64_t bytes_per_second = 0;        // response bandwidth per connection, 0 = unlimited
+
+    bool active() const {
+        return delay.count() > 0 || jitter.count() > 0 || error_percent > 0 || reset_percent > 0 ||
+               bytes_per_second > 0;
+    }
+
+    bool operator==(const FaultOptions&) const = default;
+};
+
+enum class FaultAction : uint8_t {
+    None,   // handle the request as usual, after the delay
+    Error,  // answer error_status
+    Reset   // drop the connection without an answer
+};
+
+// What happens to one request, drawn once when it arrives.
+struct FaultPlan {
+    std::chrono::milliseconds delay{0};
+    FaultAction action = FaultAction::None;
+};
+
+FaultPlan plan_fault(const FaultOptions& options);
+
+// Paces a response to bytes_per_second: how much may be sent now, and when more may.
+// Credit builds up to a tenth of a second's worth, so a throttled connection is woken
+// about ten times a second rather than for every few bytes.
+class BandwidthThrottle {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void reset(uint64_t bytes_per_second, Clock::time_point now);
+    bool active() const { return rate_ > 0; }
+
+    // Bytes that may go out now; unlimited when inactive.
+    uint64_t allowance(Clock::time_point now);
+    void consume(uint64_t bytes);
+    // When the credit is full again.
+    Clock::time_point next_allowance() const;
+
+private:
+    uint64_t rate_ = 0;
+    double credit_ = 0;
+    Clock::time_point refilled_at_;
+};
+
+}  // namespace notiman
@@ -0,0 +1,189 @@
+#include "forwarding.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdio>
+
+#include "http_wire.h"
+
+namespace notiman {
+
+namespace {
+
+char lower_ascii(char c) {
+    return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+
+std::string format_byte_count(uint64_t bytes) {
+    static constexpr std::array<const char*, 4> units = {"B", "KB", "MB", "GB"};
+    double value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024 && unit + 1 < units.size()) {
+        value /= 1024;
+        ++unit;
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+    return text;
+}
+
+std::string format_latency(std::chrono::microseconds latency) {
+    const double ms = static_cast<double>(latency.count()) / 1000;
+    char text[32];
+    std::snprintf(text, sizeof(text), ms < 10 ? "%.1fms" : "%.0fms", ms);
+    return text;
+}
+
+}  // namespace
+
+std::string lowercase(std::string_view input) {
+    std::string result(input);
+    for (char& c : result) {
+        c = lower_ascii(c);
+    }
+    return result;
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (lower_ascii(a[i]) != lower_ascii(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool is_idempotent_method(std::string_view method) {
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" ||
+           method == "PUT" || method == "DELETE";
+}
+
+std::string build_forward_path(std::string_view request_path,
+                               std::string_view request_query,
+                               std::string_view target_base_path) {
+    std::string joined = target_base_path.empty() ? "/" : std::string(target_base_path);
+
+    if (joined.back() == '/' && !request_path.empty() && request_path.front() == '/') {
+        joined.pop_back();
+    } else if (joined.back() != '/' && !request_path.empty() && request_path.front() != '/') {
+        joined.push_back('/');
+    }
+    joined += request_path;
+
+    if (!request_query.empty()) {
+        joined += "?";
+        joined += request_query;
+    }
+    return joined;
+}
+
+std::string extract_query_from_target(std::string_view target) {
+    const size_t qpos = target.find('?');
+    if (qpos == std::string_view::npos || qpos + 1 >= target.size()) {
+        return {};
+    }
+    return std::string(target.substr(qpos + 1));
+}
+
+bool is_excluded_header(std::string_view key) {
+    static constexpr std::array<std::string_view, 5> excluded_headers = {
+        "host", "content-length", "transfer-encoding", "connection", "expect"
+    };
+    for (const auto excluded : excluded_headers) {
+        if (iequals(key, excluded)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_upgrade_request(std::string_view connection, std::string_view upgrade) {
+    return !upgrade.empty() && header_has_token(connection, "upgrade");
+}
+
+NotificationIcon icon_for_status(int status) {
+    if (status >= 500) {
+        return NotificationIcon::Error;
+    }
+    if (status >= 400) {
+        return NotificationIcon::Warning;
+    }
+    return NotificationIcon::Info;
+}
+
+std::string build_request_title(std::string_view method, long long elapsed_ms) {
+    std::string title(method);
+    title += " ";
+    title += std::to_string(elapsed_ms);
+    title += "ms";
+    return title;
+}
+
+std::string build_tunnel_summary(std::string_view target,
+                                 uint64_t bytes_up,
+                                 uint64_t bytes_down,
+                                 std::chrono::seconds open_for) {
+    std::string summary(target);
+    summary += ": ";
+    summary += format_byte_count(bytes_up);
+    summary += " up, ";
+    summary += format_byte_count(bytes_down);
+    summary += " down, open ";
+    const long long seconds = open_for.count();
+    if (seconds >= 60) {
+        summary += std::to_string(seconds / 60);
+        summary += "m ";
+    }
+    summary += std::to_string(seconds % 60);
+    summary += "s";
+    return summary;
+}
+
+ProxyNotification breaker_notification(const ProxyRoute& route, const BreakerTransition& transition) {
+    ProxyNotification notification;
+    switch (transition.state) {
+    case BreakerState::Open:
+        notification.icon = NotificationIcon::Error;
+        notification.title = "Circuit open";
+        break;
+    case BreakerState::HalfOpen:
+        notification.icon = NotificationIcon::Warning;
+        notification.title = "Circuit half-open";
+        break;
+    case BreakerState::Closed:
+        notification.icon = NotificationIcon::Success;
+        notification.title = "Circuit closed";
+        break;
+    }
+    notification.body = transition.reason;
+    notification.code = "circuit-breaker";
+    notification.project = route.name;
+    // Every transition is news, and the circuit can trip again within one window.
+    notification.coalesce = false;
+    return notification;
+}
+
+ProxyNotification anomaly_notification(const ProxyRoute& route, const LatencyAnomaly& anomaly) {
+    ProxyNotification notification;
+    notification.icon = NotificationIcon::Warning;
+    notification.title = "Route slower than usual";
+    notification.body = "Requests take " + format_latency(anomaly.recent) + ", usually " + format_latency(anomaly.usual);
+    notification.code = "latency-anomaly";
+    notification.project = route.name;
+    return notification;
+}
+
+RequestOutcome request_outcome(const ProxyRoute& route, int status, std::chrono::steady_clock::time_point started_at) {
+    RequestOutcome outcome;
+    outcome.status = status;
+    outcome.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started_at);
+    outcome.aggregate_window = std::chrono::milliseconds(std::max(route.notify_window_ms, 0));
+    return outcome;
+}
+
+}  // namespace notiman
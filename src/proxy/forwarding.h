@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "../shared/icon.h"
+#include "circuit_breaker.h"
+#include "notification_dispatcher.h"
+#include "notification_policy.h"
+#include "proxy_config.h"
+
+namespace notiman {
+
+// Request rewriting and reporting rules shared by every proxy engine.
+
+std::string lowercase(std::string_view input);
+
+// ASCII case-insensitive comparison, for header names and tokens.
+bool iequals(std::string_view a, std::string_view b);
+
+bool is_idempotent_method(std::string_view method);
+
+// Joins the route's base path with the request path and appends the query, if any.
+std::string build_forward_path(std::string_view request_path,
+                               std::string_view request_query,
+                               std::string_view target_base_path);
+
+std::string extract_query_from_target(std::string_view target);
+
+// Hop-by-hop and framing headers the proxy sets itself instead of copying.
+bool is_excluded_header(std::string_view key);
+
+// True for an HTTP/1.1 request asking to switch protocols, such as a WebSocket handshake.
+bool is_upgrade_request(std::string_view connection, std::string_view upgrade);
+
+NotificationIcon icon_for_status(int status);
+
+std::string build_request_title(std::string_view method, long long elapsed_ms);
+
+// Body of the notification for a closed tunnel: "/ws: 12.4 KB up, 1.2 MB down, open 3m 12s".
+std::string build_tunnel_summary(std::string_view target,
+                                 uint64_t bytes_up,
+                                 uint64_t bytes_down,
+                                 std::chrono::seconds open_for);
+
+// The one notification a route's circuit breaker sends per state change.
+ProxyNotification breaker_notification(const ProxyRoute& route, const BreakerTransition& transition);
+
+// The one notification a route's notification policy sends when its latency jumps.
+ProxyNotification anomaly_notification(const ProxyRoute& route, const LatencyAnomaly& anomaly);
+
+// Outcome for a request's notification, rolled up with the route's notify_window_ms.
+RequestOutcome request_outcome(const ProxyRoute& route, int status, std::chrono::steady_clock::time_point started_at);
+
+}  // namespace notiman
@@ -0,0 +1,304 @@
+// notiman-proxy without a tray icon or notification host, for Linux.
+// Notifications are written to stderr; SIGHUP or saving proxy.ini reloads routes, and
+// changes under a mock route's directory reload its canned responses.
+// SIGUSR2 starts a new process on the same listening socket and drains this one, so
+// restarts, upgrades included, lose no requests.
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <CLI11/CLI11.hpp>
+
+#include "health_checker.h"
+#include "inotify_watcher.h"
+#include "listener_handoff.h"
+#include "notification_dispatcher.h"
+#include "proxy_config.h"
+#include "proxy_engine.h"
+#include "proxy_metrics.h"
+#include "route_table.h"
+#include "traffic_capture.h"
+#include "upstream_pool.h"
+
+namespace {
+
+constexpr auto kPoolSweepInterval = std::chrono::seconds(5);
+// A successor that does not accept within this long is killed and this process keeps serving.
+constexpr auto kSuccessorReadyTimeout = std::chrono::seconds(10);
+
+notiman::ProxyConfig g_proxy_config;  // owned by the main thread
+notiman::RouteTablePublisher g_routes;
+std::unique_ptr<notiman::NotificationDispatcher> g_notifications;
+std::vector<std::unique_ptr<notiman::InotifyWatcher>> g_mock_watchers;  // owned by the main thread
+
+std::filesystem::path ensure_proxy_config_path() {
+    const std::filesystem::path dir = notiman::ProxyConfig::user_config_dir();
+    if (dir.empty()) {
+        return notiman::ProxyConfig::default_config_path();
+    }
+
+    std::filesystem::path config_path = dir / "proxy.ini";
+    if (std::filesystem::exists(config_path)) {
+        return config_path;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    std::ofstream out(config_path);
+    if (out) {
+        out << "[proxy]\n";
+        out << "host=127.0.0.1\n";
+        out << "port=8080\n\n";
+        out << "[routes]\n";
+        out << "; api = http://localhost:3000\n";
+    }
+    return config_path;
+}
+
+// Runs on the dispatcher thread.
+void log_notification(const notiman::ProxyNotification& notification) {
+    std::string line = "[" + notiman::icon_to_string(notification.icon) + "] ";
+    if (!notification.project.empty()) {
+        line += notification.project + ": ";
+    }
+    line += notification.title;
+    if (!notification.code.empty()) {
+        line += " " + notification.code;
+    }
+    if (!notification.body.empty()) {
+        line += " - " + notification.body;
+    }
+    line += "\n";
+    std::fputs(line.c_str(), stderr);
+}
+
+void notify(notiman::NotificationIcon icon, std::string title, std::string body = {}) {
+    g_notifications->post(notiman::ProxyNotification{icon, std::move(title), std::move(body), {}, {}});
+}
+
+void warn_config(const std::vector<notiman::ConfigWarning>& warnings) {
+    for (const auto& warning : warnings) {
+        notify(notiman::NotificationIcon::Warning, warning.title, warning.body);
+    }
+}
+
+// Runs on a mock watcher's thread.
+void reload_mocks(const std::filesystem::path& directory) {
+    const auto table = g_routes.load();
+    if (!table) {
+        return;
+    }
+    for (const auto& route : table->routes()) {
+        if (route.mock && route.mock->watch_dir() == directory) {
+            route.mock->reload();
+        }
+    }
+    notify(notiman::NotificationIcon::Info, "Mock responses reloaded", directory.string());
+}
+
+// One watcher per directory that mock routes answer from, redone whenever routes change.
+void watch_mocks() {
+    g_mock_watchers.clear();
+    std::vector<std::filesystem::path> directories;
+    for (const auto& route : g_routes.load()->routes()) {
+        if (route.mock && std::find(directories.begin(), directories.end(), route.mock->watch_dir()) == directories.end()) {
+            directories.push_back(route.mock->watch_dir());
+        }
+    }
+    for (const auto& directory : directories) {
+        auto watcher = std::make_unique<notiman::InotifyWatcher>();
+        if (watcher->start_tree(directory, [directory] { reload_mocks(directory); })) {
+            g_mock_watchers.push_back(std::move(watcher));
+        } else {
+            notify(notiman::NotificationIcon::Warning, "Mock directory not watched", directory.string());
+        }
+    }
+}
+
+void reload_config(const std::filesystem::path& config_path) {
+    auto new_config = notiman::ProxyConfig::load_from_file(config_path);
+    // The listener and engine keep their settings until restart; everything else applies live.
+    new_config.host = g_proxy_config.host;
+    new_config.port = g_proxy_config.port;
+    new_config.engine = g_proxy_config.engine;
+    new_config.workers = g_proxy_config.workers;
+    new_config.listeners = g_proxy_config.listeners;
+    new_config.splice = g_proxy_config.splice;
+    new_config.metrics = g_proxy_config.metrics;
+    new_config.capture_path = g_proxy_config.capture_path;
+    new_config.capture_body_bytes = g_proxy_config.capture_body_bytes;
+    new_config.notify_queue_size = g_proxy_config.notify_queue_size;
+    g_proxy_config = std::move(new_config);
+    const auto warnings = g_proxy_config.disable_blocking_options();
+
+    g_routes.publish(notiman::RouteTable::build(g_proxy_config, g_routes.load().get()));
+    g_notifications->set_coalesce_window(std::chrono::milliseconds(g_proxy_config.notify_coalesce_ms));
+    watch_mocks();
+    notify(notiman::NotificationIcon::Info, "Proxy config reloaded", "Routes updated");
+    warn_config(warnings);
+}
+
+// Starts the successor for SIGUSR2. It reads proxy.ini afresh and takes over the listening
+// sockets unless the listen address changed, in which case it binds its own.
+bool hand_over(const std::filesystem::path& exe,
+               const std::vector<std::string>& args,
+               const std::filesystem::path& config_path,
+               const notiman::ProxyEngine& engine) {
+    const auto next_config = notiman::ProxyConfig::load_from_file(config_path);
+    const bool same_address = next_config.host == g_proxy_config.host && next_config.port == g_proxy_config.port;
+    const std::vector<int> listen_fds = same_address ? engine.listen_sockets() : std::vector<int>{};
+    const pid_t successor = notiman::start_successor(exe, args, listen_fds, kSuccessorReadyTimeout);
+    if (successor < 0) {
+        notify(notiman::NotificationIcon::Error,
+               "notiman-proxy restart failed",
+               "The new process did not start accepting; this one keeps serving");
+        return false;
+    }
+    notiman::notify_service_manager("MAINPID=" + std::to_string(successor));
+    notify(notiman::NotificationIcon::Info,
+           "notiman-proxy restarting",
+           "Process " + std::to_string(successor) + " took over; draining this one");
+    return true;
+}
+
+void evict_idle_upstream_connections() {
+    const auto table = g_routes.load();
+    if (!table) {
+        return;
+    }
+    for (const auto& route : table->routes()) {
+        for (const auto& target : route.balancer.targets()) {
+            target->pool()->evict_idle();
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    CLI::App app{"Notiman reverse proxy"};
+    std::string config_arg;
+    app.add_option("-c,--config", config_arg, "Path to proxy.ini (default: ~/.config/notiman/proxy.ini)");
+    CLI11_PARSE(app, argc, argv);
+
+    // Before any thread starts: taking them edits the environment.
+    const notiman::InheritedSockets inherited = notiman::take_inherited_sockets();
+    // A restart execs whatever binary is installed at this path by then.
+    std::error_code exe_error;
+    std::filesystem::path exe = std::filesystem::read_symlink("/proc/self/exe", exe_error);
+    if (exe_error) {
+        exe = argv[0];
+    }
+    const std::vector<std::string> args(argv, argv + argc);
+
+    // Signals are taken synchronously by the main thread; block them before any thread starts.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    const std::filesystem::path config_path = config_arg.empty() ? ensure_proxy_config_path()
+                                                                 : std::filesystem::path(config_arg);
+    g_proxy_config = notiman::ProxyConfig::load_from_file(config_path);
+    const auto warnings = g_proxy_config.disable_blocking_options();
+    g_routes.publish(notiman::RouteTable::build(g_proxy_config, nullptr));
+
+    notiman::NotificationDispatcherOptions dispatcher_options;
+    dispatcher_options.queue_capacity = static_cast<size_t>(g_proxy_config.notify_queue_size);
+    dispatcher_options.coalesce_window = std::chrono::milliseconds(g_proxy_config.notify_coalesce_ms);
+    g_notifications = std::make_unique<notiman::NotificationDispatcher>(dispatcher_options, log_notification);
+    warn_config(warnings);
+
+    std::unique_ptr<notiman::ProxyMetrics> metrics;
+    if (g_proxy_config.metrics) {
+        metrics = std::make_unique<notiman::ProxyMetrics>();
+    }
+    std::unique_ptr<notiman::TrafficCapture> capture;
+    if (!g_proxy_config.capture_path.empty()) {
+        notiman::TrafficCaptureOptions capture_options;
+        capture_options.path = g_proxy_config.capture_path;
+        capture_options.body_limit = static_cast<size_t>(g_proxy_config.capture_body_bytes);
+        capture = std::make_unique<notiman::TrafficCapture>(capture_options);
+        if (!capture->ok()) {
+            notify(notiman::NotificationIcon::Warning,
+                   "notiman-proxy capture disabled",
+                   "Cannot append to " + g_proxy_config.capture_path);
+            capture.reset();
+        }
+    }
+    auto engine = notiman::make_proxy_engine(
+        g_proxy_config, g_routes, g_notifications.get(), metrics.get(), capture.get());
+    const bool started = !inherited.listen_fds.empty() ? engine->start_inherited(inherited.listen_fds)
+                                                       : engine->start(g_proxy_config.host, g_proxy_config.port);
+    if (!started) {
+        notify(
+            notiman::NotificationIcon::Error,
+            "notiman-proxy startup error",
+            !inherited.listen_fds.empty()
+                ? "Cannot serve on the inherited listening sockets"
+                : "Failed to bind " + g_proxy_config.host + ":" + std::to_string(g_proxy_config.port));
+        g_notifications->stop();
+        return 1;
+    }
+    // start() returns once the socket accepts; nothing is lost between here and the predecessor's drain.
+    notiman::report_ready(inherited.ready_fd);
+
+    notify(
+        notiman::NotificationIcon::Info,
+        "notiman-proxy started",
+        "Listening on " + g_proxy_config.host + ":" + std::to_string(engine->port()) +
+            " (" + engine->name() + " engine, config " + config_path.string() + ")");
+
+    notiman::HealthChecker health(g_routes, g_notifications.get());
+
+    // The watcher only raises SIGHUP so every reload happens on this thread.
+    notiman::InotifyWatcher watcher;
+    watcher.start(config_path, [] { kill(getpid(), SIGHUP); });
+    watch_mocks();
+
+    const timespec sweep_interval{std::chrono::duration_cast<std::chrono::seconds>(kPoolSweepInterval).count(), 0};
+    for (;;) {
+        const int signal_number = sigtimedwait(&signals, nullptr, &sweep_interval);
+        if (signal_number == SIGHUP) {
+            reload_config(config_path);
+        } else if (signal_number == SIGUSR2) {
+            if (hand_over(exe, args, config_path, *engine)) {
+                break;
+            }
+        } else if (signal_number == SIGINT || signal_number == SIGTERM) {
+            break;
+        } else {
+            evict_idle_upstream_connections();
+        }
+    }
+
+    watcher.stop();
+    g_mock_watchers.clear();
+    health.stop();
+    const auto drain_timeout = std::chrono::milliseconds(g_proxy_config.drain_timeout_ms);
+    if (const size_t busy = engine->drain(drain_timeout); busy > 0) {
+        notify(notiman::NotificationIcon::Warning,
+               "notiman-proxy stopped draining",
+               std::to_string(busy) + " connections still busy after " + std::to_string(drain_timeout.count()) +
+                   " ms are closed");
+    }
+    engine->stop();
+    if (capture) {
+        capture->stop();
+    }
+    g_routes.publish(nullptr);
+    g_notifications->stop();
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "health_checker.h"
+
+#include <algorithm>
+
+#include <httplib/httplib.h>
+
+namespace notiman {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Picks up routes added by a reload even while every existing target is idle.
+constexpr auto kMaxWait = std::chrono::seconds(1);
+
+bool probe(const UpstreamTarget& target, const ProxyRoute& route) {
+    const TargetEndpoint& endpoint = target.endpoint();
+    httplib::Client client(endpoint.socket_path.empty() ? endpoint.host : endpoint.socket_path, endpoint.port);
+    httplib::Headers headers;
+    if (!endpoint.socket_path.empty()) {
+        // httplib takes the socket path for the host, and would send it as the Host header.
+        client.set_address_family(AF_UNIX);
+        headers.emplace("Host", endpoint.host);
+    }
+    const auto timeout = std::chrono::milliseconds(route.health_timeout_ms);
+    client.set_connection_timeout(timeout);
+    client.set_read_timeout(timeout);
+    client.set_write_timeout(timeout);
+    client.set_keep_alive(false);
+    const auto result = client.Get(route.health_path, headers);
+    return result && result->status >= 200 && result->status < 400;
+}
+
+}  // namespace
+
+HealthChecker::HealthChecker(RouteTablePublisher& routes, NotificationDispatcher* notifications)
+    : routes_(routes), notifications_(notifications) {
+    thread_ = std::thread([this] { run(); });
+}
+
+HealthChecker::~HealthChecker() {
+    stop();
+}
+
+void HealthChecker::stop() {
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void HealthChecker::run() {
+    std::unique_lock lock(mutex_);
+    while (!stopping_) {
+        lock.unlock();
+        const auto next = probe_due_targets();
+        lock.lock();
+        wake_.wait_until(lock, std::min(next, Clock::now() + kMaxWait), [this] { return stopping_; });
+    }
+}
+
+Clock::time_point HealthChecker::probe_due_targets() {
+    const auto table = routes_.load();
+    auto next = Clock::now() + kMaxWait;
+    if (!table) {
+        return next;
+    }
+
+    for (const auto& compiled : table->routes()) {
+        const ProxyRoute& route = compiled.route;
+        if (route.health_path.empty()) {
+            continue;
+        }
+        for (const auto& target : compiled.balancer.targets()) {
+            UpstreamTarget::ProbeState& state = target->probe_state();
+            if (Clock::now() < state.next_probe) {
+                next = std::min(next, state.next_probe);
+                continue;
+            }
+
+            const bool passed = probe(*target, route);
+            state.next_probe = Clock::now() + std::chrono::milliseconds(route.health_interval_ms);
+            next = std::min(next, state.next_probe);
+            if (!target->record_probe(passed, route.health_fall, route.health_rise) || notifications_ == nullptr) {
+                continue;
+            }
+            if (target->healthy()) {
+                notifications_->post(ProxyNotification{
+                    NotificationIcon::Info, "Target reinstated", target->url() + " passed its health checks",
+                    "health", route.name});
+            } else {
+                notifications_->post(ProxyNotification{
+                    NotificationIcon::Warning, "Target ejected", target->url() + " failed its health checks",
+                    "health", route.name});
+            }
+        }
+
+        std::lock_guard lock(mutex_);
+        if (stopping_) {
+            break;
+        }
+    }
+    return next;
+}
+
+}  // namespace notiman
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "notification_dispatcher.h"
+#include "route_table.h"
+
+namespace notiman {
+
+// Probes the targets of every route with a health_path on one background thread.
+// Each target is probed every health_interval_ms with a GET; a 2xx or 3xx answer
+// within health_timeout_ms passes. Ejection and reinstatement flip an atomic flag
+// on the target that the balancer reads, and are reported as notifications.
+class HealthChecker {
+public:
+    // notifications may be null to run silently.
+    HealthChecker(RouteTablePublisher& routes, NotificationDispatcher* notifications);
+    ~HealthChecker();
+
+    HealthChecker(const HealthChecker&) = delete;
+    HealthChecker& operator=(const HealthChecker&) = delete;
+
+    void stop();
+
+private:
+    void run();
+    // Probes every due target; returns when the next one falls due.
+    std::chrono::steady_clock::time_point probe_due_targets();
+
+    RouteTablePublisher& routes_;
+    NotificationDispatcher* notifications_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+}  // namespace notiman
@@ -0,0 +1,49 @@
+#include "hedge_policy.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace notiman {
+
+HedgePolicy::HedgePolicy(HedgeOptions options) : options_(options) {}
+
+std::optional<std::chrono::microseconds> HedgePolicy::plan() {
+    {
+        std::lock_guard lock(mutex_);
+        credit_ = std::min(credit_ + options_.budget_percent / 100.0, kMaxCredit);
+    }
+    const int64_t delay_us = delay_us_.load(std::memory_order_relaxed);
+    if (delay_us == 0) {
+        return std::nullopt;
+    }
+    return std::chrono::microseconds(delay_us);
+}
+
+bool HedgePolicy::spend() {
+    std::lock_guard lock(mutex_);
+    if (credit_ < 1.0) {
+        return false;
+    }
+    credit_ -= 1.0;
+    return true;
+}
+
+void HedgePolicy::record(std::chrono::microseconds waited) {
+    std::vector<int64_t> window;
+    {
+        std::lock_guard lock(mutex_);
+        samples_[recorded_ % kWindow] = std::max<int64_t>(waited.count(), 0);
+        ++recorded_;
+        if (recorded_ < kWarmup || (recorded_ - kWarmup) % kRefresh != 0) {
+            return;
+        }
+        window.assign(samples_.begin(), samples_.begin() + std::min<size_t>(recorded_, kWindow));
+    }
+
+    const auto p95 = window.begin() + static_cast<std::ptrdiff_t>(window.size() * 95 / 100);
+    std::nth_element(window.begin(), p95, window.end());
+    const int64_t min_delay_us = std::chrono::duration_cast<std::chrono::microseconds>(options_.min_delay).count();
+    delay_us_.store(std::max<int64_t>({*p95, min_delay_us, 1}), std::memory_order_relaxed);
+}
+
+}  // namespace notiman
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace notiman {
+
+struct HedgeOptions {
+    std::chrono::milliseconds min_delay{10};  // never hedge sooner than this, however fast the route
+    uint32_t budget_percent = 10;             // hedges at most this share of requests
+
+    bool operator==(const HedgeOptions&) const = default;
+};
+
+// Per-route hedging: when an idempotent request has gone without a response head for
+// longer than the route usually takes, a second attempt is sent and the first answer wins.
+// The delay is the 95th percentile of the time to response head over the route's last
+// kWindow first attempts, recomputed every kRefresh of them. A budget bounds the extra
+// load: each request earns budget_percent of a hedge, and a hedge spends a whole one, so
+// a stalled upstream gets at most that share of its requests doubled.
+class HedgePolicy {
+public:
+    static constexpr size_t kWindow = 200;
+    static constexpr uint32_t kRefresh = 16;
+    // First attempts seen before the percentile is trusted; no request is hedged until then.
+    static constexpr uint32_t kWarmup = 20;
+    // Unspent budget kept, in hedges, so a quiet period does not bank a burst of them.
+    static constexpr double kMaxCredit = 10.0;
+
+    explicit HedgePolicy(HedgeOptions options);
+
+    HedgePolicy(const HedgePolicy&) = delete;
+    HedgePolicy& operator=(const HedgePolicy&) = delete;
+
+    const HedgeOptions& options() const { return options_; }
+
+    // Counts a request toward the budget. How long its first attempt may wait for a response
+    // head before it is hedged, or nullopt while the route is still warming up.
+    std::optional<std::chrono::microseconds> plan();
+
+    // Takes one hedge from the budget; false once it is spent.
+    bool spend();
+
+    // Time to response head of a first attempt, or how long it had waited when it was
+    // abandoned for a hedge that answered first.
+    void record(std::chrono::microseconds waited);
+
+private:
+    const HedgeOptions options_;
+    std::atomic<int64_t> delay_us_ = 0;  // 0 until warmed up
+
+    std::mutex mutex_;  // guards the fields below
+    std::array<int64_t, kWindow> samples_{};
+    uint32_t recorded_ = 0;
+    double credit_ = 0;
+};
+
+}  // namespace notiman
@@ -0,0 +1,402 @@
+#include "http_wire.h"
+
+#include <algorithm>
+#include <charconv>
+
+#include "forwarding.h"
+
+namespace notiman {
+
+namespace {
+
+bool is_token_char(char c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        return true;
+    }
+    switch (c) {
+    case '!': case '#': case '$': case '%': case '&': case '\'': case '*':
+    case '+': case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::string_view trim_ows(std::string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+        value.remove_prefix(1);
+    }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+        value.remove_suffix(1);
+    }
+    return value;
+}
+
+// Splits the start line and header fields. Lines end in CRLF; a bare LF is tolerated.
+ParseStatus parse_head_lines(std::string_view buffer,
+                             std::string_view& start_line,
+                             std::vector<HeaderField>& headers,
+                             size_t& head_bytes) {
+    headers.clear();
+    size_t pos = 0;
+    bool have_start_line = false;
+
+    for (;;) {
+        const size_t newline = buffer.find('\n', pos);
+        if (newline == std::string_view::npos) {
+            return ParseStatus::Incomplete;
+        }
+        size_t end = newline;
+        if (end > pos && buffer[end - 1] == '\r') {
+            --end;
+        }
+        const std::string_view line = buffer.substr(pos, end - pos);
+        pos = newline + 1;
+
+        if (!have_start_line) {
+            // Empty lines before a request are allowed (RFC 9112 section 2.2).
+            if (!line.empty()) {
+                start_line = line;
+                have_start_line = true;
+            }
+            continue;
+        }
+
+        if (line.empty()) {
+            head_bytes = pos;
+            return ParseStatus::Complete;
+        }
+
+        // Obsolete line folding is rejected rather than unfolded.
+        if (line.front() == ' ' || line.front() == '\t') {
+            return ParseStatus::Invalid;
+        }
+
+        const size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0) {
+            return ParseStatus::Invalid;
+        }
+        const std::string_view name = line.substr(0, colon);
+        if (!std::all_of(name.begin(), name.end(), is_token_char)) {
+            return ParseStatus::Invalid;
+        }
+        headers.push_back(HeaderField{name, trim_ows(line.substr(colon + 1))});
+    }
+}
+
+bool parse_http_version(std::string_view text, int& minor_version) {
+    if (text.size() != 8 || text.substr(0, 7) != "HTTP/1." || text[7] < '0' || text[7] > '9') {
+        return false;
+    }
+    minor_version = text[7] - '0';
+    return true;
+}
+
+bool parse_content_length(std::string_view value, uint64_t& length) {
+    if (value.empty()) {
+        return false;
+    }
+    const auto result = std::from_chars(value.data(), value.data() + value.size(), length);
+    return result.ec == std::errc() && result.ptr == value.data() + value.size();
+}
+
+// Transfer-Encoding lists codings in the order they were applied; chunked must be last.
+bool is_chunked_last(std::string_view value) {
+    const size_t comma = value.rfind(',');
+    const std::string_view last = trim_ows(comma == std::string_view::npos ? value : value.substr(comma + 1));
+    return iequals(last, "chunked");
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+}  // namespace
+
+ParseStatus parse_request_head(std::string_view buffer, RequestHead& head) {
+    std::string_view start_line;
+    const ParseStatus status = parse_head_lines(buffer, start_line, head.headers, head.head_bytes);
+    if (status != ParseStatus::Complete) {
+        return status;
+    }
+
+    const size_t first_space = start_line.find(' ');
+    const size_t last_space = start_line.rfind(' ');
+    if (first_space == std::string_view::npos || first_space == 0 || last_space == first_space) {
+        return ParseStatus::Invalid;
+    }
+    head.method = start_line.substr(0, first_space);
+    head.target = start_line.substr(first_space + 1, last_space - first_space - 1);
+    if (head.target.empty() || !std::all_of(head.method.begin(), head.method.end(), is_token_char)) {
+        return ParseStatus::Invalid;
+    }
+    if (!parse_http_version(start_line.substr(last_space + 1), head.minor_version)) {
+        return ParseStatus::Invalid;
+    }
+    return ParseStatus::Complete;
+}
+
+ParseStatus parse_response_head(std::string_view buffer, ResponseHead& head) {
+    std::string_view start_line;
+    const ParseStatus status = parse_head_lines(buffer, start_line, head.headers, head.head_bytes);
+    if (status != ParseStatus::Complete) {
+        return status;
+    }
+
+    // HTTP/1.1 200 OK
+    if (start_line.size() < 12 || start_line[8] != ' ' ||
+        !parse_http_version(start_line.substr(0, 8), head.minor_version)) {
+        return ParseStatus::Invalid;
+    }
+    const auto result = std::from_chars(start_line.data() + 9, start_line.data() + 12, head.status);
+    if (result.ec != std::errc() || result.ptr != start_line.data() + 12 || head.status < 100 || head.status > 999) {
+        return ParseStatus::Invalid;
+    }
+    head.reason = start_line.size() > 13 ? start_line.substr(13) : std::string_view{};
+    return ParseStatus::Complete;
+}
+
+std::string_view find_header(const std::vector<HeaderField>& headers, std::string_view name) {
+    for (const auto& field : headers) {
+        if (iequals(field.name, name)) {
+            return field.value;
+        }
+    }
+    return {};
+}
+
+bool has_header(const std::vector<HeaderField>& headers, std::string_view name) {
+    for (const auto& field : headers) {
+        if (iequals(field.name, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool header_has_token(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        const size_t comma = value.find(',');
+        if (iequals(trim_ows(value.substr(0, comma)), token)) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+void BodyFramer::reset(Mode mode, uint64_t length) {
+    mode_ = mode;
+    remaining_ = length;
+    saw_size_digit_ = false;
+    switch (mode) {
+    case Mode::None:
+        state_ = State::Done;
+        break;
+    case Mode::Length:
+        state_ = length == 0 ? State::Done : State::Body;
+        break;
+    case Mode::Chunked:
+        state_ = State::ChunkSize;
+        break;
+    case Mode::UntilClose:
+        state_ = State::Body;
+        break;
+    }
+}
+
+size_t BodyFramer::consume(const char* data, size_t size) {
+    size_t used = 0;
+    while (used < size) {
+        switch (state_) {
+        case State::Done:
+        case State::Failed:
+            return used;
+
+        case State::Body: {
+            if (mode_ == Mode::UntilClose) {
+                return size;
+            }
+            const size_t take = static_cast<size_t>(std::min<uint64_t>(remaining_, size - used));
+            used += take;
+            remaining_ -= take;
+            if (remaining_ == 0) {
+                state_ = State::Done;
+            }
+            break;
+        }
+
+        case State::ChunkData: {
+            const size_t take = static_cast<size_t>(std::min<uint64_t>(remaining_, size - used));
+            used += take;
+            remaining_ -= take;
+            if (remaining_ == 0) {
+                state_ = State::ChunkDataCr;
+            }
+            break;
+        }
+
+        default: {
+            const char c = data[used++];
+            switch (state_) {
+            case State::ChunkSize: {
+                const int digit = hex_value(c);
+                if (digit >= 0) {
+                    if (remaining_ > (UINT64_MAX >> 4)) {
+                        state_ = State::Failed;
+                        return used;
+                    }
+                    remaining_ = (remaining_ << 4) | static_cast<uint64_t>(digit);
+                    saw_size_digit_ = true;
+                } else if (!saw_size_digit_) {
+                    state_ = State::Failed;
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    state_ = State::ChunkExtension;
+                } else if (c == '\r') {
+                    state_ = State::ChunkSizeLf;
+                } else if (c == '\n') {
+                    state_ = remaining_ == 0 ? State::TrailerStart : State::ChunkData;
+                } else {
+                    state_ = State::Failed;
+                }
+                break;
+            }
+            case State::ChunkExtension:
+                if (c == '\r') {
+                    state_ = State::ChunkSizeLf;
+                } else if (c == '\n') {
+                    state_ = remaining_ == 0 ? State::TrailerStart : State::ChunkData;
+                }
+                break;
+            case State::ChunkSizeLf:
+                if (c != '\n') {
+                    state_ = State::Failed;
+                } else {
+                    state_ = remaining_ == 0 ? State::TrailerStart : State::ChunkData;
+                }
+                break;
+            case State::ChunkDataCr:
+                if (c == '\r') {
+                    state_ = State::ChunkDataLf;
+                } else if (c == '\n') {
+                    state_ = State::ChunkSize;
+                    saw_size_digit_ = false;
+                } else {
+                    state_ = State::Failed;
+                }
+                break;
+            case State::ChunkDataLf:
+                if (c != '\n') {
+                    state_ = State::Failed;
+                } else {
+                    state_ = State::ChunkSize;
+                    saw_size_digit_ = false;
+                }
+                break;
+            case State::TrailerStart:
+                if (c == '\r') {
+                    state_ = State::TrailerEndLf;
+                } else if (c == '\n') {
+                    state_ = State::Done;
+                } else {
+                    state_ = State::TrailerLine;
+                }
+                break;
+            case State::TrailerLine:
+                if (c == '\n') {
+                    state_ = State::TrailerStart;
+                }
+                break;
+            case State::TrailerEndLf:
+                state_ = c == '\n' ? State::Done : State::Failed;
+                break;
+            default:
+                state_ = State::Failed;
+                break;
+            }
+            if (state_ == State::Failed) {
+                return used;
+            }
+            break;
+        }
+        }
+    }
+    return used;
+}
+
+void BodyFramer::skip(uint64_t count) {
+    if (mode_ != Mode::Length || state_ != State::Body) {
+        return;
+    }
+    remaining_ -= std::min(remaining_, count);
+    if (remaining_ == 0) {
+        state_ = State::Done;
+    }
+}
+
+FramingStatus request_body_framing(const std::vector<HeaderField>& headers,
+                                   BodyFramer::Mode& mode,
+                                   uint64_t& length) {
+    length = 0;
+    const std::string_view transfer_encoding = find_header(headers, "Transfer-Encoding");
+    if (!transfer_encoding.empty()) {
+        if (!is_chunked_last(transfer_encoding)) {
+            return FramingStatus::Unsupported;
+        }
+        mode = BodyFramer::Mode::Chunked;
+        return FramingStatus::Ok;
+    }
+
+    if (has_header(headers, "Content-Length")) {
+        if (!parse_content_length(find_header(headers, "Content-Length"), length)) {
+            return FramingStatus::Invalid;
+        }
+        mode = length > 0 ? BodyFramer::Mode::Length : BodyFramer::Mode::None;
+        return FramingStatus::Ok;
+    }
+
+    mode = BodyFramer::Mode::None;
+    return FramingStatus::Ok;
+}
+
+FramingStatus response_body_framing(std::string_view request_method,
+                                    const ResponseHead& head,
+                                    BodyFramer::Mode& mode,
+                                    uint64_t& length) {
+    length = 0;
+    if (request_method == "HEAD" || head.status < 200 || head.status == 204 || head.status == 304) {
+        mode = BodyFramer::Mode::None;
+        return FramingStatus::Ok;
+    }
+
+    const std::string_view transfer_encoding = find_header(head.headers, "Transfer-Encoding");
+    if (!transfer_encoding.empty()) {
+        mode = is_chunked_last(transfer_encoding) ? BodyFramer::Mode::Chunked : BodyFramer::Mode::UntilClose;
+        return FramingStatus::Ok;
+    }
+
+    if (has_header(head.headers, "Content-Length")) {
+        if (!parse_content_length(find_header(head.headers, "Content-Length"), length)) {
+            return FramingStatus::Invalid;
+        }
+        mode = length > 0 ? BodyFramer::Mode::Length : BodyFramer::Mode::None;
+        return FramingStatus::Ok;
+    }
+
+    mode = BodyFramer::Mode::UntilClose;
+    return FramingStatus::Ok;
+}
+
+}  // namespace notiman
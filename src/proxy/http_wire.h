@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace notiman {
+
+// Incremental HTTP/1.x parsing for engines that relay bytes themselves.
+// Parsed views point into the caller's buffer and are valid until it changes.
+
+struct HeaderField {
+    std::string_view name;
+    std::string_view value;
+};
+
+struct RequestHead {
+    std::string_view method;
+    std::string_view target;
+    int minor_version = 1;
+    std::vector<HeaderField> headers;  // cleared and refilled, so capacity is reused
+    size_t head_bytes = 0;             // bytes up to and including the blank line
+};
+
+struct ResponseHead {
+    int minor_version = 1;
+    int status = 0;
+    std::string_view reason;
+    std::vector<HeaderField> headers;
+    size_t head_bytes = 0;
+};
+
+enum class ParseStatus {
+    Incomplete,
+    Complete,
+    Invalid
+};
+
+ParseStatus parse_request_head(std::string_view buffer, RequestHead& head);
+ParseStatus parse_response_head(std::string_view buffer, ResponseHead& head);
+
+// Case-insensitive lookup of the first header called name. Empty when absent.
+std::string_view find_header(const std::vector<HeaderField>& headers, std::string_view name);
+bool has_header(const std::vector<HeaderField>& headers, std::string_view name);
+
+// True when a comma-separated header value such as Connection lists token.
+bool header_has_token(std::string_view value, std::string_view token);
+
+// Finds where a message body ends without decoding it, so the body can be
+// relayed verbatim including its chunked framing.
+class BodyFramer {
+public:
+    enum class Mode : uint8_t {
+        None,        // no body
+        Length,      // Content-Length bytes
+        Chunked,     // Transfer-Encoding: chunked, up to and including the trailers
+        UntilClose   // response delimited by the peer closing the connection
+    };
+
+    void reset(Mode mode, uint64_t length = 0);
+
+    // Returns how many of the given bytes belong to the body. Bytes past the end
+    // are left for the caller (a pipelined request, or garbage from the upstream).
+    size_t consume(const char* data, size_t size);
+
+    // Body bytes still to come when the count is known up front (Length framing), so they
+    // can be forwarded without passing through consume(); 0 otherwise.
+    uint64_t remaining_length() const { return mode_ == Mode::Length && state_ == State::Body ? remaining_ : 0; }
+
+    // Accounts for count bytes forwarded without consume(); at most remaining_length().
+    void skip(uint64_t count);
+
+    Mode mode() const { return mode_; }
+    bool done() const { return state_ == State::Done; }
+    bool failed() const { return state_ == State::Failed; }
+
+private:
+    enum class State : uint8_t {
+        Done,
+        Failed,
+        Body,
+        ChunkSize,
+        ChunkExtension,
+        ChunkSizeLf,
+        ChunkData,
+        ChunkDataCr,
+        ChunkDataLf,
+        TrailerStart,
+        TrailerLine,
+        TrailerEndLf
+    };
+
+    Mode mode_ = Mode::None;
+    State state_ = State::Done;
+    uint64_t remaining_ = 0;
+    bool saw_size_digit_ = false;
+};
+
+enum class FramingStatus {
+    Ok,
+    Invalid,
+    Unsupported
+};
+
+// Body framing of a request from its headers (RFC 9112 section 6.3).
+FramingStatus request_body_framing(const std::vector<HeaderField>& headers,
+                                   BodyFramer::Mode& mode,
+                                   uint64_t& length);
+
+// Body framing of a response to a request with the given method.
+FramingStatus response_body_framing(std::string_view request_method,
+                                    const ResponseHead& head,
+                                    BodyFramer::Mode& mode,
+                                    uint64_t& length);
+
+}  // namespace notiman
@@ -0,0 +1,1372 @@
+#include "httplib_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+
+#include "body_stream.h"
+#include "fault_injector.h"
+#include "forwarding.h"
+#include "response_cache.h"
+#include "upstream_pool.h"
+
+#ifdef __linux__
+#include "listen_sockets.h"
+#endif
+
+namespace notiman {
+
+// Shared between the request handler and the thread running the upstream exchange
+// for routes with stream=true.
+struct StreamingExchange {
+    explicit StreamingExchange(size_t buffer_bytes) : body(buffer_bytes) {}
+
+    std::mutex mutex;
+    std::condition_variable headers_ready;
+    bool has_headers = false;
+    bool finished = false;
+    int status = 0;
+    httplib::Headers headers;
+    BoundedBodyBuffer body;
+    std::string target_url;
+    std::thread worker;
+
+    // Read once the worker has been joined.
+    std::chrono::microseconds connect_time{-1};
+    bool resolver_hit = false;
+    std::chrono::steady_clock::time_point first_byte_at;
+    uint64_t bytes_in = 0;
+
+    // A streamed request body is read on the worker through the handler's ContentReader,
+    // which is only valid until the handler returns. Guarded by mutex.
+    std::condition_variable request_body_read;
+    bool request_body_taken = false;
+    bool request_body_done = false;
+    bool request_body_released = false;
+
+    // Called by the handler before it returns: waits out a worker still reading the body and
+    // keeps one that has not started from touching it. True when the worker never took the
+    // body, so the handler has to drain it.
+    bool release_request_body() {
+        std::unique_lock lock(mutex);
+        request_body_released = true;
+        request_body_read.wait(lock, [this] { return !request_body_taken || request_body_done; });
+        return !request_body_taken;
+    }
+
+    void join() {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+};
+
+// An upstream response as handed to requests coalesced onto another one's exchange.
+struct CoalescedResponse {
+    int status = 0;
+    httplib::Headers headers;  // already filtered for the client
+    std::string body;
+};
+
+// Starts hedges at their deadlines, on one thread shared by all requests. Started with the
+// first hedged request, so engines without hedged routes never run it.
+class HedgeTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    ~HedgeTimer() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void schedule(Clock::time_point at, std::function<void()> fn) {
+        {
+            std::lock_guard lock(mutex_);
+            if (!thread_.joinable()) {
+                thread_ = std::thread([this] { run(); });
+            }
+            const bool earliest = queue_.empty() || at < queue_.top().at;
+            queue_.push(Entry{at, std::move(fn)});
+            if (!earliest) {
+                return;
+            }
+        }
+        wake_.notify_one();
+    }
+
+private:
+    struct Entry {
+        Clock::time_point at;
+        std::function<void()> fn;
+
+        bool operator>(const Entry& other) const { return at > other.at; }
+    };
+
+    void run() {
+        std::unique_lock lock(mutex_);
+        while (!stopping_) {
+            if (queue_.empty()) {
+                wake_.wait(lock);
+                continue;
+            }
+            if (Clock::now() < queue_.top().at) {
+                wake_.wait_until(lock, queue_.top().at);
+                continue;
+            }
+            std::function<void()> fn = std::move(const_cast<Entry&>(queue_.top()).fn);
+            queue_.pop();
+            lock.unlock();
+            fn();
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex_;  // guards the fields below
+    std::condition_variable wake_;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<>> queue_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+// A request's first upstream attempt and the hedge raced against it. The first attempt
+// runs on the request's thread; the hedge timer starts the second on a thread of its own
+// once the first has waited the route's hedge delay without a response head. Whichever
+// answers first shuts the other's socket down. Clients are only stopped under the mutex,
+// while their owner has them registered here.
+struct HedgeRace {
+    std::mutex mutex;  // guards the fields below
+    // Valid until first_returned, which the request's thread sets before it lets go of it.
+    const CompiledRoute* route = nullptr;
+    // The first attempt as it was before send() filled in its per-target headers. Never
+    // changed once armed, so the timer can copy it while the first attempt is in flight.
+    std::shared_ptr<const httplib::Request> request;
+    std::string downstream_path;   // to forward the hedge under another target's base path
+    std::string downstream_query;
+    std::shared_ptr<UpstreamTarget> first_target;
+    httplib::ClientImpl* first = nullptr;   // the first attempt's client while it is in flight
+    httplib::ClientImpl* second = nullptr;  // the hedge's client while it is in flight
+    bool first_headers = false;  // too late to hedge
+    bool first_returned = false;
+    bool first_won = false;
+    bool hedged = false;
+    bool hedge_won = false;
+    std::thread worker;
+
+    // The hedge's exchange. Read once the worker has been joined.
+    httplib::Result result;
+    std::chrono::steady_clock::time_point first_byte_at;
+    std::chrono::microseconds connect_time{-1};
+    bool resolver_hit = false;
+
+    void join() {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+};
+
+namespace {
+
+std::string read_request_body(const httplib::ContentReader& body_reader) {
+    std::string body;
+    body_reader([&](const char* data, size_t length) {
+        body.append(data, length);
+        return true;
+    });
+    return body;
+}
+
+// Consumes an unread request body so the keep-alive connection stays in sync.
+void drain_request_body(const httplib::ContentReader* body_reader) {
+    if (body_reader != nullptr) {
+        (*body_reader)([](const char*, size_t) { return true; });
+    }
+}
+
+// The hedge's side of a race: the same request to target, over a new connection when
+// that is where the first attempt went.
+void run_hedge(const std::shared_ptr<HedgeRace>& race,
+               httplib::Request request,
+               const std::shared_ptr<UpstreamTarget>& target,
+               bool fresh) {
+    InFlightRequest in_flight(target);
+    auto lease = fresh ? target->pool()->acquire_fresh() : target->pool()->acquire();
+    request.response_handler = [&race](const httplib::Response&) {
+        std::lock_guard lock(race->mutex);
+        race->first_byte_at = std::chrono::steady_clock::now();
+        return !race->first_won;
+    };
+    {
+        std::lock_guard lock(race->mutex);
+        if (race->first_won) {
+            return;
+        }
+        race->second = &lease.client();
+    }
+    auto result = lease.client().send(request);
+
+    std::lock_guard lock(race->mutex);
+    race->second = nullptr;
+    if (!result || race->first_won) {
+        return;
+    }
+    race->hedge_won = true;
+    race->result = std::move(result);
+    race->connect_time = lease.connect_time();
+    race->resolver_hit = lease.resolver_hit();
+    if (race->first != nullptr) {
+        race->first->stop();
+    }
+}
+
+// Swaps the client the hedge would stop for the first attempt's retry. False when there
+// is no point retrying: the hedge has already answered.
+bool retry_first_attempt(HedgeRace* race, httplib::ClientImpl* client) {
+    if (race == nullptr) {
+        return true;
+    }
+    std::lock_guard lock(race->mutex);
+    race->first = race->hedge_won ? nullptr : client;
+    return !race->hedge_won;
+}
+
+// Pumps the downstream request body straight into the upstream socket. Once the upstream
+// stops taking it, the rest is still read and dropped, so the client connection stays in
+// step for its next request.
+void attach_streamed_request_body(const httplib::Request& req,
+                                  const httplib::ContentReader& body_reader,
+                                  httplib::Request& outgoing,
+                                  const std::shared_ptr<StreamingExchange>& exchange) {
+    const bool chunked = !req.has_header("Content-Length");
+    outgoing.is_chunked_content_provider_ = chunked;
+    outgoing.content_length_ = chunked ? 0 : static_cast<size_t>(req.get_header_value_u64("Content-Length"));
+    if (chunked) {
+        // httplib frames the chunks but only adds the header on its own Post() overloads.
+        outgoing.set_header("Transfer-Encoding", "chunked");
+    }
+    outgoing.content_provider_ = [&body_reader, exchange, chunked](size_t, size_t, httplib::DataSink& sink) {
+        {
+            std::lock_guard lock(exchange->mutex);
+            if (exchange->request_body_taken || exchange->request_body_released) {
+                return false;
+            }
+            exchange->request_body_taken = true;
+        }
+        bool forwarding = true;
+        const bool read = body_reader([&](const char* data, size_t length) {
+            if (forwarding && sink.write(data, length)) {
+                exchange->bytes_in += length;
+            } else {
+                forwarding = false;
+            }
+            return true;
+        });
+        {
+            std::lock_guard lock(exchange->mutex);
+            exchange->request_body_done = true;
+        }
+        exchange->request_body_read.notify_all();
+        if (read && forwarding && chunked) {
+            sink.done();
+        }
+        return read && forwarding;
+    };
+}
+
+// Request side of a capture record, with the body cut to the capture's limit.
+CapturedExchange captured_request(const httplib::Request& req, std::string_view body, size_t body_limit) {
+    CapturedExchange exchange;
+    exchange.method = req.method;
+    exchange.host = req.get_header_value("Host");
+    exchange.target = req.target;
+    for (const auto& [key, value] : req.headers) {
+        // httplib adds the socket addresses as headers; the client never sent them.
+        if (key == "REMOTE_ADDR" || key == "REMOTE_PORT" || key == "LOCAL_ADDR" || key == "LOCAL_PORT") {
+            continue;
+        }
+        exchange.headers.append(key).append(": ").append(value).append("\r\n");
+    }
+    exchange.request_body = body.substr(0, body_limit);
+    return exchange;
+}
+
+std::string_view header_value(const httplib::Headers& headers, std::string_view name) {
+    const auto it = headers.find(std::string(name));
+    return it != headers.end() ? std::string_view(it->second) : std::string_view{};
+}
+
+CacheHeaders cache_headers(const httplib::Headers& headers) {
+    return CacheHeaders(headers.begin(), headers.end());
+}
+
+// A stored response as this request gets it: a 304 when the client already holds it.
+void respond_from_cache(httplib::Response& res,
+                        const CachedResponse& entry,
+                        const CacheRequest& request,
+                        std::chrono::steady_clock::time_point now) {
+    const bool not_modified = matches_if_none_match(request.if_none_match, entry.etag);
+    res.status = not_modified ? 304 : entry.status;
+    res.headers = httplib::Headers(entry.headers.begin(), entry.headers.end());
+    res.set_header("Age", std::to_string(entry.age(now).count()));
+    res.body = not_modified ? std::string() : entry.body;
+}
+
+}  // namespace
+
+// httplib::Server that can serve on an inherited socket, and stop accepting without
+// shutting the listening socket down: a successor process may be accepting on it too.
+class ProxyServer : public httplib::Server {
+public:
+    // httplib sets TCP_NODELAY only on sockets it creates and offers no hook on accepted
+    // ones. They inherit it from the listener, so every adopted listener gets it, inherited
+    // and handed-over ones included.
+    void adopt(socket_t listen_socket) {
+        const int enabled = 1;
+        setsockopt(listen_socket, IPPROTO_TCP, TCP_NODELAY,
+                   reinterpret_cast<const char*>(&enabled), sizeof(enabled));
+        svr_sock_ = listen_socket;
+    }
+    socket_t listening_socket() const { return svr_sock_; }
+
+    // The accept loop notices within the idle interval; the caller closes the socket.
+    socket_t stop_accepting() { return svr_sock_.exchange(INVALID_SOCKET); }
+};
+
+namespace {
+
+// httplib hands every accepted connection to its task queue on the accept thread, which
+// makes the queue the place to count connections per listener.
+class CountingTaskQueue : public httplib::TaskQueue {
+public:
+    CountingTaskQueue(ProxyMetrics& metrics, size_t listener)
+        : metrics_(metrics), listener_(listener), pool_(CPPHTTPLIB_THREAD_POOL_COUNT) {}
+
+    bool enqueue(std::function<void()> fn) override {
+        metrics_.record_connection(listener_);
+        return pool_.enqueue(std::move(fn));
+    }
+    void shutdown() override { pool_.shutdown(); }
+    void on_idle() override { pool_.on_idle(); }
+
+private:
+    ProxyMetrics& metrics_;
+    const size_t listener_;
+    httplib::ThreadPool pool_;
+};
+
+}  // namespace
+
+HttplibEngine::HttplibEngine(HttplibEngineOptions options,
+                             RouteTablePublisher& routes,
+                             NotificationDispatcher* notifications,
+                             ProxyMetrics* metrics,
+                             TrafficCapture* capture)
+    : options_(options),
+      routes_(routes),
+      notifications_(notifications),
+      metrics_(metrics),
+      capture_(capture),
+      hedge_timer_(std::make_unique<HedgeTimer>()) {}
+
+HttplibEngine::~HttplibEngine() {
+    stop();
+}
+
+void HttplibEngine::notify(NotificationIcon icon,
+                           std::string title,
+                           std::string body,
+                           std::string code,
+                           std::string project,
+                           std::optional<RequestOutcome> request) {
+    if (notifications_ == nullptr) {
+        return;
+    }
+    notifications_->post(ProxyNotification{
+        icon, std::move(title), std::move(body), std::move(code), std::move(project), request});
+}
+
+void HttplibEngine::record(RequestSample sample, std::chrono::steady_clock::time_point started_at) {
+    if (metrics_ == nullptr) {
+        return;
+    }
+    sample.total = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started_at);
+    metrics_->record(sample);
+}
+
+void HttplibEngine::capture(CapturedExchange exchange,
+                            const RequestSample& sample,
+                            std::chrono::steady_clock::time_point started_at,
+                            std::string_view response_body) {
+    exchange.started_at = capture_wall_clock(started_at);
+    exchange.duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started_at);
+    exchange.status = sample.status;
+    exchange.route = sample.route;
+    exchange.response_body = response_body.substr(0, capture_->body_limit());
+    exchange.request_body_bytes = sample.bytes_in;
+    exchange.response_body_bytes = sample.bytes_out;
+    capture_->record(std::move(exchange));
+}
+
+bool HttplibEngine::admit_upstream(const httplib::Request& req,
+                                   httplib::Response& res,
+                                   const httplib::ContentReader* body_reader,
+                                   const CompiledRoute& compiled,
+                                   RequestSample& sample,
+                                   std::chrono::steady_clock::time_point started_at,
+                                   bool& probe,
+                                   ConcurrencyPermit& permit) {
+    probe = false;
+    const auto refuse = [&](const char* message, std::chrono::seconds retry_after) {
+        drain_request_body(body_reader);
+        res.status = 503;
+        res.set_header("Retry-After", std::to_string(retry_after.count()));
+        res.set_content(message, "text/plain");
+        sample.status = res.status;
+        sample.bytes_out = res.body.size();
+        record(sample, started_at);
+        if (capture_ != nullptr) {
+            capture(captured_request(req, {}, 0), sample, started_at, res.body);
+        }
+        return false;
+    };
+
+    if (compiled.limiter) {
+        // A queued request would wait on a worker the other routes need; refuse it instead.
+        permit = compiled.limiter->try_acquire();
+        if (!permit) {
+            return refuse("Route over its concurrency limit", compiled.limiter->retry_after());
+        }
+    }
+    if (!compiled.breaker) {
+        return true;
+    }
+    const BreakerAdmission admission = compiled.breaker->admit(std::chrono::steady_clock::now());
+    if (admission.transition && notifications_ != nullptr) {
+        notifications_->post(breaker_notification(compiled.route, *admission.transition));
+    }
+    if (admission.allowed) {
+        probe = admission.probe;
+        return true;
+    }
+    permit.release();
+    return refuse("Upstream circuit open", std::chrono::ceil<std::chrono::seconds>(admission.retry_after));
+}
+
+void HttplibEngine::report_upstream(const CompiledRoute& compiled, bool probe, bool success) {
+    if (!compiled.breaker) {
+        return;
+    }
+    const auto transition = compiled.breaker->record(probe, success, std::chrono::steady_clock::now());
+    if (transition && notifications_ != nullptr) {
+        notifications_->post(breaker_notification(compiled.route, *transition));
+    }
+}
+
+std::optional<RequestOutcome> HttplibEngine::request_notification(const CompiledRoute& compiled,
+                                                                 int status,
+                                                                 std::chrono::steady_clock::time_point started_at) {
+    if (notifications_ == nullptr) {
+        return std::nullopt;
+    }
+    const RequestOutcome outcome = request_outcome(compiled.route, status, started_at);
+    if (!compiled.notify_policy) {
+        return outcome;
+    }
+    const NotificationVerdict verdict = compiled.notify_policy->evaluate(status, outcome.elapsed);
+    if (verdict.anomaly) {
+        notifications_->post(anomaly_notification(compiled.route, *verdict.anomaly));
+    }
+    return verdict.report ? std::optional<RequestOutcome>(outcome) : std::nullopt;
+}
+
+void HttplibEngine::serve_metrics(const httplib::Request& req, httplib::Response& res) {
+    const bool json = metrics_wants_json(extract_query_from_target(req.target), req.get_header_value("Accept"));
+    const MetricsSnapshot snapshot = metrics_->snapshot();
+    res.status = 200;
+    if (json) {
+        res.set_content(format_json(snapshot), "application/json");
+    } else {
+        res.set_content(format_prometheus(snapshot), "text/plain; version=0.0.4");
+    }
+}
+
+bool HttplibEngine::inject_fault(const httplib::Request& req,
+                                 httplib::Response& res,
+                                 const httplib::ContentReader* body_reader,
+                                 const CompiledRoute& compiled,
+                                 RequestSample& sample,
+                                 std::chrono::steady_clock::time_point started_at) {
+    const FaultOptions& faults = compiled.faults;
+    // Delays would hold a pooled worker thread; loading the config turns them off for this engine.
+    const FaultPlan plan = plan_fault(faults);
+    if (plan.action == FaultAction::None) {
+        return false;
+    }
+
+    drain_request_body(body_reader);
+    const bool reset = plan.action == FaultAction::Reset;
+    if (reset) {
+        // httplib cannot drop a connection before answering; a body that fails to arrive
+        // makes it close the connection straight after the head.
+        res.status = 200;
+        res.set_content_provider(1, "text/plain", [](size_t, size_t, httplib::DataSink&) { return false; });
+    } else {
+        res.status = faults.error_status;
+        res.set_content("Injected fault", "text/plain");
+        sample.status = res.status;
+        sample.bytes_out = res.body.size();
+        record(sample, started_at);
+        if (capture_ != nullptr) {
+            capture(captured_request(req, {}, 0), sample, started_at, res.body);
+        }
+    }
+    // A dropped connection counts as a 502 for the route's notification policy.
+    if (const auto outcome = request_notification(compiled, reset ? 502 : res.status, started_at)) {
+        notify(
+            NotificationIcon::Warning,
+            "Injected fault",
+            reset ? "Connection reset for " + req.path : "Answered " + std::to_string(res.status) + " to " + req.path,
+            "fault",
+            compiled.route.name,
+            *outcome);
+    }
+    return true;
+}
+
+void HttplibEngine::serve_mock(const httplib::Request& req,
+                               httplib::Response& res,
+                               const httplib::ContentReader* body_reader,
+                               const CompiledRoute& compiled,
+                               RequestSample& sample,
+                               std::chrono::steady_clock::time_point started_at) {
+    drain_request_body(body_reader);
+    const std::shared_ptr<const MockResponse> mock = compiled.mock->find(req.method, req.path);
+    const std::string_view body = mock->body();
+
+    res.status = mock->status;
+    for (const auto& [key, value] : mock->headers) {
+        res.set_header(key, value);
+    }
+    uint64_t bytes_out = req.method == "HEAD" ? 0 : body.size();
+    if (mock->status == 200) {
+        res.set_header("Accept-Ranges", "bytes");
+        if (!req.ranges.empty()) {
+            // httplib checks the ranges against the length and writes them with Content-Range.
+            res.status = 206;
+            ByteRange range;
+            if (bytes_out > 0 &&
+                parse_byte_range(req.get_header_value("Range"), body.size(), range) == RangeStatus::Partial) {
+                bytes_out = range.length;
+            }
+        }
+    }
+    if (body.empty()) {
+        res.set_content("", mock->content_type);
+    } else {
+        res.set_content_provider(
+            body.size(), mock->content_type, [mock](size_t offset, size_t length, httplib::DataSink& sink) {
+                return sink.write(mock->body().data() + offset, length);
+            });
+    }
+
+    const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started_at).count();
+    sample.status = res.status;
+    sample.bytes_out = bytes_out;
+    record(sample, started_at);
+    if (capture_ != nullptr) {
+        capture(captured_request(req, {}, 0), sample, started_at, body);
+    }
+    if (const auto outcome = request_notification(compiled, res.status, started_at)) {
+        notify(
+            icon_for_status(res.status),
+            build_request_title(req.method, elapsed_ms),
+            "",
+            req.path,
+            compiled.route.name,
+            *outcome);
+    }
+}
+
+// Fills the downstream response once upstream headers arrived. From here on the body is
+// pulled through the bounded buffer by httplib's content provider on this worker thread.
+void HttplibEngine::respond_from_stream(const httplib::Request& req,
+                                        httplib::Response& res,
+                                        const CompiledRoute& compiled,
+                                        const std::shared_ptr<StreamingExchange>& exchange,
+                                        std::chrono::steady_clock::time_point started_at,
+                                        bool breaker_probe) {
+    const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started_at).count();
+    const ProxyRoute& route = compiled.route;
+
+    RequestSample sample;
+    sample.route = route.name;
+    sample.path = req.path;
+
+    report_upstream(compiled, breaker_probe, exchange->has_headers && !is_gateway_error(exchange->status));
+    if (!exchange->has_headers) {
+        exchange->join();
+        res.status = 502;
+        res.set_content("Failed to reach upstream target", "text/plain");
+        sample.status = res.status;
+        sample.bytes_in = exchange->bytes_in;
+        sample.bytes_out = res.body.size();
+        sample.connect = exchange->connect_time;
+        sample.resolver_hit = exchange->resolver_hit;
+        record(sample, started_at);
+        if (capture_ != nullptr) {
+            capture(captured_request(req, {}, 0), sample, started_at, res.body);
+        }
+        if (const auto outcome = request_notification(compiled, res.status, started_at)) {
+            notify(
+                NotificationIcon::Error,
+                "Proxy error",
+                "Failed to connect to " + exchange->target_url,
+                "upstream",
+                route.name,
+                *outcome);
+        }
+        return;
+    }
+
+    res.status = exchange->status;
+    for (const auto& [key, value] : exchange->headers) {
+        if (is_excluded_header(key) || iequals(key, "content-type")) {
+            continue;
+        }
+        res.set_header(key.c_str(), value.c_str());
+    }
+
+    const auto upstream_content_type = exchange->headers.find("Content-Type");
+    const std::string content_type = upstream_content_type != exchange->headers.end()
+        ? upstream_content_type->second
+        : "application/octet-stream";
+    const bool bodyless = req.method == "HEAD" || res.status == 204 || res.status == 304 || res.status < 200;
+
+    // Title reports time to first byte; the body keeps flowing after we return.
+    if (const auto outcome = request_notification(compiled, res.status, started_at)) {
+        notify(
+            icon_for_status(res.status),
+            build_request_title(req.method, elapsed_ms),
+            "",
+            req.path,
+            route.name,
+            *outcome);
+    }
+
+    // Streamed bodies are not kept; the record still has their sizes.
+    std::optional<CapturedExchange> captured;
+    if (capture_ != nullptr) {
+        captured = captured_request(req, {}, 0);
+    }
+
+    const auto finish_sample = [exchange, started_at](RequestSample& finished) {
+        finished.bytes_in = exchange->bytes_in;
+        finished.connect = exchange->connect_time;
+        finished.resolver_hit = exchange->resolver_hit;
+        finished.ttfb = std::chrono::duration_cast<std::chrono::microseconds>(exchange->first_byte_at - started_at);
+    };
+    sample.status = res.status;
+
+    if (bodyless) {
+        exchange->body.abort();
+        exchange->join();
+        if (upstream_content_type != exchange->headers.end()) {
+            res.set_header("Content-Type", content_type);
+        }
+        finish_sample(sample);
+        record(sample, started_at);
+        if (captured) {
+            capture(std::move(*captured), sample, started_at);
+        }
+        return;
+    }
+
+    // The body is still flowing when this handler returns; the releaser sees the end of it.
+    auto bytes_out = std::make_shared<uint64_t>(0);
+    auto release = [this, exchange, bytes_out, finish_sample, started_at, status = res.status,
+                    route_name = route.name, path = req.path, captured = std::move(captured)](bool success) mutable {
+        if (!success) {
+            exchange->body.abort();
+        }
+        exchange->join();
+
+        RequestSample finished;
+        finished.route = route_name;
+        finished.path = path;
+        finished.status = status;
+        finished.bytes_out = *bytes_out;
+        finish_sample(finished);
+        record(finished, started_at);
+        if (captured) {
+            capture(std::move(*captured), finished, started_at);
+        }
+    };
+
+    const auto content_length = exchange->headers.find("Content-Length");
+    if (content_length != exchange->headers.end()) {
+        res.set_content_provider(
+            static_cast<size_t>(std::strtoull(content_length->second.c_str(), nullptr, 10)),
+            content_type,
+            [exchange, bytes_out](size_t, size_t, httplib::DataSink& sink) {
+                char chunk[16 * 1024];
+                const size_t count = exchange->body.read(chunk, sizeof(chunk));
+                *bytes_out += count;
+                return count > 0 && sink.write(chunk, count);
+            },
+            release);
+        return;
+    }
+
+    res.set_chunked_content_provider(
+        content_type,
+        [exchange, bytes_out](size_t, httplib::DataSink& sink) {
+            char chunk[16 * 1024];
+            const size_t count = exchange->body.read(chunk, sizeof(chunk));
+            if (count > 0) {
+                *bytes_out += count;
+                return sink.write(chunk, count);
+            }
+            if (exchange->body.completed()) {
+                sink.done();
+                return true;
+            }
+            return false;
+        },
+        release);
+}
+
+void HttplibEngine::proxy_streaming_request(const httplib::Request& req,
+                                            httplib::Response& res,
+                                            const httplib::ContentReader* body_reader,
+                                            const CompiledRoute& compiled,
+                                            const std::shared_ptr<UpstreamTarget>& target,
+                                            size_t buffer_bytes,
+                                            httplib::Request outgoing,
+                                            std::chrono::steady_clock::time_point started_at,
+                                            bool breaker_probe,
+                                            ConcurrencyPermit permit) {
+    const bool has_streamed_body = body_reader != nullptr;
+    auto exchange = std::make_shared<StreamingExchange>(buffer_bytes);
+    exchange->target_url = target->url();
+    if (has_streamed_body) {
+        attach_streamed_request_body(req, *body_reader, outgoing, exchange);
+    }
+
+    exchange->worker = std::thread(
+        [exchange, in_flight = InFlightRequest(target), pool = target->pool(), outgoing = std::move(outgoing),
+         has_streamed_body, permit = std::move(permit)]() mutable {
+            // The concurrency slot is held until the body has been relayed.
+            outgoing.response_handler = [&](const httplib::Response& response) {
+                permit.record(!is_gateway_error(response.status), std::chrono::steady_clock::now());
+                {
+                    std::lock_guard lock(exchange->mutex);
+                    exchange->status = response.status;
+                    exchange->headers = response.headers;
+                    exchange->has_headers = true;
+                    exchange->first_byte_at = std::chrono::steady_clock::now();
+                }
+                exchange->headers_ready.notify_all();
+                return true;
+            };
+            outgoing.content_receiver = [&](const char* data, size_t length, uint64_t, uint64_t) {
+                return exchange->body.write(data, length);
+            };
+
+            auto lease = pool->acquire();
+            auto result = lease.client().send(outgoing);
+            if (!result && lease.reused() && !has_streamed_body && is_idempotent_method(outgoing.method)) {
+                bool headers_sent = false;
+                {
+                    std::lock_guard lock(exchange->mutex);
+                    headers_sent = exchange->has_headers;
+                }
+                if (!headers_sent) {
+                    lease.discard();
+                    lease = pool->acquire_fresh();
+                    result = lease.client().send(outgoing);
+                }
+            }
+            exchange->connect_time = lease.connect_time();
+            exchange->resolver_hit = lease.resolver_hit();
+            permit.record(false, std::chrono::steady_clock::now());
+
+            exchange->body.finish(static_cast<bool>(result));
+            {
+                std::lock_guard lock(exchange->mutex);
+                exchange->finished = true;
+            }
+            exchange->headers_ready.notify_all();
+        });
+
+    {
+        std::unique_lock lock(exchange->mutex);
+        exchange->headers_ready.wait(lock, [&] { return exchange->has_headers || exchange->finished; });
+    }
+    // An upstream may answer before it has read the whole body; the reader must be done with
+    // before the response goes out on the same connection.
+    if (has_streamed_body && exchange->release_request_body()) {
+        drain_request_body(body_reader);
+    }
+
+    try {
+        respond_from_stream(req, res, compiled, exchange, started_at, breaker_probe);
+    } catch (...) {
+        exchange->body.abort();
+        exchange->join();
+        throw;
+    }
+}
+
+std::shared_ptr<HedgeRace> HttplibEngine::arm_hedge(const CompiledRoute& compiled,
+                                                   const httplib::Request& req,
+                                                   const httplib::Request& outgoing,
+                                                   const std::shared_ptr<UpstreamTarget>& target,
+                                                   httplib::ClientImpl& client) {
+    const auto delay = compiled.hedge->plan();
+    if (!delay) {
+        return nullptr;
+    }
+    auto snapshot = std::make_shared<httplib::Request>(outgoing);
+    snapshot->response_handler = nullptr;
+    // send() adds these for the client it goes out on; the hedge's client sets its own.
+    for (const char* added : {"Host", "Connection", "Content-Length"}) {
+        snapshot->headers.erase(added);
+    }
+
+    auto race = std::make_shared<HedgeRace>();
+    race->route = &compiled;
+    race->request = std::move(snapshot);
+    race->downstream_path = req.path;
+    race->downstream_query = extract_query_from_target(req.target);
+    race->first_target = target;
+    race->first = &client;
+    hedge_timer_->schedule(std::chrono::steady_clock::now() + *delay, [race] {
+        std::lock_guard lock(race->mutex);
+        if (race->first_headers || race->first_returned || !race->route->hedge->spend()) {
+            return;
+        }
+        // Another target when the balancer offers one, else a second connection to the same.
+        const std::shared_ptr<UpstreamTarget>& hedge_target = race->route->balancer.pick();
+        httplib::Request request = *race->request;
+        if (hedge_target->endpoint().base_path != race->first_target->endpoint().base_path) {
+            request.path = build_forward_path(
+                race->downstream_path, race->downstream_query, hedge_target->endpoint().base_path);
+        }
+        race->hedged = true;
+        race->worker = std::thread(
+            run_hedge, race, std::move(request), hedge_target, hedge_target == race->first_target);
+    });
+    return race;
+}
+
+void HttplibEngine::proxy_request(const httplib::Request& req,
+                                  httplib::Response& res,
+                                  const httplib::ContentReader* body_reader) {
+    const auto started_at = std::chrono::steady_clock::now();
+
+    if (metrics_ != nullptr && req.path == kMetricsPath && (req.method == "GET" || req.method == "HEAD")) {
+        serve_metrics(req, res);
+        return;
+    }
+
+    RequestSample sample;
+    sample.path = req.path;
+
+    const RouteTable& routes = routes_.current();
+    const std::string host_header = req.get_header_value("Host");
+    const CompiledRoute* compiled = routes.find(host_header, req.path);
+    if (compiled == nullptr) {
+        drain_request_body(body_reader);
+        res.status = 500;
+        res.set_content("No route configured for host", "text/plain");
+        sample.status = res.status;
+        sample.bytes_out = res.body.size();
+        record(sample, started_at);
+        if (capture_ != nullptr) {
+            capture(captured_request(req, {}, 0), sample, started_at, res.body);
+        }
+        notify(
+            NotificationIcon::Error,
+            "Proxy error",
+            "No route configured for " + host_header + req.path,
+            "route-match",
+            "");
+        return;
+    }
+
+    const ProxyRoute& route = compiled->route;
+    sample.route = route.name;
+    if (compiled->faults.active()) {
+        if (inject_fault(req, res, body_reader, *compiled, sample, started_at)) {
+            return;
+        }
+    }
+    if (compiled->mock) {
+        serve_mock(req, res, body_reader, *compiled, sample, started_at);
+        return;
+    }
+    if (compiled->balancer.empty()) {
+        drain_request_body(body_reader);
+        res.status = 500;
+        res.set_content("Invalid route target URL", "text/plain");
+        sample.status = res.status;
+        sample.bytes_out = res.body.size();
+        record(sample, started_at);
+        if (capture_ != nullptr) {
+            capture(captured_request(req, {}, 0), sample, started_at, res.body);
+        }
+        if (const auto outcome = request_notification(*compiled, res.status, started_at)) {
+            notify(
+                NotificationIcon::Error,
+                "Proxy error",
+                "Invalid target URL for route " + route.name,
+                "target-url",
+                route.name,
+                *outcome);
+        }
+        return;
+    }
+
+    const std::shared_ptr<UpstreamTarget>& target = compiled->balancer.pick();
+    const TargetEndpoint& endpoint = target->endpoint();
+
+    httplib::Headers headers;
+    for (const auto& [key, value] : req.headers) {
+        if (is_excluded_header(key)) {
+            continue;
+        }
+        headers.emplace(key, value);
+    }
+
+    httplib::Request outgoing;
+    outgoing.method = req.method;
+    outgoing.path = build_forward_path(
+        req.path,
+        extract_query_from_target(req.target),
+        endpoint.base_path);
+    outgoing.headers = std::move(headers);
+
+    bool breaker_probe = false;
+    ConcurrencyPermit permit;
+    if (route.stream_bodies) {
+        if (!admit_upstream(req, res, body_reader, *compiled, sample, started_at, breaker_probe, permit)) {
+            return;
+        }
+        proxy_streaming_request(req,
+                                res,
+                                body_reader,
+                                *compiled,
+                                target,
+                                routes.stream_buffer_bytes(),
+                                std::move(outgoing),
+                                started_at,
+                                breaker_probe,
+                                std::move(permit));
+        return;
+    }
+
+    // Fresh stored responses are served here. A stale one with an ETag is validated with
+    // a conditional request, and a 304 answer serves it again.
+    const auto request_header = [&req](std::string_view name) { return header_value(req.headers, name); };
+    CacheRequest cache_req;
+    std::shared_ptr<const CachedResponse> cached;
+    if (compiled->cache && body_reader == nullptr && req.body.empty()) {
+        cache_req = cache_request(req.method, request_header);
+    }
+    if (cache_req.usable) {
+        cached = compiled->cache->find(req.target, request_header);
+        if (cached && is_fresh(*cached, cache_req, started_at)) {
+            respond_from_cache(res, *cached, cache_req, started_at);
+            sample.status = res.status;
+            sample.bytes_out = res.body.size();
+            sample.cache = CacheResult::Hit;
+            record(sample, started_at);
+            if (capture_ != nullptr) {
+                capture(captured_request(req, {}, 0), sample, started_at, res.body);
+            }
+            const auto served_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - started_at).count();
+            if (const auto outcome = request_notification(*compiled, res.status, started_at)) {
+                notify(
+                    icon_for_status(res.status),
+                    build_request_title(req.method, served_ms),
+                    "",
+                    req.path,
+                    route.name,
+                    *outcome);
+            }
+            return;
+        }
+        if (cached && !cached->etag.empty()) {
+            outgoing.headers.erase("If-None-Match");
+            outgoing.headers.emplace("If-None-Match", cached->etag);
+        } else {
+            cached.reset();
+        }
+        sample.cache = CacheResult::Miss;
+    }
+
+    // Identical GETs already in flight on this route share that request's response.
+    RequestCoalescer<CoalescedResponse>::Lead lead;
+    if (route.coalesce && body_reader == nullptr && req.body.empty() && is_coalescable_method(req.method)) {
+        const auto header = [&req](const std::string& name) { return req.get_header_value(name); };
+        auto [joined, shared] = coalescer_.join(coalescing_key(route, req.method, req.target, header));
+        if (shared) {
+            res.status = shared->status;
+            res.headers = shared->headers;
+            res.body = shared->body;
+
+            sample.status = res.status;
+            sample.bytes_out = res.body.size();
+            sample.coalesced = true;
+            record(sample, started_at);
+            if (capture_ != nullptr) {
+                capture(captured_request(req, {}, 0), sample, started_at, res.body);
+            }
+            const auto waited_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - started_at).count();
+            if (const auto outcome = request_notification(*compiled, res.status, started_at)) {
+                notify(
+                    icon_for_status(res.status),
+                    build_request_title(req.method, waited_ms),
+                    "",
+                    req.path,
+                    route.name,
+                    *outcome);
+            }
+            return;
+        }
+        // Without a shared response the leader failed; go upstream like any other request.
+        lead = std::move(joined);
+    }
+
+    if (!admit_upstream(req, res, body_reader, *compiled, sample, started_at, breaker_probe, permit)) {
+        return;
+    }
+
+    outgoing.body = body_reader != nullptr ? read_request_body(*body_reader) : req.body;
+    sample.bytes_in = outgoing.body.size();
+
+    std::chrono::steady_clock::time_point first_byte_at;
+    std::shared_ptr<HedgeRace> race;
+    outgoing.response_handler = [&first_byte_at, &race](const httplib::Response&) {
+        first_byte_at = std::chrono::steady_clock::now();
+        if (race) {
+            std::lock_guard lock(race->mutex);
+            race->first_headers = true;
+        }
+        return true;
+    };
+
+    InFlightRequest in_flight(target);
+    auto lease = target->pool()->acquire();
+    const auto sent_at = std::chrono::steady_clock::now();
+    if (compiled->hedge && is_idempotent_method(req.method)) {
+        race = arm_hedge(*compiled, req, outgoing, target, lease.client());
+    }
+    auto result = lease.client().send(outgoing);
+    if (!result && lease.reused() && is_idempotent_method(req.method) &&
+        retry_first_attempt(race.get(), nullptr)) {
+        // The upstream may close an idle keep-alive socket between our probe and the write.
+        lease.discard();
+        lease = target->pool()->acquire_fresh();
+        if (retry_first_attempt(race.get(), &lease.client())) {
+            result = lease.client().send(outgoing);
+        }
+    }
+    sample.connect = lease.connect_time();
+    sample.resolver_hit = lease.resolver_hit();
+    if (compiled->hedge && first_byte_at != std::chrono::steady_clock::time_point{}) {
+        compiled->hedge->record(std::chrono::duration_cast<std::chrono::microseconds>(first_byte_at - sent_at));
+    }
+    if (race) {
+        {
+            std::lock_guard lock(race->mutex);
+            race->first = nullptr;
+            race->first_returned = true;
+            race->first_won = result && !race->hedge_won;
+            if (race->first_won && race->second != nullptr) {
+                race->second->stop();
+            }
+        }
+        // A first attempt that failed outright still waits for its hedge's answer.
+        race->join();
+        sample.hedged = race->hedged;
+        sample.hedge_won = race->hedge_won;
+        if (race->hedge_won) {
+            if (first_byte_at == std::chrono::steady_clock::time_point{}) {
+                compiled->hedge->record(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - sent_at));
+            }
+            result = std::move(race->result);
+            first_byte_at = race->first_byte_at;
+            sample.connect = race->connect_time;
+            sample.resolver_hit = race->resolver_hit;
+        }
+    }
+    const auto ended_at = std::chrono::steady_clock::now();
+    const auto elapsed_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(ended_at - started_at).count();
+    report_upstream(*compiled, breaker_probe, result && !is_gateway_error(result->status));
+    permit.record(result && !is_gateway_error(result->status), ended_at);
+
+    if (!result) {
+        res.status = 502;
+        res.set_content("Failed to reach upstream target", "text/plain");
+        sample.status = res.status;
+        sample.bytes_out = res.body.size();
+        record(sample, started_at);
+        if (capture_ != nullptr) {
+            capture(captured_request(req, outgoing.body, capture_->body_limit()), sample, started_at, res.body);
+        }
+        if (const auto outcome = request_notification(*compiled, res.status, started_at)) {
+            notify(
+                NotificationIcon::Error,
+                "Proxy error",
+                "Failed to connect to " + target->url(),
+                "upstream",
+                route.name,
+                *outcome);
+        }
+        return;
+    }
+
+    res.status = result->status;
+    res.body = std::move(result->body);
+    for (const auto& [key, value] : result->headers) {
+        if (is_excluded_header(key)) {
+            continue;
+        }
+        res.set_header(key.c_str(), value.c_str());
+    }
+    if (cached && res.status == 304) {
+        cached = refresh_cache_entry(*cached, cache_headers(res.headers), ended_at);
+        compiled->cache->store(req.target, cached);
+        respond_from_cache(res, *cached, cache_req, ended_at);
+        sample.cache = CacheResult::Revalidated;
+    } else if (cache_req.usable && req.method == "GET") {
+        if (auto entry = make_cache_entry(
+                cache_req, request_header, res.status, result->reason, cache_headers(res.headers), ended_at)) {
+            entry->body = res.body;
+            compiled->cache->store(req.target, std::move(entry));
+        }
+    }
+    lead.publish(std::make_shared<const CoalescedResponse>(CoalescedResponse{res.status, res.headers, res.body}));
+
+    sample.status = res.status;
+    sample.bytes_out = res.body.size();
+    sample.ttfb = std::chrono::duration_cast<std::chrono::microseconds>(first_byte_at - started_at);
+    record(sample, started_at);
+    if (capture_ != nullptr) {
+        capture(captured_request(req, outgoing.body, capture_->body_limit()), sample, started_at, res.body);
+    }
+
+    if (const auto outcome = request_notification(*compiled, res.status, started_at)) {
+        notify(
+            icon_for_status(res.status),
+            build_request_title(req.method, elapsed_ms),
+            "",
+            req.path,
+            route.name,
+            *outcome);
+    }
+}
+
+void HttplibEngine::add_server(size_t listener) {
+    auto server = std::make_unique<ProxyServer>();
+#ifndef _WIN32
+    // httplib's POSIX default is SO_REUSEPORT alone, which lets a second proxy bind the same
+    // port and leaves TIME_WAIT connections blocking the next start's bind.
+    server->set_socket_options([](socket_t sock) {
+        const int enabled = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+    });
+#endif
+    if (metrics_ != nullptr) {
+        server->new_task_queue = [metrics = metrics_, listener] { return new CountingTaskQueue(*metrics, listener); };
+    }
+
+    auto guarded = [this](const httplib::Request& req,
+                          httplib::Response& res,
+                          const httplib::ContentReader* body_reader) {
+        busy_.fetch_add(1, std::memory_order_relaxed);
+        try {
+            proxy_request(req, res, body_reader);
+        } catch (...) {
+            res.status = 500;
+            res.set_content("Internal proxy error", "text/plain");
+            notify(NotificationIcon::Error, "Proxy error", "Unhandled exception.", "internal");
+        }
+        if (draining_.load(std::memory_order_relaxed)) {
+            // httplib closes the connection after this response; say so, so the client does not reuse it.
+            res.headers.erase("Connection");
+            res.set_header("Connection", "close");
+        }
+        if (!res.content_provider_) {
+            busy_.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+        // A streamed body is written after the handler returns; the request is done when
+        // httplib releases its provider.
+        res.content_provider_resource_releaser_ =
+            [this, release = std::move(res.content_provider_resource_releaser_)](bool success) {
+                if (release) {
+                    release(success);
+                }
+                busy_.fetch_sub(1, std::memory_order_relaxed);
+            };
+    };
+    auto handler = [guarded](const httplib::Request& req, httplib::Response& res) {
+        guarded(req, res, nullptr);
+    };
+    // Requests with a body get the reader variant so streaming routes can forward it unbuffered.
+    auto body_handler = [guarded](const httplib::Request& req,
+                                  httplib::Response& res,
+                                  const httplib::ContentReader& body_reader) {
+        guarded(req, res, &body_reader);
+    };
+
+    server->Get(R"(/.*)", handler);
+    server->Post(R"(/.*)", body_handler);
+    server->Post(R"(/.*)", handler);
+    server->Put(R"(/.*)", body_handler);
+    server->Put(R"(/.*)", handler);
+    server->Delete(R"(/.*)", body_handler);
+    server->Delete(R"(/.*)", handler);
+    server->Patch(R"(/.*)", body_handler);
+    server->Patch(R"(/.*)", handler);
+    server->Options(R"(/.*)", handler);
+
+    // Handlers get a parsed request but never the socket, so a protocol switch cannot be
+    // relayed here. Refuse it rather than forward a handshake that cannot complete.
+    server->set_pre_routing_handler([](const httplib::Request& req, httplib::Response& res) {
+        if (req.method != "CONNECT" &&
+            !is_upgrade_request(req.get_header_value("Connection"), req.get_header_value("Upgrade"))) {
+            return httplib::Server::HandlerResponse::Unhandled;
+        }
+        res.status = 501;
+        res.set_content("WebSocket and CONNECT tunnels need engine=epoll", "text/plain");
+        return httplib::Server::HandlerResponse::Handled;
+    });
+
+    // Small proxied responses would otherwise wait out Nagle against delayed ACKs.
+    server->set_tcp_nodelay(true);
+    // Wake the accept loop now and then so drain() can stop it without a shutdown().
+    server->set_idle_interval(0, 100000);
+    servers_.push_back(std::move(server));
+}
+
+void HttplibEngine::run_servers() {
+    draining_ = false;
+    for (auto& server : servers_) {
+        threads_.emplace_back([server = server.get()] { server->listen_after_bind(); });
+    }
+    for (auto& server : servers_) {
+        server->wait_until_ready();
+    }
+}
+
+bool HttplibEngine::start(const std::string& host, int port) {
+#ifdef __linux__
+    std::vector<int> listen_fds = open_listen_sockets(host, port, std::max<size_t>(options_.listeners, 1));
+    if (listen_fds.empty()) {
+        return false;
+    }
+    return start_inherited(listen_fds);
+#else
+    add_server(0);
+    port_ = port == 0 ? servers_[0]->bind_to_any_port(host) : (servers_[0]->bind_to_port(host, port) ? port : -1);
+    if (port_ <= 0) {
+        servers_.clear();
+        port_ = 0;
+        return false;
+    }
+    run_servers();
+    return true;
+#endif
+}
+
+#ifndef _WIN32
+bool HttplibEngine::start_inherited(const std::vector<int>& listen_fds) {
+    std::string address;
+    int port = 0;
+    if (!listen_fds.empty()) {
+        httplib::detail::get_local_ip_and_port(listen_fds.front(), address, port);
+    }
+    if (port <= 0) {
+        return false;
+    }
+    for (size_t i = 0; i < listen_fds.size(); ++i) {
+        add_server(i);
+        servers_.back()->adopt(listen_fds[i]);
+    }
+    port_ = port;
+    run_servers();
+    return true;
+}
+
+std::vector<int> HttplibEngine::listen_sockets() const {
+    std::vector<int> fds;
+    for (const auto& server : servers_) {
+        if (server->listening_socket() != INVALID_SOCKET) {
+            fds.push_back(server->listening_socket());
+        }
+    }
+    return fds;
+}
+#endif
+
+size_t HttplibEngine::drain(std::chrono::milliseconds timeout) {
+    if (servers_.empty() || draining_) {
+        return busy_.load(std::memory_order_relaxed);
+    }
+    draining_ = true;
+    for (auto& server : servers_) {
+        drained_sockets_.push_back(server->stop_accepting());
+    }
+
+    // Idle keep-alive connections end on their own: httplib stops serving a connection
+    // once the server socket is gone.
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (busy_.load(std::memory_order_relaxed) > 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return busy_.load(std::memory_order_relaxed);
+}
+
+void HttplibEngine::stop() {
+    if (!draining_) {
+        for (auto& server : servers_) {
+            server->stop();
+        }
+    }
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+    for (const socket_t sock : drained_sockets_) {
+        if (sock != INVALID_SOCKET) {
+            httplib::detail::close_socket(sock);
+        }
+    }
+    drained_sockets_.clear();
+    servers_.clear();
+}
+
+}  // namespace notiman
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <httplib/httplib.h>
+
+#include "proxy_engine.h"
+#include "request_coalescer.h"
+#include "traffic_capture.h"
+
+namespace notiman {
+
+struct StreamingExchange;
+struct CoalescedResponse;
+struct HedgeRace;
+class HedgeTimer;
+class ProxyServer;
+
+struct HttplibEngineOptions {
+    // Linux: listening sockets in one SO_REUSEPORT group, each with its own httplib::Server,
+    // accept thread and worker pool. Other platforms always use one.
+    size_t listeners = 1;
+};
+
+// Thread-per-connection engine on top of httplib::Server. Available on every platform.
+class HttplibEngine : public ProxyEngine {
+public:
+    HttplibEngine(HttplibEngineOptions options,
+                  RouteTablePublisher& routes,
+                  NotificationDispatcher* notifications,
+                  ProxyMetrics* metrics,
+                  TrafficCapture* capture);
+    ~HttplibEngine() override;
+
+    bool start(const std::string& host, int port) override;
+#ifndef _WIN32
+    bool start_inherited(const std::vector<int>& listen_fds) override;
+    std::vector<int> listen_sockets() const override;
+#endif
+    size_t drain(std::chrono::milliseconds timeout) override;
+    void stop() override;
+    int port() const override { return port_; }
+    const char* name() const override { return "httplib"; }
+
+private:
+    // Creates the server for listening socket number listener.
+    void add_server(size_t listener);
+    void run_servers();
+
+    void proxy_request(const httplib::Request& req,
+                       httplib::Response& res,
+                       const httplib::ContentReader* body_reader);
+    void proxy_streaming_request(const httplib::Request& req,
+                                 httplib::Response& res,
+                                 const httplib::ContentReader* body_reader,
+                                 const CompiledRoute& compiled,
+                                 const std::shared_ptr<UpstreamTarget>& target,
+                                 size_t buffer_bytes,
+                                 httplib::Request outgoing,
+                                 std::chrono::steady_clock::time_point started_at,
+                                 bool breaker_probe,
+                                 ConcurrencyPermit permit);
+    void respond_from_stream(const httplib::Request& req,
+                             httplib::Response& res,
+                             const CompiledRoute& compiled,
+                             const std::shared_ptr<StreamingExchange>& exchange,
+                             std::chrono::steady_clock::time_point started_at,
+                             bool breaker_probe);
+    // Waits for a slot under the route's concurrency limit, then asks its circuit breaker
+    // whether the request may go upstream. When it may not, answers and records it as a 503
+    // and returns false.
+    bool admit_upstream(const httplib::Request& req,
+                        httplib::Response& res,
+                        const httplib::ContentReader* body_reader,
+                        const CompiledRoute& compiled,
+                        RequestSample& sample,
+                        std::chrono::steady_clock::time_point started_at,
+                        bool& probe,
+                        ConcurrencyPermit& permit);
+    // Reports how the upstream answered an admitted request to the route's circuit breaker.
+    void report_upstream(const CompiledRoute& compiled, bool probe, bool success);
+    // Schedules a hedge for a request to a route with hedge=true, to start once the first
+    // attempt, about to go out on client, has gone the route's hedge delay without an
+    // answer. Must be called before outgoing is sent: the hedge resends a copy taken here.
+    // Null while the route is still learning its latency.
+    std::shared_ptr<HedgeRace> arm_hedge(const CompiledRoute& compiled,
+                                         const httplib::Request& req,
+                                         const httplib::Request& outgoing,
+                                         const std::shared_ptr<UpstreamTarget>& target,
+                                         httplib::ClientImpl& client);
+    // Runs the route's notification policy over a finished request. The outcome to attach to
+    // its notification, or nullopt when it is not to be reported; build nothing else before.
+    std::optional<RequestOutcome> request_notification(const CompiledRoute& compiled,
+                                                       int status,
+                                                       std::chrono::steady_clock::time_point started_at);
+    void serve_metrics(const httplib::Request& req, httplib::Response& res);
+    // Draws the route's error and reset faults; delays never reach this engine. True when the
+    // fault answered the request itself.
+    bool inject_fault(const httplib::Request& req,
+                      httplib::Response& res,
+                      const httplib::ContentReader* body_reader,
+                      const CompiledRoute& compiled,
+                      RequestSample& sample,
+                      std::chrono::steady_clock::time_point started_at);
+    // Answers from the route's mock store. Ranges are sliced by httplib from the mapped body.
+    void serve_mock(const httplib::Request& req,
+                    httplib::Response& res,
+                    const httplib::ContentReader* body_reader,
+                    const CompiledRoute& compiled,
+                    RequestSample& sample,
+                    std::chrono::steady_clock::time_point started_at);
+    void record(RequestSample sample, std::chrono::steady_clock::time_point started_at);
+    // Completes a record started by captured_request() and queues it for the capture writer.
+    void capture(CapturedExchange exchange,
+                 const RequestSample& sample,
+                 std::chrono::steady_clock::time_point started_at,
+                 std::string_view response_body = {});
+
+    // Queues a notification for the dispatcher thread. Never blocks the caller.
+    void notify(NotificationIcon icon,
+                std::string title,
+                std::string body = {},
+                std::string code = {},
+                std::string project = {},
+                std::optional<RequestOutcome> request = std::nullopt);
+
+    HttplibEngineOptions options_;
+    RouteTablePublisher& routes_;
+    NotificationDispatcher* notifications_;
+    ProxyMetrics* metrics_;
+    TrafficCapture* capture_;
+    RequestCoalescer<CoalescedResponse> coalescer_;
+    std::unique_ptr<HedgeTimer> hedge_timer_;
+    std::vector<std::unique_ptr<ProxyServer>> servers_;
+    std::vector<std::thread> threads_;
+    int port_ = 0;
+    std::vector<socket_t> drained_sockets_;  // taken from the servers by drain(), closed by stop()
+    std::atomic<size_t> busy_ = 0;           // requests between the handler and the end of their response
+    std::atomic<bool> draining_ = false;
+};
+
+}  // namespace notiman
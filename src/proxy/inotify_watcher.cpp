@@ -0,0 +1,147 @@
+#include "inotify_watcher.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <utility>
+
+namespace notiman {
+
+InotifyWatcher::~InotifyWatcher() {
+    stop();
+}
+
+namespace {
+
+constexpr uint32_t kTreeEvents = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+}  // namespace
+
+bool InotifyWatcher::open() {
+    stop();
+
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotify_fd_ < 0 || wake_fd_ < 0) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+bool InotifyWatcher::start(const std::filesystem::path& file, std::function<void()> on_change) {
+    if (!open()) {
+        return false;
+    }
+
+    // Watch the directory, not the file: editors often save by renaming a new file over it.
+    const std::filesystem::path directory = file.has_parent_path() ? file.parent_path() : ".";
+    if (inotify_add_watch(inotify_fd_, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        stop();
+        return false;
+    }
+
+    filename_ = file.filename().string();
+    on_change_ = std::move(on_change);
+    thread_ = std::thread([this] { run(); });
+    return true;
+}
+
+bool InotifyWatcher::start_tree(const std::filesystem::path& directory, std::function<void()> on_change) {
+    if (!open()) {
+        return false;
+    }
+    watch_tree(directory);
+    if (tree_dirs_.empty()) {
+        stop();
+        return false;
+    }
+    filename_.clear();
+    on_change_ = std::move(on_change);
+    thread_ = std::thread([this] { run(); });
+    return true;
+}
+
+void InotifyWatcher::watch_tree(const std::filesystem::path& directory) {
+    const int wd = inotify_add_watch(inotify_fd_, directory.c_str(), kTreeEvents | IN_ONLYDIR);
+    if (wd < 0) {
+        return;
+    }
+    tree_dirs_[wd] = directory;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (entry.is_directory(error) && !entry.is_symlink(error)) {
+            watch_tree(entry.path());
+        }
+    }
+}
+
+void InotifyWatcher::stop() {
+    if (wake_fd_ >= 0) {
+        const uint64_t one = 1;
+        [[maybe_unused]] const ssize_t written = write(wake_fd_, &one, sizeof(one));
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (inotify_fd_ >= 0) {
+        close(inotify_fd_);
+        inotify_fd_ = -1;
+    }
+    if (wake_fd_ >= 0) {
+        close(wake_fd_);
+        wake_fd_ = -1;
+    }
+    tree_dirs_.clear();
+}
+
+void InotifyWatcher::run() {
+    alignas(inotify_event) char buf[4096];
+    pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if ((fds[1].revents & POLLIN) != 0) {
+            return;
+        }
+
+        bool changed = false;
+        for (;;) {
+            const ssize_t length = read(inotify_fd_, buf, sizeof(buf));
+            if (length <= 0) {
+                break;
+            }
+            for (ssize_t offset = 0; offset < length;) {
+                const auto* event = reinterpret_cast<const inotify_event*>(buf + offset);
+                if (filename_.empty()) {
+                    changed = true;
+                    const auto dir = tree_dirs_.find(event->wd);
+                    if ((event->mask & IN_ISDIR) != 0 && (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0 &&
+                        dir != tree_dirs_.end()) {
+                        watch_tree(dir->second / event->name);
+                    }
+                    if ((event->mask & IN_IGNORED) != 0) {
+                        tree_dirs_.erase(event->wd);
+                    }
+                } else if (event->len > 0 && filename_ == event->name) {
+                    changed = true;
+                }
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+            }
+        }
+        if (changed) {
+            on_change_();
+        }
+    }
+}
+
+}  // namespace notiman
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace notiman {
+
+// Linux counterpart of run_config_watcher: watches a file's directory with inotify and
+// calls on_change from its own thread whenever that file is written or replaced. With
+// start_tree it watches a whole directory tree instead and reports any change in it.
+class InotifyWatcher {
+public:
+    InotifyWatcher() = default;
+    InotifyWatcher(const InotifyWatcher&) = delete;
+    InotifyWatcher& operator=(const InotifyWatcher&) = delete;
+    ~InotifyWatcher();
+
+    bool start(const std::filesystem::path& file, std::function<void()> on_change);
+    // Directories created later are watched as they appear.
+    bool start_tree(const std::filesystem::path& directory, std::function<void()> on_change);
+    void stop();
+
+private:
+    bool open();
+    void watch_tree(const std::filesystem::path& directory);
+    void run();
+
+    int inotify_fd_ = -1;
+    int wake_fd_ = -1;
+    std::string filename_;  // empty when watching a tree
+    std::unordered_map<int, std::filesystem::path> tree_dirs_;  // by watch descriptor
+    std::function<void()> on_change_;
+    std::thread thread_;
+};
+
+}  // namespace notiman
@@ -0,0 +1,104 @@
+#include "listen_sockets.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace notiman {
+
+namespace {
+
+int open_socket(const sockaddr* address, socklen_t length, bool reuse_port, bool listening) {
+    const int fd = socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    const int enabled = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+    if (reuse_port) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled));
+    }
+    // Accepted connections inherit it, so small responses never wait out Nagle against delayed ACKs.
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+    if (bind(fd, address, length) != 0 || (listening && listen(fd, SOMAXCONN) != 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Binds a socket without SO_REUSEPORT: that fails on a port something listens on,
+// whether or not the listener is in a reuseport group.
+bool address_free(const sockaddr* address, socklen_t length) {
+    const int probe = open_socket(address, length, false, false);
+    if (probe < 0) {
+        return false;
+    }
+    close(probe);
+    return true;
+}
+
+}  // namespace
+
+std::vector<int> open_listen_sockets(const std::string& host, int port, size_t count) {
+    std::vector<int> fds;
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+    addrinfo* result = nullptr;
+    if (count == 0 || getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+        return fds;
+    }
+
+    const bool group = count > 1;
+    for (const addrinfo* info = result; info != nullptr && fds.empty(); info = info->ai_next) {
+        if (group && port != 0 && !address_free(info->ai_addr, info->ai_addrlen)) {
+            continue;
+        }
+        const int first = open_socket(info->ai_addr, info->ai_addrlen, group, true);
+        if (first < 0) {
+            continue;
+        }
+        fds.push_back(first);
+
+        // The rest join the first one's address, port included when it was picked for us.
+        sockaddr_storage address{};
+        socklen_t length = sizeof(address);
+        getsockname(first, reinterpret_cast<sockaddr*>(&address), &length);
+        while (fds.size() < count) {
+            const int fd = open_socket(reinterpret_cast<const sockaddr*>(&address), length, true, true);
+            if (fd < 0) {
+                close_listen_sockets(fds);
+                break;
+            }
+            fds.push_back(fd);
+        }
+    }
+    freeaddrinfo(result);
+    return fds;
+}
+
+int bound_port(int fd) {
+    sockaddr_storage address{};
+    socklen_t length = sizeof(address);
+    if (getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        return 0;
+    }
+    if (address.ss_family == AF_INET6) {
+        return ntohs(reinterpret_cast<const sockaddr_in6*>(&address)->sin6_port);
+    }
+    return ntohs(reinterpret_cast<const sockaddr_in*>(&address)->sin_port);
+}
+
+void close_listen_sockets(std::vector<int>& fds) {
+    for (const int fd : fds) {
+        close(fd);
+    }
+    fds.clear();
+}
+
+}  // namespace notiman
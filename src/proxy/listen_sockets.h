@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace notiman {
+
+// Opens count non-blocking, close-on-exec TCP_NODELAY sockets listening on host:port (0
+// picks a free port). With more than one they form an SO_REUSEPORT group on one address and the kernel
+// spreads new connections over them, so each can have its own accepting thread without a
+// shared accept queue. A port some other process listens on is refused even when that
+// process uses SO_REUSEPORT itself. Empty on failure.
+std::vector<int> open_listen_sockets(const std::string& host, int port, size_t count);
+
+// Local port of a bound socket, 0 if it cannot be read.
+int bound_port(int fd);
+
+void close_listen_sockets(std::vector<int>& fds);
+
+}  // namespace notiman
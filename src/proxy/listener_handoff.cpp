@@ -0,0 +1,238 @@
+#include "listener_handoff.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+extern char** environ;
+
+namespace notiman {
+
+namespace {
+
+// systemd passes its sockets from fd 3 on (SD_LISTEN_FDS_START); the handoff does the same
+// and puts the ready pipe right after them.
+constexpr int kFirstListenFd = 3;
+constexpr const char* kListenFdsVariable = "NOTIMAN_LISTEN_FDS";
+constexpr const char* kReadyFdVariable = "NOTIMAN_READY_FD";
+
+int env_int(const char* name) {
+    const char* value = std::getenv(name);
+    if (value == nullptr || *value == '\0') {
+        return -1;
+    }
+    char* end = nullptr;
+    const long number = std::strtol(value, &end, 10);
+    return *end == '\0' && number >= 0 && number <= INT_MAX ? static_cast<int>(number) : -1;
+}
+
+bool is_listening_socket(int fd) {
+    int accepting = 0;
+    socklen_t length = sizeof(accepting);
+    return getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &length) == 0 && accepting != 0;
+}
+
+void set_cloexec(int fd) {
+    const int flags = fcntl(fd, F_GETFD);
+    if (flags >= 0) {
+        fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+    }
+}
+
+bool is_variable(const char* entry, std::string_view name) {
+    return std::strncmp(entry, name.data(), name.size()) == 0 && entry[name.size()] == '=';
+}
+
+// Runs in the forked child: async-signal-safe calls only.
+void close_descriptors_from(int first, long max_fd) {
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, static_cast<unsigned>(first), ~0u, 0u) == 0) {
+        return;
+    }
+#endif
+    for (long fd = first; fd < max_fd; ++fd) {
+        close(static_cast<int>(fd));
+    }
+}
+
+}  // namespace
+
+InheritedSockets take_inherited_sockets() {
+    InheritedSockets sockets;
+
+    int count = env_int(kListenFdsVariable);
+    // LISTEN_PID keeps a child that inherited systemd's variables from taking its sockets.
+    if (count < 0 && env_int("LISTEN_PID") == getpid()) {
+        count = env_int("LISTEN_FDS");
+    }
+    for (int fd = kFirstListenFd; fd < kFirstListenFd + count; ++fd) {
+        if (is_listening_socket(fd)) {
+            set_cloexec(fd);
+            sockets.listen_fds.push_back(fd);
+        }
+    }
+
+    const int ready_fd = env_int(kReadyFdVariable);
+    if (ready_fd >= 0 && fcntl(ready_fd, F_GETFD) >= 0) {
+        set_cloexec(ready_fd);
+        sockets.ready_fd = ready_fd;
+    }
+
+    for (const char* name : {kListenFdsVariable, kReadyFdVariable, "LISTEN_PID", "LISTEN_FDS", "LISTEN_FDNAMES"}) {
+        unsetenv(name);
+    }
+    return sockets;
+}
+
+void report_ready(int ready_fd) {
+    if (ready_fd < 0) {
+        notify_service_manager("READY=1");
+        return;
+    }
+    const char ready = 1;
+    [[maybe_unused]] const ssize_t written = write(ready_fd, &ready, 1);
+    close(ready_fd);
+}
+
+void notify_service_manager(const std::string& state) {
+    const char* path = std::getenv("NOTIFY_SOCKET");
+    if (path == nullptr || (path[0] != '/' && path[0] != '@')) {
+        return;
+    }
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const size_t length = std::strlen(path);
+    if (length >= sizeof(address.sun_path)) {
+        return;
+    }
+    std::memcpy(address.sun_path, path, length);
+    if (path[0] == '@') {
+        address.sun_path[0] = '\0';  // abstract namespace
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return;
+    }
+    sendto(fd, state.data(), state.size(), MSG_NOSIGNAL, reinterpret_cast<const sockaddr*>(&address),
+           static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + length));
+    close(fd);
+}
+
+pid_t start_successor(const std::filesystem::path& exe,
+                      const std::vector<std::string>& args,
+                      const std::vector<int>& listen_fds,
+                      std::chrono::milliseconds timeout) {
+    const int count = static_cast<int>(listen_fds.size());
+    const int ready_slot = kFirstListenFd + count;
+
+    // Everything the child needs is built before fork: another thread may hold the
+    // allocator's lock at that moment, so the child must not allocate.
+    std::vector<std::string> environment;
+    for (char** entry = environ; *entry != nullptr; ++entry) {
+        if (!is_variable(*entry, kListenFdsVariable) && !is_variable(*entry, kReadyFdVariable)) {
+            environment.emplace_back(*entry);
+        }
+    }
+    if (count > 0) {
+        environment.push_back(std::string(kListenFdsVariable) + "=" + std::to_string(count));
+    }
+    environment.push_back(std::string(kReadyFdVariable) + "=" + std::to_string(ready_slot));
+
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    std::vector<char*> envp;
+    for (auto& entry : environment) {
+        envp.push_back(entry.data());
+    }
+    envp.push_back(nullptr);
+    const std::string path = exe.string();
+    const long max_fd = sysconf(_SC_OPEN_MAX);
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    // Above the slots they are moved to, so no dup2 overwrites another one's source.
+    std::vector<int> sources;
+    bool duplicated = true;
+    for (const int fd : listen_fds) {
+        sources.push_back(fcntl(fd, F_DUPFD_CLOEXEC, ready_slot + 1));
+        duplicated = duplicated && sources.back() >= 0;
+    }
+    sources.push_back(fcntl(ready[1], F_DUPFD_CLOEXEC, ready_slot + 1));
+    duplicated = duplicated && sources.back() >= 0;
+    close(ready[1]);
+
+    const pid_t pid = duplicated ? fork() : -1;
+    if (pid == 0) {
+        bool moved = true;
+        for (int i = 0; i <= count; ++i) {
+            moved = moved && dup2(sources[static_cast<size_t>(i)], kFirstListenFd + i) == kFirstListenFd + i;
+        }
+        if (moved) {
+            // Upstream sockets are not all close-on-exec; the successor must not keep them open.
+            close_descriptors_from(ready_slot + 1, max_fd);
+            // The parent blocks the signals it waits for; the successor sets up its own.
+            sigprocmask(SIG_SETMASK, &no_signals, nullptr);
+            execve(path.c_str(), argv.data(), envp.data());
+        }
+        _exit(127);
+    }
+    for (const int fd : sources) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (pid < 0) {
+        close(ready[0]);
+        return -1;
+    }
+
+    // The successor writes one byte once it accepts; EOF means it exited first.
+    bool ready_seen = false;
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+        const auto remaining =
+            std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) {
+            break;
+        }
+        pollfd entry{ready[0], POLLIN, 0};
+        const int result = poll(&entry, 1, static_cast<int>(remaining.count()));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result > 0) {
+            char byte = 0;
+            ready_seen = read(ready[0], &byte, 1) == 1;
+        }
+        break;
+    }
+    close(ready[0]);
+    if (ready_seen) {
+        return pid;
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    return -1;
+}
+
+}  // namespace notiman
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace notiman {
+
+// Descriptors handed down by whoever started this process.
+struct InheritedSockets {
+    // Bound and listening, from fd 3 on: from systemd socket activation (LISTEN_FDS), or
+    // from the notiman-proxy this process replaces (NOTIMAN_LISTEN_FDS).
+    std::vector<int> listen_fds;
+    // Write end of the pipe the replaced process waits on (NOTIMAN_READY_FD), or -1.
+    int ready_fd = -1;
+};
+
+// Takes the inherited descriptors and clears the variables that announced them, so they
+// do not leak into processes started later. Call before starting any thread.
+InheritedSockets take_inherited_sockets();
+
+// Tells whoever started this process that it is accepting: the replaced notiman-proxy
+// through ready_fd, which is closed, or else systemd through $NOTIFY_SOCKET.
+void report_ready(int ready_fd);
+
+// Sends a state line such as "MAINPID=123" to systemd. Does nothing outside a service.
+void notify_service_manager(const std::string& state);
+
+// Starts a new notiman-proxy from exe with args (args[0] included), passing listen_fds
+// down as its listeners (none binds its own), and waits up to timeout for it to report
+// ready. Returns its pid, or -1 after killing and reaping a successor that never got ready.
+pid_t start_successor(const std::filesystem::path& exe,
+                      const std::vector<std::string>& args,
+                      const std::vector<int>& listen_fds,
+                      std::chrono::milliseconds timeout);
+
+}  // namespace notiman
@@ -7,26 +7,27 @@
 #include <shellapi.h>
 #include <shlobj.h>
 
-#include <atomic>
-#include <cctype>
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <memory>
-#include <optional>
-#include <shared_mutex>
 #include <string>
 #include <thread>
-#include <unordered_set>
 #include <vector>
 
-#include <httplib/httplib.h>
-
 #include "../shared/payload.h"
 #include "../shared/host_ipc.h"
 #include "../shared/config_watcher.h"
 #include "../shared/tray_icon.h"
+#include "health_checker.h"
+#include "notification_dispatcher.h"
 #include "proxy_config.h"
+#include "proxy_engine.h"
+#include "proxy_metrics.h"
+#include "route_table.h"
+#include "traffic_capture.h"
+#include "upstream_pool.h"
 
 #pragma comment(lib, "shell32.lib")
 
@@ -36,26 +37,32 @@ constexpr UINT IDM_OPEN_SETTINGS = 1001;
 constexpr UINT IDM_EXIT = 1002;
 constexpr UINT WM_TRAYICON = WM_APP + 1;
 constexpr UINT WM_CONFIG_CHANGED = WM_APP + 2;
+constexpr UINT WM_MOCKS_CHANGED = WM_APP + 3;  // wParam: index into g_mock_watchers
+constexpr UINT_PTR IDT_POOL_SWEEP = 1;
+constexpr UINT kPoolSweepIntervalMs = 5000;
 
 NOTIFYICONDATAW g_nid = {};
 HWND g_hwnd = nullptr;
-std::unique_ptr<httplib::Server> g_server;
-std::thread g_server_thread;
-std::atomic_bool g_server_running = false;
-notiman::ProxyConfig g_proxy_config;
-std::shared_mutex g_config_mutex;
+std::unique_ptr<notiman::ProxyEngine> g_engine;
+notiman::ProxyConfig g_proxy_config;  // owned by the UI thread
+notiman::RouteTablePublisher g_routes;
+
+std::unique_ptr<notiman::NotificationDispatcher> g_notifications;
+std::unique_ptr<notiman::ProxyMetrics> g_metrics;  // null when metrics=false
+std::unique_ptr<notiman::HealthChecker> g_health;
+std::unique_ptr<notiman::TrafficCapture> g_capture;  // null when capture_path is empty
 
 std::filesystem::path g_config_path;
 std::thread g_watcher_thread;
 HANDLE g_watcher_dir_handle = INVALID_HANDLE_VALUE;
 
-std::string lowercase(const std::string& input) {
-    std::string result = input;
-    for (char& c : result) {
-        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
-    }
-    return result;
-}
+// Watches a directory that mock routes answer from.
+struct MockWatcher {
+    std::filesystem::path directory;
+    HANDLE dir_handle = INVALID_HANDLE_VALUE;
+    std::thread thread;
+};
+std::vector<std::unique_ptr<MockWatcher>> g_mock_watchers;  // owned by the UI thread
 
 std::wstring utf8_to_utf16(const std::string& utf8) {
     if (utf8.empty()) {
@@ -98,281 +105,135 @@ std::filesystem::path ensure_proxy_config_path() {
     return notiman::ProxyConfig::default_config_path();
 }
 
-void notify_host(notiman::NotificationIcon icon,
-                 const std::wstring& title,
-                 const std::wstring& body = L"",
-                 const std::wstring& code = L"",
-                 const std::wstring& project = L"") {
+// Runs on the dispatcher thread; the only place proxy notifications are widened for the host.
+void deliver_to_host(const notiman::ProxyNotification& notification) {
     notiman::NotificationPayload payload;
-    payload.icon = icon;
-    payload.title = title;
-    payload.body = body;
-    payload.code = code;
-    payload.project = project;
+    payload.icon = notification.icon;
+    payload.title = utf8_to_utf16(notification.title);
+    payload.body = utf8_to_utf16(notification.body);
+    payload.code = utf8_to_utf16(notification.code);
+    payload.project = utf8_to_utf16(notification.project);
     payload.duration = 10000;
     notiman::send_payload_to_host(payload);
 }
 
-struct TargetEndpoint {
-    std::string scheme;
-    std::string host;
-    int port = 80;
-    std::string base_path = "/";
-};
-
-std::optional<TargetEndpoint> parse_target_endpoint(const std::string& url) {
-    const size_t scheme_pos = url.find("://");
-    if (scheme_pos == std::string::npos) {
-        return std::nullopt;
-    }
-
-    TargetEndpoint endpoint;
-    endpoint.scheme = url.substr(0, scheme_pos);
-    if (endpoint.scheme != "http") {
-        return std::nullopt;
-    }
-
-    const size_t authority_start = scheme_pos + 3;
-    const size_t path_start = url.find('/', authority_start);
-    const std::string authority = (path_start == std::string::npos)
-        ? url.substr(authority_start)
-        : url.substr(authority_start, path_start - authority_start);
-    endpoint.base_path = (path_start == std::string::npos) ? "/" : url.substr(path_start);
-
-    if (authority.empty()) {
-        return std::nullopt;
-    }
-
-    const size_t colon_pos = authority.rfind(':');
-    if (colon_pos != std::string::npos) {
-        endpoint.host = authority.substr(0, colon_pos);
-        const std::string port_text = authority.substr(colon_pos + 1);
-        if (endpoint.host.empty() || port_text.empty()) {
-            return std::nullopt;
-        }
-        try {
-            endpoint.port = std::stoi(port_text);
-        } catch (...) {
-            return std::nullopt;
-        }
-    } else {
-        endpoint.host = authority;
-        endpoint.port = 80;
-    }
-
-    if (endpoint.base_path.empty()) {
-        endpoint.base_path = "/";
+// Queues a notification for the dispatcher thread. Never blocks the caller.
+void notify_host(notiman::NotificationIcon icon,
+                 std::string title,
+                 std::string body = {},
+                 std::string code = {},
+                 std::string project = {}) {
+    if (!g_notifications) {
+        return;
     }
-    return endpoint;
+    g_notifications->post(notiman::ProxyNotification{
+        icon, std::move(title), std::move(body), std::move(code), std::move(project)});
 }
 
-// Extracts the subdomain from a Host header value like "api.localhost:8080" -> "api"
-std::string extract_subdomain(const std::string& host_header) {
-    // Strip port
-    const size_t colon = host_header.rfind(':');
-    const std::string host = (colon != std::string::npos) ? host_header.substr(0, colon) : host_header;
-
-    // Must end with ".localhost"
-    constexpr std::string_view suffix = ".localhost";
-    if (host.size() <= suffix.size()) {
-        return {};
-    }
-    if (lowercase(host).substr(host.size() - suffix.size()) != suffix) {
-        return {};
-    }
-
-    // Only one subdomain level: "api.localhost" -> "api", "a.b.localhost" -> rejected
-    const std::string sub = host.substr(0, host.size() - suffix.size());
-    if (sub.empty() || sub.find('.') != std::string::npos) {
-        return {};
+void warn_config(const std::vector<notiman::ConfigWarning>& warnings) {
+    for (const auto& warning : warnings) {
+        notify_host(notiman::NotificationIcon::Warning, warning.title, warning.body);
     }
-    return sub;
 }
 
-std::optional<notiman::ProxyRoute> find_route_for_host(const std::string& host_header) {
-    const std::string sub = lowercase(extract_subdomain(host_header));
-    if (sub.empty()) {
-        return std::nullopt;
+void evict_idle_upstream_connections() {
+    const auto table = g_routes.load();
+    if (!table) {
+        return;
     }
-    std::shared_lock lock(g_config_mutex);
-    for (const auto& route : g_proxy_config.routes) {
-        if (route.subdomain == sub) {
-            return route;
+    for (const auto& route : table->routes()) {
+        for (const auto& target : route.balancer.targets()) {
+            target->pool()->evict_idle();
         }
     }
-    return std::nullopt;
-}
-
-std::string build_forward_path(const std::string& request_path,
-                               const std::string& request_query,
-                               const std::string& target_base_path) {
-    std::string joined = target_base_path.empty() ? "/" : target_base_path;
-
-    if (joined.back() == '/' && !request_path.empty() && request_path.front() == '/') {
-        joined.pop_back();
-    } else if (joined.back() != '/' && !request_path.empty() && request_path.front() != '/') {
-        joined.push_back('/');
-    }
-    joined += request_path;
-
-    if (!request_query.empty()) {
-        joined += "?";
-        joined += request_query;
-    }
-    return joined;
 }
 
-std::string extract_query_from_target(const std::string& target) {
-    const size_t qpos = target.find('?');
-    if (qpos == std::string::npos || qpos + 1 >= target.size()) {
-        return {};
+void stop_mock_watchers() {
+    for (auto& watcher : g_mock_watchers) {
+        if (watcher->thread.joinable()) {
+            CancelSynchronousIo(reinterpret_cast<HANDLE>(watcher->thread.native_handle()));
+        }
+        CloseHandle(watcher->dir_handle);
+        if (watcher->thread.joinable()) {
+            watcher->thread.join();
+        }
     }
-    return target.substr(qpos + 1);
+    g_mock_watchers.clear();
 }
 
-std::wstring build_request_title(const httplib::Request& req, long long elapsed_ms) {
-    return utf8_to_utf16(req.method + " " + std::to_string(elapsed_ms) + "ms");
-}
-
-void proxy_request(const httplib::Request& req, httplib::Response& res) {
-    const auto started_at = std::chrono::steady_clock::now();
-
-    const std::string host_header = req.get_header_value("Host");
-    auto route = find_route_for_host(host_header);
-    if (!route.has_value()) {
-        res.status = 500;
-        res.set_content("No route configured for host", "text/plain");
-        notify_host(
-            notiman::NotificationIcon::Error,
-            L"Proxy error",
-            utf8_to_utf16("No route configured for " + host_header),
-            L"route-match",
-            L"");
-        return;
-    }
-
-    auto endpoint = parse_target_endpoint(route->target_base_url);
-    if (!endpoint.has_value()) {
-        res.status = 500;
-        res.set_content("Invalid route target URL", "text/plain");
-        notify_host(
-            notiman::NotificationIcon::Error,
-            L"Proxy error",
-            utf8_to_utf16("Invalid target URL for route " + route->subdomain),
-            L"target-url",
-            utf8_to_utf16(route->subdomain));
-        return;
-    }
-
-    httplib::Client client(endpoint->host, endpoint->port);
-    client.set_connection_timeout(3, 0);
-    client.set_read_timeout(15, 0);
-    client.set_write_timeout(15, 0);
-
-    httplib::Headers headers;
-    const std::unordered_set<std::string> excluded_headers = {
-        "host", "content-length", "transfer-encoding", "connection"
-    };
-    for (const auto& [key, value] : req.headers) {
-        if (excluded_headers.find(lowercase(key)) != excluded_headers.end()) {
+// One watcher per mock directory, redone whenever routes change.
+void watch_mocks() {
+    stop_mock_watchers();
+    for (const auto& route : g_routes.load()->routes()) {
+        if (!route.mock) {
             continue;
         }
-        headers.emplace(key, value);
-    }
-
-    httplib::Request outgoing;
-    outgoing.method = req.method;
-    outgoing.path = build_forward_path(
-        req.path,
-        extract_query_from_target(req.target),
-        endpoint->base_path);
-    outgoing.headers = std::move(headers);
-    outgoing.body = req.body;
-
-    auto result = client.send(outgoing);
-    const auto ended_at = std::chrono::steady_clock::now();
-    const auto elapsed_ms =
-        std::chrono::duration_cast<std::chrono::milliseconds>(ended_at - started_at).count();
-
-    if (!result) {
-        res.status = 502;
-        res.set_content("Failed to reach upstream target", "text/plain");
-        notify_host(
-            notiman::NotificationIcon::Error,
-            L"Proxy error",
-            utf8_to_utf16("Failed to connect to " + route->target_base_url),
-            L"upstream",
-            utf8_to_utf16(route->subdomain));
-        return;
-    }
-
-    res.status = result->status;
-    res.body = result->body;
-    for (const auto& [key, value] : result->headers) {
-        if (excluded_headers.find(lowercase(key)) != excluded_headers.end()) {
+        const std::filesystem::path directory = route.mock->watch_dir();
+        if (std::any_of(g_mock_watchers.begin(), g_mock_watchers.end(), [&directory](const auto& watcher) {
+                return watcher->directory == directory;
+            })) {
             continue;
         }
-        res.set_header(key.c_str(), value.c_str());
-    }
-
-    notiman::NotificationIcon icon = notiman::NotificationIcon::Info;
-    if (result->status >= 500) {
-        icon = notiman::NotificationIcon::Error;
-    } else if (result->status >= 400) {
-        icon = notiman::NotificationIcon::Warning;
+        auto watcher = std::make_unique<MockWatcher>();
+        watcher->directory = directory;
+        watcher->dir_handle = CreateFileW(
+            directory.wstring().c_str(),
+            FILE_LIST_DIRECTORY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+        if (watcher->dir_handle == INVALID_HANDLE_VALUE) {
+            notify_host(notiman::NotificationIcon::Warning, "Mock directory not watched", directory.string());
+            continue;
+        }
+        watcher->thread = std::thread(
+            notiman::run_config_watcher,
+            watcher->dir_handle,
+            g_hwnd,
+            WM_MOCKS_CHANGED,
+            std::wstring(),
+            static_cast<WPARAM>(g_mock_watchers.size()));
+        g_mock_watchers.push_back(std::move(watcher));
     }
-
-    notify_host(
-        icon,
-        build_request_title(req, elapsed_ms),
-        L"",
-        utf8_to_utf16(req.path),
-        utf8_to_utf16(route->subdomain));
 }
 
 bool start_proxy_server() {
-    g_server = std::make_unique<httplib::Server>();
-    if (!g_server) {
-        return false;
-    }
-
-    auto handler = [](const httplib::Request& req, httplib::Response& res) {
-        try {
-            proxy_request(req, res);
-        } catch (...) {
-            res.status = 500;
-            res.set_content("Internal proxy error", "text/plain");
-            notify_host(notiman::NotificationIcon::Error, L"Proxy error", L"Unhandled exception.", L"internal");
+    if (g_proxy_config.metrics) {
+        g_metrics = std::make_unique<notiman::ProxyMetrics>();
+    }
+    if (!g_proxy_config.capture_path.empty()) {
+        notiman::TrafficCaptureOptions capture_options;
+        capture_options.path = utf8_to_utf16(g_proxy_config.capture_path);
+        capture_options.body_limit = static_cast<size_t>(g_proxy_config.capture_body_bytes);
+        g_capture = std::make_unique<notiman::TrafficCapture>(capture_options);
+        if (!g_capture->ok()) {
+            notify_host(notiman::NotificationIcon::Warning,
+                        "notiman-proxy capture disabled",
+                        "Cannot append to " + g_proxy_config.capture_path);
+            g_capture.reset();
         }
-    };
-
-    g_server->Get(R"(/.*)", handler);
-    g_server->Post(R"(/.*)", handler);
-    g_server->Put(R"(/.*)", handler);
-    g_server->Delete(R"(/.*)", handler);
-    g_server->Patch(R"(/.*)", handler);
-    g_server->Options(R"(/.*)", handler);
-
-    g_server_thread = std::thread([] {
-        g_server_running = true;
-        g_server->listen(g_proxy_config.host, g_proxy_config.port);
-        g_server_running = false;
-    });
-
-    // Quick startup check. If binding fails immediately, the thread exits.
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
-    return g_server_running.load();
+    }
+    g_health = std::make_unique<notiman::HealthChecker>(g_routes, g_notifications.get());
+    g_engine = notiman::make_proxy_engine(
+        g_proxy_config, g_routes, g_notifications.get(), g_metrics.get(), g_capture.get());
+    if (g_proxy_config.engine != g_engine->name()) {
+        notify_host(
+            notiman::NotificationIcon::Warning,
+            "notiman-proxy engine unavailable",
+            "engine=" + g_proxy_config.engine + " is not supported on this platform, using " + g_engine->name());
+    }
+    return g_engine->start(g_proxy_config.host, g_proxy_config.port);
 }
 
 void stop_proxy_server() {
-    if (g_server) {
-        g_server->stop();
-    }
-    if (g_server_thread.joinable()) {
-        g_server_thread.join();
-    }
-    g_server.reset();
-    g_server_running = false;
+    g_health.reset();
+    if (g_engine) {
+        g_engine->drain(std::chrono::milliseconds(g_proxy_config.drain_timeout_ms));
+        g_engine->stop();
+        g_engine.reset();
+    }
+    g_capture.reset();
+    g_metrics.reset();
+    g_routes.publish(nullptr);
 }
 
 LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
@@ -400,15 +261,52 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 
     case WM_CONFIG_CHANGED: {
         auto new_config = notiman::ProxyConfig::load_from_file(g_config_path);
-        {
-            std::unique_lock lock(g_config_mutex);
-            g_proxy_config.routes = std::move(new_config.routes);
+        // The listener keeps its address until restart; everything else applies live.
+        new_config.host = g_proxy_config.host;
+        new_config.port = g_proxy_config.port;
+        new_config.engine = g_proxy_config.engine;
+        new_config.workers = g_proxy_config.workers;
+        new_config.listeners = g_proxy_config.listeners;
+        new_config.splice = g_proxy_config.splice;
+        new_config.metrics = g_proxy_config.metrics;
+        new_config.capture_path = g_proxy_config.capture_path;
+        new_config.capture_body_bytes = g_proxy_config.capture_body_bytes;
+        new_config.notify_queue_size = g_proxy_config.notify_queue_size;
+        g_proxy_config = std::move(new_config);
+        const auto warnings = g_proxy_config.disable_blocking_options();
+
+        // Workers pick up the new snapshot on their next request; in-flight requests finish on the old one.
+        g_routes.publish(notiman::RouteTable::build(g_proxy_config, g_routes.load().get()));
+        g_notifications->set_coalesce_window(std::chrono::milliseconds(g_proxy_config.notify_coalesce_ms));
+        watch_mocks();
+        notify_host(notiman::NotificationIcon::Info, "Proxy config reloaded", "Routes updated");
+        warn_config(warnings);
+        return 0;
+    }
+
+    case WM_MOCKS_CHANGED: {
+        // A change posted just before a config reload renumbered the watchers reloads the wrong store at worst.
+        if (wParam >= g_mock_watchers.size()) {
+            return 0;
         }
-        notify_host(notiman::NotificationIcon::Info, L"Proxy config reloaded", L"Routes updated");
+        const std::filesystem::path& directory = g_mock_watchers[wParam]->directory;
+        for (const auto& route : g_routes.load()->routes()) {
+            if (route.mock && route.mock->watch_dir() == directory) {
+                route.mock->reload();
+            }
+        }
+        notify_host(notiman::NotificationIcon::Info, "Mock responses reloaded", directory.string());
         return 0;
     }
 
+    case WM_TIMER:
+        if (wParam == IDT_POOL_SWEEP) {
+            evict_idle_upstream_connections();
+        }
+        return 0;
+
     case WM_DESTROY:
+        KillTimer(hwnd, IDT_POOL_SWEEP);
         PostQuitMessage(0);
         return 0;
 
@@ -461,6 +359,14 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
 
     g_config_path = ensure_proxy_config_path();
     g_proxy_config = notiman::ProxyConfig::load_from_file(g_config_path);
+    const auto warnings = g_proxy_config.disable_blocking_options();
+    g_routes.publish(notiman::RouteTable::build(g_proxy_config, nullptr));
+
+    notiman::NotificationDispatcherOptions dispatcher_options;
+    dispatcher_options.queue_capacity = static_cast<size_t>(g_proxy_config.notify_queue_size);
+    dispatcher_options.coalesce_window = std::chrono::milliseconds(g_proxy_config.notify_coalesce_ms);
+    g_notifications = std::make_unique<notiman::NotificationDispatcher>(dispatcher_options, deliver_to_host);
+    warn_config(warnings);
 
     g_watcher_dir_handle = CreateFileW(
         g_config_path.parent_path().wstring().c_str(),
@@ -473,17 +379,21 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
             g_watcher_dir_handle,
             g_hwnd,
             WM_CONFIG_CHANGED,
-            g_config_path.filename().wstring());
+            g_config_path.filename().wstring(),
+            0);
     }
 
+    watch_mocks();
+
     notiman::init_tray_icon(g_nid, g_hwnd, 1, WM_TRAYICON, L"Notiman Proxy");
     notiman::add_tray_icon(g_nid);
 
     if (!start_proxy_server()) {
         notify_host(
             notiman::NotificationIcon::Error,
-            L"notiman-proxy startup error",
-            utf8_to_utf16("Failed to bind " + g_proxy_config.host + ":" + std::to_string(g_proxy_config.port)));
+            "notiman-proxy startup error",
+            "Failed to bind " + g_proxy_config.host + ":" + std::to_string(g_proxy_config.port));
+        g_notifications->stop();
         notiman::remove_tray_icon(g_nid);
         if (mutex) {
             CloseHandle(mutex);
@@ -491,10 +401,12 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
         return 1;
     }
 
+    SetTimer(g_hwnd, IDT_POOL_SWEEP, kPoolSweepIntervalMs, nullptr);
+
     notify_host(
         notiman::NotificationIcon::Info,
-        L"notiman-proxy started",
-        utf8_to_utf16("Listening on " + g_proxy_config.host + ":" + std::to_string(g_proxy_config.port)));
+        "notiman-proxy started",
+        "Listening on " + g_proxy_config.host + ":" + std::to_string(g_proxy_config.port));
 
     MSG msg = {};
     while (GetMessage(&msg, nullptr, 0, 0)) {
@@ -512,8 +424,10 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
     if (g_watcher_thread.joinable()) {
         g_watcher_thread.join();
     }
+    stop_mock_watchers();
 
     stop_proxy_server();
+    g_notifications->stop();
     notiman::remove_tray_icon(g_nid);
 
     if (mutex) {
@@ -0,0 +1,470 @@
+#include "mock_store.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <tuple>
+
+namespace notiman {
+
+namespace {
+
+constexpr std::string_view kIndexFile = "index.html";
+
+std::string_view trim(std::string_view value) {
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.front()))) {
+        value.remove_prefix(1);
+    }
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back()))) {
+        value.remove_suffix(1);
+    }
+    return value;
+}
+
+bool iequals_ascii(std::string_view a, std::string_view b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// The request path as a path below the mock directory; nullopt when it would leave it.
+std::optional<std::filesystem::path> relative_file(std::string_view path) {
+    std::string decoded;
+    decoded.reserve(path.size());
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (path[i] == '%' && i + 2 < path.size() && hex_digit(path[i + 1]) >= 0 && hex_digit(path[i + 2]) >= 0) {
+            decoded.push_back(static_cast<char>(hex_digit(path[i + 1]) * 16 + hex_digit(path[i + 2])));
+            i += 2;
+        } else {
+            decoded.push_back(path[i]);
+        }
+    }
+
+    std::filesystem::path relative;
+    for (size_t start = 0; start <= decoded.size();) {
+        const size_t slash = std::min(decoded.find('/', start), decoded.size());
+        const std::string_view segment = std::string_view(decoded).substr(start, slash - start);
+        if (segment == ".." || segment.find('\\') != std::string_view::npos ||
+            segment.find(':') != std::string_view::npos || segment.find('\0') != std::string_view::npos) {
+            return std::nullopt;
+        }
+        if (!segment.empty() && segment != ".") {
+            relative /= std::filesystem::path(std::u8string(segment.begin(), segment.end()));
+        }
+        start = slash + 1;
+    }
+    return relative;
+}
+
+std::shared_ptr<const MockResponse> not_found() {
+    static const auto response = [] {
+        auto built = std::make_shared<MockResponse>();
+        built->status = 404;
+        built->content_type = "text/plain";
+        built->inline_body = "No mock response for this path";
+        return built;
+    }();
+    return response;
+}
+
+}  // namespace
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::filesystem::path& path) {
+    std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+    const HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    const auto close_file = [handle](std::shared_ptr<MappedFile> result) {
+        CloseHandle(handle);
+        return result;
+    };
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(handle, &size)) {
+        return close_file(nullptr);
+    }
+    file->size_ = static_cast<size_t>(size.QuadPart);
+    if (file->size_ < MappedFile::kMapMinBytes) {
+        file->contents_.resize(file->size_);
+        DWORD read = 0;
+        if (file->size_ > 0 &&
+            (!ReadFile(handle, file->contents_.data(), static_cast<DWORD>(file->size_), &read, nullptr) ||
+             read != file->size_)) {
+            return close_file(nullptr);
+        }
+        file->data_ = file->contents_.data();
+        return close_file(std::move(file));
+    }
+    // The view keeps the mapping alive after both handles are closed.
+    const HANDLE mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        return close_file(nullptr);
+    }
+    file->data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (file->data_ == nullptr) {
+        return close_file(nullptr);
+    }
+    file->mapped_ = true;
+    return close_file(std::move(file));
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    const auto close_file = [fd](std::shared_ptr<MappedFile> result) {
+        close(fd);
+        return result;
+    };
+    struct stat info {};
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return close_file(nullptr);
+    }
+    file->size_ = static_cast<size_t>(info.st_size);
+    if (file->size_ < MappedFile::kMapMinBytes) {
+        file->contents_.resize(file->size_);
+        for (size_t done = 0; done < file->size_;) {
+            const ssize_t read = pread(fd, file->contents_.data() + done, file->size_ - done, static_cast<off_t>(done));
+            if (read < 0 && errno == EINTR) {
+                continue;
+            }
+            if (read <= 0) {
+                return close_file(nullptr);
+            }
+            done += static_cast<size_t>(read);
+        }
+        file->data_ = file->contents_.data();
+        return close_file(std::move(file));
+    }
+    // The mapping outlives the descriptor.
+    void* data = mmap(nullptr, file->size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        return close_file(nullptr);
+    }
+    file->data_ = data;
+    file->mapped_ = true;
+    return close_file(std::move(file));
+#endif
+}
+
+MappedFile::~MappedFile() {
+    if (!mapped_) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+#else
+    munmap(const_cast<void*>(data_), size_);
+#endif
+}
+
+RangeStatus parse_byte_range(std::string_view header, uint64_t size, ByteRange& range) {
+    header = trim(header);
+    if (!header.starts_with("bytes=") || header.find(',') != std::string_view::npos) {
+        return RangeStatus::Whole;
+    }
+    const std::string_view spec = trim(header.substr(6));
+    const size_t dash = spec.find('-');
+    if (dash == std::string_view::npos) {
+        return RangeStatus::Whole;
+    }
+    const auto parse = [](std::string_view digits, uint64_t& value) {
+        const auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+        return !digits.empty() && error == std::errc() && end == digits.data() + digits.size();
+    };
+
+    const std::string_view from = spec.substr(0, dash);
+    const std::string_view to = spec.substr(dash + 1);
+    uint64_t first = 0;
+    uint64_t last = 0;
+    if (from.empty()) {
+        // "bytes=-500": the last 500 bytes.
+        uint64_t suffix = 0;
+        if (!parse(to, suffix)) {
+            return RangeStatus::Whole;
+        }
+        if (suffix == 0 || size == 0) {
+            return RangeStatus::Unsatisfiable;
+        }
+        first = size - std::min(suffix, size);
+        last = size - 1;
+    } else {
+        if (!parse(from, first) || (!to.empty() && !parse(to, last))) {
+            return RangeStatus::Whole;
+        }
+        if (to.empty()) {
+            last = size - 1;
+        } else if (last < first) {
+            return RangeStatus::Whole;
+        }
+        if (first >= size) {
+            return RangeStatus::Unsatisfiable;
+        }
+        last = std::min(last, size - 1);
+    }
+    range.first = first;
+    range.length = last - first + 1;
+    return RangeStatus::Partial;
+}
+
+std::string_view mock_content_type(std::string_view filename) {
+    static constexpr std::pair<std::string_view, std::string_view> kTypes[] = {
+        {".html", "text/html; charset=utf-8"},
+        {".htm", "text/html; charset=utf-8"},
+        {".json", "application/json"},
+        {".js", "text/javascript; charset=utf-8"},
+        {".mjs", "text/javascript; charset=utf-8"},
+        {".css", "text/css; charset=utf-8"},
+        {".txt", "text/plain; charset=utf-8"},
+        {".xml", "application/xml"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".webp", "image/webp"},
+        {".ico", "image/x-icon"},
+        {".wasm", "application/wasm"},
+        {".woff2", "font/woff2"},
+        {".map", "application/json"},
+    };
+    const size_t dot = filename.rfind('.');
+    if (dot != std::string_view::npos) {
+        const std::string_view extension = filename.substr(dot);
+        for (const auto& [suffix, type] : kTypes) {
+            if (iequals_ascii(extension, suffix)) {
+                return type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+MockStore::MockStore(std::filesystem::path root)
+    : root_(std::move(root)), manifest_(std::filesystem::is_regular_file(root_)) {
+    entries_ = load_manifest();
+}
+
+std::filesystem::path MockStore::watch_dir() const {
+    return manifest_ ? root_.parent_path() : root_;
+}
+
+std::shared_ptr<const MockResponse> MockStore::find(std::string_view method, std::string_view path) {
+    if (manifest_) {
+        std::shared_lock lock(mutex_);
+        const ManifestEntry* best = nullptr;
+        for (const ManifestEntry& entry : entries_) {
+            if (!entry.method.empty() && entry.method != method) {
+                continue;
+            }
+            const bool matches = entry.subtree ? path.starts_with(entry.path) &&
+                                                     (path.size() == entry.path.size() || path[entry.path.size()] == '/' ||
+                                                      entry.path.empty())
+                                               : path == entry.path;
+            if (!matches) {
+                continue;
+            }
+            // Exact over subtree, longer subtree over shorter, a named method over any.
+            const auto rank = [](const ManifestEntry& e) {
+                return std::make_tuple(!e.subtree, e.path.size(), !e.method.empty());
+            };
+            if (best == nullptr || rank(entry) > rank(*best)) {
+                best = &entry;
+            }
+        }
+        return best != nullptr ? best->response : not_found();
+    }
+
+    if (method != "GET" && method != "HEAD") {
+        return not_found();
+    }
+    uint64_t generation = 0;
+    {
+        std::unique_lock lock(mutex_);
+        if (const auto it = files_.find(std::string(path)); it != files_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->response;
+        }
+        generation = generation_;
+    }
+    // Read without the lock; a reload meanwhile keeps it out of the cache.
+    auto response = load_file(path);
+    if (!response) {
+        return not_found();
+    }
+    cache_file(path, response, generation);
+    return response;
+}
+
+void MockStore::reload() {
+    auto entries = load_manifest();
+    std::unique_lock lock(mutex_);
+    entries_ = std::move(entries);
+    files_.clear();
+    lru_.clear();
+    cached_bytes_ = 0;
+    ++generation_;
+}
+
+void MockStore::cache_file(std::string_view path,
+                           const std::shared_ptr<const MockResponse>& response,
+                           uint64_t generation) {
+    const size_t bytes = response->body().size();
+    std::unique_lock lock(mutex_);
+    if (generation != generation_ || bytes > kMaxCachedBytes) {
+        return;
+    }
+    if (const auto it = files_.find(std::string(path)); it != files_.end()) {
+        // Another request loaded it first; keep theirs.
+        return;
+    }
+    lru_.push_front(CachedFile{std::string(path), response});
+    files_.emplace(lru_.front().path, lru_.begin());
+    cached_bytes_ += bytes;
+    while (files_.size() > kMaxCachedFiles || cached_bytes_ > kMaxCachedBytes) {
+        const CachedFile& oldest = lru_.back();
+        cached_bytes_ -= oldest.response->body().size();
+        files_.erase(oldest.path);
+        lru_.pop_back();
+    }
+}
+
+std::shared_ptr<const MockResponse> MockStore::load_file(std::string_view path) const {
+    const auto relative = relative_file(path);
+    if (!relative) {
+        return nullptr;
+    }
+    std::filesystem::path file = root_ / *relative;
+    std::error_code error;
+    if (std::filesystem::is_directory(file, error)) {
+        file /= kIndexFile;
+    }
+    auto mapped = MappedFile::open(file);
+    if (!mapped) {
+        return nullptr;
+    }
+    auto response = std::make_shared<MockResponse>();
+    response->content_type = mock_content_type(file.filename().string());
+    response->file = std::move(mapped);
+    return response;
+}
+
+std::vector<MockStore::ManifestEntry> MockStore::load_manifest() const {
+    std::vector<ManifestEntry> entries;
+    if (!manifest_) {
+        return entries;
+    }
+    std::ifstream in(root_);
+    std::shared_ptr<MockResponse> response;
+    std::string file_name;
+    const auto finish = [&] {
+        if (!response) {
+            return;
+        }
+        if (!file_name.empty()) {
+            response->file = MappedFile::open(root_.parent_path() / file_name);
+            if (!response->file) {
+                response->status = 500;
+                response->content_type = "text/plain";
+                response->headers.clear();
+                response->inline_body = "Mock file missing: " + file_name;
+            }
+        }
+        if (response->content_type.empty()) {
+            response->content_type = file_name.empty() ? "text/plain; charset=utf-8" : mock_content_type(file_name);
+        }
+        entries.back().response = std::move(response);
+        response.reset();
+        file_name.clear();
+    };
+
+    std::string line;
+    while (std::getline(in, line)) {
+        const std::string_view text = trim(line);
+        if (text.empty() || text.front() == ';' || text.front() == '#') {
+            continue;
+        }
+        if (text.front() == '[') {
+            finish();
+            const std::string_view name = trim(text.substr(1, text.find(']') - 1));
+            const size_t space = name.find_first_of(" \t");
+            ManifestEntry entry;
+            std::string_view path = name;
+            if (space != std::string_view::npos) {
+                entry.method.assign(name.substr(0, space));
+                std::transform(entry.method.begin(), entry.method.end(), entry.method.begin(), [](unsigned char c) {
+                    return static_cast<char>(std::toupper(c));
+                });
+                path = trim(name.substr(space + 1));
+            }
+            if (path.empty() || path.front() != '/') {
+                continue;  // not a response section; its keys are skipped below
+            }
+            if (path.ends_with("/**")) {
+                entry.subtree = true;
+                path.remove_suffix(3);
+            }
+            entry.path.assign(path);
+            entries.push_back(std::move(entry));
+            response = std::make_shared<MockResponse>();
+            continue;
+        }
+        const size_t equals = text.find('=');
+        if (!response || equals == std::string_view::npos) {
+            continue;
+        }
+        const std::string_view key = trim(text.substr(0, equals));
+        const std::string_view value = trim(text.substr(equals + 1));
+        if (key == "status") {
+            int status = 0;
+            std::from_chars(value.data(), value.data() + value.size(), status);
+            if (status >= 100 && status <= 599) {
+                response->status = status;
+            }
+        } else if (key == "file") {
+            file_name.assign(value);
+        } else if (key == "body") {
+            response->inline_body.assign(value);
+        } else if (key == "header") {
+            const size_t colon = value.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            const std::string_view name = trim(value.substr(0, colon));
+            const std::string_view field = trim(value.substr(colon + 1));
+            if (iequals_ascii(name, "Content-Type")) {
+                response->content_type.assign(field);
+            } else if (!iequals_ascii(name, "Content-Length") && !iequals_ascii(name, "Transfer-Encoding") &&
+                       !iequals_ascii(name, "Connection")) {
+                response->headers.emplace_back(name, field);
+            }
+        }
+    }
+    finish();
+    return entries;
+}
+
+}  // namespace notiman
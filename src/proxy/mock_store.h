@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace notiman {
+
+// A whole file's contents. Files from kMapMinBytes up are mapped read-only; smaller ones,
+// which editors are apt to rewrite in place, are read into memory, since touching a mapped
+// page past the end of a file cut shorter faults the process. The file itself is closed
+// once read or mapped, so holding contents costs no descriptor.
+class MappedFile {
+public:
+    static constexpr size_t kMapMinBytes = 1024 * 1024;
+
+    // Null when the file cannot be opened or mapped.
+    static std::shared_ptr<const MappedFile> open(const std::filesystem::path& path);
+
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view data() const { return {static_cast<const char*>(data_), size_}; }
+
+private:
+    MappedFile() = default;
+
+    const void* data_ = nullptr;  // into the mapping or contents_
+    size_t size_ = 0;
+    std::string contents_;
+    bool mapped_ = false;
+};
+
+// A canned response. Immutable once built; requests in flight keep theirs across reloads.
+struct MockResponse {
+    int status = 200;
+    std::string content_type;
+    std::vector<std::pair<std::string, std::string>> headers;  // besides Content-Type; never framing
+    std::shared_ptr<const MappedFile> file;  // the body when set
+    std::string inline_body;
+
+    std::string_view body() const { return file ? file->data() : std::string_view(inline_body); }
+};
+
+enum class RangeStatus : uint8_t {
+    Whole,          // no usable Range header: send the whole body
+    Partial,        // send range
+    Unsatisfiable   // answer 416
+};
+
+struct ByteRange {
+    uint64_t first = 0;
+    uint64_t length = 0;
+};
+
+// Reads a Range header against a body of size bytes. Only a single "bytes=" range is
+// honoured; several ranges, or a header that does not parse, get the whole body.
+RangeStatus parse_byte_range(std::string_view header, uint64_t size, ByteRange& range);
+
+// Content-Type for a file name, by extension.
+std::string_view mock_content_type(std::string_view filename);
+
+// Canned responses for a route whose target is a file: URL. A directory is served file by
+// file, GET and HEAD only, with index.html standing in for directories. A manifest file
+// lists responses by method and path instead:
+//
+//     [GET /api/users]
+//     status = 200
+//     file = users.json
+//     header = Cache-Control: no-store
+//
+//     [/api/health/**]
+//     body = ok
+//
+// A section without a method answers every method, and a path ending in "/**" everything
+// below it; exact paths win over subtrees, and longer subtrees over shorter ones. Files are
+// named relative to the manifest. Manifest bodies are loaded with the manifest; directory
+// files on first use, keeping the most recently served ones up to kMaxCachedFiles and
+// kMaxCachedBytes. Both are served from memory until reload().
+class MockStore {
+public:
+    static constexpr size_t kMaxCachedFiles = 256;
+    static constexpr size_t kMaxCachedBytes = 64 * 1024 * 1024;
+
+    explicit MockStore(std::filesystem::path root);
+
+    MockStore(const MockStore&) = delete;
+    MockStore& operator=(const MockStore&) = delete;
+
+    const std::filesystem::path& root() const { return root_; }
+    // The directory whose changes call for reload(): the root, or the manifest's directory.
+    std::filesystem::path watch_dir() const;
+
+    // Never null: paths without a response get a 404.
+    std::shared_ptr<const MockResponse> find(std::string_view method, std::string_view path);
+
+    // Drops every mapped body and reads the manifest again. Safe while requests are served.
+    void reload();
+
+private:
+    struct ManifestEntry {
+        std::string method;  // empty for any
+        std::string path;    // without the "/**" of a subtree
+        bool subtree = false;
+        std::shared_ptr<const MockResponse> response;
+    };
+
+    struct CachedFile {
+        std::string path;  // request path
+        std::shared_ptr<const MockResponse> response;
+    };
+
+    std::vector<ManifestEntry> load_manifest() const;
+    std::shared_ptr<const MockResponse> load_file(std::string_view path) const;
+    // Adds a loaded file unless a reload came in while it was read, then trims the cache.
+    void cache_file(std::string_view path, const std::shared_ptr<const MockResponse>& response, uint64_t generation);
+
+    const std::filesystem::path root_;
+    const bool manifest_;
+
+    std::shared_mutex mutex_;  // guards everything below
+    std::vector<ManifestEntry> entries_;
+    std::list<CachedFile> lru_;  // front is the most recently used
+    std::unordered_map<std::string, std::list<CachedFile>::iterator> files_;  // by request path
+    size_t cached_bytes_ = 0;
+    uint64_t generation_ = 0;  // bumped by reload()
+};
+
+}  // namespace notiman
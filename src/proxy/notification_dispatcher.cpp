@@ -0,0 +1,261 @@
+#include "notification_dispatcher.h"
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "proxy_metrics.h"
+
+namespace notiman {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto kIdleWait = std::chrono::milliseconds(250);
+
+struct CoalesceWindow {
+    Clock::time_point closes_at;
+    uint64_t merged = 0;
+    ProxyNotification latest;
+};
+
+// Per-request reports carry their timing in the title, so a burst of them merges per
+// project and severity. Anything else merges only with repeats of itself, so the "(+N more)"
+// summary never stands in for a notification that said something different.
+std::string coalesce_key(const ProxyNotification& notification) {
+    std::string key = notification.project;
+    key.push_back('\x1f');
+    key.push_back(static_cast<char>('0' + static_cast<int>(notification.icon)));
+    if (!notification.request.has_value()) {
+        for (const std::string* part : {&notification.code, &notification.title, &notification.body}) {
+            key.push_back('\x1f');
+            key += *part;
+        }
+    }
+    return key;
+}
+
+ProxyNotification summarize(CoalesceWindow& window) {
+    ProxyNotification summary = std::move(window.latest);
+    if (window.merged > 1) {
+        summary.title += " (+" + std::to_string(window.merged - 1) + " more)";
+    }
+    return summary;
+}
+
+// Requests reported for one project since its aggregation window opened.
+struct RequestAggregate {
+    Clock::time_point closes_at;
+    uint64_t requests = 0;
+    std::array<uint64_t, 5> status_classes{};  // 1xx .. 5xx
+    LatencyHistogram latency;
+    std::optional<ProxyNotification> first;    // sent as is if no other request follows
+};
+
+// "60 req, 2 errors, p95 48ms" with the status classes in the body.
+ProxyNotification summarize(RequestAggregate& aggregate, const std::string& project) {
+    const uint64_t errors = aggregate.status_classes[3] + aggregate.status_classes[4];
+    ProxyNotification summary;
+    summary.icon = aggregate.status_classes[4] > 0 ? NotificationIcon::Error
+        : aggregate.status_classes[3] > 0          ? NotificationIcon::Warning
+                                                   : NotificationIcon::Info;
+    summary.title = std::to_string(aggregate.requests) + " req";
+    if (errors > 0) {
+        summary.title += ", " + std::to_string(errors) + (errors == 1 ? " error" : " errors");
+    }
+    summary.title += ", p95 " + std::to_string(aggregate.latency.percentile_us(0.95) / 1000) + "ms";
+    for (size_t i = 0; i < aggregate.status_classes.size(); ++i) {
+        if (aggregate.status_classes[i] == 0) {
+            continue;
+        }
+        if (!summary.body.empty()) {
+            summary.body += ", ";
+        }
+        summary.body += std::to_string(i + 1) + "xx: " + std::to_string(aggregate.status_classes[i]);
+    }
+    summary.project = project;
+    return summary;
+}
+
+}  // namespace
+
+NotificationDispatcher::NotificationDispatcher(NotificationDispatcherOptions options, Sink sink)
+    : sink_(std::move(sink)),
+      queue_(options.queue_capacity),
+      coalesce_window_ms_(options.coalesce_window.count()) {
+    thread_ = std::thread([this] { run(); });
+}
+
+NotificationDispatcher::~NotificationDispatcher() {
+    stop();
+}
+
+bool NotificationDispatcher::post(ProxyNotification notification) {
+    if (!queue_.try_push(std::move(notification))) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    // Notify without taking wake_mutex_ so producers never block. A wakeup lost to the
+    // race with the dispatcher going to sleep only delays delivery by at most kIdleWait.
+    if (!wake_pending_.exchange(true, std::memory_order_acq_rel)) {
+        wake_.notify_one();
+    }
+    return true;
+}
+
+void NotificationDispatcher::set_coalesce_window(std::chrono::milliseconds window) {
+    coalesce_window_ms_.store(window.count(), std::memory_order_relaxed);
+}
+
+void NotificationDispatcher::stop() {
+    if (stopping_.exchange(true)) {
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        return;
+    }
+    {
+        std::lock_guard lock(wake_mutex_);
+        wake_pending_ = true;
+    }
+    wake_.notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void NotificationDispatcher::deliver(const ProxyNotification& notification) {
+    try {
+        sink_(notification);
+        delivered_.fetch_add(1, std::memory_order_relaxed);
+    } catch (...) {
+        // A failing host must not take the dispatcher down.
+    }
+}
+
+void NotificationDispatcher::run() {
+    std::unordered_map<std::string, CoalesceWindow> windows;
+    std::unordered_map<std::string, RequestAggregate> aggregates;
+    uint64_t reported_drops = 0;
+    ProxyNotification next;
+
+    for (;;) {
+        const bool stopping = stopping_.load(std::memory_order_acquire);
+        wake_pending_.store(false, std::memory_order_release);
+
+        const auto window = std::chrono::milliseconds(coalesce_window_ms_.load(std::memory_order_relaxed));
+        auto now = Clock::now();
+
+        const auto coalesce = [&](ProxyNotification notification) {
+            if (window.count() <= 0 || !notification.coalesce) {
+                deliver(notification);
+                return;
+            }
+
+            auto key = coalesce_key(notification);
+            auto it = windows.find(key);
+            if (it != windows.end() && now < it->second.closes_at) {
+                ++it->second.merged;
+                it->second.latest = std::move(notification);
+                coalesced_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            if (it != windows.end() && it->second.merged > 0) {
+                deliver(summarize(it->second));
+            }
+            // First of a burst goes out immediately and opens a window for the rest.
+            deliver(notification);
+            windows[std::move(key)] = CoalesceWindow{now + window, 0, {}};
+        };
+
+        // Drain everything queued as one batch.
+        while (queue_.try_pop(next)) {
+            if (!next.request.has_value() || next.request->aggregate_window.count() <= 0) {
+                coalesce(std::move(next));
+                continue;
+            }
+
+            const RequestOutcome outcome = *next.request;
+            auto [it, opened] = aggregates.try_emplace(next.project);
+            RequestAggregate& aggregate = it->second;
+            if (opened) {
+                aggregate.closes_at = now + outcome.aggregate_window;
+            }
+            ++aggregate.requests;
+            ++aggregate.status_classes[static_cast<size_t>(std::clamp(outcome.status / 100, 1, 5) - 1)];
+            aggregate.latency.record(static_cast<uint64_t>(std::max<int64_t>(outcome.elapsed.count(), 0)));
+            if (aggregate.requests > 1) {
+                aggregate.first.reset();
+                aggregated_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // Server errors are escalated on their own as well as counted.
+            if (outcome.status >= 500) {
+                coalesce(std::move(next));
+            } else if (aggregate.requests == 1) {
+                aggregate.first = std::move(next);
+            }
+        }
+
+        now = Clock::now();
+        auto next_deadline = now + kIdleWait;
+        for (auto it = windows.begin(); it != windows.end();) {
+            if (stopping || now >= it->second.closes_at) {
+                if (it->second.merged > 0) {
+                    deliver(summarize(it->second));
+                    // Keep merging while the burst continues.
+                    it->second = CoalesceWindow{now + window, 0, {}};
+                    ++it;
+                } else {
+                    it = windows.erase(it);
+                }
+                continue;
+            }
+            if (it->second.closes_at < next_deadline) {
+                next_deadline = it->second.closes_at;
+            }
+            ++it;
+        }
+
+        for (auto it = aggregates.begin(); it != aggregates.end();) {
+            RequestAggregate& aggregate = it->second;
+            if (!stopping && now < aggregate.closes_at) {
+                next_deadline = std::min(next_deadline, aggregate.closes_at);
+                ++it;
+                continue;
+            }
+            // A lone request is reported as itself; a lone 5xx already was.
+            if (aggregate.first.has_value()) {
+                deliver(*aggregate.first);
+            } else if (aggregate.requests > 1) {
+                deliver(summarize(aggregate, it->first));
+            }
+            it = aggregates.erase(it);
+        }
+
+        const uint64_t drops = dropped_.load(std::memory_order_relaxed);
+        if (drops != reported_drops) {
+            ProxyNotification warning;
+            warning.icon = NotificationIcon::Warning;
+            warning.title = "Proxy notifications dropped";
+            warning.body = std::to_string(drops - reported_drops) + " notifications were dropped (queue full).";
+            deliver(warning);
+            reported_drops = drops;
+        }
+
+        if (stopping) {
+            break;
+        }
+
+        std::unique_lock lock(wake_mutex_);
+        wake_.wait_until(lock, next_deadline, [this] {
+            return wake_pending_.load(std::memory_order_acquire) || stopping_.load(std::memory_order_acquire);
+        });
+    }
+}
+
+}  // namespace notiman
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "../shared/icon.h"
+#include "mpsc_queue.h"
+
+namespace notiman {
+
+// How one proxied request ended, attached to its notification.
+struct RequestOutcome {
+    int status = 0;
+    std::chrono::microseconds elapsed{0};
+    // Requests to the same project inside this window are rolled up into one summary;
+    // 5xx responses are still delivered on their own. 0 reports every request.
+    std::chrono::milliseconds aggregate_window{0};
+};
+
+// UTF-8 notification as produced by the proxy. Converted to a host payload only on delivery.
+struct ProxyNotification {
+    NotificationIcon icon = NotificationIcon::Info;
+    std::string title;
+    std::string body;
+    std::string code;
+    std::string project;
+    std::optional<RequestOutcome> request{};  // set for per-request reports
+    bool coalesce = true;  // false delivers it on its own even inside a coalescing window
+};
+
+struct NotificationDispatcherOptions {
+    size_t queue_capacity = 1024;
+    // Repeats of a notification inside this window are merged, as are a project's per-request
+    // reports of the same severity. 0 disables merging.
+    std::chrono::milliseconds coalesce_window{500};
+};
+
+// Moves host delivery off the request path. Producers enqueue into a bounded lock-free
+// queue and return immediately; one dispatcher thread drains it in batches, delivers the
+// first notification of a burst right away and folds the rest of the window into one summary.
+// Per-request reports are rolled up per project first ("60 req, 2 errors, p95 48ms"), so
+// the number delivered is bounded by the number of routes rather than the request rate.
+class NotificationDispatcher {
+public:
+    using Sink = std::function<void(const ProxyNotification&)>;
+
+    NotificationDispatcher(NotificationDispatcherOptions options, Sink sink);
+    ~NotificationDispatcher();
+
+    NotificationDispatcher(const NotificationDispatcher&) = delete;
+    NotificationDispatcher& operator=(const NotificationDispatcher&) = delete;
+
+    // Never blocks. Returns false and counts a drop when the queue is full.
+    bool post(ProxyNotification notification);
+
+    void set_coalesce_window(std::chrono::milliseconds window);
+
+    // Delivers everything still queued or pending in a window, then joins the thread.
+    void stop();
+
+    uint64_t delivered() const { return delivered_.load(std::memory_order_relaxed); }
+    uint64_t coalesced() const { return coalesced_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t aggregated() const { return aggregated_.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+    void deliver(const ProxyNotification& notification);
+
+    Sink sink_;
+    MpscQueue<ProxyNotification> queue_;
+    std::atomic<int64_t> coalesce_window_ms_;
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::atomic_bool wake_pending_ = false;
+    std::atomic_bool stopping_ = false;
+
+    std::atomic<uint64_t> delivered_ = 0;
+    std::atomic<uint64_t> coalesced_ = 0;
+    std::atomic<uint64_t> dropped_ = 0;
+    std::atomic<uint64_t> aggregated_ = 0;
+
+    std::thread thread_;
+};
+
+}  // namespace notiman
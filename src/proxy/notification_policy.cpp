@@ -0,0 +1,55 @@
+#include "notification_policy.h"
+
+#include <algorithm>
+
+namespace notiman {
+
+NotificationPolicy::NotificationPolicy(NotificationPolicyOptions options) : options_(options) {}
+
+NotificationVerdict NotificationPolicy::evaluate(int status, std::chrono::microseconds elapsed) {
+    NotificationVerdict verdict;
+    if (options_.anomaly_factor > 0 && status < 500) {
+        verdict.anomaly = track(elapsed);
+    }
+    if (!options_.filters()) {
+        return verdict;
+    }
+
+    const int status_class = std::clamp(status / 100, 1, 5);
+    verdict.report = (options_.slow.count() > 0 && elapsed > options_.slow) ||
+                     (options_.status_classes & (1u << (status_class - 1))) != 0 ||
+                     (options_.sample > 0 &&
+                      requests_.fetch_add(1, std::memory_order_relaxed) % options_.sample == 0);
+    return verdict;
+}
+
+std::optional<LatencyAnomaly> NotificationPolicy::track(std::chrono::microseconds elapsed) {
+    const auto latency = static_cast<double>(std::max<int64_t>(elapsed.count(), 0));
+    std::lock_guard lock(mutex_);
+    if (samples_ == 0) {
+        recent_us_ = latency;
+        usual_us_ = latency;
+    } else {
+        recent_us_ += kRecentWeight * (latency - recent_us_);
+        usual_us_ += kUsualWeight * (latency - usual_us_);
+    }
+    if (samples_ < kWarmup) {
+        ++samples_;
+        return std::nullopt;
+    }
+
+    const double factor = options_.anomaly_factor;
+    const double min_rise = std::chrono::duration<double, std::micro>(kMinRise).count();
+    if (anomalous_) {
+        anomalous_ = recent_us_ > usual_us_ * (1 + factor) / 2;
+        return std::nullopt;
+    }
+    if (recent_us_ <= usual_us_ * factor || recent_us_ - usual_us_ < min_rise) {
+        return std::nullopt;
+    }
+    anomalous_ = true;
+    return LatencyAnomaly{std::chrono::microseconds(static_cast<int64_t>(recent_us_)),
+                          std::chrono::microseconds(static_cast<int64_t>(usual_us_))};
+}
+
+}  // namespace notiman
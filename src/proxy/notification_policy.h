@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace notiman {
+
+struct NotificationPolicyOptions {
+    std::chrono::milliseconds slow{0};  // report requests slower than this, 0 = off
+    uint8_t status_classes = 0;         // bit n-1 set: report nxx responses
+    uint32_t sample = 0;                // report 1 in this many requests, 0 = off
+    uint32_t anomaly_factor = 0;        // alert when latency rises this many times over usual, 0 = off
+
+    // Without any filter every request is reported, as when a route has no policy.
+    bool filters() const { return slow.count() > 0 || status_classes != 0 || sample > 0; }
+
+    bool operator==(const NotificationPolicyOptions&) const = default;
+};
+
+// A route's recent latency next to its usual latency, when the first rose past anomaly_factor.
+struct LatencyAnomaly {
+    std::chrono::microseconds recent{0};
+    std::chrono::microseconds usual{0};
+};
+
+// What evaluate() decided for one finished request.
+struct NotificationVerdict {
+    bool report = true;
+    std::optional<LatencyAnomaly> anomaly;  // this request made the route's latency anomalous
+};
+
+// Per-route filter run on every finished request before its notification is built. A
+// request is reported when it matches any configured filter: slower than the threshold,
+// in a listed status class, or picked by 1-in-N sampling. Filtering only touches an
+// atomic counter; latency tracking takes a lock and is only on with anomaly_factor set.
+//
+// Anomalies are judged from two exponentially weighted latency averages of the
+// requests below 500: a fast one over roughly the last ten and a slow one over roughly
+// the last two hundred. When the fast one passes anomaly_factor times the slow one the
+// route alerts once, and again only after it has come back below halfway.
+class NotificationPolicy {
+public:
+    static constexpr double kRecentWeight = 0.2;
+    static constexpr double kUsualWeight = 0.01;
+    // Requests seen before the usual latency is trusted.
+    static constexpr uint32_t kWarmup = 50;
+    // Rises smaller than this are jitter, however fast the route usually is.
+    static constexpr auto kMinRise = std::chrono::milliseconds(5);
+
+    explicit NotificationPolicy(NotificationPolicyOptions options);
+
+    NotificationPolicy(const NotificationPolicy&) = delete;
+    NotificationPolicy& operator=(const NotificationPolicy&) = delete;
+
+    const NotificationPolicyOptions& options() const { return options_; }
+
+    NotificationVerdict evaluate(int status, std::chrono::microseconds elapsed);
+
+private:
+    std::optional<LatencyAnomaly> track(std::chrono::microseconds elapsed);
+
+    const NotificationPolicyOptions options_;
+    std::atomic<uint64_t> requests_ = 0;
+
+    std::mutex mutex_;  // guards the fields below
+    double recent_us_ = 0;
+    double usual_us_ = 0;
+    uint32_t samples_ = 0;
+    bool anomalous_ = false;
+};
+
+}  // namespace notiman
@@ -1,15 +1,47 @@
 #include "proxy_config.h"
 
+#ifdef _WIN32
 #include <windows.h>
 #include <shlobj.h>
+#endif
 
 #include <algorithm>
 #include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <unordered_map>
+#include <utility>
 
 namespace notiman {
 
 namespace {
 
+std::string trim(const std::string& input) {
+    size_t start = 0;
+    while (start < input.size() && std::isspace(static_cast<unsigned char>(input[start])) != 0) {
+        ++start;
+    }
+
+    size_t end = input.size();
+    while (end > start && std::isspace(static_cast<unsigned char>(input[end - 1])) != 0) {
+        --end;
+    }
+
+    return input.substr(start, end - start);
+}
+
+std::string lowercase(const std::string& input) {
+    std::string result = input;
+    for (char& c : result) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return result;
+}
+
+using IniEntries = std::vector<std::pair<std::string, std::string>>;
+
+#ifdef _WIN32
+
 std::string narrow_utf8(const wchar_t* value) {
     if (value == nullptr || value[0] == L'\0') {
         return {};
@@ -26,62 +58,330 @@ std::string narrow_utf8(const wchar_t* value) {
     return result;
 }
 
-std::string trim(const std::string& input) {
-    size_t start = 0;
-    while (start < input.size() && std::isspace(static_cast<unsigned char>(input[start])) != 0) {
-        ++start;
+std::wstring widen_utf8(const std::string& value) {
+    if (value.empty()) {
+        return {};
     }
 
-    size_t end = input.size();
-    while (end > start && std::isspace(static_cast<unsigned char>(input[end - 1])) != 0) {
-        --end;
+    const int size = MultiByteToWideChar(CP_UTF8, 0, value.c_str(), -1, nullptr, 0);
+    if (size <= 1) {
+        return {};
     }
 
-    return input.substr(start, end - start);
+    std::wstring result(static_cast<size_t>(size), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, value.c_str(), -1, result.data(), size);
+    result.pop_back();
+    return result;
 }
 
-std::string lowercase(const std::string& input) {
-    std::string result = input;
-    for (char& c : result) {
-        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+// Reads through the profile API so the file keeps its Windows INI semantics.
+class IniSource {
+public:
+    explicit IniSource(const std::filesystem::path& path) : ini_path_(path.wstring()) {}
+
+    std::string get(const std::string& section, const std::string& key) const {
+        wchar_t buf[1024] = {};
+        GetPrivateProfileStringW(
+            widen_utf8(section).c_str(),
+            widen_utf8(key).c_str(),
+            L"",
+            buf,
+            static_cast<DWORD>(_countof(buf)),
+            ini_path_.c_str());
+        return trim(narrow_utf8(buf));
     }
-    return result;
-}
 
-std::vector<ProxyRoute> load_routes(const std::wstring& ini_path) {
-    std::vector<ProxyRoute> routes;
+    IniEntries entries(const std::string& section) const {
+        IniEntries result;
+
+        std::vector<wchar_t> section_data(32768, L'\0');
+        const DWORD copied = GetPrivateProfileSectionW(
+            widen_utf8(section).c_str(),
+            section_data.data(),
+            static_cast<DWORD>(section_data.size()),
+            ini_path_.c_str());
 
-    std::vector<wchar_t> section_data(32768, L'\0');
-    const DWORD copied = GetPrivateProfileSectionW(
-        L"routes",
-        section_data.data(),
-        static_cast<DWORD>(section_data.size()),
-        ini_path.c_str());
-
-    if (copied == 0) {
-        return routes;
-    }
-
-    const wchar_t* cursor = section_data.data();
-    while (*cursor != L'\0') {
-        std::wstring line(cursor);
-        const size_t equals_pos = line.find(L'=');
-        if (equals_pos != std::wstring::npos) {
-            const std::wstring key_w = line.substr(0, equals_pos);
-            const std::wstring value_w = line.substr(equals_pos + 1);
-            const std::string key = lowercase(trim(narrow_utf8(key_w.c_str())));
-            const std::string value = trim(narrow_utf8(value_w.c_str()));
-
-            if (!key.empty() && !value.empty()) {
-                routes.push_back(ProxyRoute{key, value});
+        if (copied == 0) {
+            return result;
+        }
+
+        const wchar_t* cursor = section_data.data();
+        while (*cursor != L'\0') {
+            std::wstring line(cursor);
+            const size_t equals_pos = line.find(L'=');
+            if (equals_pos != std::wstring::npos) {
+                const std::wstring key_w = line.substr(0, equals_pos);
+                const std::wstring value_w = line.substr(equals_pos + 1);
+                result.emplace_back(trim(narrow_utf8(key_w.c_str())), trim(narrow_utf8(value_w.c_str())));
+            }
+            cursor += line.size() + 1;
+        }
+        return result;
+    }
+
+private:
+    std::wstring ini_path_;
+};
+
+#else
+
+// Parses the file once with the same rules the Windows profile API applies:
+// case-insensitive section and key names, ';' comments, first key wins.
+class IniSource {
+public:
+    explicit IniSource(const std::filesystem::path& path) {
+        std::ifstream in(path);
+        std::string line;
+        IniEntries* current = nullptr;
+        while (std::getline(in, line)) {
+            line = trim(line);
+            if (line.empty() || line.front() == ';' || line.front() == '#') {
+                continue;
+            }
+            if (line.front() == '[') {
+                const size_t close = line.find(']');
+                const std::string name = lowercase(trim(line.substr(1, close == std::string::npos ? std::string::npos : close - 1)));
+                current = &sections_[name];
+                continue;
             }
+            const size_t equals_pos = line.find('=');
+            if (current == nullptr || equals_pos == std::string::npos) {
+                continue;
+            }
+            current->emplace_back(trim(line.substr(0, equals_pos)), trim(line.substr(equals_pos + 1)));
         }
-        cursor += line.size() + 1;
     }
 
+    std::string get(const std::string& section, const std::string& key) const {
+        const auto it = sections_.find(lowercase(section));
+        if (it == sections_.end()) {
+            return {};
+        }
+        for (const auto& [entry_key, value] : it->second) {
+            if (lowercase(entry_key) == lowercase(key)) {
+                return value;
+            }
+        }
+        return {};
+    }
+
+    IniEntries entries(const std::string& section) const {
+        const auto it = sections_.find(lowercase(section));
+        return it != sections_.end() ? it->second : IniEntries{};
+    }
+
+private:
+    std::unordered_map<std::string, IniEntries> sections_;
+};
+
+#endif
+
+std::string read_string(const IniSource& ini, const std::string& section, const std::string& key, const std::string& fallback) {
+    std::string value = ini.get(section, key);
+    return value.empty() ? fallback : value;
+}
+
+int read_int(const IniSource& ini, const std::string& section, const std::string& key, int fallback) {
+    const std::string value = ini.get(section, key);
+    if (value.empty()) {
+        return fallback;
+    }
+    char* end = nullptr;
+    const long parsed = std::strtol(value.c_str(), &end, 10);
+    if (end == value.c_str()) {
+        return fallback;
+    }
+    return static_cast<int>(std::clamp<long>(parsed, -2147483647L, 2147483647L));
+}
+
+bool read_bool(const IniSource& ini, const std::string& section, const std::string& key, bool fallback) {
+    const std::string value = lowercase(ini.get(section, key));
+    if (value == "1" || value == "true" || value == "yes" || value == "on") {
+        return true;
+    }
+    if (value == "0" || value == "false" || value == "no" || value == "off") {
+        return false;
+    }
+    return fallback;
+}
+
+std::vector<std::string> split_list(const std::string& value) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        std::string item = trim(value.substr(start, end - start));
+        if (!item.empty()) {
+            items.push_back(std::move(item));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+std::vector<ProxyRoute> load_routes(const IniSource& ini) {
+    std::vector<ProxyRoute> routes;
+    for (const auto& [key, value] : ini.entries("routes")) {
+        // Host names are case-insensitive, paths are not.
+        const size_t slash = key.find('/');
+        ProxyRoute route;
+        route.name = lowercase(key.substr(0, slash)) + (slash != std::string::npos ? key.substr(slash) : "");
+        route.target_base_urls = split_list(value);
+        if (!route.name.empty() && !route.target_base_urls.empty()) {
+            routes.push_back(std::move(route));
+        }
+    }
     return routes;
 }
 
+// The local path of a file: target ("file:mocks", "file:/srv/mocks", "file:///C:/mocks"),
+// or empty for any other URL.
+std::filesystem::path mock_path(std::string_view url, const std::filesystem::path& config_dir) {
+    if (url.size() < 5 || lowercase(std::string(url.substr(0, 5))) != "file:") {
+        return {};
+    }
+    std::string_view path = url.substr(5);
+    if (path.starts_with("//")) {
+        path.remove_prefix(2);
+        const size_t slash = path.find('/');
+        if (slash == std::string_view::npos) {
+            return {};
+        }
+        path.remove_prefix(slash);  // the authority, "localhost" or empty
+    }
+    // "/C:/mocks" names a Windows drive.
+    if (path.size() >= 3 && path[0] == '/' && std::isalpha(static_cast<unsigned char>(path[1])) && path[2] == ':') {
+        path.remove_prefix(1);
+    }
+    if (path.empty()) {
+        return {};
+    }
+    const std::filesystem::path local(std::u8string(path.begin(), path.end()));
+    return (local.is_absolute() ? local : config_dir / local).lexically_normal();
+}
+
+// Per-route options live in an optional [route.<name>] section.
+void load_route_options(ProxyRoute& route, const IniSource& ini, const ProxyConfig& config) {
+    const std::string section = "route." + route.name;
+    route.stream_bodies = read_bool(ini, section, "stream", route.stream_bodies);
+
+    route.balance = lowercase(read_string(ini, section, "balance", route.balance));
+    if (route.balance != "round_robin" && route.balance != "least_outstanding" && route.balance != "p2c") {
+        route.balance = "round_robin";
+    }
+
+    route.health_path = read_string(ini, section, "health_path", route.health_path);
+    if (!route.health_path.empty() && route.health_path.front() != '/') {
+        route.health_path.insert(route.health_path.begin(), '/');
+    }
+
+    route.health_interval_ms = read_int(ini, section, "health_interval_ms", route.health_interval_ms);
+    if (route.health_interval_ms <= 0) {
+        route.health_interval_ms = 5000;
+    }
+
+    route.health_timeout_ms = read_int(ini, section, "health_timeout_ms", route.health_timeout_ms);
+    if (route.health_timeout_ms <= 0) {
+        route.health_timeout_ms = 1000;
+    }
+
+    route.health_fall = std::max(1, read_int(ini, section, "health_fall", route.health_fall));
+    route.health_rise = std::max(1, read_int(ini, section, "health_rise", route.health_rise));
+
+    route.notify_window_ms = read_int(ini, section, "notify_window_ms", config.notify_window_ms);
+    if (route.notify_window_ms < 0) {
+        route.notify_window_ms = config.notify_window_ms;
+    }
+
+    route.notify_slow_ms = std::max(0, read_int(ini, section, "notify_slow_ms", route.notify_slow_ms));
+    // "4xx, 5xx"; anything else in the list is ignored.
+    for (const auto& status_class : split_list(ini.get(section, "notify_status"))) {
+        const std::string lowered = lowercase(status_class);
+        if (lowered.size() == 3 && lowered[0] >= '1' && lowered[0] <= '5' && lowered.ends_with("xx")) {
+            route.notify_status.push_back(lowered[0] - '0');
+        }
+    }
+    route.notify_sample = std::max(0, read_int(ini, section, "notify_sample", route.notify_sample));
+    route.notify_anomaly = read_int(ini, section, "notify_anomaly", route.notify_anomaly);
+    if (route.notify_anomaly < 2) {
+        route.notify_anomaly = 0;
+    }
+
+    route.coalesce = read_bool(ini, section, "coalesce", route.coalesce);
+    const std::string coalesce_headers = ini.get(section, "coalesce_headers");
+    if (!coalesce_headers.empty()) {
+        route.coalesce_headers.clear();
+        for (const auto& name : split_list(coalesce_headers)) {
+            route.coalesce_headers.push_back(lowercase(name));
+        }
+    }
+
+    route.cache = read_bool(ini, section, "cache", route.cache);
+    route.cache_size_mb = read_int(ini, section, "cache_size_mb", route.cache_size_mb);
+    if (route.cache_size_mb <= 0) {
+        route.cache_size_mb = 32;
+    }
+
+    route.connect_timeout_ms = read_int(ini, section, "connect_timeout_ms", route.connect_timeout_ms);
+    if (route.connect_timeout_ms <= 0) {
+        route.connect_timeout_ms = 3000;
+    }
+
+    route.timeout_ms = read_int(ini, section, "timeout_ms", route.timeout_ms);
+    if (route.timeout_ms <= 0) {
+        route.timeout_ms = 15000;
+    }
+
+    route.breaker = read_bool(ini, section, "breaker", route.breaker);
+    route.breaker_failures = std::max(0, read_int(ini, section, "breaker_failures", route.breaker_failures));
+    route.breaker_error_percent =
+        std::clamp(read_int(ini, section, "breaker_error_percent", route.breaker_error_percent), 0, 100);
+    route.breaker_window_ms = read_int(ini, section, "breaker_window_ms", route.breaker_window_ms);
+    if (route.breaker_window_ms <= 0) {
+        route.breaker_window_ms = 10000;
+    }
+    route.breaker_open_ms = read_int(ini, section, "breaker_open_ms", route.breaker_open_ms);
+    if (route.breaker_open_ms <= 0) {
+        route.breaker_open_ms = 5000;
+    }
+
+    route.concurrency_limit = read_bool(ini, section, "concurrency_limit", route.concurrency_limit);
+    route.concurrency_min = std::max(1, read_int(ini, section, "concurrency_min", route.concurrency_min));
+    route.concurrency_max =
+        std::max(route.concurrency_min, read_int(ini, section, "concurrency_max", route.concurrency_max));
+    route.concurrency_initial = std::clamp(read_int(ini, section, "concurrency_initial", route.concurrency_initial),
+                                           route.concurrency_min,
+                                           route.concurrency_max);
+    route.queue_size = std::max(0, read_int(ini, section, "queue_size", route.queue_size));
+    route.queue_timeout_ms = read_int(ini, section, "queue_timeout_ms", route.queue_timeout_ms);
+    if (route.queue_timeout_ms <= 0) {
+        route.queue_timeout_ms = 1000;
+    }
+
+    route.hedge = read_bool(ini, section, "hedge", route.hedge);
+    route.hedge_min_ms = std::max(0, read_int(ini, section, "hedge_min_ms", route.hedge_min_ms));
+    route.hedge_budget_percent =
+        std::clamp(read_int(ini, section, "hedge_budget_percent", route.hedge_budget_percent), 0, 100);
+
+    route.fault_delay_ms = std::max(0, read_int(ini, section, "fault_delay_ms", route.fault_delay_ms));
+    route.fault_jitter_ms = std::max(0, read_int(ini, section, "fault_jitter_ms", route.fault_jitter_ms));
+    route.fault_delay_percent =
+        std::clamp(read_int(ini, section, "fault_delay_percent", route.fault_delay_percent), 0, 100);
+    route.fault_reset_percent =
+        std::clamp(read_int(ini, section, "fault_reset_percent", route.fault_reset_percent), 0, 100);
+    route.fault_error_percent = std::clamp(read_int(ini, section, "fault_error_percent", route.fault_error_percent),
+                                           0,
+                                           100 - route.fault_reset_percent);
+    route.fault_error_status = read_int(ini, section, "fault_error_status", route.fault_error_status);
+    if (route.fault_error_status < 400 || route.fault_error_status > 599) {
+        route.fault_error_status = 503;
+    }
+    route.fault_bytes_per_sec = std::max(0, read_int(ini, section, "fault_bytes_per_sec", route.fault_bytes_per_sec));
+}
+
 }  // namespace
 
 ProxyConfig ProxyConfig::load_from_file(const std::filesystem::path& path) {
@@ -90,25 +390,127 @@ ProxyConfig ProxyConfig::load_from_file(const std::filesystem::path& path) {
         return config;
     }
 
-    const std::wstring ini_path = path.wstring();
+    const IniSource ini(path);
 
-    wchar_t host_buf[256] = {};
-    GetPrivateProfileStringW(
-        L"proxy", L"host", L"127.0.0.1", host_buf, static_cast<DWORD>(_countof(host_buf)), ini_path.c_str());
-    config.host = narrow_utf8(host_buf);
-    if (config.host.empty()) {
-        config.host = "127.0.0.1";
-    }
+    config.host = read_string(ini, "proxy", "host", config.host);
 
-    config.port = static_cast<int>(GetPrivateProfileIntW(L"proxy", L"port", config.port, ini_path.c_str()));
+    config.port = read_int(ini, "proxy", "port", config.port);
     if (config.port <= 0 || config.port > 65535) {
         config.port = 8080;
     }
 
-    config.routes = load_routes(ini_path);
+    config.engine = lowercase(read_string(ini, "proxy", "engine", config.engine));
+    if (config.engine != "httplib" && config.engine != "epoll") {
+        config.engine = "httplib";
+    }
+
+    config.workers = read_int(ini, "proxy", "workers", config.workers);
+    if (config.workers < 0) {
+        config.workers = 0;
+    }
+
+    config.listeners = read_int(ini, "proxy", "listeners", config.listeners);
+    if (config.listeners < 0) {
+        config.listeners = 0;
+    }
+
+    config.splice = read_bool(ini, "proxy", "splice", config.splice);
+
+    config.pool_max_idle = read_int(ini, "proxy", "pool_max_idle", config.pool_max_idle);
+    if (config.pool_max_idle < 0) {
+        config.pool_max_idle = 0;
+    }
+
+    config.pool_idle_timeout_ms = read_int(ini, "proxy", "pool_idle_timeout_ms", config.pool_idle_timeout_ms);
+    if (config.pool_idle_timeout_ms <= 0) {
+        config.pool_idle_timeout_ms = 30000;
+    }
+
+    config.resolve_ttl_ms = read_int(ini, "proxy", "resolve_ttl_ms", config.resolve_ttl_ms);
+    if (config.resolve_ttl_ms < 0) {
+        config.resolve_ttl_ms = 30000;
+    }
+
+    config.stream_buffer_kb = read_int(ini, "proxy", "stream_buffer_kb", config.stream_buffer_kb);
+    if (config.stream_buffer_kb <= 0) {
+        config.stream_buffer_kb = 64;
+    }
+
+    config.drain_timeout_ms = read_int(ini, "proxy", "drain_timeout_ms", config.drain_timeout_ms);
+    if (config.drain_timeout_ms < 0) {
+        config.drain_timeout_ms = 10000;
+    }
+
+    config.notify_queue_size = read_int(ini, "proxy", "notify_queue_size", config.notify_queue_size);
+    if (config.notify_queue_size <= 0) {
+        config.notify_queue_size = 1024;
+    }
+
+    config.notify_coalesce_ms = read_int(ini, "proxy", "notify_coalesce_ms", config.notify_coalesce_ms);
+    if (config.notify_coalesce_ms < 0) {
+        config.notify_coalesce_ms = 0;
+    }
+
+    config.notify_window_ms = read_int(ini, "proxy", "notify_window_ms", config.notify_window_ms);
+    if (config.notify_window_ms < 0) {
+        config.notify_window_ms = 0;
+    }
+
+    config.metrics = read_bool(ini, "proxy", "metrics", config.metrics);
+
+    config.capture_path = read_string(ini, "proxy", "capture_path", config.capture_path);
+    config.capture_body_bytes = read_int(ini, "proxy", "capture_body_bytes", config.capture_body_bytes);
+    if (config.capture_body_bytes < 0) {
+        config.capture_body_bytes = 0;
+    }
+
+    config.routes = load_routes(ini);
+    for (auto& route : config.routes) {
+        load_route_options(route, ini, config);
+        if (route.target_base_urls.size() == 1) {
+            route.mock_path = mock_path(route.target_base_urls.front(),
+                                        std::filesystem::absolute(path).parent_path());
+        }
+    }
     return config;
 }
 
+std::vector<ConfigWarning> ProxyConfig::disable_blocking_options() {
+    std::vector<ConfigWarning> warnings;
+#ifdef __linux__
+    if (engine == "epoll") {
+        return warnings;
+    }
+#endif
+    std::string delayed;
+    std::string queued;
+    for (ProxyRoute& route : routes) {
+        if (route.fault_delay_ms > 0 || route.fault_jitter_ms > 0 || route.fault_bytes_per_sec > 0) {
+            route.fault_delay_ms = 0;
+            route.fault_jitter_ms = 0;
+            route.fault_bytes_per_sec = 0;
+            delayed += (delayed.empty() ? "" : ", ") + route.name;
+        }
+        if (route.concurrency_limit && route.queue_size > 0) {
+            route.queue_size = 0;
+            queued += (queued.empty() ? "" : ", ") + route.name;
+        }
+    }
+    if (!delayed.empty()) {
+        warnings.push_back(ConfigWarning{
+            "Fault delays disabled",
+            "fault_delay_ms, fault_jitter_ms and fault_bytes_per_sec need engine = epoll; ignored for " + delayed});
+    }
+    if (!queued.empty()) {
+        warnings.push_back(ConfigWarning{
+            "Concurrency queue disabled",
+            "queue_size needs engine = epoll; requests over the limit are refused at once for " + queued});
+    }
+    return warnings;
+}
+
+#ifdef _WIN32
+
 std::filesystem::path ProxyConfig::default_config_path() {
     WCHAR appdata_path[MAX_PATH];
     if (SHGetFolderPathW(NULL, CSIDL_APPDATA, NULL, 0, appdata_path) == S_OK) {
@@ -130,4 +532,33 @@ std::filesystem::path ProxyConfig::default_config_path() {
     return "config/proxy.ini";
 }
 
+#else
+
+std::filesystem::path ProxyConfig::user_config_dir() {
+    if (const char* xdg = std::getenv("XDG_CONFIG_HOME"); xdg != nullptr && xdg[0] != '\0') {
+        return std::filesystem::path(xdg) / "notiman";
+    }
+    if (const char* home = std::getenv("HOME"); home != nullptr && home[0] != '\0') {
+        return std::filesystem::path(home) / ".config" / "notiman";
+    }
+    return {};
+}
+
+std::filesystem::path ProxyConfig::default_config_path() {
+    const std::filesystem::path user_dir = user_config_dir();
+    if (!user_dir.empty() && std::filesystem::exists(user_dir / "proxy.ini")) {
+        return user_dir / "proxy.ini";
+    }
+
+    std::error_code error;
+    const std::filesystem::path exe_path = std::filesystem::read_symlink("/proc/self/exe", error);
+    if (!error) {
+        return exe_path.parent_path() / "config" / "proxy.ini";
+    }
+
+    return "config/proxy.ini";
+}
+
+#endif
+
 }  // namespace notiman
@@ -7,17 +7,100 @@
 namespace notiman {
 
 struct ProxyRoute {
-    std::string subdomain;
-    std::string target_base_url;
+    // The [routes] key: a host pattern under .localhost ("api", "v2.api", "*.preview",
+    // "**.dev"), optionally followed by a path prefix ("shop/api/users/**"). Lowercase
+    // up to the path.
+    std::string name;
+    std::vector<std::string> target_base_urls;  // one or more, from a comma-separated [routes] value
+    // Set when the route's only target is a file: URL: a directory or manifest of canned
+    // responses served in place of an upstream. Absolute, relative paths resolved against
+    // the config file's directory.
+    std::filesystem::path mock_path;
+    // Options from the optional [route.<name>] section.
+    bool stream_bodies = false;
+    std::string balance = "round_robin";   // "round_robin", "least_outstanding" or "p2c"
+    std::string health_path;               // probed on every target when set; empty disables checks
+    int health_interval_ms = 5000;
+    int health_timeout_ms = 1000;
+    int health_fall = 3;                   // consecutive failed probes before a target is ejected
+    int health_rise = 2;                   // consecutive passed probes before it is reinstated
+    int notify_window_ms = -1;             // request roll-up window; loading fills in the [proxy] value when unset
+    // With any of these three set, only requests matching one of them are reported.
+    int notify_slow_ms = 0;                // requests slower than this, 0 = off
+    std::vector<int> notify_status;        // status classes, 4 for 4xx
+    int notify_sample = 0;                 // 1 in this many requests, 0 = off
+    int notify_anomaly = 0;                // alert once latency rises this many times over usual, 0 = off
+    bool coalesce = false;                 // concurrent identical GET/HEAD requests share one upstream exchange
+    // Request headers that must match, besides method and target, for two requests to share a response.
+    std::vector<std::string> coalesce_headers = {"accept", "accept-encoding", "authorization", "cookie"};
+    bool cache = false;                    // keep GET responses the upstream marks cacheable
+    int cache_size_mb = 32;                // memory bound of the route's response cache
+    int connect_timeout_ms = 3000;         // upstream TCP connect
+    int timeout_ms = 15000;                // upstream reads and writes that make no progress
+    bool breaker = true;                   // fail fast with 503 while the upstream keeps failing
+    int breaker_failures = 5;              // failures in a row that open the circuit, 0 ignores streaks
+    int breaker_error_percent = 50;        // failure share over breaker_window_ms that opens it, 0 ignores it
+    int breaker_window_ms = 10000;
+    int breaker_open_ms = 5000;            // time before the first probe request
+    bool concurrency_limit = false;        // adaptive cap on requests in flight upstream, with a wait queue
+    int concurrency_min = 1;
+    int concurrency_max = 100;
+    int concurrency_initial = 10;
+    int queue_size = 50;                   // requests waiting for a slot before new ones get 503; epoll engine only
+    int queue_timeout_ms = 1000;           // longest wait for a slot
+    bool hedge = false;                    // resend idempotent requests still waiting past the route's p95
+    int hedge_min_ms = 10;                 // earliest a request is hedged, however fast the route
+    int hedge_budget_percent = 10;         // share of requests that may be hedged
+    // Fault injection, for testing clients against a slow or flaky upstream.
+    int fault_delay_ms = 0;                // latency added to requests, epoll engine only
+    int fault_jitter_ms = 0;               // up to this much more, at random
+    int fault_delay_percent = 100;         // share of requests delayed
+    int fault_error_percent = 0;           // share answered with fault_error_status instead
+    int fault_error_status = 503;
+    int fault_reset_percent = 0;           // share whose connection is dropped instead
+    int fault_bytes_per_sec = 0;           // response bandwidth per connection, 0 = unlimited; epoll engine only
+
+    bool operator==(const ProxyRoute&) const = default;
+};
+
+// A setting loading could not honour, as a notification title and body.
+struct ConfigWarning {
+    std::string title;
+    std::string body;
 };
 
 struct ProxyConfig {
     std::string host = "127.0.0.1";
     int port = 8080;
+    std::string engine = "httplib";   // "httplib" (thread per connection) or "epoll" (Linux event loops)
+    int workers = 0;                   // epoll event loops, 0 = one per core
+    int listeners = 0;                 // Linux: listening sockets sharing the port via SO_REUSEPORT, 0 = one per core
+    bool splice = true;                // epoll: forward large bodies with splice() when nothing rewrites them
+    int pool_max_idle = 8;             // idle upstream connections kept per route, 0 disables pooling
+    int pool_idle_timeout_ms = 30000;
+    int resolve_ttl_ms = 30000;        // upstream addresses are looked up again after this, 0 on every connect
+    int stream_buffer_kb = 64;         // per-connection buffer for routes with stream=true
+    int drain_timeout_ms = 10000;      // on shutdown or restart, in-flight requests get this long to finish
+    int notify_queue_size = 1024;      // pending notifications before new ones are dropped
+    int notify_coalesce_ms = 500;      // repeated notifications inside this window are merged
+    int notify_window_ms = 1000;       // requests per route inside this window become one summary, 0 = one each
+    bool metrics = true;               // record latency histograms and serve /__notiman/metrics
+    std::string capture_path;          // append every exchange to this capture file; empty disables capture
+    int capture_body_bytes = 0;        // body bytes kept per direction in the capture, 0 keeps metadata only
     std::vector<ProxyRoute> routes;
 
     static ProxyConfig load_from_file(const std::filesystem::path& path);
+    // Turns off route options that would make the httplib engine hold one of its pooled
+    // worker threads while a request waits, starving every other route: fault delays,
+    // bandwidth caps and the concurrency limit's wait queue. Nothing changes when the epoll
+    // engine runs. Returns a warning per option turned off, for the caller to post. Call
+    // once engine is final.
+    std::vector<ConfigWarning> disable_blocking_options();
     static std::filesystem::path default_config_path();
+#ifndef _WIN32
+    // $XDG_CONFIG_HOME/notiman, or ~/.config/notiman. Empty when neither is set.
+    static std::filesystem::path user_config_dir();
+#endif
 };
 
 }  // namespace notiman
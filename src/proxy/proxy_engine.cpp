@@ -0,0 +1,36 @@
+#include "proxy_engine.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "httplib_engine.h"
+
+#ifdef __linux__
+#include "epoll_engine.h"
+#endif
+
+namespace notiman {
+
+std::unique_ptr<ProxyEngine> make_proxy_engine(const ProxyConfig& config,
+                                               RouteTablePublisher& routes,
+                                               NotificationDispatcher* notifications,
+                                               ProxyMetrics* metrics,
+                                               TrafficCapture* capture) {
+    size_t listeners = 1;
+#ifdef __linux__
+    listeners = config.listeners > 0 ? static_cast<size_t>(config.listeners)
+                                     : std::max(1u, std::thread::hardware_concurrency());
+    if (config.engine == "epoll") {
+        EpollEngineOptions options;
+        options.workers = static_cast<size_t>(config.workers);
+        options.listeners = listeners;
+        options.splice_bodies = config.splice;
+        return std::make_unique<EpollEngine>(options, routes, notifications, metrics, capture);
+    }
+#endif
+    HttplibEngineOptions options;
+    options.listeners = listeners;
+    return std::make_unique<HttplibEngine>(options, routes, notifications, metrics, capture);
+}
+
+}  // namespace notiman
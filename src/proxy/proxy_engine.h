@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "notification_dispatcher.h"
+#include "proxy_config.h"
+#include "proxy_metrics.h"
+#include "route_table.h"
+#include "traffic_capture.h"
+
+namespace notiman {
+
+// Accepts downstream connections and forwards them along the published route table.
+class ProxyEngine {
+public:
+    virtual ~ProxyEngine() = default;
+
+    // Binds host:port (0 picks a free port) and starts serving. False if the bind failed.
+    virtual bool start(const std::string& host, int port) = 0;
+
+#ifndef _WIN32
+    // Starts serving on sockets that are already bound and listening, passed down by systemd
+    // or by the process this one replaces; one listener per socket. The engine owns them
+    // from then on.
+    virtual bool start_inherited(const std::vector<int>& listen_fds) = 0;
+
+    // The listening sockets, for handing over to a successor process. Empty when not started.
+    virtual std::vector<int> listen_sockets() const = 0;
+#endif
+
+    // Stops accepting and waits up to timeout for requests in flight to finish. Idle
+    // keep-alive connections are closed, busy ones after their response. The listening
+    // socket is never shut down, so a successor sharing it keeps accepting. Returns how
+    // many connections were still busy at the deadline; stop() closes them.
+    virtual size_t drain(std::chrono::milliseconds timeout) = 0;
+
+    // Stops accepting, closes connections and joins the serving threads.
+    virtual void stop() = 0;
+
+    // Bound port once start() succeeded.
+    virtual int port() const = 0;
+
+    // The proxy.ini engine= value this engine implements.
+    virtual const char* name() const = 0;
+};
+
+// Builds the engine named by config.engine, or the httplib engine where that one is
+// not available on this platform. notifications may be null to run silently, metrics
+// null to skip recording and leave /__notiman/metrics to the routes, and capture null
+// to keep no traffic capture.
+std::unique_ptr<ProxyEngine> make_proxy_engine(const ProxyConfig& config,
+                                               RouteTablePublisher& routes,
+                                               NotificationDispatcher* notifications,
+                                               ProxyMetrics* metrics,
+                                               TrafficCapture* capture);
+
+}  // namespace notiman
@@ -0,0 +1,672 @@
+#include "proxy_metrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+
+#include <nlohmann/json.hpp>
+
+namespace notiman {
+
+namespace {
+
+constexpr std::string_view kOtherTemplate = "/:other";
+constexpr std::string_view kUnmatchedRoute = "-";
+// Labels for PathMetrics::cache, in CacheResult order after None.
+constexpr std::array<std::string_view, 3> kCacheResultNames = {"hit", "revalidated", "miss"};
+constexpr std::array<std::string_view, 2> kResolverResultNames = {"hit", "miss"};
+
+// Prometheus histogram buckets in seconds. Fine buckets straddling a boundary count
+// towards the next one, which is within the histogram's own precision.
+constexpr std::array<std::pair<const char*, uint64_t>, 15> kPrometheusBuckets = {{
+    {"0.0005", 500},
+    {"0.001", 1000},
+    {"0.0025", 2500},
+    {"0.005", 5000},
+    {"0.01", 10000},
+    {"0.025", 25000},
+    {"0.05", 50000},
+    {"0.1", 100000},
+    {"0.25", 250000},
+    {"0.5", 500000},
+    {"1", 1000000},
+    {"2.5", 2500000},
+    {"5", 5000000},
+    {"10", 10000000},
+    {"30", 30000000},
+}};
+
+constexpr std::array<std::pair<const char*, double>, 4> kQuantiles = {{
+    {"0.5", 0.5},
+    {"0.9", 0.9},
+    {"0.99", 0.99},
+    {"0.999", 0.999},
+}};
+
+// Written by the owning thread only, read by snapshot(): a relaxed load and store
+// avoids the locked instruction a fetch_add would cost on every request.
+struct ShardCounter {
+    std::atomic<uint64_t> value = 0;
+
+    void add(uint64_t amount) {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+    uint64_t load() const { return value.load(std::memory_order_relaxed); }
+};
+
+struct ShardHistogram {
+    std::array<ShardCounter, LatencyHistogram::kBucketCount> buckets;
+    ShardCounter count;
+    ShardCounter sum_us;
+    ShardCounter max_us;
+
+    void record(uint64_t micros) {
+        buckets[LatencyHistogram::bucket_index(micros)].add(1);
+        count.add(1);
+        sum_us.add(micros);
+        if (micros > max_us.load()) {
+            max_us.value.store(micros, std::memory_order_relaxed);
+        }
+    }
+
+    void merge_into(LatencyHistogram& out) const {
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            out.buckets[i] += buckets[i].load();
+        }
+        out.count += count.load();
+        out.sum_us += sum_us.load();
+        out.max_us = std::max(out.max_us, max_us.load());
+    }
+};
+
+struct ShardSeries {
+    std::string route;
+    std::string path;
+    std::array<ShardCounter, 5> status_classes;
+    ShardCounter bytes_in;
+    ShardCounter bytes_out;
+    ShardCounter coalesced;
+    ShardCounter hedges;
+    ShardCounter hedges_won;
+    ShardCounter tunnels;
+    std::array<ShardCounter, 3> cache;
+    std::array<ShardCounter, 2> resolver;
+    ShardHistogram total;
+    ShardHistogram connect;
+    ShardHistogram ttfb;
+};
+
+std::atomic<uint64_t> g_next_metrics_id = 1;
+
+uint64_t to_micros(std::chrono::microseconds value) {
+    return value.count() > 0 ? static_cast<uint64_t>(value.count()) : 0;
+}
+
+bool is_digits(std::string_view segment) {
+    return std::all_of(segment.begin(), segment.end(), [](unsigned char c) { return std::isdigit(c) != 0; });
+}
+
+bool is_uuid(std::string_view segment) {
+    if (segment.size() != 36) {
+        return false;
+    }
+    for (size_t i = 0; i < segment.size(); ++i) {
+        const bool dash = i == 8 || i == 13 || i == 18 || i == 23;
+        if (dash ? segment[i] != '-' : std::isxdigit(static_cast<unsigned char>(segment[i])) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Hashes and object ids: 16+ hex characters with at least one digit, so words don't match.
+bool is_hex_id(std::string_view segment) {
+    if (segment.size() < 16) {
+        return false;
+    }
+    bool digit = false;
+    for (const char c : segment) {
+        if (std::isxdigit(static_cast<unsigned char>(c)) == 0) {
+            return false;
+        }
+        digit |= std::isdigit(static_cast<unsigned char>(c)) != 0;
+    }
+    return digit;
+}
+
+std::string escape_label(std::string_view value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (const char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+void append_seconds(std::string& out, uint64_t micros) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.6f", static_cast<double>(micros) / 1e6);
+    out += buf;
+}
+
+void append_histogram(std::string& out,
+                      const char* name,
+                      const std::string& labels,
+                      const LatencyHistogram& histogram) {
+    for (const auto& [le, micros] : kPrometheusBuckets) {
+        out += name;
+        out += "_bucket{" + labels + ",le=\"" + le + "\"} ";
+        out += std::to_string(histogram.count_at_or_below(micros));
+        out += "\n";
+    }
+    out += name;
+    out += "_bucket{" + labels + ",le=\"+Inf\"} " + std::to_string(histogram.count) + "\n";
+    out += name;
+    out += "_sum{" + labels + "} ";
+    append_seconds(out, histogram.sum_us);
+    out += "\n";
+    out += name;
+    out += "_count{" + labels + "} " + std::to_string(histogram.count) + "\n";
+}
+
+void append_header(std::string& out, const char* name, const char* type, const char* help) {
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+nlohmann::json histogram_json(const LatencyHistogram& histogram) {
+    return {
+        {"count", histogram.count},
+        {"mean_us", histogram.count > 0 ? histogram.sum_us / histogram.count : 0},
+        {"p50_us", histogram.percentile_us(0.5)},
+        {"p90_us", histogram.percentile_us(0.9)},
+        {"p99_us", histogram.percentile_us(0.99)},
+        {"p999_us", histogram.percentile_us(0.999)},
+        {"max_us", histogram.max_us},
+    };
+}
+
+nlohmann::json path_json(const PathMetrics& metrics) {
+    nlohmann::json status = nlohmann::json::object();
+    for (size_t i = 0; i < metrics.status_classes.size(); ++i) {
+        if (metrics.status_classes[i] > 0) {
+            status[std::to_string(i + 1) + "xx"] = metrics.status_classes[i];
+        }
+    }
+    nlohmann::json cache = nlohmann::json::object();
+    for (size_t i = 0; i < metrics.cache.size(); ++i) {
+        if (metrics.cache[i] > 0) {
+            cache[std::string(kCacheResultNames[i])] = metrics.cache[i];
+        }
+    }
+    nlohmann::json resolver = nlohmann::json::object();
+    for (size_t i = 0; i < metrics.resolver.size(); ++i) {
+        if (metrics.resolver[i] > 0) {
+            resolver[std::string(kResolverResultNames[i])] = metrics.resolver[i];
+        }
+    }
+    return {
+        {"requests", metrics.total.count},
+        {"status", std::move(status)},
+        {"bytes_in", metrics.bytes_in},
+        {"bytes_out", metrics.bytes_out},
+        {"coalesced", metrics.coalesced},
+        {"hedges", metrics.hedges},
+        {"hedges_won", metrics.hedges_won},
+        {"tunnels", metrics.tunnels},
+        {"cache", std::move(cache)},
+        {"resolver", std::move(resolver)},
+        {"latency", histogram_json(metrics.total)},
+        {"upstream_connect", histogram_json(metrics.connect)},
+        {"upstream_ttfb", histogram_json(metrics.ttfb)},
+    };
+}
+
+}  // namespace
+
+size_t LatencyHistogram::bucket_index(uint64_t micros) {
+    if (micros < kSubBuckets) {
+        return static_cast<size_t>(micros);
+    }
+    const uint64_t clamped = std::min(micros, (uint64_t{1} << kMaxValueBits) - 1);
+    const auto shift = static_cast<unsigned>(std::bit_width(clamped)) - 1 - kSubBucketBits;
+    const uint64_t sub_bucket = (clamped >> shift) - kSubBuckets;
+    return static_cast<size_t>(kSubBuckets + shift * kSubBuckets + sub_bucket);
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(size_t index) {
+    if (index < kSubBuckets) {
+        return index;
+    }
+    const uint64_t shift = (index - kSubBuckets) / kSubBuckets;
+    const uint64_t sub_bucket = (index - kSubBuckets) % kSubBuckets;
+    return ((kSubBuckets + sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t micros) {
+    ++buckets[bucket_index(micros)];
+    ++count;
+    sum_us += micros;
+    max_us = std::max(max_us, micros);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum_us += other.sum_us;
+    max_us = std::max(max_us, other.max_us);
+}
+
+uint64_t LatencyHistogram::percentile_us(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(bucket_upper_bound(i), max_us);
+        }
+    }
+    return max_us;
+}
+
+uint64_t LatencyHistogram::count_at_or_below(uint64_t micros) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < buckets.size() && bucket_upper_bound(i) <= micros; ++i) {
+        total += buckets[i];
+    }
+    return total;
+}
+
+void PathMetrics::merge(const PathMetrics& other) {
+    for (size_t i = 0; i < status_classes.size(); ++i) {
+        status_classes[i] += other.status_classes[i];
+    }
+    bytes_in += other.bytes_in;
+    bytes_out += other.bytes_out;
+    coalesced += other.coalesced;
+    hedges += other.hedges;
+    hedges_won += other.hedges_won;
+    tunnels += other.tunnels;
+    for (size_t i = 0; i < cache.size(); ++i) {
+        cache[i] += other.cache[i];
+    }
+    for (size_t i = 0; i < resolver.size(); ++i) {
+        resolver[i] += other.resolver[i];
+    }
+    total.merge(other.total);
+    connect.merge(other.connect);
+    ttfb.merge(other.ttfb);
+}
+
+void normalize_path_template(std::string_view path, std::string& out) {
+    out.clear();
+    size_t start = path.empty() || path.front() != '/' ? 0 : 1;
+    out += '/';
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string_view::npos) {
+            end = path.size();
+        }
+        const std::string_view segment = path.substr(start, end - start);
+        if (!segment.empty() && is_digits(segment)) {
+            out += ":id";
+        } else if (is_uuid(segment)) {
+            out += ":uuid";
+        } else if (is_hex_id(segment)) {
+            out += ":hash";
+        } else {
+            out += segment;
+        }
+        if (end == path.size()) {
+            break;
+        }
+        out += '/';
+        start = end + 1;
+    }
+}
+
+bool metrics_wants_json(std::string_view query, std::string_view accept) {
+    return query.find("format=json") != std::string_view::npos ||
+           accept.find("application/json") != std::string_view::npos;
+}
+
+std::string format_prometheus(const MetricsSnapshot& snapshot) {
+    std::vector<std::string> labels;
+    labels.reserve(snapshot.paths.size());
+    for (const auto& metrics : snapshot.paths) {
+        labels.push_back("route=\"" + escape_label(metrics.route) + "\",path=\"" + escape_label(metrics.path) + "\"");
+    }
+
+    std::string out;
+    append_header(out, "notiman_proxy_requests_total", "counter", "Requests answered, by status class.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        const auto& classes = snapshot.paths[i].status_classes;
+        for (size_t c = 0; c < classes.size(); ++c) {
+            if (classes[c] > 0) {
+                out += "notiman_proxy_requests_total{" + labels[i] + ",code=\"" + std::to_string(c + 1) + "xx\"} " +
+                       std::to_string(classes[c]) + "\n";
+            }
+        }
+    }
+
+    append_header(out, "notiman_proxy_request_bytes_total", "counter", "Request body bytes received from clients.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        out += "notiman_proxy_request_bytes_total{" + labels[i] + "} " +
+               std::to_string(snapshot.paths[i].bytes_in) + "\n";
+    }
+    append_header(out, "notiman_proxy_response_bytes_total", "counter", "Response body bytes sent to clients.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        out += "notiman_proxy_response_bytes_total{" + labels[i] + "} " +
+               std::to_string(snapshot.paths[i].bytes_out) + "\n";
+    }
+    append_header(out,
+                  "notiman_proxy_coalesced_requests_total",
+                  "counter",
+                  "Requests answered from an identical in-flight request's upstream exchange.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        out += "notiman_proxy_coalesced_requests_total{" + labels[i] + "} " +
+               std::to_string(snapshot.paths[i].coalesced) + "\n";
+    }
+    append_header(out,
+                  "notiman_proxy_hedges_total",
+                  "counter",
+                  "Second attempts sent for idempotent requests slower than the route's 95th percentile.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        out += "notiman_proxy_hedges_total{" + labels[i] + "} " +
+               std::to_string(snapshot.paths[i].hedges) + "\n";
+    }
+    append_header(out,
+                  "notiman_proxy_hedges_won_total",
+                  "counter",
+                  "Hedges that answered before the attempt they were racing.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        out += "notiman_proxy_hedges_won_total{" + labels[i] + "} " +
+               std::to_string(snapshot.paths[i].hedges_won) + "\n";
+    }
+    append_header(out,
+                  "notiman_proxy_tunnels_total",
+                  "counter",
+                  "Closed WebSocket and CONNECT tunnels; their traffic is in the byte counters.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        out += "notiman_proxy_tunnels_total{" + labels[i] + "} " + std::to_string(snapshot.paths[i].tunnels) + "\n";
+    }
+    append_header(out,
+                  "notiman_proxy_cache_requests_total",
+                  "counter",
+                  "Requests on routes with a response cache, by how the cache answered them.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        const auto& results = snapshot.paths[i].cache;
+        for (size_t r = 0; r < results.size(); ++r) {
+            if (results[r] > 0) {
+                out += "notiman_proxy_cache_requests_total{" + labels[i] + ",result=\"" +
+                       std::string(kCacheResultNames[r]) + "\"} " + std::to_string(results[r]) + "\n";
+            }
+        }
+    }
+
+    append_header(out,
+                  "notiman_proxy_resolver_lookups_total",
+                  "counter",
+                  "Upstream address lookups behind new connections, by whether the resolver cache answered.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        const auto& results = snapshot.paths[i].resolver;
+        for (size_t r = 0; r < results.size(); ++r) {
+            if (results[r] > 0) {
+                out += "notiman_proxy_resolver_lookups_total{" + labels[i] + ",result=\"" +
+                       std::string(kResolverResultNames[r]) + "\"} " + std::to_string(results[r]) + "\n";
+            }
+        }
+    }
+
+    append_header(out,
+                  "notiman_proxy_request_duration_seconds",
+                  "histogram",
+                  "Time from the request head to the end of the response.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        append_histogram(out, "notiman_proxy_request_duration_seconds", labels[i], snapshot.paths[i].total);
+    }
+
+    // Quantiles straight from the fine-grained histogram, which the coarse buckets above lose.
+    append_header(out,
+                  "notiman_proxy_request_duration_quantile_seconds",
+                  "gauge",
+                  "Request duration quantiles within 1/16 of the true value.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        for (const auto& [label, q] : kQuantiles) {
+            out += "notiman_proxy_request_duration_quantile_seconds{" + labels[i] + ",quantile=\"" + label + "\"} ";
+            append_seconds(out, snapshot.paths[i].total.percentile_us(q));
+            out += "\n";
+        }
+    }
+
+    append_header(out,
+                  "notiman_proxy_upstream_connect_seconds",
+                  "histogram",
+                  "TCP connect time of new upstream connections.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        append_histogram(out, "notiman_proxy_upstream_connect_seconds", labels[i], snapshot.paths[i].connect);
+    }
+
+    append_header(out,
+                  "notiman_proxy_upstream_ttfb_seconds",
+                  "histogram",
+                  "Time from the request head to the upstream response head.");
+    for (size_t i = 0; i < snapshot.paths.size(); ++i) {
+        append_histogram(out, "notiman_proxy_upstream_ttfb_seconds", labels[i], snapshot.paths[i].ttfb);
+    }
+
+    append_header(out,
+                  "notiman_proxy_connections_total",
+                  "counter",
+                  "Downstream connections accepted, by listening socket.");
+    for (size_t i = 0; i < snapshot.listener_connections.size(); ++i) {
+        out += "notiman_proxy_connections_total{listener=\"" + std::to_string(i) + "\"} " +
+               std::to_string(snapshot.listener_connections[i]) + "\n";
+    }
+    return out;
+}
+
+std::string format_json(const MetricsSnapshot& snapshot) {
+    nlohmann::json routes = nlohmann::json::array();
+    for (size_t i = 0; i < snapshot.paths.size();) {
+        PathMetrics rollup;
+        rollup.route = snapshot.paths[i].route;
+        nlohmann::json paths = nlohmann::json::array();
+        for (; i < snapshot.paths.size() && snapshot.paths[i].route == rollup.route; ++i) {
+            rollup.merge(snapshot.paths[i]);
+            nlohmann::json entry = path_json(snapshot.paths[i]);
+            entry["path"] = snapshot.paths[i].path;
+            paths.push_back(std::move(entry));
+        }
+        nlohmann::json route = path_json(rollup);
+        route["route"] = rollup.route;
+        route["paths"] = std::move(paths);
+        routes.push_back(std::move(route));
+    }
+    nlohmann::json listeners = nlohmann::json::array();
+    for (size_t i = 0; i < snapshot.listener_connections.size(); ++i) {
+        listeners.push_back({{"listener", i}, {"connections", snapshot.listener_connections[i]}});
+    }
+    return nlohmann::json{{"routes", std::move(routes)}, {"listeners", std::move(listeners)}}.dump(2);
+}
+
+struct ProxyMetrics::Shard {
+    // Taken by the owning thread when it adds a series and by snapshot() while reading.
+    // Lookups by the owner need no lock: nobody else ever modifies the maps.
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<ShardSeries>> series;
+    std::unordered_map<std::string, size_t> templates_per_route;
+    std::string key;
+    std::string path;
+    // Connections the owning thread accepted, all on one listening socket.
+    std::atomic<size_t> listener = 0;
+    std::atomic<uint64_t> connections = 0;
+};
+
+ProxyMetrics::ProxyMetrics() : id_(g_next_metrics_id.fetch_add(1)) {}
+
+ProxyMetrics::~ProxyMetrics() = default;
+
+ProxyMetrics::Shard& ProxyMetrics::local_shard() {
+    // Keyed by instance id rather than address so a new instance never sees a stale shard.
+    thread_local uint64_t cached_owner = 0;
+    thread_local Shard* cached_shard = nullptr;
+    if (cached_owner == id_) {
+        return *cached_shard;
+    }
+
+    std::lock_guard lock(mutex_);
+    auto& shard = shards_[std::this_thread::get_id()];
+    if (!shard) {
+        shard = std::make_unique<Shard>();
+    }
+    cached_owner = id_;
+    cached_shard = shard.get();
+    return *shard;
+}
+
+void ProxyMetrics::record(const RequestSample& sample) {
+    Shard& shard = local_shard();
+
+    const std::string_view route = sample.route.empty() ? kUnmatchedRoute : sample.route;
+    shard.key.assign(route);
+    shard.key += '\n';
+    if (sample.route.empty()) {
+        // Unmatched hosts get one series; their paths are whatever the client made up.
+        shard.path.assign("/*");
+    } else {
+        normalize_path_template(sample.path, shard.path);
+    }
+    shard.key += shard.path;
+
+    auto it = shard.series.find(shard.key);
+    if (it == shard.series.end()) {
+        auto& templates = shard.templates_per_route[std::string(route)];
+        if (templates >= kMaxTemplatesPerRoute) {
+            shard.path.assign(kOtherTemplate);
+            shard.key.assign(route);
+            shard.key += '\n';
+            shard.key += shard.path;
+            it = shard.series.find(shard.key);
+        }
+        if (it == shard.series.end()) {
+            auto series = std::make_unique<ShardSeries>();
+            series->route.assign(route);
+            series->path = shard.path;
+            std::lock_guard lock(shard.mutex);
+            it = shard.series.emplace(shard.key, std::move(series)).first;
+            ++templates;
+        }
+    }
+
+    ShardSeries& series = *it->second;
+    if (sample.status >= 100 && sample.status < 600) {
+        series.status_classes[static_cast<size_t>(sample.status / 100 - 1)].add(1);
+    }
+    series.bytes_in.add(sample.bytes_in);
+    series.bytes_out.add(sample.bytes_out);
+    if (sample.coalesced) {
+        series.coalesced.add(1);
+    }
+    if (sample.hedged) {
+        series.hedges.add(1);
+        if (sample.hedge_won) {
+            series.hedges_won.add(1);
+        }
+    }
+    if (sample.tunnel) {
+        series.tunnels.add(1);
+    }
+    if (sample.cache != CacheResult::None) {
+        series.cache[static_cast<size_t>(sample.cache) - 1].add(1);
+    }
+    series.total.record(to_micros(sample.total));
+    if (sample.connect.count() >= 0) {
+        series.connect.record(to_micros(sample.connect));
+        series.resolver[sample.resolver_hit ? 0 : 1].add(1);
+    }
+    if (sample.ttfb.count() >= 0) {
+        series.ttfb.record(to_micros(sample.ttfb));
+    }
+}
+
+void ProxyMetrics::record_connection(size_t listener) {
+    Shard& shard = local_shard();
+    shard.listener.store(listener, std::memory_order_relaxed);
+    shard.connections.store(shard.connections.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+MetricsSnapshot ProxyMetrics::snapshot() const {
+    std::unordered_map<std::string, PathMetrics> merged;
+    std::vector<uint64_t> listener_connections;
+    {
+        std::lock_guard lock(mutex_);
+        for (const auto& [thread, shard] : shards_) {
+            if (const uint64_t connections = shard->connections.load(std::memory_order_relaxed); connections > 0) {
+                const size_t listener = shard->listener.load(std::memory_order_relaxed);
+                if (listener_connections.size() <= listener) {
+                    listener_connections.resize(listener + 1);
+                }
+                listener_connections[listener] += connections;
+            }
+            std::lock_guard shard_lock(shard->mutex);
+            for (const auto& [key, series] : shard->series) {
+                PathMetrics& out = merged[key];
+                out.route = series->route;
+                out.path = series->path;
+                for (size_t i = 0; i < out.status_classes.size(); ++i) {
+                    out.status_classes[i] += series->status_classes[i].load();
+                }
+                out.bytes_in += series->bytes_in.load();
+                out.bytes_out += series->bytes_out.load();
+                out.coalesced += series->coalesced.load();
+                out.hedges += series->hedges.load();
+                out.hedges_won += series->hedges_won.load();
+                out.tunnels += series->tunnels.load();
+                for (size_t i = 0; i < out.cache.size(); ++i) {
+                    out.cache[i] += series->cache[i].load();
+                }
+                for (size_t i = 0; i < out.resolver.size(); ++i) {
+                    out.resolver[i] += series->resolver[i].load();
+                }
+                series->total.merge_into(out.total);
+                series->connect.merge_into(out.connect);
+                series->ttfb.merge_into(out.ttfb);
+            }
+        }
+    }
+
+    MetricsSnapshot result;
+    result.listener_connections = std::move(listener_connections);
+    result.paths.reserve(merged.size());
+    for (auto& [key, metrics] : merged) {
+        result.paths.push_back(std::move(metrics));
+    }
+    std::sort(result.paths.begin(), result.paths.end(), [](const PathMetrics& a, const PathMetrics& b) {
+        return a.route != b.route ? a.route < b.route : a.path < b.path;
+    });
+    return result;
+}
+
+}  // namespace notiman
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace notiman {
+
+// Reserved path answered by the proxy itself on every host. Prometheus text by default,
+// JSON with ?format=json or an Accept header asking for application/json.
+inline constexpr std::string_view kMetricsPath = "/__notiman/metrics";
+
+// Log-linear latency histogram in microseconds, HDR style: every power of two is split
+// into kSubBuckets linear buckets, so any recorded value is off by at most 1/kSubBuckets.
+// Values from 0 up to ~71 minutes fit in under 4 KB.
+struct LatencyHistogram {
+    static constexpr unsigned kSubBucketBits = 4;
+    static constexpr uint64_t kSubBuckets = uint64_t{1} << kSubBucketBits;
+    static constexpr unsigned kMaxValueBits = 32;
+    static constexpr size_t kBucketCount = kSubBuckets + (kMaxValueBits - kSubBucketBits) * kSubBuckets;
+
+    static size_t bucket_index(uint64_t micros);
+    // Largest value that lands in bucket index.
+    static uint64_t bucket_upper_bound(size_t index);
+
+    void record(uint64_t micros);
+    void merge(const LatencyHistogram& other);
+
+    // Upper bound of the bucket holding the q-quantile (0 < q <= 1). 0 when empty.
+    uint64_t percentile_us(double q) const;
+    // Values recorded at or below micros, rounded down to whole buckets.
+    uint64_t count_at_or_below(uint64_t micros) const;
+
+    std::array<uint64_t, kBucketCount> buckets{};
+    uint64_t count = 0;
+    uint64_t sum_us = 0;
+    uint64_t max_us = 0;
+};
+
+// How a request on a route with a response cache was answered.
+enum class CacheResult : uint8_t {
+    None,         // not looked up: no cache on the route, or the request bypasses it
+    Hit,          // served from a fresh stored response
+    Revalidated,  // stored response confirmed by a 304 from the upstream
+    Miss          // went upstream for a new response
+};
+
+// One finished exchange as seen by an engine.
+struct RequestSample {
+    std::string_view route;  // route name; empty when no route matched the request
+    std::string_view path;   // request path without the query
+    int status = 0;          // status sent to the client
+    uint64_t bytes_in = 0;   // request body bytes received from the client
+    uint64_t bytes_out = 0;  // response body bytes sent to the client
+    bool coalesced = false;  // answered from an identical request's upstream exchange
+    bool hedged = false;     // a second attempt went upstream after the first was slow to answer
+    bool hedge_won = false;  // with hedged: the second attempt answered first
+    bool tunnel = false;     // upgraded or CONNECT; the byte counts include the tunnel traffic
+    CacheResult cache = CacheResult::None;
+    std::chrono::microseconds total{0};  // for a tunnel, until the handshake completed
+    std::chrono::microseconds connect{-1};  // negative when a pooled connection was reused
+    bool resolver_hit = false;              // with connect: the upstream addresses came from the resolver cache
+    std::chrono::microseconds ttfb{-1};     // request start to upstream response head; negative if none
+};
+
+// Merged counters of one route and path template.
+struct PathMetrics {
+    std::string route;
+    std::string path;
+    std::array<uint64_t, 5> status_classes{};  // 1xx .. 5xx
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t coalesced = 0;  // upstream exchanges saved by request coalescing
+    uint64_t hedges = 0;      // second attempts sent for slow requests
+    uint64_t hedges_won = 0;  // of those, the ones that answered first
+    uint64_t tunnels = 0;    // closed WebSocket and CONNECT tunnels
+    std::array<uint64_t, 3> cache{};  // hits, revalidations, misses
+    std::array<uint64_t, 2> resolver{};  // address lookups behind new upstream connections: hits, misses
+    LatencyHistogram total;
+    LatencyHistogram connect;
+    LatencyHistogram ttfb;
+
+    void merge(const PathMetrics& other);
+};
+
+struct MetricsSnapshot {
+    std::vector<PathMetrics> paths;  // sorted by route, then path
+    std::vector<uint64_t> listener_connections;  // accepted connections by listening socket
+};
+
+// Replaces variable path segments (numbers, UUIDs, long hex ids) with placeholders so
+// /users/42 and /users/43 share the series /users/:id.
+void normalize_path_template(std::string_view path, std::string& out);
+
+std::string format_prometheus(const MetricsSnapshot& snapshot);
+std::string format_json(const MetricsSnapshot& snapshot);
+
+// True when a metrics request asked for JSON rather than Prometheus text.
+bool metrics_wants_json(std::string_view query, std::string_view accept);
+
+// Per-route latency and traffic counters. Each recording thread writes only its own
+// shard, without locks or atomic read-modify-writes; snapshot() merges the shards.
+class ProxyMetrics {
+public:
+    // Distinct path templates kept per route in each shard; the rest share "/:other".
+    static constexpr size_t kMaxTemplatesPerRoute = 64;
+
+    ProxyMetrics();
+    ProxyMetrics(const ProxyMetrics&) = delete;
+    ProxyMetrics& operator=(const ProxyMetrics&) = delete;
+    ~ProxyMetrics();
+
+    void record(const RequestSample& sample);
+
+    // A connection accepted on listening socket number listener. Each thread is expected
+    // to accept for one listener only.
+    void record_connection(size_t listener);
+
+    MetricsSnapshot snapshot() const;
+
+private:
+    struct Shard;
+
+    Shard& local_shard();
+
+    const uint64_t id_;
+    mutable std::mutex mutex_;
+    // A shard outlives its thread and is adopted by the next thread given the same id,
+    // so threads that come and go do not grow this map.
+    std::unordered_map<std::thread::id, std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace notiman
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "proxy_config.h"
+
+namespace notiman {
+
+// GET and HEAD without a body: the only requests a route may answer from another
+// identical request's upstream exchange.
+inline bool is_coalescable_method(std::string_view method) {
+    return method == "GET" || method == "HEAD";
+}
+
+// Requests with equal keys get the same response: same route, method and target, and
+// the same values for the route's coalesce_headers. header(name) returns a request
+// header value, empty when absent.
+template <typename HeaderLookup>
+std::string coalescing_key(const ProxyRoute& route,
+                           std::string_view method,
+                           std::string_view target,
+                           HeaderLookup&& header) {
+    std::string key;
+    key.append(route.name).append("\n").append(method).append(" ").append(target);
+    for (const auto& name : route.coalesce_headers) {
+        key.append("\n").append(header(name));
+    }
+    return key;
+}
+
+// Singleflight for blocking engines: the first request for a key leads and goes
+// upstream; requests joining while it is in flight wait for its response instead.
+// When the leader gives up without a response, every waiter goes upstream itself.
+template <typename Response>
+class RequestCoalescer {
+    struct Flight {
+        std::mutex mutex;
+        std::condition_variable done_cv;
+        bool done = false;
+        std::shared_ptr<const Response> response;  // null when the leader failed
+    };
+
+public:
+    // Held by the request that goes upstream. Waiters are released by publish() or,
+    // without a response, when the lead is destroyed.
+    class Lead {
+    public:
+        Lead() = default;
+        Lead(RequestCoalescer* owner, std::string key, std::shared_ptr<Flight> flight)
+            : owner_(owner), key_(std::move(key)), flight_(std::move(flight)) {}
+        Lead(Lead&& other) noexcept { *this = std::move(other); }
+        Lead& operator=(Lead&& other) noexcept {
+            if (this != &other) {
+                release(nullptr);
+                owner_ = std::exchange(other.owner_, nullptr);
+                key_ = std::move(other.key_);
+                flight_ = std::move(other.flight_);
+            }
+            return *this;
+        }
+        ~Lead() { release(nullptr); }
+
+        void publish(std::shared_ptr<const Response> response) { release(std::move(response)); }
+
+    private:
+        void release(std::shared_ptr<const Response> response) {
+            if (owner_ == nullptr) {
+                return;
+            }
+            owner_->finish(key_, *flight_, std::move(response));
+            owner_ = nullptr;
+        }
+
+        RequestCoalescer* owner_ = nullptr;
+        std::string key_;
+        std::shared_ptr<Flight> flight_;
+    };
+
+    // Leads a new flight for key (returned Lead is active), or waits for the one in flight
+    // and returns its response. Both empty: the leader failed, go upstream without coalescing.
+    std::pair<Lead, std::shared_ptr<const Response>> join(const std::string& key) {
+        std::shared_ptr<Flight> flight;
+        {
+            std::lock_guard lock(mutex_);
+            auto [it, inserted] = flights_.try_emplace(key);
+            if (inserted) {
+                it->second = std::make_shared<Flight>();
+                return {Lead(this, key, it->second), nullptr};
+            }
+            flight = it->second;
+        }
+        std::unique_lock lock(flight->mutex);
+        flight->done_cv.wait(lock, [&] { return flight->done; });
+        return {Lead(), flight->response};
+    }
+
+private:
+    void finish(const std::string& key, Flight& flight, std::shared_ptr<const Response> response) {
+        {
+            std::lock_guard lock(mutex_);
+            flights_.erase(key);
+        }
+        {
+            std::lock_guard lock(flight.mutex);
+            flight.response = std::move(response);
+            flight.done = true;
+        }
+        flight.done_cv.notify_all();
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights_;
+};
+
+}  // namespace notiman
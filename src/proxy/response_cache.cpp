@@ -0,0 +1,329 @@
+#include "response_cache.h"
+
+#include <algorithm>
+#include <charconv>
+
+#include "forwarding.h"
+
+namespace notiman {
+
+namespace {
+
+constexpr size_t kEntryOverhead = 256;
+
+std::string_view trim(std::string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+        value.remove_prefix(1);
+    }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+        value.remove_suffix(1);
+    }
+    return value;
+}
+
+// Calls visit with each trimmed, non-empty element of a comma-separated header value.
+template <typename Visit>
+void for_each_element(std::string_view value, Visit&& visit) {
+    while (!value.empty()) {
+        const size_t comma = value.find(',');
+        const std::string_view element = trim(value.substr(0, comma));
+        if (!element.empty()) {
+            visit(element);
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+}
+
+std::optional<int64_t> parse_seconds(std::string_view value) {
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+    }
+    int64_t seconds = 0;
+    const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), seconds);
+    if (error != std::errc() || end != value.data() + value.size() || seconds < 0) {
+        return std::nullopt;
+    }
+    return seconds;
+}
+
+std::string_view find_cache_header(const CacheHeaders& headers, std::string_view name) {
+    for (const auto& [key, value] : headers) {
+        if (iequals(key, name)) {
+            return value;
+        }
+    }
+    return {};
+}
+
+// Statuses a shared cache may store when the response says how long it stays fresh.
+bool is_cacheable_status(int status) {
+    switch (status) {
+        case 200:
+        case 203:
+        case 204:
+        case 300:
+        case 301:
+        case 308:
+        case 404:
+        case 410:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::chrono::seconds freshness(const CacheControl& control) {
+    if (control.no_cache || control.no_store) {
+        return std::chrono::seconds(0);
+    }
+    return std::chrono::seconds(control.s_maxage.value_or(control.max_age.value_or(0)));
+}
+
+std::string_view strip_weak(std::string_view etag) {
+    return etag.starts_with("W/") ? etag.substr(2) : etag;
+}
+
+}  // namespace
+
+CacheControl parse_cache_control(std::string_view value) {
+    CacheControl control;
+    for_each_element(value, [&control](std::string_view directive) {
+        const size_t equals = directive.find('=');
+        const std::string name = lowercase(trim(directive.substr(0, equals)));
+        const std::string_view argument = equals == std::string_view::npos ? std::string_view{}
+                                                                            : trim(directive.substr(equals + 1));
+        if (name == "no-store") {
+            control.no_store = true;
+        } else if (name == "no-cache") {
+            control.no_cache = true;
+        } else if (name == "private") {
+            control.is_private = true;
+        } else if (name == "public") {
+            control.is_public = true;
+        } else if (name == "must-revalidate" || name == "proxy-revalidate") {
+            control.must_revalidate = true;
+        } else if (name == "max-age") {
+            control.max_age = parse_seconds(argument);
+        } else if (name == "s-maxage") {
+            control.s_maxage = parse_seconds(argument);
+        }
+    });
+    return control;
+}
+
+CacheRequest cache_request(std::string_view method, const CacheHeaderLookup& header) {
+    CacheRequest request;
+    if (method != "GET" && method != "HEAD") {
+        return request;
+    }
+    // Ranges are forwarded as they are rather than cut out of a stored response.
+    if (!header("Range").empty()) {
+        return request;
+    }
+    const CacheControl control = parse_cache_control(header("Cache-Control"));
+    if (control.no_store) {
+        return request;
+    }
+    request.usable = true;
+    request.revalidate = control.no_cache || control.max_age == 0 ||
+                         (header("Cache-Control").empty() && lowercase(header("Pragma")).find("no-cache") != std::string::npos);
+    request.max_age = control.max_age;
+    request.authorized = !header("Authorization").empty();
+    request.if_none_match = header("If-None-Match");
+    return request;
+}
+
+size_t CachedResponse::bytes() const {
+    size_t total = kEntryOverhead + reason.size() + body.size() + etag.size();
+    for (const auto& [name, value] : headers) {
+        total += name.size() + value.size();
+    }
+    for (const auto& [name, value] : vary) {
+        total += name.size() + value.size();
+    }
+    return total;
+}
+
+std::chrono::seconds CachedResponse::age(std::chrono::steady_clock::time_point now) const {
+    return initial_age + std::chrono::duration_cast<std::chrono::seconds>(now - stored_at);
+}
+
+std::shared_ptr<CachedResponse> make_cache_entry(const CacheRequest& request,
+                                                 const CacheHeaderLookup& request_header,
+                                                 int status,
+                                                 std::string_view reason,
+                                                 CacheHeaders response_headers,
+                                                 std::chrono::steady_clock::time_point now) {
+    if (!request.usable || !is_cacheable_status(status)) {
+        return nullptr;
+    }
+    const CacheControl control = parse_cache_control(find_cache_header(response_headers, "Cache-Control"));
+    if (control.no_store || control.is_private) {
+        return nullptr;
+    }
+    // One client's cookie must never be handed to another.
+    if (!find_cache_header(response_headers, "Set-Cookie").empty()) {
+        return nullptr;
+    }
+    if (request.authorized && !control.is_public && !control.s_maxage && !control.must_revalidate) {
+        return nullptr;
+    }
+
+    auto entry = std::make_shared<CachedResponse>();
+    bool varies_on_everything = false;
+    for (const auto& [name, value] : response_headers) {
+        if (!iequals(name, "Vary")) {
+            continue;
+        }
+        for_each_element(value, [&](std::string_view field) {
+            if (field == "*") {
+                varies_on_everything = true;
+                return;
+            }
+            std::string lowered = lowercase(field);
+            std::string current(request_header(lowered));
+            entry->vary.emplace_back(std::move(lowered), std::move(current));
+        });
+    }
+    if (varies_on_everything) {
+        return nullptr;
+    }
+
+    entry->fresh_for = freshness(control);
+    entry->etag = find_cache_header(response_headers, "ETag");
+    if (entry->fresh_for.count() <= 0 && entry->etag.empty()) {
+        return nullptr;
+    }
+    entry->initial_age = std::chrono::seconds(parse_seconds(find_cache_header(response_headers, "Age")).value_or(0));
+    std::erase_if(response_headers, [](const auto& field) { return iequals(field.first, "Age"); });
+
+    entry->status = status;
+    entry->reason = reason;
+    entry->headers = std::move(response_headers);
+    entry->stored_at = now;
+    return entry;
+}
+
+std::shared_ptr<const CachedResponse> refresh_cache_entry(const CachedResponse& stale,
+                                                          const CacheHeaders& not_modified_headers,
+                                                          std::chrono::steady_clock::time_point now) {
+    auto entry = std::make_shared<CachedResponse>(stale);
+    entry->initial_age = std::chrono::seconds(0);
+    for (const auto& [name, value] : not_modified_headers) {
+        if (iequals(name, "Age")) {
+            entry->initial_age = std::chrono::seconds(parse_seconds(value).value_or(0));
+            continue;
+        }
+        std::erase_if(entry->headers, [&name](const auto& field) { return iequals(field.first, name); });
+    }
+    for (const auto& field : not_modified_headers) {
+        if (!iequals(field.first, "Age")) {
+            entry->headers.push_back(field);
+        }
+    }
+    entry->fresh_for = freshness(parse_cache_control(find_cache_header(entry->headers, "Cache-Control")));
+    entry->etag = find_cache_header(entry->headers, "ETag");
+    entry->stored_at = now;
+    return entry;
+}
+
+bool is_fresh(const CachedResponse& entry, const CacheRequest& request, std::chrono::steady_clock::time_point now) {
+    if (request.revalidate) {
+        return false;
+    }
+    const std::chrono::seconds age = entry.age(now);
+    if (request.max_age && age.count() > *request.max_age) {
+        return false;
+    }
+    return age < entry.fresh_for;
+}
+
+bool matches_if_none_match(std::string_view if_none_match, std::string_view etag) {
+    if (if_none_match.empty() || etag.empty()) {
+        return false;
+    }
+    bool matched = false;
+    for_each_element(if_none_match, [&](std::string_view candidate) {
+        // If-None-Match uses the weak comparison.
+        matched = matched || candidate == "*" || strip_weak(candidate) == strip_weak(etag);
+    });
+    return matched;
+}
+
+ResponseCache::ResponseCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+ResponseCache::Shard& ResponseCache::shard_for(std::string_view key) {
+    return shards_[std::hash<std::string_view>{}(key) % kShards];
+}
+
+std::shared_ptr<const CachedResponse> ResponseCache::find(std::string_view key, const CacheHeaderLookup& request_header) {
+    Shard& shard = shard_for(key);
+    std::lock_guard lock(shard.mutex);
+    const auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    for (const auto& variant : it->second->variants) {
+        const bool matches = std::all_of(variant->vary.begin(), variant->vary.end(), [&](const auto& field) {
+            return request_header(field.first) == field.second;
+        });
+        if (matches) {
+            return variant;
+        }
+    }
+    return nullptr;
+}
+
+bool ResponseCache::store(std::string_view key, std::shared_ptr<const CachedResponse> entry) {
+    const size_t entry_bytes = entry->bytes() + key.size();
+    if (entry_bytes > max_entry_bytes()) {
+        return false;
+    }
+
+    Shard& shard = shard_for(key);
+    std::lock_guard lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        shard.lru.push_front(Slot{std::string(key), {}, 0});
+        it = shard.index.emplace(shard.lru.front().key, shard.lru.begin()).first;
+    } else {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    }
+
+    Slot& slot = *it->second;
+    const size_t before = slot.bytes;
+    std::erase_if(slot.variants, [&entry](const auto& variant) { return variant->vary == entry->vary; });
+    slot.variants.insert(slot.variants.begin(), std::move(entry));
+    if (slot.variants.size() > kMaxVariants) {
+        slot.variants.pop_back();
+    }
+    slot.bytes = 0;
+    for (const auto& variant : slot.variants) {
+        slot.bytes += variant->bytes() + slot.key.size();
+    }
+    shard.bytes = shard.bytes - before + slot.bytes;
+
+    const size_t budget = max_bytes_ / kShards;
+    while (shard.bytes > budget && shard.lru.size() > 1) {
+        const Slot& oldest = shard.lru.back();
+        shard.bytes -= oldest.bytes;
+        shard.index.erase(oldest.key);
+        shard.lru.pop_back();
+    }
+    return true;
+}
+
+size_t ResponseCache::bytes() const {
+    size_t total = 0;
+    for (const auto& shard : shards_) {
+        std::lock_guard lock(shard.mutex);
+        total += shard.bytes;
+    }
+    return total;
+}
+
+}  // namespace notiman
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace notiman {
+
+// Header fields in the order received. Names keep their case unless noted.
+using CacheHeaders = std::vector<std::pair<std::string, std::string>>;
+
+// Returns a header value of the request or response being looked at, empty when absent.
+using CacheHeaderLookup = std::function<std::string_view(std::string_view name)>;
+
+struct CacheControl {
+    bool no_store = false;
+    bool no_cache = false;
+    bool is_private = false;
+    bool is_public = false;
+    bool must_revalidate = false;
+    std::optional<int64_t> max_age;
+    std::optional<int64_t> s_maxage;
+};
+
+CacheControl parse_cache_control(std::string_view value);
+
+// How one request may use its route's cache.
+struct CacheRequest {
+    bool usable = false;      // GET or HEAD without no-store or Range
+    bool revalidate = false;  // no-cache or max-age=0: a stored response must be validated first
+    bool authorized = false;  // responses are stored only when they say a shared cache may
+    std::optional<int64_t> max_age;
+    std::string if_none_match;
+};
+
+CacheRequest cache_request(std::string_view method, const CacheHeaderLookup& header);
+
+// A stored response. Entries are immutable once stored; revalidation stores a copy.
+struct CachedResponse {
+    int status = 0;
+    std::string reason;
+    CacheHeaders headers;  // end-to-end headers, without framing or Age
+    std::string body;
+    std::string etag;
+    CacheHeaders vary;  // lowercase request header names listed in Vary and their values
+    std::chrono::steady_clock::time_point stored_at;
+    std::chrono::seconds initial_age{0};  // Age the upstream reported
+    std::chrono::seconds fresh_for{0};
+
+    size_t bytes() const;
+    std::chrono::seconds age(std::chrono::steady_clock::time_point now) const;
+};
+
+// A new entry for a GET response the upstream allows a shared cache to store, without
+// its body; null when the response must not be stored. Stored responses either have
+// an explicit max-age or s-maxage, or an ETag to revalidate with.
+std::shared_ptr<CachedResponse> make_cache_entry(const CacheRequest& request,
+                                                 const CacheHeaderLookup& request_header,
+                                                 int status,
+                                                 std::string_view reason,
+                                                 CacheHeaders response_headers,
+                                                 std::chrono::steady_clock::time_point now);
+
+// The stored entry updated with the headers of a 304 answering its revalidation.
+std::shared_ptr<const CachedResponse> refresh_cache_entry(const CachedResponse& stale,
+                                                          const CacheHeaders& not_modified_headers,
+                                                          std::chrono::steady_clock::time_point now);
+
+// True when the entry can be served without asking the upstream.
+bool is_fresh(const CachedResponse& entry, const CacheRequest& request, std::chrono::steady_clock::time_point now);
+
+// True when the client's If-None-Match names the entry's ETag, so it gets a 304.
+bool matches_if_none_match(std::string_view if_none_match, std::string_view etag);
+
+// Size-bounded response cache for one route. Keys are request targets; each key keeps
+// a few variants told apart by the request headers the response listed in Vary.
+// Eviction is least-recently-used per shard, and every shard has its own lock, so
+// lookups from different threads rarely wait on each other.
+class ResponseCache {
+public:
+    static constexpr size_t kShards = 8;
+    static constexpr size_t kMaxVariants = 4;
+
+    explicit ResponseCache(size_t max_bytes);
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    size_t max_bytes() const { return max_bytes_; }
+    // Entries above this are not stored, so one response cannot flush a whole shard.
+    size_t max_entry_bytes() const { return max_bytes_ / kShards / 4; }
+
+    // The variant of key whose Vary headers match the request, fresh or not.
+    std::shared_ptr<const CachedResponse> find(std::string_view key, const CacheHeaderLookup& request_header);
+
+    // Replaces the variant with the same Vary values. False when the entry is too large.
+    bool store(std::string_view key, std::shared_ptr<const CachedResponse> entry);
+
+    size_t bytes() const;
+
+private:
+    struct Slot {
+        std::string key;
+        std::vector<std::shared_ptr<const CachedResponse>> variants;  // most recent first
+        size_t bytes = 0;
+    };
+
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view value) const { return std::hash<std::string_view>{}(value); }
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Slot> lru;  // front is the most recently used
+        std::unordered_map<std::string, std::list<Slot>::iterator, StringHash, std::equal_to<>> index;
+        size_t bytes = 0;
+    };
+
+    Shard& shard_for(std::string_view key);
+
+    const size_t max_bytes_;
+    std::array<Shard, kShards> shards_;
+};
+
+}  // namespace notiman
@@ -0,0 +1,216 @@
+#include "route_matcher.h"
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <unordered_map>
+
+namespace notiman {
+
+namespace {
+
+constexpr size_t kNoRoute = static_cast<size_t>(-1);
+constexpr std::string_view kHostSuffix = ".localhost";
+// The longest DNS name; a host with more labels than fit cannot be one.
+constexpr size_t kMaxHostLength = 253;
+constexpr size_t kMaxLabels = kMaxHostLength / 2 + 1;
+
+struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view value) const { return std::hash<std::string_view>{}(value); }
+};
+
+}  // namespace
+
+// Radix tree node: one run of path bytes shared by every prefix below it.
+struct RouteMatcher::PathNode {
+    std::string edge;                                // bytes from the parent; empty only at the root
+    std::vector<std::unique_ptr<PathNode>> children;  // sorted by first edge byte, which differs between them
+    size_t route = kNoRoute;
+};
+
+// Trie node for one host label, walked from the rightmost label.
+struct RouteMatcher::HostNode {
+    std::unordered_map<std::string, std::unique_ptr<HostNode>, StringHash, std::equal_to<>> labels;
+    std::unique_ptr<HostNode> any_label;         // "*"
+    std::unique_ptr<PathNode> paths;             // patterns that end at this node
+    std::unique_ptr<PathNode> paths_below;       // patterns that put "**" in front of this node
+};
+
+bool RouteMatcher::insert_path(PathNode& root, std::string_view prefix, size_t route) {
+    PathNode* node = &root;
+    while (!prefix.empty()) {
+        auto it = std::lower_bound(node->children.begin(), node->children.end(), prefix.front(),
+                                   [](const auto& child, char c) { return child->edge.front() < c; });
+        if (it == node->children.end() || (*it)->edge.front() != prefix.front()) {
+            auto leaf = std::make_unique<PathNode>();
+            leaf->edge = std::string(prefix);
+            leaf->route = route;
+            node->children.insert(it, std::move(leaf));
+            return true;
+        }
+
+        const std::string& edge = (*it)->edge;
+        const size_t common = static_cast<size_t>(
+            std::mismatch(edge.begin(), edge.end(), prefix.begin(), prefix.end()).first - edge.begin());
+        if (common < edge.size()) {
+            // The new prefix ends or turns off inside this edge: split it there.
+            auto middle = std::make_unique<PathNode>();
+            middle->edge = edge.substr(0, common);
+            (*it)->edge.erase(0, common);
+            middle->children.push_back(std::move(*it));
+            *it = std::move(middle);
+        }
+        node = it->get();
+        prefix.remove_prefix(common);
+    }
+    if (node->route != kNoRoute) {
+        return false;
+    }
+    node->route = route;
+    return true;
+}
+
+// Longest prefix of path that ends on a segment boundary and has a route.
+size_t RouteMatcher::match_path(const PathNode& root, std::string_view path) {
+    const PathNode* node = &root;
+    size_t matched = 0;
+    size_t best = kNoRoute;
+    for (;;) {
+        if (node->route != kNoRoute && (matched == 0 || matched == path.size() || path[matched] == '/')) {
+            best = node->route;
+        }
+        if (matched == path.size()) {
+            return best;
+        }
+        const auto it = std::lower_bound(node->children.begin(), node->children.end(), path[matched],
+                                         [](const auto& child, char c) { return child->edge.front() < c; });
+        if (it == node->children.end() || !path.substr(matched).starts_with((*it)->edge)) {
+            return best;
+        }
+        matched += (*it)->edge.size();
+        node = it->get();
+    }
+}
+
+std::optional<RoutePattern> parse_route_pattern(std::string_view name) {
+    const size_t slash = name.find('/');
+    const std::string_view host = name.substr(0, slash);
+    std::string_view path = slash != std::string_view::npos ? name.substr(slash) : std::string_view{};
+
+    RoutePattern pattern;
+    for (size_t start = 0;;) {
+        const size_t dot = host.find('.', start);
+        const std::string_view label = host.substr(start, dot - start);
+        const bool wildcard = label == "*" || (label == "**" && start == 0);
+        if (label.empty() || (!wildcard && label.find('*') != std::string_view::npos)) {
+            return std::nullopt;
+        }
+        pattern.host_labels.emplace_back(label);
+        if (dot == std::string_view::npos) {
+            break;
+        }
+        start = dot + 1;
+    }
+
+    // "/api/users", "/api/users/" and "/api/users/**" all name the same subtree.
+    if (path.ends_with("/**")) {
+        path.remove_suffix(2);
+    }
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+    if (path.find('*') != std::string_view::npos) {
+        return std::nullopt;
+    }
+    pattern.path_prefix = std::string(path);
+    return pattern;
+}
+
+RouteMatcher::RouteMatcher() : root_(std::make_unique<HostNode>()) {}
+RouteMatcher::~RouteMatcher() = default;
+RouteMatcher::RouteMatcher(RouteMatcher&&) noexcept = default;
+RouteMatcher& RouteMatcher::operator=(RouteMatcher&&) noexcept = default;
+
+bool RouteMatcher::add(const RoutePattern& pattern, size_t route) {
+    HostNode* node = root_.get();
+    std::unique_ptr<PathNode>* paths = nullptr;
+    for (size_t i = pattern.host_labels.size(); i-- > 0;) {
+        const std::string& label = pattern.host_labels[i];
+        if (label == "**") {
+            paths = &node->paths_below;
+            break;
+        }
+        std::unique_ptr<HostNode>& child = label == "*" ? node->any_label : node->labels[label];
+        if (!child) {
+            child = std::make_unique<HostNode>();
+        }
+        node = child.get();
+    }
+    if (paths == nullptr) {
+        paths = &node->paths;
+    }
+    if (!*paths) {
+        *paths = std::make_unique<PathNode>();
+    }
+    return insert_path(**paths, pattern.path_prefix, route);
+}
+
+std::optional<size_t> RouteMatcher::match(std::string_view host_header, std::string_view path) const {
+    const size_t colon = host_header.rfind(':');
+    const std::string_view host = colon != std::string_view::npos ? host_header.substr(0, colon) : host_header;
+    if (host.size() <= kHostSuffix.size() || host.size() > kMaxHostLength) {
+        return std::nullopt;
+    }
+    char lowered[kMaxHostLength];
+    for (size_t i = 0; i < host.size(); ++i) {
+        lowered[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(host[i])));
+    }
+    std::string_view name(lowered, host.size());
+    if (!name.ends_with(kHostSuffix)) {
+        return std::nullopt;
+    }
+    name.remove_suffix(kHostSuffix.size());
+
+    // Rightmost label first, the order the trie is built in.
+    std::string_view labels[kMaxLabels];
+    size_t count = 0;
+    for (size_t end = name.size();;) {
+        const size_t dot = name.rfind('.', end - 1);
+        const size_t start = dot == std::string_view::npos ? 0 : dot + 1;
+        if (start == end) {
+            return std::nullopt;
+        }
+        labels[count++] = name.substr(start, end - start);
+        if (dot == std::string_view::npos) {
+            break;
+        }
+        end = dot;
+        if (end == 0) {
+            return std::nullopt;
+        }
+    }
+
+    // Depth-first, most specific branch first. A node sits at a fixed depth, so each one
+    // is visited at most once.
+    const auto search = [&](const auto& self, const HostNode& node, size_t depth) -> size_t {
+        if (depth == count) {
+            return node.paths ? match_path(*node.paths, path) : kNoRoute;
+        }
+        if (const auto it = node.labels.find(labels[depth]); it != node.labels.end()) {
+            if (const size_t route = self(self, *it->second, depth + 1); route != kNoRoute) {
+                return route;
+            }
+        }
+        if (node.any_label) {
+            if (const size_t route = self(self, *node.any_label, depth + 1); route != kNoRoute) {
+                return route;
+            }
+        }
+        return node.paths_below ? match_path(*node.paths_below, path) : kNoRoute;
+    };
+    const size_t route = search(search, *root_, 0);
+    return route != kNoRoute ? std::optional<size_t>(route) : std::nullopt;
+}
+
+}  // namespace notiman
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace notiman {
+
+// A route name split into what requests are matched on:
+// "shop/api/users/**" -> host labels {"shop"}, path prefix "/api/users".
+struct RoutePattern {
+    // Labels in front of ".localhost", left to right. "*" stands for any one label; a
+    // leading "**" for one or more.
+    std::vector<std::string> host_labels;
+    // Matches this path and everything below it, on segment boundaries. Empty matches all.
+    std::string path_prefix;
+};
+
+// Parses a route name as ProxyConfig loads it. nullopt when it is not a valid pattern.
+std::optional<RoutePattern> parse_route_pattern(std::string_view name);
+
+// Maps a request's host and path to the best route: the most specific host pattern
+// (exact labels before "*", "*" before "**", compared from the right) that has a path
+// prefix matching, and among those the longest prefix. Hosts are a trie of labels and
+// each host pattern's prefixes a radix tree, so a lookup walks the labels and path bytes
+// of the request once, however many routes there are. Lookups never allocate.
+class RouteMatcher {
+public:
+    RouteMatcher();
+    ~RouteMatcher();
+    RouteMatcher(RouteMatcher&&) noexcept;
+    RouteMatcher& operator=(RouteMatcher&&) noexcept;
+
+    // False, leaving the matcher unchanged, when an equal pattern was added before.
+    bool add(const RoutePattern& pattern, size_t route);
+
+    // host_header may carry a port and any case; path is the request path without the
+    // query. The route passed to add(), or nullopt.
+    std::optional<size_t> match(std::string_view host_header, std::string_view path) const;
+
+private:
+    struct PathNode;
+    struct HostNode;
+
+    static bool insert_path(PathNode& root, std::string_view prefix, size_t route);
+    static size_t match_path(const PathNode& root, std::string_view path);
+
+    std::unique_ptr<HostNode> root_;
+};
+
+}  // namespace notiman
@@ -0,0 +1,239 @@
+#include "route_table.h"
+
+#include <algorithm>
+
+namespace notiman {
+
+namespace {
+
+UpstreamPoolOptions pool_options(const ProxyConfig& config, const ProxyRoute& route) {
+    UpstreamPoolOptions options;
+    options.max_idle = static_cast<size_t>(config.pool_max_idle);
+    options.idle_timeout = std::chrono::milliseconds(config.pool_idle_timeout_ms);
+    options.connection_timeout = std::chrono::milliseconds(route.connect_timeout_ms);
+    options.io_timeout = std::chrono::milliseconds(route.timeout_ms);
+    options.resolve_ttl = std::chrono::milliseconds(config.resolve_ttl_ms);
+    return options;
+}
+
+CircuitBreakerOptions breaker_options(const ProxyRoute& route) {
+    CircuitBreakerOptions options;
+    options.consecutive_failures = route.breaker_failures;
+    options.error_percent = route.breaker_error_percent;
+    options.window = std::chrono::milliseconds(route.breaker_window_ms);
+    options.open_for = std::chrono::milliseconds(route.breaker_open_ms);
+    return options;
+}
+
+// The previous table's target for url, if its pool settings still match.
+std::shared_ptr<UpstreamTarget> reusable_target(const CompiledRoute* old_route,
+                                                const std::string& url,
+                                                const UpstreamPoolOptions& options) {
+    if (old_route == nullptr) {
+        return nullptr;
+    }
+    for (const auto& target : old_route->balancer.targets()) {
+        const UpstreamPoolOptions& old_options = target->pool()->options();
+        if (target->url() == url &&
+            old_options.max_idle == options.max_idle &&
+            old_options.idle_timeout == options.idle_timeout &&
+            old_options.connection_timeout == options.connection_timeout &&
+            old_options.io_timeout == options.io_timeout &&
+            old_options.resolve_ttl == options.resolve_ttl) {
+            return target;
+        }
+    }
+    return nullptr;
+}
+
+ConcurrencyLimitOptions limit_options(const ProxyRoute& route) {
+    ConcurrencyLimitOptions options;
+    options.min_limit = route.concurrency_min;
+    options.max_limit = route.concurrency_max;
+    options.initial_limit = route.concurrency_initial;
+    options.queue_size = route.queue_size;
+    options.queue_timeout = std::chrono::milliseconds(route.queue_timeout_ms);
+    return options;
+}
+
+HedgeOptions hedge_options(const ProxyRoute& route) {
+    HedgeOptions options;
+    options.min_delay = std::chrono::milliseconds(route.hedge_min_ms);
+    options.budget_percent = static_cast<uint32_t>(route.hedge_budget_percent);
+    return options;
+}
+
+NotificationPolicyOptions notification_options(const ProxyRoute& route) {
+    NotificationPolicyOptions options;
+    options.slow = std::chrono::milliseconds(route.notify_slow_ms);
+    for (const int status_class : route.notify_status) {
+        options.status_classes |= static_cast<uint8_t>(1u << (status_class - 1));
+    }
+    options.sample = static_cast<uint32_t>(route.notify_sample);
+    options.anomaly_factor = static_cast<uint32_t>(route.notify_anomaly);
+    return options;
+}
+
+FaultOptions fault_options(const ProxyRoute& route) {
+    FaultOptions options;
+    options.delay = std::chrono::milliseconds(route.fault_delay_ms);
+    options.jitter = std::chrono::milliseconds(route.fault_jitter_ms);
+    options.delay_percent = static_cast<uint32_t>(route.fault_delay_percent);
+    options.error_percent = static_cast<uint32_t>(route.fault_error_percent);
+    options.error_status = route.fault_error_status;
+    options.reset_percent = static_cast<uint32_t>(route.fault_reset_percent);
+    options.bytes_per_second = static_cast<uint64_t>(route.fault_bytes_per_sec);
+    return options;
+}
+
+BalancePolicy balance_policy(const ProxyRoute& route) {
+    return parse_balance_policy(route.balance).value_or(BalancePolicy::RoundRobin);
+}
+
+}  // namespace
+
+std::shared_ptr<const RouteTable> RouteTable::build(const ProxyConfig& config, const RouteTable* previous) {
+    auto table = std::make_shared<RouteTable>();
+    table->stream_buffer_bytes_ = static_cast<size_t>(config.stream_buffer_kb) * 1024;
+    table->routes_.reserve(config.routes.size());
+    table->index_.reserve(config.routes.size());
+
+    for (const auto& route : config.routes) {
+        // Of two routes with the same pattern, the first one wins.
+        const auto pattern = parse_route_pattern(route.name);
+        if (!pattern.has_value() || !table->matcher_.add(*pattern, table->routes_.size())) {
+            continue;
+        }
+
+        const CompiledRoute* old_route = previous != nullptr ? previous->find_by_name(route.name) : nullptr;
+        const auto options = pool_options(config, route);
+        std::vector<std::shared_ptr<UpstreamTarget>> targets;
+        for (const auto& url : route.target_base_urls) {
+            if (auto reused = reusable_target(old_route, url, options)) {
+                targets.push_back(std::move(reused));
+                continue;
+            }
+            auto endpoint = parse_target_endpoint(url);
+            if (!endpoint.has_value()) {
+                continue;
+            }
+            auto pool = std::make_shared<UpstreamPool>(endpoint->host, endpoint->port, options, endpoint->socket_path);
+            targets.push_back(std::make_shared<UpstreamTarget>(url, std::move(*endpoint), std::move(pool)));
+        }
+
+        CompiledRoute compiled;
+        compiled.route = route;
+        compiled.balancer = TargetBalancer(std::move(targets), balance_policy(route), !route.health_path.empty());
+        compiled.faults = fault_options(route);
+        if (route.cache) {
+            compiled.cache = old_route != nullptr && old_route->cache && old_route->route == route
+                                 ? old_route->cache
+                                 : std::make_shared<ResponseCache>(static_cast<size_t>(route.cache_size_mb) << 20);
+        }
+        if (route.breaker) {
+            const CircuitBreakerOptions breaker = breaker_options(route);
+            compiled.breaker = old_route != nullptr && old_route->breaker && old_route->breaker->options() == breaker
+                                   ? old_route->breaker
+                                   : std::make_shared<CircuitBreaker>(breaker);
+        }
+        if (route.concurrency_limit) {
+            const ConcurrencyLimitOptions limits = limit_options(route);
+            compiled.limiter = old_route != nullptr && old_route->limiter && old_route->limiter->options() == limits
+                                   ? old_route->limiter
+                                   : std::make_shared<ConcurrencyLimiter>(limits);
+        }
+        if (route.hedge) {
+            const HedgeOptions hedging = hedge_options(route);
+            compiled.hedge = old_route != nullptr && old_route->hedge && old_route->hedge->options() == hedging
+                                 ? old_route->hedge
+                                 : std::make_shared<HedgePolicy>(hedging);
+        }
+        const NotificationPolicyOptions notifications = notification_options(route);
+        if (notifications.filters() || notifications.anomaly_factor > 0) {
+            compiled.notify_policy =
+                old_route != nullptr && old_route->notify_policy && old_route->notify_policy->options() == notifications
+                    ? old_route->notify_policy
+                    : std::make_shared<NotificationPolicy>(notifications);
+        }
+
+        if (!route.mock_path.empty()) {
+            compiled.mock = old_route != nullptr && old_route->mock && old_route->mock->root() == route.mock_path
+                                ? old_route->mock
+                                : std::make_shared<MockStore>(route.mock_path);
+        }
+
+        table->index_.emplace(route.name, table->routes_.size());
+        table->routes_.push_back(std::move(compiled));
+    }
+
+    // Pools the new table dropped close their idle sockets now instead of whenever the
+    // last worker thread lets go of the old snapshot.
+    if (previous != nullptr) {
+        for (const auto& old_route : previous->routes_) {
+            const CompiledRoute* current = table->find_by_name(old_route.route.name);
+            for (const auto& old_target : old_route.balancer.targets()) {
+                const bool kept = current != nullptr &&
+                                  std::find(current->balancer.targets().begin(),
+                                            current->balancer.targets().end(),
+                                            old_target) != current->balancer.targets().end();
+                if (!kept) {
+                    old_target->pool()->retire();
+                }
+            }
+        }
+    }
+    return table;
+}
+
+const CompiledRoute* RouteTable::find(std::string_view host_header, std::string_view path) const {
+    const std::optional<size_t> index = matcher_.match(host_header, path);
+    return index.has_value() ? &routes_[*index] : nullptr;
+}
+
+const CompiledRoute* RouteTable::find_by_name(std::string_view name) const {
+    const auto it = index_.find(name);
+    return it != index_.end() ? &routes_[it->second] : nullptr;
+}
+
+void RouteTablePublisher::publish(std::shared_ptr<const RouteTable> table) {
+    table_.store(std::move(table), std::memory_order_release);
+    generation_.fetch_add(1, std::memory_order_release);
+}
+
+std::shared_ptr<const RouteTable> RouteTablePublisher::load() const {
+    return table_.load(std::memory_order_acquire);
+}
+
+const std::shared_ptr<const RouteTable>& RouteTablePublisher::cached() const {
+    struct Cache {
+        const RouteTablePublisher* owner = nullptr;
+        uint64_t generation = 0;
+        std::shared_ptr<const RouteTable> table;
+    };
+    thread_local Cache cache;
+
+    // Common case is one relaxed-cost load of the generation counter: no lock and no
+    // reference count traffic on a shared control block.
+    const uint64_t generation = generation_.load(std::memory_order_acquire);
+    if (cache.owner != this || cache.generation != generation || !cache.table) {
+        cache.table = table_.load(std::memory_order_acquire);
+        cache.owner = this;
+        cache.generation = generation;
+    }
+
+    if (!cache.table) {
+        static const std::shared_ptr<const RouteTable> empty = std::make_shared<const RouteTable>();
+        return empty;
+    }
+    return cache.table;
+}
+
+const RouteTable& RouteTablePublisher::current() const {
+    return *cached();
+}
+
+std::shared_ptr<const RouteTable> RouteTablePublisher::snapshot() const {
+    return cached();
+}
+
+}  // namespace notiman
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "circuit_breaker.h"
+#include "concurrency_limiter.h"
+#include "fault_injector.h"
+#include "hedge_policy.h"
+#include "mock_store.h"
+#include "notification_policy.h"
+#include "proxy_config.h"
+#include "response_cache.h"
+#include "route_matcher.h"
+#include "upstream_pool.h"
+#include "upstream_target.h"
+
+namespace notiman {
+
+// A route with everything the request path needs already resolved.
+struct CompiledRoute {
+    ProxyRoute route;
+    TargetBalancer balancer;  // valid targets only; empty when none of the URLs parsed
+    std::shared_ptr<ResponseCache> cache;  // null unless the route has cache=true
+    std::shared_ptr<CircuitBreaker> breaker;  // null when the route has breaker=false
+    std::shared_ptr<ConcurrencyLimiter> limiter;  // null unless the route has concurrency_limit=true
+    std::shared_ptr<HedgePolicy> hedge;  // null unless the route has hedge=true
+    std::shared_ptr<NotificationPolicy> notify_policy;  // null when every request is reported and anomalies are off
+    std::shared_ptr<MockStore> mock;  // set for a file: target; answers every request in place of the balancer
+    FaultOptions faults;  // inactive unless the route injects faults
+};
+
+// Immutable routing snapshot built once per config load. Lookups never allocate or lock.
+class RouteTable {
+public:
+    // previous may be null. Targets are carried over when their URL and pool settings
+    // did not change, so warm connections, health and in-flight counts survive the reload.
+    // A route's response cache is kept only when none of the route's settings changed;
+    // its circuit breaker, concurrency limiter, hedge policy and notification policy, with
+    // their state, when their settings stayed the same, and its mock store while it points
+    // at the same path.
+    static std::shared_ptr<const RouteTable> build(const ProxyConfig& config, const RouteTable* previous);
+
+    // The route for a request, by Host header value and path without the query.
+    // Routes whose name is not a valid pattern are never found.
+    const CompiledRoute* find(std::string_view host_header, std::string_view path) const;
+    const CompiledRoute* find_by_name(std::string_view name) const;
+
+    const std::vector<CompiledRoute>& routes() const { return routes_; }
+    size_t stream_buffer_bytes() const { return stream_buffer_bytes_; }
+
+private:
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view value) const { return std::hash<std::string_view>{}(value); }
+    };
+
+    std::vector<CompiledRoute> routes_;
+    std::unordered_map<std::string, size_t, StringHash, std::equal_to<>> index_;
+    RouteMatcher matcher_;
+    size_t stream_buffer_bytes_ = 0;
+};
+
+// Publishes route tables RCU-style: writers swap in a new immutable snapshot, readers
+// keep using whichever snapshot they loaded. Each thread caches its snapshot and only
+// touches the shared pointer again after a new table was published.
+class RouteTablePublisher {
+public:
+    void publish(std::shared_ptr<const RouteTable> table);
+
+    std::shared_ptr<const RouteTable> load() const;
+
+    // The calling thread's cached snapshot. Stays valid until this thread calls current() again.
+    const RouteTable& current() const;
+
+    // Owning reference to the same cached snapshot, for event loops that keep a route
+    // across many current() calls made on behalf of other connections.
+    std::shared_ptr<const RouteTable> snapshot() const;
+
+private:
+    const std::shared_ptr<const RouteTable>& cached() const;
+
+    std::atomic<std::shared_ptr<const RouteTable>> table_;
+    std::atomic<uint64_t> generation_ = 0;
+};
+
+}  // namespace notiman
@@ -0,0 +1,240 @@
+#include "traffic_capture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <utility>
+
+namespace notiman {
+
+namespace {
+
+constexpr auto kIdleWait = std::chrono::milliseconds(250);
+constexpr size_t kRecordAlignment = 8;
+
+size_t padded(size_t bytes) {
+    return (bytes + kRecordAlignment - 1) & ~(kRecordAlignment - 1);
+}
+
+template <typename T>
+T clamp_to(size_t value) {
+    return static_cast<T>(std::min<size_t>(value, std::numeric_limits<T>::max()));
+}
+
+CaptureFileHeader file_header() {
+    CaptureFileHeader header{};
+    std::memcpy(header.magic, kCaptureMagic, sizeof(header.magic));
+    header.version = kCaptureVersion;
+    header.header_bytes = sizeof(CaptureFileHeader);
+    return header;
+}
+
+bool valid_file_header(std::string_view file, size_t& first_record) {
+    CaptureFileHeader header{};
+    if (file.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, kCaptureMagic, sizeof(header.magic)) != 0 ||
+        header.version != kCaptureVersion || header.header_bytes < sizeof(header)) {
+        return false;
+    }
+    first_record = header.header_bytes;
+    return true;
+}
+
+// An existing file is only appended to when it is a capture of this version.
+bool existing_file_usable(const std::filesystem::path& path, bool& empty) {
+    std::error_code error;
+    const auto size = std::filesystem::file_size(path, error);
+    empty = error || size == 0;
+    if (empty) {
+        return true;
+    }
+    std::ifstream in(path, std::ios::binary);
+    std::string head(sizeof(CaptureFileHeader), '\0');
+    in.read(head.data(), static_cast<std::streamsize>(head.size()));
+    size_t first_record = 0;
+    return in && valid_file_header(head, first_record);
+}
+
+void append_record(std::string& out, const CapturedExchange& exchange) {
+    const std::string_view method(exchange.method.data(), clamp_to<uint16_t>(exchange.method.size()));
+    const std::string_view route(exchange.route.data(), clamp_to<uint16_t>(exchange.route.size()));
+    const std::string_view host(exchange.host.data(), clamp_to<uint16_t>(exchange.host.size()));
+    const std::string_view target(exchange.target.data(), clamp_to<uint32_t>(exchange.target.size()));
+    const std::string_view headers(exchange.headers.data(), clamp_to<uint32_t>(exchange.headers.size()));
+    const std::string_view request_body(exchange.request_body.data(), clamp_to<uint32_t>(exchange.request_body.size()));
+    const std::string_view response_body(exchange.response_body.data(), clamp_to<uint32_t>(exchange.response_body.size()));
+
+    const size_t fields = method.size() + route.size() + host.size() + target.size() + headers.size() +
+                          request_body.size() + response_body.size();
+    const size_t record_bytes = padded(sizeof(CaptureRecordHeader) + fields);
+    if (record_bytes > std::numeric_limits<uint32_t>::max()) {
+        return;
+    }
+
+    CaptureRecordHeader header{};
+    header.record_bytes = static_cast<uint32_t>(record_bytes);
+    header.status = clamp_to<uint16_t>(static_cast<size_t>(std::max(exchange.status, 0)));
+    if (request_body.size() < exchange.request_body_bytes) {
+        header.flags |= kCaptureRequestBodyTruncated;
+    }
+    if (response_body.size() < exchange.response_body_bytes) {
+        header.flags |= kCaptureResponseBodyTruncated;
+    }
+    header.started_unix_us = static_cast<uint64_t>(std::max<int64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(exchange.started_at.time_since_epoch()).count(), 0));
+    header.duration_us = static_cast<uint64_t>(std::max<int64_t>(exchange.duration.count(), 0));
+    header.request_body_bytes = exchange.request_body_bytes;
+    header.response_body_bytes = exchange.response_body_bytes;
+    header.method_bytes = static_cast<uint16_t>(method.size());
+    header.route_bytes = static_cast<uint16_t>(route.size());
+    header.host_bytes = static_cast<uint16_t>(host.size());
+    header.target_bytes = static_cast<uint32_t>(target.size());
+    header.headers_bytes = static_cast<uint32_t>(headers.size());
+    header.request_body_kept = static_cast<uint32_t>(request_body.size());
+    header.response_body_kept = static_cast<uint32_t>(response_body.size());
+
+    const size_t start = out.size();
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const std::string_view field : {method, route, host, target, headers, request_body, response_body}) {
+        out.append(field);
+    }
+    out.resize(start + record_bytes, '\0');
+}
+
+}  // namespace
+
+bool read_capture(std::string_view file, const std::function<void(const CaptureRecordView&)>& visit) {
+    size_t offset = 0;
+    if (!valid_file_header(file, offset)) {
+        return false;
+    }
+
+    while (file.size() - offset >= sizeof(CaptureRecordHeader)) {
+        CaptureRecordView record;
+        std::memcpy(&record.header, file.data() + offset, sizeof(CaptureRecordHeader));
+        const CaptureRecordHeader& header = record.header;
+        const uint64_t fields = uint64_t{header.method_bytes} + header.route_bytes + header.host_bytes +
+                                header.target_bytes + header.headers_bytes + header.request_body_kept +
+                                header.response_body_kept;
+        if (header.record_bytes < sizeof(CaptureRecordHeader) + fields ||
+            header.record_bytes > file.size() - offset) {
+            break;
+        }
+
+        size_t cursor = offset + sizeof(CaptureRecordHeader);
+        const auto take = [&](size_t length) {
+            const std::string_view field = file.substr(cursor, length);
+            cursor += length;
+            return field;
+        };
+        record.method = take(header.method_bytes);
+        record.route = take(header.route_bytes);
+        record.host = take(header.host_bytes);
+        record.target = take(header.target_bytes);
+        record.headers = take(header.headers_bytes);
+        record.request_body = take(header.request_body_kept);
+        record.response_body = take(header.response_body_kept);
+        visit(record);
+
+        offset += header.record_bytes;
+    }
+    return true;
+}
+
+std::chrono::system_clock::time_point capture_wall_clock(std::chrono::steady_clock::time_point at) {
+    return std::chrono::system_clock::now() -
+           std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::steady_clock::now() - at);
+}
+
+TrafficCapture::TrafficCapture(TrafficCaptureOptions options)
+    : options_(std::move(options)), queue_(options_.queue_capacity) {
+    bool empty = true;
+    if (!existing_file_usable(options_.path, empty)) {
+        return;
+    }
+#ifdef _WIN32
+    file_ = _wfopen(options_.path.c_str(), L"ab");
+#else
+    file_ = std::fopen(options_.path.c_str(), "ab");
+#endif
+    if (file_ == nullptr) {
+        return;
+    }
+    if (empty) {
+        const CaptureFileHeader header = file_header();
+        std::fwrite(&header, sizeof(header), 1, file_);
+        std::fflush(file_);
+    }
+    thread_ = std::thread([this] { run(); });
+}
+
+TrafficCapture::~TrafficCapture() {
+    stop();
+}
+
+bool TrafficCapture::record(CapturedExchange exchange) {
+    if (file_ == nullptr || !queue_.try_push(std::move(exchange))) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (!wake_pending_.exchange(true, std::memory_order_acq_rel)) {
+        wake_.notify_one();
+    }
+    return true;
+}
+
+void TrafficCapture::stop() {
+    if (!stopping_.exchange(true)) {
+        std::lock_guard lock(wake_mutex_);
+        wake_pending_ = true;
+    }
+    wake_.notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (file_ != nullptr) {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+void TrafficCapture::run() {
+    std::string batch;
+    CapturedExchange next;
+
+    for (;;) {
+        const bool stopping = stopping_.load(std::memory_order_acquire);
+        wake_pending_.store(false, std::memory_order_release);
+
+        // One write per batch: records only ever reach the file whole and in order.
+        uint64_t count = 0;
+        while (queue_.try_pop(next)) {
+            append_record(batch, next);
+            ++count;
+        }
+        if (!batch.empty()) {
+            std::fwrite(batch.data(), 1, batch.size(), file_);
+            std::fflush(file_);
+            written_.fetch_add(count, std::memory_order_relaxed);
+            batch.clear();
+            if (batch.capacity() > 1 << 20) {
+                batch.shrink_to_fit();
+            }
+        }
+
+        if (stopping) {
+            break;
+        }
+
+        std::unique_lock lock(wake_mutex_);
+        wake_.wait_for(lock, kIdleWait, [this] {
+            return wake_pending_.load(std::memory_order_acquire) || stopping_.load(std::memory_order_acquire);
+        });
+    }
+}
+
+}  // namespace notiman
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "mpsc_queue.h"
+
+namespace notiman {
+
+// Capture files are append-only: a 16-byte file header, then records that each start
+// on an 8-byte boundary with a fixed CaptureRecordHeader followed by its variable
+// fields. Integers are stored in host order, which is little-endian on every platform
+// the proxy builds for, so a reader can mmap the file and walk the records in place.
+inline constexpr char kCaptureMagic[8] = {'N', 'T', 'M', 'C', 'A', 'P', 'T', '1'};
+inline constexpr uint32_t kCaptureVersion = 1;
+
+struct CaptureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;  // offset of the first record
+};
+
+enum CaptureFlags : uint16_t {
+    kCaptureRequestBodyTruncated = 1 << 0,
+    kCaptureResponseBodyTruncated = 1 << 1,
+};
+
+// Variable fields follow in declaration order: method, route, host, target, request
+// headers ("Name: value\r\n" lines), kept request body, kept response body.
+struct CaptureRecordHeader {
+    uint32_t record_bytes;        // this header, its fields and padding to the next record
+    uint16_t status;
+    uint16_t flags;               // CaptureFlags
+    uint64_t started_unix_us;     // wall clock when the request head arrived
+    uint64_t duration_us;
+    uint64_t request_body_bytes;  // full sizes, even when only a prefix was kept
+    uint64_t response_body_bytes;
+    uint16_t method_bytes;
+    uint16_t route_bytes;
+    uint16_t host_bytes;
+    uint16_t reserved;
+    uint32_t target_bytes;
+    uint32_t headers_bytes;
+    uint32_t request_body_kept;
+    uint32_t response_body_kept;
+};
+
+static_assert(sizeof(CaptureFileHeader) == 16);
+static_assert(sizeof(CaptureRecordHeader) == 64);
+
+// One exchange as handed to the capture by an engine. Bodies are already cut to the
+// capture's body_limit().
+struct CapturedExchange {
+    std::chrono::system_clock::time_point started_at;
+    std::chrono::microseconds duration{0};
+    int status = 0;
+    std::string method;
+    std::string route;
+    std::string host;
+    std::string target;   // path and query as received
+    std::string headers;  // "Name: value\r\n" lines
+    std::string request_body;
+    std::string response_body;
+    uint64_t request_body_bytes = 0;
+    uint64_t response_body_bytes = 0;
+};
+
+// A record inside a mapped capture file. Views point into the file image.
+struct CaptureRecordView {
+    CaptureRecordHeader header;
+    std::string_view method;
+    std::string_view route;
+    std::string_view host;
+    std::string_view target;
+    std::string_view headers;
+    std::string_view request_body;
+    std::string_view response_body;
+};
+
+// Walks the records of a capture file image in order. False when the file header is
+// missing or from another version; a torn record at the end is ignored.
+bool read_capture(std::string_view file, const std::function<void(const CaptureRecordView&)>& visit);
+
+// Wall-clock time of a recent steady_clock instant, for CapturedExchange::started_at.
+std::chrono::system_clock::time_point capture_wall_clock(std::chrono::steady_clock::time_point at);
+
+struct TrafficCaptureOptions {
+    std::filesystem::path path;
+    size_t body_limit = 0;         // body bytes kept per direction, 0 keeps none
+    size_t queue_capacity = 4096;  // exchanges waiting for the writer before new ones are dropped
+};
+
+// Appends exchanges to a capture file from a background thread. Engines hand over
+// finished exchanges through a bounded lock-free queue, so capturing never blocks or
+// does I/O on the request path; when the writer falls behind, exchanges are dropped
+// and counted instead.
+class TrafficCapture {
+public:
+    explicit TrafficCapture(TrafficCaptureOptions options);
+    ~TrafficCapture();
+
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+    // False when the file could not be opened for appending; record() then drops everything.
+    bool ok() const { return file_ != nullptr; }
+    size_t body_limit() const { return options_.body_limit; }
+
+    // Never blocks. Returns false and counts a drop when the queue is full.
+    bool record(CapturedExchange exchange);
+
+    // Writes everything still queued, then joins the writer and closes the file.
+    void stop();
+
+    uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+
+    const TrafficCaptureOptions options_;
+    std::FILE* file_ = nullptr;
+    MpscQueue<CapturedExchange> queue_;
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::atomic_bool wake_pending_ = false;
+    std::atomic_bool stopping_ = false;
+
+    std::atomic<uint64_t> written_ = 0;
+    std::atomic<uint64_t> dropped_ = 0;
+
+    std::thread thread_;
+};
+
+}  // namespace notiman
@@ -0,0 +1,219 @@
+#include "upstream_pool.h"
+
+#include <utility>
+
+namespace notiman {
+
+UpstreamConnection::UpstreamConnection(const std::string& host,
+                                       int port,
+                                       UpstreamResolver& resolver,
+                                       std::atomic<uint64_t>& connects)
+    : httplib::ClientImpl(host, port), resolver_(resolver), connects_(connects) {}
+
+std::chrono::microseconds UpstreamConnection::take_connect_time() {
+    return std::exchange(connect_time_, std::chrono::microseconds(-1));
+}
+
+bool UpstreamConnection::create_and_connect_socket(Socket& socket, httplib::Error& error) {
+    connects_.fetch_add(1, std::memory_order_relaxed);
+    const auto started_at = std::chrono::steady_clock::now();
+    const UpstreamResolution resolution = resolver_.resolve(started_at);
+    const auto timeout = std::chrono::seconds(connection_timeout_sec_) +
+                         std::chrono::microseconds(connection_timeout_usec_);
+    const ResolvedConnection connection =
+        connect_resolved(resolution, std::chrono::duration_cast<std::chrono::milliseconds>(timeout));
+    if (connection.sock == INVALID_SOCKET) {
+        resolver_.failed();
+        error = connection.timed_out ? httplib::Error::ConnectionTimeout : httplib::Error::Connection;
+        return false;
+    }
+    resolver_.connected(connection.family);
+    apply_socket_options(connection.sock, connection.family);
+    socket.sock = connection.sock;
+    resolver_hit_ = resolution.hit;
+    connect_time_ = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started_at);
+    return true;
+}
+
+// What httplib's own connect sets on the sockets it opens.
+void UpstreamConnection::apply_socket_options(socket_t sock, int family) const {
+    if (tcp_nodelay_ && family != AF_UNIX) {
+        const int enabled = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enabled), sizeof(enabled));
+    }
+#ifdef _WIN32
+    const auto read_timeout = static_cast<uint32_t>(read_timeout_sec_ * 1000 + read_timeout_usec_ / 1000);
+    const auto write_timeout = static_cast<uint32_t>(write_timeout_sec_ * 1000 + write_timeout_usec_ / 1000);
+#else
+    timeval read_timeout{};
+    read_timeout.tv_sec = static_cast<decltype(read_timeout.tv_sec)>(read_timeout_sec_);
+    read_timeout.tv_usec = static_cast<decltype(read_timeout.tv_usec)>(read_timeout_usec_);
+    timeval write_timeout{};
+    write_timeout.tv_sec = static_cast<decltype(write_timeout.tv_sec)>(write_timeout_sec_);
+    write_timeout.tv_usec = static_cast<decltype(write_timeout.tv_usec)>(write_timeout_usec_);
+#endif
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&read_timeout), sizeof(read_timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&write_timeout), sizeof(write_timeout));
+}
+
+UpstreamLease::UpstreamLease(std::shared_ptr<UpstreamPool> pool,
+                             std::unique_ptr<UpstreamConnection> connection,
+                             bool reused)
+    : pool_(std::move(pool)), connection_(std::move(connection)), reused_(reused) {}
+
+UpstreamLease& UpstreamLease::operator=(UpstreamLease&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = std::move(other.pool_);
+        connection_ = std::move(other.connection_);
+        reused_ = other.reused_;
+    }
+    return *this;
+}
+
+UpstreamLease::~UpstreamLease() {
+    release();
+}
+
+std::chrono::microseconds UpstreamLease::connect_time() {
+    return connection_ ? connection_->take_connect_time() : std::chrono::microseconds(-1);
+}
+
+void UpstreamLease::discard() {
+    connection_.reset();
+}
+
+void UpstreamLease::release() {
+    if (pool_ && connection_) {
+        pool_->release(std::move(connection_));
+    }
+    connection_.reset();
+}
+
+UpstreamPool::UpstreamPool(std::string host, int port, UpstreamPoolOptions options, std::string socket_path)
+    : host_(std::move(host)),
+      port_(port),
+      options_(options),
+      resolver_(host_, port_, options_.resolve_ttl, std::move(socket_path)) {
+    idle_.reserve(options_.max_idle);
+}
+
+UpstreamLease UpstreamPool::acquire() {
+    acquired_.fetch_add(1, std::memory_order_relaxed);
+
+    const auto now = std::chrono::steady_clock::now();
+    for (;;) {
+        std::unique_ptr<UpstreamConnection> candidate;
+        {
+            std::lock_guard lock(mutex_);
+            if (idle_.empty()) {
+                break;
+            }
+
+            // Most recently used sits at the back; if it is stale every entry is.
+            if (now - idle_.back().idle_since > options_.idle_timeout) {
+                evicted_.fetch_add(idle_.size(), std::memory_order_relaxed);
+                idle_.clear();
+                break;
+            }
+
+            candidate = std::move(idle_.back().connection);
+            idle_.pop_back();
+        }
+
+        // Probe outside the lock: a peer that closed the keep-alive socket shows up as readable EOF.
+        if (candidate->is_socket_open() && httplib::detail::is_socket_alive(candidate->socket())) {
+            reused_.fetch_add(1, std::memory_order_relaxed);
+            return UpstreamLease(shared_from_this(), std::move(candidate), true);
+        }
+        evicted_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return UpstreamLease(shared_from_this(), make_connection(), false);
+}
+
+UpstreamLease UpstreamPool::acquire_fresh() {
+    acquired_.fetch_add(1, std::memory_order_relaxed);
+    return UpstreamLease(shared_from_this(), make_connection(), false);
+}
+
+size_t UpstreamPool::evict_idle() {
+    std::vector<IdleConnection> expired;
+    {
+        std::lock_guard lock(mutex_);
+        const auto now = std::chrono::steady_clock::now();
+        auto it = idle_.begin();
+        while (it != idle_.end() && now - it->idle_since > options_.idle_timeout) {
+            ++it;
+        }
+        expired.assign(std::make_move_iterator(idle_.begin()), std::make_move_iterator(it));
+        idle_.erase(idle_.begin(), it);
+    }
+    evicted_.fetch_add(expired.size(), std::memory_order_relaxed);
+    return expired.size();
+}
+
+void UpstreamPool::retire() {
+    std::vector<IdleConnection> closing;
+    {
+        std::lock_guard lock(mutex_);
+        retired_ = true;
+        closing.swap(idle_);
+    }
+    evicted_.fetch_add(closing.size(), std::memory_order_relaxed);
+}
+
+bool UpstreamPool::retired() const {
+    std::lock_guard lock(mutex_);
+    return retired_;
+}
+
+UpstreamPoolStats UpstreamPool::stats() const {
+    UpstreamPoolStats result;
+    result.acquired = acquired_.load(std::memory_order_relaxed);
+    result.reused = reused_.load(std::memory_order_relaxed);
+    result.connects = connects_.load(std::memory_order_relaxed);
+    result.evicted = evicted_.load(std::memory_order_relaxed);
+    {
+        std::lock_guard lock(mutex_);
+        result.idle = idle_.size();
+    }
+    return result;
+}
+
+std::unique_ptr<UpstreamConnection> UpstreamPool::make_connection() {
+    auto connection = std::make_unique<UpstreamConnection>(host_, port_, resolver_, connects_);
+    connection->set_keep_alive(options_.max_idle > 0);
+    connection->set_tcp_nodelay(true);
+    connection->set_connection_timeout(options_.connection_timeout);
+    connection->set_read_timeout(options_.io_timeout);
+    connection->set_write_timeout(options_.io_timeout);
+    return connection;
+}
+
+void UpstreamPool::release(std::unique_ptr<UpstreamConnection> connection) {
+    // The client closes its socket itself on errors or "Connection: close" responses.
+    if (options_.max_idle == 0 || !connection->is_socket_open()) {
+        return;
+    }
+
+    std::unique_ptr<UpstreamConnection> overflow;
+    {
+        std::lock_guard lock(mutex_);
+        if (retired_) {
+            overflow = std::move(connection);
+        } else {
+            idle_.push_back(IdleConnection{std::move(connection), std::chrono::steady_clock::now()});
+        }
+        if (idle_.size() > options_.max_idle) {
+            overflow = std::move(idle_.front().connection);
+            idle_.erase(idle_.begin());
+        }
+    }
+    if (overflow) {
+        evicted_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+}  // namespace notiman
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <httplib/httplib.h>
+
+#include "upstream_resolver.h"
+
+namespace notiman {
+
+struct UpstreamPoolOptions {
+    // Idle keep-alive connections kept per route. 0 disables pooling entirely.
+    size_t max_idle = 8;
+    std::chrono::milliseconds idle_timeout{30000};
+    std::chrono::milliseconds connection_timeout{3000};
+    std::chrono::milliseconds io_timeout{15000};
+    std::chrono::milliseconds resolve_ttl{30000};  // how long resolved addresses are reused
+};
+
+struct UpstreamPoolStats {
+    uint64_t acquired = 0;
+    uint64_t reused = 0;
+    uint64_t connects = 0;
+    uint64_t evicted = 0;
+    size_t idle = 0;
+};
+
+// Keep-alive client that connects through the pool's resolver cache and counts fresh
+// TCP connects so pool reuse is observable.
+class UpstreamConnection : public httplib::ClientImpl {
+public:
+    UpstreamConnection(const std::string& host, int port, UpstreamResolver& resolver, std::atomic<uint64_t>& connects);
+
+    // How long the last successful TCP connect took, or -1 if none happened since the previous call.
+    std::chrono::microseconds take_connect_time();
+
+    // Whether the last successful connect found its addresses in the resolver cache.
+    bool resolver_hit() const { return resolver_hit_; }
+
+protected:
+    bool create_and_connect_socket(Socket& socket, httplib::Error& error) override;
+
+private:
+    void apply_socket_options(socket_t sock, int family) const;
+
+    UpstreamResolver& resolver_;
+    std::atomic<uint64_t>& connects_;
+    std::chrono::microseconds connect_time_{-1};
+    bool resolver_hit_ = false;
+};
+
+class UpstreamPool;
+
+// Exclusive use of one upstream connection. Returns it to the pool on destruction
+// unless discard() was called or the socket was closed during the exchange.
+class UpstreamLease {
+public:
+    UpstreamLease(std::shared_ptr<UpstreamPool> pool,
+                  std::unique_ptr<UpstreamConnection> connection,
+                  bool reused);
+    UpstreamLease(UpstreamLease&& other) noexcept = default;
+    UpstreamLease& operator=(UpstreamLease&& other) noexcept;
+    UpstreamLease(const UpstreamLease&) = delete;
+    UpstreamLease& operator=(const UpstreamLease&) = delete;
+    ~UpstreamLease();
+
+    httplib::ClientImpl& client() { return *connection_; }
+
+    // True when the connection came out of the idle list rather than being newly created.
+    bool reused() const { return reused_; }
+
+    // Connect time of the exchange just made, -1 when it ran on an open socket.
+    std::chrono::microseconds connect_time();
+    bool resolver_hit() const { return connection_ && connection_->resolver_hit(); }
+
+    void discard();
+
+private:
+    void release();
+
+    std::shared_ptr<UpstreamPool> pool_;
+    std::unique_ptr<UpstreamConnection> connection_;
+    bool reused_ = false;
+};
+
+// Bounded set of persistent connections to one upstream host:port, or to a Unix domain
+// socket when socket_path is set; host and port then only make the Host header.
+// Idle connections are handed out most-recently-used first, probed before reuse
+// and closed once they have been idle longer than idle_timeout.
+class UpstreamPool : public std::enable_shared_from_this<UpstreamPool> {
+public:
+    UpstreamPool(std::string host, int port, UpstreamPoolOptions options, std::string socket_path = {});
+
+    UpstreamLease acquire();
+
+    // Skips the idle list. Used to retry after a reused socket turned out to be stale.
+    UpstreamLease acquire_fresh();
+
+    // Closes connections idle for longer than idle_timeout. Returns how many were closed.
+    size_t evict_idle();
+
+    // Closes every idle connection and stops keeping returned ones. Used once a config
+    // reload no longer routes to this pool; requests still in flight finish normally.
+    void retire();
+    bool retired() const;
+
+    UpstreamPoolStats stats() const;
+
+    const std::string& host() const { return host_; }
+    int port() const { return port_; }
+    const UpstreamPoolOptions& options() const { return options_; }
+
+    // Shared with the epoll engine, which connects on its own sockets.
+    UpstreamResolver& resolver() { return resolver_; }
+
+private:
+    friend class UpstreamLease;
+
+    struct IdleConnection {
+        std::unique_ptr<UpstreamConnection> connection;
+        std::chrono::steady_clock::time_point idle_since;
+    };
+
+    std::unique_ptr<UpstreamConnection> make_connection();
+    void release(std::unique_ptr<UpstreamConnection> connection);
+
+    const std::string host_;
+    const int port_;
+    const UpstreamPoolOptions options_;
+    UpstreamResolver resolver_;
+
+    mutable std::mutex mutex_;
+    std::vector<IdleConnection> idle_;  // back() is the most recently used
+    bool retired_ = false;
+
+    std::atomic<uint64_t> acquired_ = 0;
+    std::atomic<uint64_t> reused_ = 0;
+    std::atomic<uint64_t> connects_ = 0;
+    std::atomic<uint64_t> evicted_ = 0;
+};
+
+}  // namespace notiman
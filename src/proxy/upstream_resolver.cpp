@@ -0,0 +1,233 @@
+#include "upstream_resolver.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/un.h>
+#endif
+
+namespace notiman {
+
+namespace {
+
+#ifdef _WIN32
+using PollEntry = WSAPOLLFD;
+
+int poll_sockets(PollEntry* entries, size_t count, int timeout_ms) {
+    return WSAPoll(entries, static_cast<ULONG>(count), timeout_ms);
+}
+#else
+using PollEntry = pollfd;
+
+int poll_sockets(PollEntry* entries, size_t count, int timeout_ms) {
+    return poll(entries, static_cast<nfds_t>(count), timeout_ms);
+}
+#endif
+
+std::vector<ResolvedAddress> lookup(const std::string& host, int port) {
+    std::vector<ResolvedAddress> addresses;
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+        return addresses;
+    }
+    for (const addrinfo* info = result; info != nullptr; info = info->ai_next) {
+        if (info->ai_addrlen > sizeof(sockaddr_storage)) {
+            continue;
+        }
+        ResolvedAddress address;
+        std::memcpy(&address.address, info->ai_addr, info->ai_addrlen);
+        address.length = static_cast<socklen_t>(info->ai_addrlen);
+        addresses.push_back(address);
+    }
+    freeaddrinfo(result);
+    return addresses;
+}
+
+std::vector<ResolvedAddress> socket_address(const std::string& path) {
+    std::vector<ResolvedAddress> addresses;
+#ifndef _WIN32
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        return addresses;
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.data(), path.size());
+    ResolvedAddress resolved;
+    std::memcpy(&resolved.address, &address, sizeof(address));
+    resolved.length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+    addresses.push_back(resolved);
+#else
+    (void)path;
+#endif
+    return addresses;
+}
+
+bool has_both_families(const std::vector<ResolvedAddress>& addresses) {
+    const auto is_v4 = [](const ResolvedAddress& address) { return address.family() == AF_INET; };
+    return std::any_of(addresses.begin(), addresses.end(), is_v4) &&
+           !std::all_of(addresses.begin(), addresses.end(), is_v4);
+}
+
+// Starts a non-blocking connect. INVALID_SOCKET when it failed straight away.
+socket_t start_connect(const ResolvedAddress& address) {
+    const socket_t sock = socket(address.family(), SOCK_STREAM, 0);
+    if (sock == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+    httplib::detail::set_nonblocking(sock, true);
+    if (connect(sock, reinterpret_cast<const sockaddr*>(&address.address), address.length) != 0 &&
+        httplib::detail::is_connection_error()) {
+        httplib::detail::close_socket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+int pending_error(socket_t sock) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) != 0) {
+        return -1;
+    }
+    return error;
+}
+
+}  // namespace
+
+UpstreamResolver::UpstreamResolver(std::string host,
+                                   int port,
+                                   std::chrono::milliseconds ttl,
+                                   std::string socket_path)
+    : host_(std::move(host)), port_(port), ttl_(ttl), socket_path_(std::move(socket_path)) {}
+
+UpstreamResolution UpstreamResolver::resolve(Clock::time_point now) {
+    {
+        std::lock_guard lock(mutex_);
+        if (addresses_ && now < expires_at_) {
+            return {addresses_, true, family_ == AF_UNSPEC && has_both_families(*addresses_)};
+        }
+    }
+
+    // Outside the lock: threads missing together each resolve, none waits on another's lookup.
+    auto fresh = std::make_shared<std::vector<ResolvedAddress>>(
+        socket_path_.empty() ? lookup(host_, port_) : socket_address(socket_path_));
+    std::lock_guard lock(mutex_);
+    if (fresh->empty()) {
+        return {std::move(fresh), false, false};
+    }
+    addresses_ = std::move(fresh);
+    expires_at_ = now + ttl_;
+    order_locked();
+    return {addresses_, false, family_ == AF_UNSPEC && has_both_families(*addresses_)};
+}
+
+void UpstreamResolver::connected(int family) {
+    std::lock_guard lock(mutex_);
+    if (family_ == family) {
+        return;
+    }
+    family_ = family;
+    order_locked();
+}
+
+void UpstreamResolver::failed() {
+    std::lock_guard lock(mutex_);
+    addresses_.reset();
+    family_ = AF_UNSPEC;
+}
+
+void UpstreamResolver::order_locked() {
+    if (!addresses_ || family_ == AF_UNSPEC || addresses_->empty() || addresses_->front().family() == family_) {
+        return;
+    }
+    auto ordered = std::make_shared<std::vector<ResolvedAddress>>(*addresses_);
+    std::stable_partition(ordered->begin(), ordered->end(), [this](const ResolvedAddress& address) {
+        return address.family() == family_;
+    });
+    addresses_ = std::move(ordered);
+}
+
+ResolvedConnection connect_resolved(const UpstreamResolution& resolution, std::chrono::milliseconds timeout) {
+    std::vector<const ResolvedAddress*> order;
+    order.reserve(resolution.addresses->size());
+    for (const auto& address : *resolution.addresses) {
+        order.push_back(&address);
+    }
+    if (resolution.race) {
+        // The first address of the other family joins the first one in the opening pair.
+        const auto other = std::find_if(order.begin(), order.end(), [&](const ResolvedAddress* address) {
+            return address->family() != order.front()->family();
+        });
+        std::rotate(order.begin() + 1, other, other + 1);
+    }
+    const size_t parallel = resolution.race ? 2 : 1;
+
+    ResolvedConnection result;
+    std::array<PollEntry, 2> attempts{};
+    std::array<int, 2> families{};
+    size_t active = 0;
+    size_t next = 0;
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    for (;;) {
+        while (active < parallel && next < order.size()) {
+            const ResolvedAddress& address = *order[next++];
+            const socket_t sock = start_connect(address);
+            if (sock != INVALID_SOCKET) {
+                attempts[active] = PollEntry{};
+                attempts[active].fd = sock;
+                attempts[active].events = POLLOUT;
+                families[active] = address.family();
+                ++active;
+            }
+        }
+        if (active == 0) {
+            return result;
+        }
+
+        const auto remaining =
+            std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        const int ready = remaining.count() > 0 ? poll_sockets(attempts.data(), active, static_cast<int>(remaining.count()))
+                                                : 0;
+        if (ready == 0) {
+            result.timed_out = true;
+            for (size_t i = 0; i < active; ++i) {
+                httplib::detail::close_socket(attempts[i].fd);
+            }
+            return result;
+        }
+
+        for (size_t i = 0; i < active;) {
+            if (ready < 0 || attempts[i].revents == 0) {
+                ++i;
+                continue;
+            }
+            if (pending_error(attempts[i].fd) == 0) {
+                result.sock = attempts[i].fd;
+                result.family = families[i];
+                for (size_t j = 0; j < active; ++j) {
+                    if (j != i) {
+                        httplib::detail::close_socket(attempts[j].fd);
+                    }
+                }
+                httplib::detail::set_nonblocking(result.sock, false);
+                return result;
+            }
+            httplib::detail::close_socket(attempts[i].fd);
+            attempts[i] = attempts[active - 1];
+            families[i] = families[active - 1];
+            --active;
+        }
+    }
+}
+
+}  // namespace notiman
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <httplib/httplib.h>
+
+namespace notiman {
+
+struct ResolvedAddress {
+    sockaddr_storage address{};
+    socklen_t length = 0;
+
+    int family() const { return address.ss_family; }
+};
+
+// One lookup, ordered for connecting: addresses of the family that last accepted a
+// connection come first.
+struct UpstreamResolution {
+    std::shared_ptr<const std::vector<ResolvedAddress>> addresses;  // never null; empty when the lookup failed
+    bool hit = false;   // answered from the cache without calling getaddrinfo
+    bool race = false;  // both families and neither proven yet: connect to one of each at once
+};
+
+// TTL-bounded address cache of one upstream host:port, shared by every thread connecting
+// to it. getaddrinfo reports no record TTLs, so entries live for a fixed ttl. An upstream
+// on a Unix domain socket resolves to the socket's address without a lookup.
+//
+// It also remembers which address family actually accepted a connection. "localhost"
+// often resolves to ::1 first while dev servers listen on 127.0.0.1 only; until one
+// family has connected, callers race both, and from then on connect to the winner first.
+class UpstreamResolver {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // ttl 0 resolves on every lookup but still remembers the family. With socket_path set,
+    // host and port are ignored.
+    UpstreamResolver(std::string host, int port, std::chrono::milliseconds ttl, std::string socket_path = {});
+
+    UpstreamResolver(const UpstreamResolver&) = delete;
+    UpstreamResolver& operator=(const UpstreamResolver&) = delete;
+
+    UpstreamResolution resolve(Clock::time_point now);
+
+    // A connection to an address of family succeeded.
+    void connected(int family);
+
+    // No address accepted a connection: the next lookup resolves and races again.
+    void failed();
+
+private:
+    void order_locked();
+
+    const std::string host_;
+    const int port_;
+    const std::chrono::milliseconds ttl_;
+    const std::string socket_path_;
+
+    std::mutex mutex_;
+    std::shared_ptr<const std::vector<ResolvedAddress>> addresses_;
+    Clock::time_point expires_at_;
+    int family_ = AF_UNSPEC;  // AF_UNSPEC until a connection succeeded
+};
+
+struct ResolvedConnection {
+    socket_t sock = INVALID_SOCKET;
+    int family = AF_UNSPEC;
+    bool timed_out = false;
+};
+
+// Blocking connect for thread-per-connection clients: races the first address of each
+// family when resolution.race, otherwise tries the addresses in order, all within timeout.
+// The socket comes back in blocking mode.
+ResolvedConnection connect_resolved(const UpstreamResolution& resolution, std::chrono::milliseconds timeout);
+
+}  // namespace notiman
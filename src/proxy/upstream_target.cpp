@@ -0,0 +1,208 @@
+#include "upstream_target.h"
+
+#include <functional>
+#include <random>
+#include <thread>
+#include <utility>
+
+#ifndef _WIN32
+#include <sys/un.h>
+#endif
+
+namespace notiman {
+
+namespace {
+
+constexpr size_t kNone = static_cast<size_t>(-1);
+
+// Per-thread generator so power-of-two-choices never shares state between workers.
+uint32_t next_random() {
+    thread_local std::minstd_rand generator(
+        static_cast<std::minstd_rand::result_type>(std::hash<std::thread::id>{}(std::this_thread::get_id())));
+    return static_cast<uint32_t>(generator());
+}
+
+// The part of a unix: target after the scheme: an absolute socket path, then the base
+// path after the next colon. Socket paths containing a colon cannot be named.
+std::optional<TargetEndpoint> parse_socket_endpoint(std::string_view rest) {
+#ifdef _WIN32
+    (void)rest;
+    return std::nullopt;
+#else
+    TargetEndpoint endpoint;
+    endpoint.scheme = "unix";
+    endpoint.host = "localhost";
+    const size_t base_start = rest.find(':');
+    endpoint.socket_path = std::string(rest.substr(0, base_start));
+    if (base_start != std::string_view::npos) {
+        endpoint.base_path = std::string(rest.substr(base_start + 1));
+    }
+    if (endpoint.socket_path.empty() || endpoint.socket_path.front() != '/' ||
+        endpoint.socket_path.size() >= sizeof(sockaddr_un::sun_path) ||
+        endpoint.base_path.empty() || endpoint.base_path.front() != '/') {
+        return std::nullopt;
+    }
+    return endpoint;
+#endif
+}
+
+}  // namespace
+
+std::optional<TargetEndpoint> parse_target_endpoint(const std::string& url) {
+    if (url.rfind("unix:", 0) == 0) {
+        return parse_socket_endpoint(std::string_view(url).substr(5));
+    }
+
+    const size_t scheme_pos = url.find("://");
+    if (scheme_pos == std::string::npos) {
+        return std::nullopt;
+    }
+
+    TargetEndpoint endpoint;
+    endpoint.scheme = url.substr(0, scheme_pos);
+    if (endpoint.scheme != "http") {
+        return std::nullopt;
+    }
+
+    const size_t authority_start = scheme_pos + 3;
+    const size_t path_start = url.find('/', authority_start);
+    const std::string authority = (path_start == std::string::npos)
+        ? url.substr(authority_start)
+        : url.substr(authority_start, path_start - authority_start);
+    endpoint.base_path = (path_start == std::string::npos) ? "/" : url.substr(path_start);
+
+    if (authority.empty()) {
+        return std::nullopt;
+    }
+
+    const size_t colon_pos = authority.rfind(':');
+    if (colon_pos != std::string::npos) {
+        endpoint.host = authority.substr(0, colon_pos);
+        const std::string port_text = authority.substr(colon_pos + 1);
+        if (endpoint.host.empty() || port_text.empty()) {
+            return std::nullopt;
+        }
+        try {
+            endpoint.port = std::stoi(port_text);
+        } catch (...) {
+            return std::nullopt;
+        }
+    } else {
+        endpoint.host = authority;
+        endpoint.port = 80;
+    }
+
+    if (endpoint.base_path.empty()) {
+        endpoint.base_path = "/";
+    }
+    return endpoint;
+}
+
+std::optional<BalancePolicy> parse_balance_policy(std::string_view name) {
+    if (name == "round_robin") {
+        return BalancePolicy::RoundRobin;
+    }
+    if (name == "least_outstanding") {
+        return BalancePolicy::LeastOutstanding;
+    }
+    if (name == "p2c") {
+        return BalancePolicy::PowerOfTwoChoices;
+    }
+    return std::nullopt;
+}
+
+UpstreamTarget::UpstreamTarget(std::string url, TargetEndpoint endpoint, std::shared_ptr<UpstreamPool> pool)
+    : url_(std::move(url)), endpoint_(std::move(endpoint)), pool_(std::move(pool)) {}
+
+bool UpstreamTarget::record_probe(bool passed, int fall, int rise) {
+    const bool healthy = healthy_.load(std::memory_order_relaxed);
+    if (passed == healthy) {
+        probe_state_.streak = 0;
+        return false;
+    }
+    if (++probe_state_.streak < (healthy ? fall : rise)) {
+        return false;
+    }
+    probe_state_.streak = 0;
+    healthy_.store(!healthy, std::memory_order_relaxed);
+    return true;
+}
+
+InFlightRequest::InFlightRequest(std::shared_ptr<UpstreamTarget> target) : target_(std::move(target)) {
+    target_->begin_request();
+}
+
+InFlightRequest::~InFlightRequest() {
+    if (target_) {
+        target_->end_request();
+    }
+}
+
+TargetBalancer::TargetBalancer(std::vector<std::shared_ptr<UpstreamTarget>> targets,
+                               BalancePolicy policy,
+                               bool check_health)
+    : targets_(std::move(targets)),
+      policy_(policy),
+      check_health_(check_health),
+      cursor_(std::make_unique<std::atomic<uint32_t>>(0)) {}
+
+size_t TargetBalancer::least_outstanding(size_t start, bool healthy_only) const {
+    size_t best = kNone;
+    uint32_t best_in_flight = 0;
+    for (size_t i = 0; i < targets_.size(); ++i) {
+        const size_t index = (start + i) % targets_.size();
+        const UpstreamTarget& target = *targets_[index];
+        if (healthy_only && !candidate(target)) {
+            continue;
+        }
+        const uint32_t in_flight = target.in_flight();
+        if (best == kNone || in_flight < best_in_flight) {
+            best = index;
+            best_in_flight = in_flight;
+        }
+    }
+    return best;
+}
+
+const std::shared_ptr<UpstreamTarget>& TargetBalancer::pick() const {
+    const size_t count = targets_.size();
+    if (count == 1) {
+        return targets_.front();
+    }
+
+    // The cursor rotates the starting point so ties do not all land on the first target.
+    const size_t start = cursor_->fetch_add(1, std::memory_order_relaxed) % count;
+    switch (policy_) {
+    case BalancePolicy::RoundRobin:
+        for (size_t i = 0; i < count; ++i) {
+            const size_t index = (start + i) % count;
+            if (candidate(*targets_[index])) {
+                return targets_[index];
+            }
+        }
+        return targets_[start];
+
+    case BalancePolicy::PowerOfTwoChoices: {
+        const size_t first = next_random() % count;
+        const size_t second = (first + 1 + next_random() % (count - 1)) % count;
+        const bool first_ok = candidate(*targets_[first]);
+        const bool second_ok = candidate(*targets_[second]);
+        if (first_ok && second_ok) {
+            return targets_[second]->in_flight() < targets_[first]->in_flight() ? targets_[second] : targets_[first];
+        }
+        if (first_ok || second_ok) {
+            return first_ok ? targets_[first] : targets_[second];
+        }
+        // Both samples are ejected: fall back to a full scan of the healthy ones.
+        break;
+    }
+
+    case BalancePolicy::LeastOutstanding:
+        break;
+    }
+
+    const size_t healthy = least_outstanding(start, true);
+    return targets_[healthy != kNone ? healthy : least_outstanding(start, false)];
+}
+
+}  // namespace notiman
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "upstream_pool.h"
+
+namespace notiman {
+
+struct TargetEndpoint {
+    std::string scheme;  // "http" or "unix"
+    std::string host;    // "localhost" for a unix target, as its Host header
+    int port = 80;
+    std::string base_path = "/";
+    std::string socket_path;  // set for a unix target, which connects here instead of to host and port
+};
+
+// "http://host[:port][/base]", or on POSIX "unix:/path/to.sock[:/base]" for an upstream
+// listening on a Unix domain socket.
+std::optional<TargetEndpoint> parse_target_endpoint(const std::string& url);
+
+enum class BalancePolicy {
+    RoundRobin,
+    LeastOutstanding,
+    PowerOfTwoChoices
+};
+
+// "round_robin", "least_outstanding" or "p2c"; nullopt for anything else.
+std::optional<BalancePolicy> parse_balance_policy(std::string_view name);
+
+// One upstream of a route. Kept across reloads while its URL and pool settings stay
+// the same, so health state and in-flight counts carry over to the new route table.
+class UpstreamTarget {
+public:
+    // Owned by the health checker thread; nothing on the request path reads it.
+    struct ProbeState {
+        int streak = 0;  // consecutive probes disagreeing with healthy()
+        std::chrono::steady_clock::time_point next_probe;
+    };
+
+    UpstreamTarget(std::string url, TargetEndpoint endpoint, std::shared_ptr<UpstreamPool> pool);
+
+    const std::string& url() const { return url_; }
+    const TargetEndpoint& endpoint() const { return endpoint_; }
+    const std::shared_ptr<UpstreamPool>& pool() const { return pool_; }
+
+    // Requests forwarded to this target that have not finished yet.
+    uint32_t in_flight() const { return in_flight_.load(std::memory_order_relaxed); }
+    void begin_request() { in_flight_.fetch_add(1, std::memory_order_relaxed); }
+    void end_request() { in_flight_.fetch_sub(1, std::memory_order_relaxed); }
+
+    bool healthy() const { return healthy_.load(std::memory_order_relaxed); }
+
+    // Applies one probe result: fall consecutive failures eject the target, rise
+    // consecutive passes reinstate it. True when healthy() changed.
+    bool record_probe(bool passed, int fall, int rise);
+
+    ProbeState& probe_state() { return probe_state_; }
+
+private:
+    const std::string url_;
+    const TargetEndpoint endpoint_;
+    const std::shared_ptr<UpstreamPool> pool_;
+
+    // Written by every worker; kept off the line holding the read-mostly fields above.
+    alignas(64) std::atomic<uint32_t> in_flight_ = 0;
+    std::atomic<bool> healthy_ = true;
+    ProbeState probe_state_;
+};
+
+// Holds one in-flight count on a target for as long as it lives.
+class InFlightRequest {
+public:
+    explicit InFlightRequest(std::shared_ptr<UpstreamTarget> target);
+    InFlightRequest(InFlightRequest&& other) noexcept = default;
+    InFlightRequest& operator=(InFlightRequest&&) = delete;
+    InFlightRequest(const InFlightRequest&) = delete;
+    InFlightRequest& operator=(const InFlightRequest&) = delete;
+    ~InFlightRequest();
+
+private:
+    std::shared_ptr<UpstreamTarget> target_;
+};
+
+// Picks a target per request. Only reads health flags and in-flight counters and
+// bumps one relaxed cursor, so concurrent picks never lock.
+class TargetBalancer {
+public:
+    TargetBalancer() = default;
+    // check_health false means every target is always a candidate.
+    TargetBalancer(std::vector<std::shared_ptr<UpstreamTarget>> targets, BalancePolicy policy, bool check_health);
+
+    bool empty() const { return targets_.empty(); }
+    const std::vector<std::shared_ptr<UpstreamTarget>>& targets() const { return targets_; }
+    BalancePolicy policy() const { return policy_; }
+
+    // A healthy target chosen by the policy, or any target when none is healthy so
+    // requests still get a real upstream error. Must not be called when empty().
+    const std::shared_ptr<UpstreamTarget>& pick() const;
+
+private:
+    bool candidate(const UpstreamTarget& target) const { return !check_health_ || target.healthy(); }
+    size_t least_outstanding(size_t start, bool healthy_only) const;
+
+    std::vector<std::shared_ptr<UpstreamTarget>> targets_;
+    BalancePolicy policy_ = BalancePolicy::RoundRobin;
+    bool check_health_ = false;
+    std::unique_ptr<std::atomic<uint32_t>> cursor_;
+};
+
+}  // namespace notiman
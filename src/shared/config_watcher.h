@@ -7,6 +7,12 @@
 namespace notiman {
 
 // Blocks while watching a directory handle and posts a message when filename changes.
-void run_config_watcher(HANDLE dir_handle, HWND hwnd, UINT changed_message, const std::wstring& filename);
+// With an empty filename it watches the whole tree and posts on any change in it; the
+// message carries param as its wParam.
+void run_config_watcher(HANDLE dir_handle,
+                        HWND hwnd,
+                        UINT changed_message,
+                        const std::wstring& filename,
+                        WPARAM param);
 
 }  // namespace notiman
@@ -0,0 +1,76 @@
+#include <cstddef>
+#include <string>
+#include <thread>
+
+#include "body_stream.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::BoundedBodyBuffer;
+
+// Reads until the end of the body in reads of at most chunk bytes.
+std::string read_all(BoundedBodyBuffer& buffer, size_t chunk) {
+    std::string body;
+    std::string scratch(chunk, '\0');
+    while (const size_t count = buffer.read(scratch.data(), scratch.size())) {
+        body.append(scratch.data(), count);
+    }
+    return body;
+}
+
+// A body many times the ring's capacity arrives whole and in order, wrapping the ring
+// at odd offsets.
+void relays_a_body_larger_than_the_ring() {
+    BoundedBodyBuffer buffer(7);
+    std::string body;
+    for (int i = 0; i < 5000; ++i) {
+        body += static_cast<char>('a' + i % 26);
+    }
+
+    std::thread producer([&buffer, &body] {
+        for (size_t offset = 0; offset < body.size(); offset += 13) {
+            const std::string piece = body.substr(offset, 13);
+            if (!buffer.write(piece.data(), piece.size())) {
+                return;
+            }
+        }
+        buffer.finish(true);
+    });
+    CHECK(read_all(buffer, 5) == body);
+    producer.join();
+    CHECK(buffer.completed());
+}
+
+// A producer that fails leaves the body incomplete, though the bytes so far are read.
+void reports_truncated_bodies() {
+    BoundedBodyBuffer buffer(16);
+    CHECK(buffer.write("partial", 7));
+    buffer.finish(false);
+    CHECK(read_all(buffer, 16) == "partial");
+    CHECK(!buffer.completed());
+}
+
+// Aborting wakes a producer blocked on a full ring and fails later writes.
+void abort_releases_the_producer() {
+    BoundedBodyBuffer buffer(4);
+    bool written = true;
+    std::thread producer([&buffer, &written] { written = buffer.write("12345678", 8); });
+    char out[2];
+    CHECK(buffer.read(out, sizeof(out)) == 2);
+    buffer.abort();
+    producer.join();
+    CHECK(!written);
+    CHECK(!buffer.write("x", 1));
+    CHECK(buffer.read(out, sizeof(out)) == 0);
+    CHECK(!buffer.completed());
+}
+
+}  // namespace
+
+int main() {
+    relays_a_body_larger_than_the_ring();
+    reports_truncated_bodies();
+    abort_releases_the_producer();
+    return notiman::test::exit_code();
+}
@@ -0,0 +1,127 @@
+#include <chrono>
+#include <cstdint>
+
+#include "circuit_breaker.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::BreakerState;
+using notiman::CircuitBreaker;
+using notiman::CircuitBreakerOptions;
+using Clock = CircuitBreaker::Clock;
+using std::chrono::milliseconds;
+
+CircuitBreakerOptions streak_only(int failures) {
+    CircuitBreakerOptions options;
+    options.consecutive_failures = failures;
+    options.error_percent = 0;
+    options.open_for = milliseconds(1000);
+    return options;
+}
+
+// A run of failures opens the circuit; a success in between starts the count again.
+void opens_after_consecutive_failures() {
+    CircuitBreaker breaker(streak_only(3));
+    const auto now = Clock::now();
+    CHECK(!breaker.record(false, false, now));
+    CHECK(!breaker.record(false, false, now));
+    CHECK(!breaker.record(false, true, now));
+    CHECK(!breaker.record(false, false, now));
+    CHECK(!breaker.record(false, false, now));
+    const auto transition = breaker.record(false, false, now);
+    CHECK(transition && transition->state == BreakerState::Open);
+    CHECK(breaker.state() == BreakerState::Open);
+}
+
+// An open circuit refuses until open_for has passed, telling the client when to retry.
+void refuses_while_open() {
+    CircuitBreaker breaker(streak_only(1));
+    const auto now = Clock::now();
+    breaker.record(false, false, now);
+
+    const auto refused = breaker.admit(now + milliseconds(400));
+    CHECK(!refused.allowed);
+    CHECK(refused.retry_after == milliseconds(600));
+}
+
+// After open_for one probe goes through alone; its success closes the circuit.
+void closes_after_a_successful_probe() {
+    CircuitBreaker breaker(streak_only(1));
+    const auto now = Clock::now();
+    breaker.record(false, false, now);
+
+    const auto probe = breaker.admit(now + milliseconds(1000));
+    CHECK(probe.allowed && probe.probe);
+    CHECK(probe.transition && probe.transition->state == BreakerState::HalfOpen);
+    CHECK(!breaker.admit(now + milliseconds(1001)).allowed);
+
+    const auto closed = breaker.record(true, true, now + milliseconds(1010));
+    CHECK(closed && closed->state == BreakerState::Closed);
+    const auto after = breaker.admit(now + milliseconds(1020));
+    CHECK(after.allowed && !after.probe);
+}
+
+// A failed probe reopens the circuit for twice as long.
+void backs_off_after_a_failed_probe() {
+    CircuitBreaker breaker(streak_only(1));
+    const auto now = Clock::now();
+    breaker.record(false, false, now);
+
+    const auto probe_at = now + milliseconds(1000);
+    CHECK(breaker.admit(probe_at).probe);
+    const auto reopened = breaker.record(true, false, probe_at);
+    CHECK(reopened && reopened->state == BreakerState::Open);
+    CHECK(!breaker.admit(probe_at + milliseconds(1999)).allowed);
+    CHECK(breaker.admit(probe_at + milliseconds(2000)).probe);
+}
+
+// A probe that never reports back stops blocking the next one after kProbeLease.
+void replaces_a_lost_probe() {
+    CircuitBreaker breaker(streak_only(1));
+    const auto now = Clock::now();
+    breaker.record(false, false, now);
+
+    const auto probe_at = now + milliseconds(1000);
+    CHECK(breaker.admit(probe_at).probe);
+    CHECK(!breaker.admit(probe_at + CircuitBreaker::kProbeLease - milliseconds(1)).allowed);
+    CHECK(breaker.admit(probe_at + CircuitBreaker::kProbeLease).probe);
+}
+
+// The error rate opens the circuit once the window holds enough requests.
+void opens_on_error_rate() {
+    CircuitBreakerOptions options;
+    options.consecutive_failures = 0;
+    options.error_percent = 50;
+    CircuitBreaker breaker(options);
+    const auto now = Clock::now();
+
+    for (uint32_t i = 0; i + 1 < CircuitBreaker::kMinWindowRequests; ++i) {
+        CHECK(!breaker.record(false, i % 2 == 0, now));
+    }
+    CHECK(breaker.state() == BreakerState::Closed);
+    const auto transition = breaker.record(false, false, now);
+    CHECK(transition && transition->state == BreakerState::Open);
+}
+
+// Results of requests admitted before the circuit opened leave it alone.
+void ignores_late_results_while_open() {
+    CircuitBreaker breaker(streak_only(1));
+    const auto now = Clock::now();
+    breaker.record(false, false, now);
+    CHECK(!breaker.record(false, true, now));
+    CHECK(breaker.state() == BreakerState::Open);
+}
+
+}  // namespace
+
+int main() {
+    opens_after_consecutive_failures();
+    refuses_while_open();
+    closes_after_a_successful_probe();
+    backs_off_after_a_failed_probe();
+    replaces_a_lost_probe();
+    opens_on_error_rate();
+    ignores_late_results_while_open();
+    return notiman::test::exit_code();
+}
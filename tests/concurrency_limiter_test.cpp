@@ -0,0 +1,90 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "concurrency_limiter.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::ConcurrencyLimiter;
+using notiman::ConcurrencyPermit;
+using Admission = ConcurrencyLimiter::Admission;
+
+std::shared_ptr<ConcurrencyLimiter> limiter_of(int limit, int queue_size) {
+    notiman::ConcurrencyLimitOptions options;
+    options.min_limit = 1;
+    options.max_limit = limit;
+    options.initial_limit = limit;
+    options.queue_size = queue_size;
+    return std::make_shared<ConcurrencyLimiter>(options);
+}
+
+// try_acquire hands out slots up to the limit and refuses the next one instead of waiting.
+void try_acquire_refuses_at_the_limit() {
+    auto limiter = limiter_of(2, 10);
+    ConcurrencyPermit first = limiter->try_acquire();
+    ConcurrencyPermit second = limiter->try_acquire();
+    CHECK(first && second);
+    CHECK(!static_cast<bool>(limiter->try_acquire()));
+    CHECK(limiter->in_flight() == 2);
+
+    first.release();
+    CHECK(limiter->in_flight() == 1);
+    CHECK(static_cast<bool>(limiter->try_acquire()));
+}
+
+// A request queued by acquire gets the slot freed before try_acquire can take it.
+void try_acquire_does_not_jump_the_queue() {
+    auto limiter = limiter_of(1, 10);
+    ConcurrencyPermit held = limiter->try_acquire();
+    bool granted = false;
+    uint64_t ticket = 0;
+    CHECK(limiter->acquire([&granted] { granted = true; }, ticket) == Admission::Queued);
+    CHECK(!static_cast<bool>(limiter->try_acquire()));
+
+    held.release();
+    CHECK(granted);
+    CHECK(limiter->in_flight() == 1);
+    CHECK(!static_cast<bool>(limiter->try_acquire()));
+}
+
+// The queue is FIFO, bounded, and a cancelled request never gets a slot.
+void queues_up_to_queue_size() {
+    auto limiter = limiter_of(1, 2);
+    uint64_t ticket = 0;
+    CHECK(limiter->acquire({}, ticket) == Admission::Admitted);
+
+    int granted = 0;
+    uint64_t first = 0;
+    uint64_t second = 0;
+    CHECK(limiter->acquire([&granted] { granted = 1; }, first) == Admission::Queued);
+    CHECK(limiter->acquire([&granted] { granted = 2; }, second) == Admission::Queued);
+    CHECK(limiter->acquire({}, ticket) == Admission::Refused);
+
+    CHECK(limiter->cancel(first));
+    limiter->release();
+    CHECK(granted == 2);
+    CHECK(!limiter->cancel(second));
+}
+
+// A failed request shrinks the limit by a quarter, but only once per round trip.
+void backs_off_on_failure() {
+    auto limiter = limiter_of(8, 0);
+    const auto admitted = ConcurrencyLimiter::Clock::now();
+    limiter->record(std::chrono::milliseconds(5), false, admitted);
+    CHECK(limiter->limit() == 6);
+    limiter->record(std::chrono::milliseconds(5), false, admitted);
+    CHECK(limiter->limit() == 6);
+}
+
+}  // namespace
+
+int main() {
+    try_acquire_refuses_at_the_limit();
+    try_acquire_does_not_jump_the_queue();
+    queues_up_to_queue_size();
+    backs_off_on_failure();
+    return notiman::test::exit_code();
+}
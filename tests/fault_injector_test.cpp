@@ -0,0 +1,100 @@
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+#include "fault_injector.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::BandwidthThrottle;
+using notiman::FaultAction;
+using notiman::FaultOptions;
+using std::chrono::milliseconds;
+
+constexpr int kDraws = 10000;
+
+void plans_certain_faults() {
+    FaultOptions options;
+    CHECK(!options.active());
+    const auto none = notiman::plan_fault(options);
+    CHECK(none.delay == milliseconds(0) && none.action == FaultAction::None);
+
+    options.delay = milliseconds(20);
+    options.error_percent = 100;
+    CHECK(options.active());
+    const auto error = notiman::plan_fault(options);
+    CHECK(error.delay == milliseconds(20) && error.action == FaultAction::Error);
+
+    // Resets are drawn first, so they win when both add up past 100.
+    options.reset_percent = 100;
+    CHECK(notiman::plan_fault(options).action == FaultAction::Reset);
+}
+
+// Delays land within delay + jitter, and only on the delayed share of requests.
+void draws_delays_and_jitter() {
+    FaultOptions options;
+    options.delay = milliseconds(10);
+    options.jitter = milliseconds(5);
+    bool saw_jitter = false;
+    for (int i = 0; i < kDraws; ++i) {
+        const auto delay = notiman::plan_fault(options).delay;
+        CHECK(delay >= milliseconds(10) && delay <= milliseconds(15));
+        saw_jitter = saw_jitter || delay > milliseconds(10);
+    }
+    CHECK(saw_jitter);
+
+    options.jitter = milliseconds(0);
+    options.delay_percent = 0;
+    CHECK(notiman::plan_fault(options).delay == milliseconds(0));
+}
+
+// Percentages hold over many requests, within a generous margin.
+void splits_by_percentage() {
+    FaultOptions options;
+    options.error_percent = 30;
+    options.reset_percent = 10;
+    int errors = 0;
+    int resets = 0;
+    for (int i = 0; i < kDraws; ++i) {
+        const auto action = notiman::plan_fault(options).action;
+        errors += action == FaultAction::Error;
+        resets += action == FaultAction::Reset;
+    }
+    CHECK(errors > kDraws * 25 / 100 && errors < kDraws * 35 / 100);
+    CHECK(resets > kDraws * 7 / 100 && resets < kDraws * 13 / 100);
+}
+
+// A throttle starts with a tenth of a second's credit, refills at its rate and never
+// holds more than that burst.
+void paces_bandwidth() {
+    const auto start = BandwidthThrottle::Clock::now();
+    BandwidthThrottle throttle;
+    CHECK(!throttle.active());
+    CHECK(throttle.allowance(start) == std::numeric_limits<uint64_t>::max());
+
+    throttle.reset(1000, start);
+    CHECK(throttle.active());
+    CHECK(throttle.allowance(start) == 100);
+    throttle.consume(100);
+    CHECK(throttle.allowance(start) == 0);
+    CHECK(throttle.next_allowance() == start + milliseconds(100));
+
+    const uint64_t half = throttle.allowance(start + milliseconds(50));
+    CHECK(half >= 49 && half <= 50);
+    CHECK(throttle.allowance(start + std::chrono::seconds(10)) == 100);
+
+    // Slow rates still let a byte through.
+    throttle.reset(5, start);
+    CHECK(throttle.allowance(start) == 1);
+}
+
+}  // namespace
+
+int main() {
+    plans_certain_faults();
+    draws_delays_and_jitter();
+    splits_by_percentage();
+    paces_bandwidth();
+    return notiman::test::exit_code();
+}
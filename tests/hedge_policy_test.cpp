@@ -0,0 +1,93 @@
+#include <chrono>
+#include <cstdint>
+
+#include "hedge_policy.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::HedgeOptions;
+using notiman::HedgePolicy;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+HedgeOptions options_of(milliseconds min_delay, uint32_t budget_percent) {
+    HedgeOptions options;
+    options.min_delay = min_delay;
+    options.budget_percent = budget_percent;
+    return options;
+}
+
+// Nothing is hedged until kWarmup first attempts have been timed.
+void waits_for_warmup() {
+    HedgePolicy policy(options_of(milliseconds(1), 100));
+    for (uint32_t i = 0; i + 1 < HedgePolicy::kWarmup; ++i) {
+        CHECK(!policy.plan());
+        policy.record(milliseconds(5));
+    }
+    CHECK(!policy.plan());
+    policy.record(milliseconds(5));
+    const auto delay = policy.plan();
+    CHECK(delay && *delay == milliseconds(5));
+}
+
+// The delay is the 95th percentile of the window: a few slow outliers do not raise it,
+// a slow tenth of the requests does.
+void hedges_past_the_95th_percentile() {
+    HedgePolicy policy(options_of(milliseconds(1), 100));
+    // 100 and 116 samples are refresh points: kWarmup plus a multiple of kRefresh.
+    for (int i = 0; i < 100; ++i) {
+        policy.record(i < 97 ? milliseconds(2) : milliseconds(500));
+    }
+    const auto delay = policy.plan();
+    CHECK(delay && *delay == milliseconds(2));
+
+    for (int i = 0; i < 16; ++i) {
+        policy.record(milliseconds(500));
+    }
+    const auto raised = policy.plan();
+    CHECK(raised && *raised == milliseconds(500));
+}
+
+// However fast the route, a request is never hedged sooner than min_delay.
+void keeps_the_minimum_delay() {
+    HedgePolicy policy(options_of(milliseconds(10), 100));
+    for (uint32_t i = 0; i < HedgePolicy::kWarmup; ++i) {
+        policy.record(microseconds(200));
+    }
+    const auto delay = policy.plan();
+    CHECK(delay && *delay == milliseconds(10));
+}
+
+// Each request earns budget_percent of a hedge; unspent credit is capped at kMaxCredit.
+void spends_within_the_budget() {
+    HedgePolicy policy(options_of(milliseconds(1), 10));
+    CHECK(!policy.spend());
+    for (int i = 0; i < 9; ++i) {
+        policy.plan();
+    }
+    CHECK(!policy.spend());
+    policy.plan();
+    policy.plan();
+    CHECK(policy.spend());
+    CHECK(!policy.spend());
+
+    for (int i = 0; i < 1000; ++i) {
+        policy.plan();
+    }
+    int spent = 0;
+    while (policy.spend()) {
+        ++spent;
+    }
+    CHECK(spent == static_cast<int>(HedgePolicy::kMaxCredit));
+}
+
+}  // namespace
+
+int main() {
+    waits_for_warmup();
+    hedges_past_the_95th_percentile();
+    keeps_the_minimum_delay();
+    spends_within_the_budget();
+    return notiman::test::exit_code();
+}
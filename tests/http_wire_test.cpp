@@ -0,0 +1,188 @@
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "http_wire.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::BodyFramer;
+using notiman::FramingStatus;
+using notiman::ParseStatus;
+
+void parses_request_heads() {
+    notiman::RequestHead head;
+    const std::string_view request = "\r\nPOST /api?x=1 HTTP/1.1\r\nHost: app.localhost\r\nX-Empty:\r\nContent-Length:  5 \r\n\r\nhello";
+    CHECK(notiman::parse_request_head(request, head) == ParseStatus::Complete);
+    CHECK(head.method == "POST" && head.target == "/api?x=1" && head.minor_version == 1);
+    CHECK(head.headers.size() == 3);
+    CHECK(notiman::find_header(head.headers, "content-length") == "5");
+    CHECK(notiman::has_header(head.headers, "x-empty") && notiman::find_header(head.headers, "X-Empty").empty());
+    CHECK(request.substr(head.head_bytes) == "hello");
+
+    // A bare LF ends lines too.
+    CHECK(notiman::parse_request_head("GET / HTTP/1.0\nHost: a\n\n", head) == ParseStatus::Complete);
+    CHECK(head.minor_version == 0 && head.headers.size() == 1);
+}
+
+void waits_for_the_whole_head() {
+    notiman::RequestHead head;
+    CHECK(notiman::parse_request_head("", head) == ParseStatus::Incomplete);
+    CHECK(notiman::parse_request_head("GET / HTTP/1.1\r\nHost: a\r\n", head) == ParseStatus::Incomplete);
+    CHECK(notiman::parse_request_head("GET / HTTP/1.1\r\nHost: a\r\n\r", head) == ParseStatus::Incomplete);
+}
+
+void rejects_malformed_requests() {
+    notiman::RequestHead head;
+    CHECK(notiman::parse_request_head("GET /\r\n\r\n", head) == ParseStatus::Invalid);
+    CHECK(notiman::parse_request_head("GET / HTTP/2.0\r\n\r\n", head) == ParseStatus::Invalid);
+    CHECK(notiman::parse_request_head("G(T / HTTP/1.1\r\n\r\n", head) == ParseStatus::Invalid);
+    CHECK(notiman::parse_request_head("GET / HTTP/1.1\r\nNo colon\r\n\r\n", head) == ParseStatus::Invalid);
+    CHECK(notiman::parse_request_head("GET / HTTP/1.1\r\nBad name: x\r\n\r\n", head) == ParseStatus::Invalid);
+    CHECK(notiman::parse_request_head("GET / HTTP/1.1\r\nA: b\r\n folded\r\n\r\n", head) == ParseStatus::Invalid);
+}
+
+void parses_response_heads() {
+    notiman::ResponseHead head;
+    CHECK(notiman::parse_response_head("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", head) ==
+          ParseStatus::Complete);
+    CHECK(head.status == 404 && head.reason == "Not Found");
+    CHECK(notiman::parse_response_head("HTTP/1.1 204\r\n\r\n", head) == ParseStatus::Complete);
+    CHECK(head.status == 204 && head.reason.empty());
+    CHECK(notiman::parse_response_head("HTTP/1.1 20x OK\r\n\r\n", head) == ParseStatus::Invalid);
+    CHECK(notiman::parse_response_head("HTTP/1.1 099 Low\r\n\r\n", head) == ParseStatus::Invalid);
+}
+
+void matches_header_tokens() {
+    CHECK(notiman::header_has_token("keep-alive, Upgrade", "upgrade"));
+    CHECK(notiman::header_has_token("close", "close"));
+    CHECK(!notiman::header_has_token("keep-alive, upgrade-insecure", "upgrade"));
+    CHECK(!notiman::header_has_token("", "close"));
+}
+
+// Feeds the body one byte at a time, so every state sees a split, and returns how many
+// bytes the framer claimed.
+size_t consume_bytewise(BodyFramer& framer, std::string_view data) {
+    size_t used = 0;
+    for (const char c : data) {
+        const size_t taken = framer.consume(&c, 1);
+        used += taken;
+        if (taken == 0) {
+            break;
+        }
+    }
+    return used;
+}
+
+// Chunked bodies end after the trailers; what follows belongs to the next message.
+void frames_chunked_bodies() {
+    const std::string body = "5;ext=1\r\nhello\r\n1A\r\n" + std::string(26, 'x') + "\r\n0\r\nTrailer: t\r\n\r\n";
+    std::string wire = body;
+    wire += "GET /next HTTP/1.1\r\n\r\n";
+
+    BodyFramer framer;
+    framer.reset(BodyFramer::Mode::Chunked);
+    CHECK(framer.consume(wire.data(), wire.size()) == body.size());
+    CHECK(framer.done());
+
+    framer.reset(BodyFramer::Mode::Chunked);
+    CHECK(consume_bytewise(framer, wire) == body.size());
+    CHECK(framer.done());
+
+    framer.reset(BodyFramer::Mode::Chunked);
+    const std::string_view bad = "5\r\nhelloXX";
+    framer.consume(bad.data(), bad.size());
+    CHECK(framer.failed());
+
+    framer.reset(BodyFramer::Mode::Chunked);
+    const std::string_view no_size = ";x\r\n";
+    framer.consume(no_size.data(), no_size.size());
+    CHECK(framer.failed());
+
+    framer.reset(BodyFramer::Mode::Chunked);
+    const std::string_view huge = "fffffffffffffffff\r\n";
+    framer.consume(huge.data(), huge.size());
+    CHECK(framer.failed());
+}
+
+void frames_length_bodies() {
+    BodyFramer framer;
+    framer.reset(BodyFramer::Mode::Length, 10);
+    CHECK(framer.remaining_length() == 10);
+    CHECK(framer.consume("abcd", 4) == 4 && !framer.done());
+    framer.skip(4);
+    CHECK(framer.remaining_length() == 2);
+    CHECK(framer.consume("efGET", 5) == 2 && framer.done());
+    CHECK(framer.remaining_length() == 0);
+
+    framer.reset(BodyFramer::Mode::None);
+    CHECK(framer.done() && framer.consume("x", 1) == 0);
+
+    framer.reset(BodyFramer::Mode::UntilClose);
+    CHECK(framer.consume("anything", 8) == 8 && !framer.done());
+}
+
+// Transfer-Encoding wins over Content-Length, and only chunked-last is relayable in a request.
+void picks_request_framing() {
+    notiman::RequestHead head;
+    BodyFramer::Mode mode = BodyFramer::Mode::None;
+    uint64_t length = 0;
+
+    notiman::parse_request_head("POST / HTTP/1.1\r\nContent-Length: 12\r\n\r\n", head);
+    CHECK(notiman::request_body_framing(head.headers, mode, length) == FramingStatus::Ok);
+    CHECK(mode == BodyFramer::Mode::Length && length == 12);
+
+    notiman::parse_request_head("POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\nContent-Length: 3\r\n\r\n", head);
+    CHECK(notiman::request_body_framing(head.headers, mode, length) == FramingStatus::Ok);
+    CHECK(mode == BodyFramer::Mode::Chunked);
+
+    notiman::parse_request_head("POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n", head);
+    CHECK(notiman::request_body_framing(head.headers, mode, length) == FramingStatus::Unsupported);
+
+    notiman::parse_request_head("POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n", head);
+    CHECK(notiman::request_body_framing(head.headers, mode, length) == FramingStatus::Invalid);
+
+    notiman::parse_request_head("GET / HTTP/1.1\r\n\r\n", head);
+    CHECK(notiman::request_body_framing(head.headers, mode, length) == FramingStatus::Ok);
+    CHECK(mode == BodyFramer::Mode::None);
+}
+
+void picks_response_framing() {
+    notiman::ResponseHead head;
+    BodyFramer::Mode mode = BodyFramer::Mode::None;
+    uint64_t length = 0;
+
+    notiman::parse_response_head("HTTP/1.1 200 OK\r\nContent-Length: 7\r\n\r\n", head);
+    CHECK(notiman::response_body_framing("GET", head, mode, length) == FramingStatus::Ok);
+    CHECK(mode == BodyFramer::Mode::Length && length == 7);
+    CHECK(notiman::response_body_framing("HEAD", head, mode, length) == FramingStatus::Ok);
+    CHECK(mode == BodyFramer::Mode::None);
+
+    notiman::parse_response_head("HTTP/1.1 304 Not Modified\r\nContent-Length: 7\r\n\r\n", head);
+    CHECK(notiman::response_body_framing("GET", head, mode, length) == FramingStatus::Ok);
+    CHECK(mode == BodyFramer::Mode::None);
+
+    notiman::parse_response_head("HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip\r\n\r\n", head);
+    CHECK(notiman::response_body_framing("GET", head, mode, length) == FramingStatus::Ok);
+    CHECK(mode == BodyFramer::Mode::UntilClose);
+
+    notiman::parse_response_head("HTTP/1.0 200 OK\r\n\r\n", head);
+    CHECK(notiman::response_body_framing("GET", head, mode, length) == FramingStatus::Ok);
+    CHECK(mode == BodyFramer::Mode::UntilClose);
+}
+
+}  // namespace
+
+int main() {
+    parses_request_heads();
+    waits_for_the_whole_head();
+    rejects_malformed_requests();
+    parses_response_heads();
+    matches_header_tokens();
+    frames_chunked_bodies();
+    frames_length_bodies();
+    picks_request_framing();
+    picks_response_framing();
+    return notiman::test::exit_code();
+}
@@ -0,0 +1,656 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <httplib/httplib.h>
+
+#include "hedge_policy.h"
+#include "proxy_config.h"
+#include "proxy_engine.h"
+#include "route_table.h"
+#include "test_support.h"
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A body large enough for the epoll engine to splice, patterned so that lost or
+// reordered bytes show.
+std::string large_body() {
+    std::string body(1 << 20, '\0');
+    for (size_t i = 0; i < body.size(); ++i) {
+        body[i] = static_cast<char>('a' + (i * 7 + i / 4096) % 26);
+    }
+    return body;
+}
+
+// Upstream that keeps the last request body it received and how it was framed. GETs
+// answer "ok", except as noted in start_handlers().
+struct RecordingUpstream {
+    httplib::Server server;
+    std::thread thread;
+    int port = 0;
+    std::string body;
+    std::string transfer_encoding;
+    std::atomic<bool> stalled = false;
+
+    bool start() {
+        start_handlers();
+        // Only the proxy's own sockets are under test.
+        server.set_tcp_nodelay(true);
+        port = server.bind_to_any_port("127.0.0.1");
+        return port > 0 && serve();
+    }
+
+#ifndef _WIN32
+    // The same upstream on a Unix domain socket at socket_path instead.
+    bool start_unix(const std::string& socket_path) {
+        start_handlers();
+        server.set_address_family(AF_UNIX);
+        return server.bind_to_port(socket_path, 80) && serve();
+    }
+#endif
+
+    void stop() {
+        server.stop();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    void start_handlers() {
+        // /slow always takes a second, /stall only the first time; /echo/... answers with
+        // the path and Host it got, /large with large_body().
+        server.Get(R"(/.*)", [this](const httplib::Request& req, httplib::Response& res) {
+            if (req.path == "/slow" || (req.path == "/stall" && !stalled.exchange(true))) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+            if (req.path == "/large") {
+                res.set_content(large_body(), "application/octet-stream");
+                return;
+            }
+            if (req.path.starts_with("/echo/")) {
+                res.set_content(req.path + " " + req.get_header_value("Host"), "text/plain");
+                return;
+            }
+            res.set_content("ok", "text/plain");
+        });
+        server.Post(R"(/.*)", [this](const httplib::Request& req, httplib::Response& res) {
+            body = req.body;
+            transfer_encoding = req.get_header_value("Transfer-Encoding");
+            res.set_content("ok", "text/plain");
+        });
+    }
+
+    bool serve() {
+        thread = std::thread([this] { server.listen_after_bind(); });
+        server.wait_until_ready();
+        return true;
+    }
+};
+
+// A proxy with the given routes, built the way notiman-proxy builds it.
+struct Proxy {
+    notiman::ProxyConfig config;
+    notiman::RouteTablePublisher routes;
+    std::unique_ptr<notiman::ProxyEngine> engine;
+
+    explicit Proxy(const std::string& engine_name) {
+        config.engine = engine_name;
+        // One listener, so the httplib engine has a single worker pool of known size.
+        config.listeners = 1;
+    }
+
+    notiman::ProxyRoute& add_route(const std::string& name, const std::string& target_url) {
+        notiman::ProxyRoute route;
+        route.name = name;
+        route.target_base_urls.push_back(target_url);
+        config.routes.push_back(std::move(route));
+        return config.routes.back();
+    }
+
+    notiman::ProxyRoute& add_route(const std::string& name, int upstream_port) {
+        return add_route(name, "http://127.0.0.1:" + std::to_string(upstream_port));
+    }
+
+    void build() {
+        routes.publish(notiman::RouteTable::build(config, nullptr));
+        engine = notiman::make_proxy_engine(config, routes, nullptr, nullptr, nullptr);
+    }
+
+    bool start() {
+        build();
+        return engine->start("127.0.0.1", 0);
+    }
+
+    void stop() {
+        engine->stop();
+        routes.publish(nullptr);
+    }
+};
+
+// Median time of sequential GETs on one keep-alive connection, after a first one that connects.
+std::chrono::microseconds keepalive_median(int port, const std::string& host) {
+    httplib::Client client("127.0.0.1", port);
+    client.set_keep_alive(true);
+    client.set_tcp_nodelay(true);
+    const httplib::Headers headers = {{"Host", host}};
+    client.Get("/warmup", headers);
+    std::vector<std::chrono::microseconds> times;
+    for (int i = 0; i < 15; ++i) {
+        const auto started = Clock::now();
+        const auto result = client.Get("/keepalive", headers);
+        times.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started));
+        CHECK(result && result->status == 200);
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+// A chunked request body on a stream=true route reaches the upstream whole and still chunked.
+void streams_chunked_request_body() {
+    RecordingUpstream upstream;
+    CHECK(upstream.start());
+
+    Proxy proxy("httplib");
+    proxy.add_route("api", upstream.port).stream_bodies = true;
+    CHECK(proxy.start());
+
+    httplib::Client client("127.0.0.1", proxy.engine->port());
+    const httplib::Headers headers = {{"Host", "api.localhost"}};
+    const auto result = client.Post(
+        "/upload",
+        headers,
+        [](size_t, httplib::DataSink& sink) {
+            sink.write("hello, ", 7);
+            sink.write("chunked ", 8);
+            sink.write("world", 5);
+            sink.done();
+            return true;
+        },
+        "text/plain");
+
+    CHECK(result && result->status == 200);
+    CHECK(upstream.body == "hello, chunked world");
+    CHECK(upstream.transfer_encoding == "chunked");
+
+    proxy.stop();
+    upstream.stop();
+}
+
+// Responses on a keep-alive connection go out at once rather than after a delayed ACK
+// (about 40 ms on Linux), on a socket the engine opened itself.
+void answers_keepalive_requests_without_nagle_delay() {
+    RecordingUpstream upstream;
+    CHECK(upstream.start());
+
+    Proxy proxy("httplib");
+    proxy.add_route("api", upstream.port);
+    CHECK(proxy.start());
+
+    CHECK(keepalive_median(proxy.engine->port(), "api.localhost") < std::chrono::milliseconds(20));
+
+    proxy.stop();
+    upstream.stop();
+}
+
+// A first attempt still waiting past the route's usual latency is hedged, and the
+// hedge's answer is sent without waiting for the first one.
+void hedges_a_stalled_request() {
+    RecordingUpstream upstream;
+    CHECK(upstream.start());
+
+    Proxy proxy("httplib");
+    notiman::ProxyRoute& route = proxy.add_route("api", upstream.port);
+    route.hedge = true;
+    route.hedge_min_ms = 20;
+    CHECK(proxy.start());
+
+    httplib::Client client("127.0.0.1", proxy.engine->port());
+    const httplib::Headers headers = {{"Host", "api.localhost"}};
+    for (uint32_t i = 0; i < 2 * notiman::HedgePolicy::kWarmup; ++i) {
+        client.Get("/warmup", headers);
+    }
+    const auto started = Clock::now();
+    const auto result = client.Get("/stall", headers);
+    const auto elapsed = Clock::now() - started;
+    CHECK(result && result->status == 200 && result->body == "ok");
+    CHECK(elapsed < std::chrono::milliseconds(500));
+
+    proxy.stop();
+    upstream.stop();
+}
+
+// drain() lets a request in flight finish before it returns, on either engine.
+void drains_requests_in_flight(const std::string& engine) {
+    RecordingUpstream upstream;
+    CHECK(upstream.start());
+
+    Proxy proxy(engine);
+    proxy.add_route("api", upstream.port);
+    CHECK(proxy.start());
+
+    httplib::Result result;
+    std::thread client([&result, port = proxy.engine->port()] {
+        httplib::Client slow("127.0.0.1", port);
+        result = slow.Get("/slow", {{"Host", "api.localhost"}});
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK(proxy.engine->drain(std::chrono::seconds(5)) == 0);
+    client.join();
+    CHECK(result && result->status == 200);
+
+    proxy.stop();
+    upstream.stop();
+}
+
+// A route at its concurrency limit refuses the excess at once instead of parking it on
+// worker threads, so more slow requests than the engine has workers leave other routes alone.
+void saturated_route_does_not_stall_other_routes() {
+    RecordingUpstream upstream;
+    CHECK(upstream.start());
+
+    Proxy proxy("httplib");
+    notiman::ProxyRoute& limited = proxy.add_route("limited", upstream.port);
+    limited.concurrency_limit = true;
+    limited.concurrency_min = 1;
+    limited.concurrency_initial = 2;
+    limited.concurrency_max = 2;
+    limited.queue_size = 50;
+    limited.queue_timeout_ms = 3000;
+    proxy.add_route("other", upstream.port);
+    CHECK(proxy.start());
+    const int port = proxy.engine->port();
+
+    std::atomic<int> refused = 0;
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < CPPHTTPLIB_THREAD_POOL_COUNT + 8; ++i) {
+        clients.emplace_back([port, &refused] {
+            httplib::Client client("127.0.0.1", port);
+            const auto result = client.Get("/slow", {{"Host", "limited.localhost"}});
+            if (result && result->status == 503) {
+                ++refused;
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    httplib::Client client("127.0.0.1", port);
+    client.set_read_timeout(5, 0);
+    const auto started = Clock::now();
+    const auto result = client.Get("/fast", {{"Host", "other.localhost"}});
+    const auto elapsed = Clock::now() - started;
+    CHECK(result && result->status == 200);
+    CHECK(elapsed < std::chrono::milliseconds(500));
+
+    for (auto& thread : clients) {
+        thread.join();
+    }
+    CHECK(refused > 0);
+
+    proxy.stop();
+    upstream.stop();
+}
+
+#ifdef __linux__
+// Large Content-Length bodies cross the epoll engine intact both ways, spliced or copied,
+// and the connection carries on with the next request.
+void relays_large_bodies(bool splice) {
+    RecordingUpstream upstream;
+    CHECK(upstream.start());
+
+    Proxy proxy("epoll");
+    proxy.config.splice = splice;
+    proxy.add_route("api", upstream.port);
+    CHECK(proxy.start());
+
+    const std::string body = large_body();
+    httplib::Client client("127.0.0.1", proxy.engine->port());
+    client.set_keep_alive(true);
+    const httplib::Headers headers = {{"Host", "api.localhost"}};
+    for (int i = 0; i < 2; ++i) {
+        upstream.body.clear();
+        const auto upload = client.Post("/upload", headers, body, "application/octet-stream");
+        CHECK(upload && upload->status == 200 && upload->body == "ok");
+        CHECK(upstream.body == body);
+
+        const auto download = client.Get("/large", headers);
+        CHECK(download && download->status == 200 && download->body == body);
+    }
+
+    client.stop();
+    proxy.stop();
+    upstream.stop();
+}
+#endif
+
+#ifndef _WIN32
+// Upstream that answers 413 as soon as it has the request headers and closes the
+// connection without reading the body.
+struct EarlyReplyUpstream {
+    int listen_fd = -1;
+    int port = 0;
+    std::thread thread;
+
+    bool start() {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listen_fd, SOMAXCONN) != 0) {
+            return false;
+        }
+        socklen_t length = sizeof(address);
+        getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length);
+        port = ntohs(address.sin_port);
+        thread = std::thread([this] {
+            const int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            std::string head;
+            char buffer[1024];
+            while (head.find("\r\n\r\n") == std::string::npos) {
+                const ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+                if (count <= 0) {
+                    break;
+                }
+                head.append(buffer, static_cast<size_t>(count));
+            }
+            const std::string response =
+                "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+            close(fd);
+        });
+        return true;
+    }
+
+    void stop() {
+        if (thread.joinable()) {
+            thread.join();
+        }
+        close(listen_fd);
+    }
+};
+
+// Upstream that echoes whatever it receives on one connection until the peer shuts down
+// its side. With upgrade set it first answers the request head with 101.
+struct EchoUpstream {
+    int listen_fd = -1;
+    int port = 0;
+    std::thread thread;
+
+    bool start(bool upgrade) {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listen_fd, SOMAXCONN) != 0) {
+            return false;
+        }
+        socklen_t length = sizeof(address);
+        getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length);
+        port = ntohs(address.sin_port);
+        thread = std::thread([this, upgrade] {
+            const int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            std::string pending;
+            char buffer[1024];
+            if (upgrade) {
+                while (pending.find("\r\n\r\n") == std::string::npos) {
+                    const ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+                    if (count <= 0) {
+                        close(fd);
+                        return;
+                    }
+                    pending.append(buffer, static_cast<size_t>(count));
+                }
+                pending.erase(0, pending.find("\r\n\r\n") + 4);
+                pending.insert(0, "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: websocket\r\n\r\n");
+            }
+            for (;;) {
+                if (!pending.empty() && send(fd, pending.data(), pending.size(), MSG_NOSIGNAL) <= 0) {
+                    break;
+                }
+                pending.clear();
+                const ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+                if (count <= 0) {
+                    break;
+                }
+                pending.assign(buffer, static_cast<size_t>(count));
+            }
+            close(fd);
+        });
+        return true;
+    }
+
+    void stop() {
+        if (thread.joinable()) {
+            thread.join();
+        }
+        close(listen_fd);
+    }
+};
+
+// Raw client connection to the proxy, giving up on reads after a few seconds.
+int connect_to(int port) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    timeval timeout{3, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads up to and including the blank line ending a response head.
+std::string read_head(int fd) {
+    std::string head;
+    char c = 0;
+    while (head.find("\r\n\r\n") == std::string::npos && recv(fd, &c, 1, 0) == 1) {
+        head += c;
+    }
+    return head;
+}
+
+// Sends request, expects a response head starting with status_line, and then, unless the
+// proxy refused, an echo of what is sent through the tunnel and a close after a half-close.
+bool tunnels(int proxy_port, const std::string& request, const std::string& status_line) {
+    const int fd = connect_to(proxy_port);
+    if (fd < 0) {
+        return false;
+    }
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    const std::string head = read_head(fd);
+    bool ok = head.starts_with(status_line);
+    if (ok && status_line.find(" 501 ") == std::string::npos) {
+        const std::string message = "ping through the tunnel";
+        send(fd, message.data(), message.size(), MSG_NOSIGNAL);
+        std::string echoed;
+        char buffer[64];
+        while (echoed.size() < message.size()) {
+            const ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+            if (count <= 0) {
+                break;
+            }
+            echoed.append(buffer, static_cast<size_t>(count));
+        }
+        shutdown(fd, SHUT_WR);
+        ok = echoed == message && recv(fd, buffer, sizeof(buffer), 0) == 0;
+    }
+    close(fd);
+    return ok;
+}
+
+// The epoll engine tunnels WebSocket upgrades and CONNECT to the route's target; the
+// httplib engine, which cannot take over the socket, refuses both with 501.
+void tunnels_upgrades_and_connect(const std::string& engine) {
+    const bool relays = engine == "epoll";
+    const std::string upgrade =
+        "GET /ws HTTP/1.1\r\nHost: ws.localhost\r\nConnection: Upgrade\r\nUpgrade: websocket\r\n\r\n";
+    const std::string connect = "CONNECT ws.localhost:443 HTTP/1.1\r\nHost: ws.localhost\r\n\r\n";
+
+    for (const bool use_connect : {false, true}) {
+        EchoUpstream upstream;
+        CHECK(upstream.start(!use_connect));
+        Proxy proxy(engine);
+        proxy.add_route("ws", upstream.port);
+        CHECK(proxy.start());
+
+        const std::string status = relays ? (use_connect ? "HTTP/1.1 200 " : "HTTP/1.1 101 ") : "HTTP/1.1 501 ";
+        CHECK(tunnels(proxy.engine->port(), use_connect ? connect : upgrade, status));
+
+        proxy.stop();
+        if (!relays) {
+            // Nothing reached the upstream: let its accept return.
+            close(connect_to(upstream.port));
+        }
+        upstream.stop();
+    }
+}
+
+// An upstream that answers before it has read a streamed chunked body: the proxy answers
+// the client once it is done with the body, and the connection serves the next request.
+void handles_upstream_answering_before_reading_the_body() {
+    EarlyReplyUpstream early;
+    CHECK(early.start());
+    RecordingUpstream upstream;
+    CHECK(upstream.start());
+
+    Proxy proxy("httplib");
+    proxy.add_route("upload", early.port).stream_bodies = true;
+    proxy.add_route("api", upstream.port);
+    CHECK(proxy.start());
+
+    httplib::Client client("127.0.0.1", proxy.engine->port());
+    client.set_keep_alive(true);
+    const std::string chunk(64 * 1024, 'x');
+    const auto result = client.Post(
+        "/upload",
+        {{"Host", "upload.localhost"}},
+        [&chunk](size_t, httplib::DataSink& sink) {
+            for (int i = 0; i < 16; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                if (!sink.write(chunk.data(), chunk.size())) {
+                    return false;
+                }
+            }
+            sink.done();
+            return true;
+        },
+        "application/octet-stream");
+    CHECK(result && result->status >= 400);
+
+    const auto next = client.Get("/next", {{"Host", "api.localhost"}});
+    CHECK(next && next->status == 200 && next->body == "ok");
+
+    // An idle keep-alive connection would hold the engine's stop() for its timeout.
+    client.stop();
+    proxy.stop();
+    upstream.stop();
+    early.stop();
+}
+
+// A unix: target is reached over its socket, under its base path, with Host: localhost,
+// on either engine.
+void forwards_to_a_unix_socket(const std::string& engine) {
+    const std::string socket_path = "/tmp/notiman-test-" + engine + ".sock";
+    unlink(socket_path.c_str());
+    RecordingUpstream upstream;
+    CHECK(upstream.start_unix(socket_path));
+
+    Proxy proxy(engine);
+    proxy.add_route("app", "unix:" + socket_path + ":/echo");
+    CHECK(proxy.start());
+
+    httplib::Client client("127.0.0.1", proxy.engine->port());
+    client.set_keep_alive(true);
+    for (int i = 0; i < 3; ++i) {
+        const auto result = client.Get("/users?page=2", {{"Host", "app.localhost"}});
+        CHECK(result && result->status == 200);
+        CHECK(result && result->body == "/echo/users localhost");
+    }
+
+    // An idle keep-alive connection would hold the engine's stop() for its timeout.
+    client.stop();
+    proxy.stop();
+    upstream.stop();
+    unlink(socket_path.c_str());
+}
+
+// The same on a listening socket handed to the engine, as systemd or a predecessor does,
+// that nobody set TCP_NODELAY on.
+void answers_keepalive_requests_without_nagle_delay_on_inherited_socket() {
+    RecordingUpstream upstream;
+    CHECK(upstream.start());
+
+    const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0);
+    CHECK(listen(listen_fd, SOMAXCONN) == 0);
+    socklen_t length = sizeof(address);
+    getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length);
+
+    Proxy proxy("httplib");
+    proxy.add_route("api", upstream.port);
+    proxy.build();
+    CHECK(proxy.engine->start_inherited({listen_fd}));
+
+    CHECK(keepalive_median(ntohs(address.sin_port), "api.localhost") < std::chrono::milliseconds(20));
+
+    proxy.stop();  // closes listen_fd
+    upstream.stop();
+}
+#endif
+
+}  // namespace
+
+int main() {
+    streams_chunked_request_body();
+    answers_keepalive_requests_without_nagle_delay();
+    hedges_a_stalled_request();
+    drains_requests_in_flight("httplib");
+#ifdef __linux__
+    drains_requests_in_flight("epoll");
+#endif
+    saturated_route_does_not_stall_other_routes();
+#ifdef __linux__
+    relays_large_bodies(true);
+    relays_large_bodies(false);
+#endif
+#ifndef _WIN32
+    handles_upstream_answering_before_reading_the_body();
+    tunnels_upgrades_and_connect("httplib");
+#ifdef __linux__
+    tunnels_upgrades_and_connect("epoll");
+#endif
+    forwards_to_a_unix_socket("httplib");
+#ifdef __linux__
+    forwards_to_a_unix_socket("epoll");
+#endif
+    answers_keepalive_requests_without_nagle_delay_on_inherited_socket();
+#endif
+    return notiman::test::exit_code();
+}
@@ -0,0 +1,132 @@
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "listener_handoff.h"
+#include "test_support.h"
+
+// Runs itself as the successor: with --successor it takes the listener it was handed,
+// reports ready and answers one connection; with --never-ready it hangs instead.
+
+namespace {
+
+using std::chrono::milliseconds;
+
+constexpr const char* kSelf = "/proc/self/exe";
+
+int run_successor() {
+    const notiman::InheritedSockets sockets = notiman::take_inherited_sockets();
+    if (sockets.listen_fds.size() != 1 || sockets.ready_fd < 0 || std::getenv("NOTIMAN_LISTEN_FDS") != nullptr ||
+        std::getenv("NOTIMAN_READY_FD") != nullptr) {
+        return 2;
+    }
+    notiman::report_ready(sockets.ready_fd);
+    const int client = accept(sockets.listen_fds[0], nullptr, nullptr);
+    if (client < 0) {
+        return 3;
+    }
+    const bool sent = send(client, "hi", 2, MSG_NOSIGNAL) == 2;
+    close(client);
+    return sent ? 0 : 4;
+}
+
+int loopback_listener(int& port) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+    listen(fd, SOMAXCONN);
+    socklen_t length = sizeof(address);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+    port = ntohs(address.sin_port);
+    return fd;
+}
+
+std::string read_from(int port) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    std::string received;
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0) {
+        char buffer[16];
+        ssize_t count = 0;
+        while ((count = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            received.append(buffer, static_cast<size_t>(count));
+        }
+    }
+    close(fd);
+    return received;
+}
+
+// The successor finds the listener where take_inherited_sockets() looks, with the
+// variables that announced it cleared, and accepts on it once it has reported ready.
+void hands_the_listener_to_a_successor() {
+    int port = 0;
+    const int listen_fd = loopback_listener(port);
+    const pid_t pid = notiman::start_successor(kSelf, {kSelf, "--successor"}, {listen_fd}, milliseconds(5000));
+    CHECK(pid > 0);
+    close(listen_fd);
+    if (pid <= 0) {
+        return;
+    }
+
+    CHECK(read_from(port) == "hi");
+    int status = 0;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// A successor that never reports ready is killed once the timeout has passed.
+void gives_up_on_a_successor_that_never_gets_ready() {
+    int port = 0;
+    const int listen_fd = loopback_listener(port);
+    const auto started = std::chrono::steady_clock::now();
+    const pid_t pid = notiman::start_successor(kSelf, {kSelf, "--never-ready"}, {listen_fd}, milliseconds(300));
+    const auto elapsed = std::chrono::steady_clock::now() - started;
+    close(listen_fd);
+
+    CHECK(pid == -1);
+    CHECK(elapsed >= milliseconds(300) && elapsed < milliseconds(3000));
+}
+
+// A successor that exits before it is ready is reported at once, not after the timeout.
+void notices_a_successor_that_exits() {
+    int port = 0;
+    const int listen_fd = loopback_listener(port);
+    const auto started = std::chrono::steady_clock::now();
+    const pid_t pid = notiman::start_successor("/nonexistent/notiman-proxy", {"notiman-proxy"}, {listen_fd},
+                                               milliseconds(5000));
+    const auto elapsed = std::chrono::steady_clock::now() - started;
+    close(listen_fd);
+
+    CHECK(pid == -1);
+    CHECK(elapsed < milliseconds(3000));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "--successor") {
+        return run_successor();
+    }
+    if (mode == "--never-ready") {
+        std::this_thread::sleep_for(std::chrono::seconds(30));
+        return 0;
+    }
+
+    hands_the_listener_to_a_successor();
+    gives_up_on_a_successor_that_never_gets_ready();
+    notices_a_successor_that_exits();
+    return notiman::test::exit_code();
+}
@@ -0,0 +1,155 @@
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "mock_store.h"
+#include "test_support.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+using notiman::ByteRange;
+using notiman::MockStore;
+using notiman::RangeStatus;
+
+// A fresh directory of mock files, removed again at the end of the test.
+struct MockDir {
+    fs::path path;
+
+    explicit MockDir(const std::string& name) : path(fs::temp_directory_path() / name) {
+        fs::remove_all(path);
+        fs::create_directories(path);
+    }
+    ~MockDir() {
+        std::error_code error;
+        fs::remove_all(path, error);
+    }
+
+    void write(const std::string& name, const std::string& contents) const {
+        fs::create_directories((path / name).parent_path());
+        std::ofstream(path / name, std::ios::binary | std::ios::trunc) << contents;
+    }
+};
+
+std::string body_of(MockStore& store, const std::string& path) {
+    return std::string(store.find("GET", path)->body());
+}
+
+void parses_byte_ranges() {
+    ByteRange range;
+    CHECK(notiman::parse_byte_range("bytes=0-99", 1000, range) == RangeStatus::Partial);
+    CHECK(range.first == 0 && range.length == 100);
+    CHECK(notiman::parse_byte_range("bytes=900-", 1000, range) == RangeStatus::Partial);
+    CHECK(range.first == 900 && range.length == 100);
+    CHECK(notiman::parse_byte_range("bytes=-10", 1000, range) == RangeStatus::Partial);
+    CHECK(range.first == 990 && range.length == 10);
+    CHECK(notiman::parse_byte_range("bytes=990-5000", 1000, range) == RangeStatus::Partial);
+    CHECK(range.length == 10);
+
+    CHECK(notiman::parse_byte_range("bytes=1000-", 1000, range) == RangeStatus::Unsatisfiable);
+    CHECK(notiman::parse_byte_range("bytes=-0", 1000, range) == RangeStatus::Unsatisfiable);
+    CHECK(notiman::parse_byte_range("bytes=0-1,5-6", 1000, range) == RangeStatus::Whole);
+    CHECK(notiman::parse_byte_range("bytes=20-10", 1000, range) == RangeStatus::Whole);
+    CHECK(notiman::parse_byte_range("items=0-1", 1000, range) == RangeStatus::Whole);
+}
+
+// Request paths never reach outside the mock directory, encoded or not.
+void refuses_paths_out_of_the_directory() {
+    MockDir outside("notiman-mock-outside");
+    outside.write("secret.txt", "secret");
+    MockDir dir("notiman-mock-traversal");
+    dir.write("index.html", "home");
+    dir.write("docs/index.html", "docs");
+    MockStore store(dir.path);
+
+    CHECK(body_of(store, "/") == "home");
+    CHECK(body_of(store, "/docs/") == "docs");
+    CHECK(body_of(store, "/./docs/index.html") == "docs");
+    CHECK(store.find("GET", "/../notiman-mock-outside/secret.txt")->status == 404);
+    CHECK(store.find("GET", "/%2e%2e/notiman-mock-outside/secret.txt")->status == 404);
+    CHECK(store.find("GET", "/docs/..%2f..%2fnotiman-mock-outside/secret.txt")->status == 404);
+    CHECK(store.find("GET", "/..\\notiman-mock-outside\\secret.txt")->status == 404);
+    CHECK(store.find("POST", "/")->status == 404);
+}
+
+// A served file is cached until reload(), which picks up the new contents.
+void reload_drops_cached_files() {
+    MockDir dir("notiman-mock-reload");
+    dir.write("data.json", "{\"v\":1}");
+    MockStore store(dir.path);
+
+    const auto first = store.find("GET", "/data.json");
+    CHECK(first->content_type == "application/json");
+    dir.write("data.json", "{\"v\":2}");
+    CHECK(store.find("GET", "/data.json") == first);
+
+    store.reload();
+    CHECK(body_of(store, "/data.json") == "{\"v\":2}");
+    CHECK(first->body() == "{\"v\":1}");
+}
+
+#ifdef __linux__
+size_t open_fds() {
+    size_t count = 0;
+    for ([[maybe_unused]] const auto& entry : fs::directory_iterator("/proc/self/fd")) {
+        ++count;
+    }
+    return count;
+}
+
+// Cached bodies, mapped or read, hold no descriptor.
+void closes_files_once_loaded() {
+    MockDir dir("notiman-mock-fds");
+    dir.write("small.txt", "small");
+    dir.write("large.bin", std::string(notiman::MappedFile::kMapMinBytes, 'x'));
+    MockStore store(dir.path);
+
+    const size_t before = open_fds();
+    const auto small = store.find("GET", "/small.txt");
+    const auto large = store.find("GET", "/large.bin");
+    CHECK(open_fds() == before);
+    CHECK(small->body() == "small");
+    CHECK(large->body().size() == notiman::MappedFile::kMapMinBytes);
+}
+#endif
+
+// "/<i>.txt", the request path of one of many files.
+std::string numbered_path(size_t i) {
+    std::string path = "/";
+    path += std::to_string(i);
+    path += ".txt";
+    return path;
+}
+
+// Only the most recently served files stay loaded.
+void bounds_the_file_cache() {
+    MockDir dir("notiman-mock-bound");
+    for (size_t i = 0; i <= MockStore::kMaxCachedFiles; ++i) {
+        dir.write(numbered_path(i).substr(1), "v1");
+    }
+    MockStore store(dir.path);
+
+    const auto first = store.find("GET", "/0.txt");
+    for (size_t i = 1; i <= MockStore::kMaxCachedFiles; ++i) {
+        store.find("GET", numbered_path(i));
+    }
+    const auto last = store.find("GET", numbered_path(MockStore::kMaxCachedFiles));
+    CHECK(store.find("GET", numbered_path(MockStore::kMaxCachedFiles)) == last);
+    CHECK(store.find("GET", "/0.txt") != first);
+}
+
+}  // namespace
+
+int main() {
+    parses_byte_ranges();
+    refuses_paths_out_of_the_directory();
+    reload_drops_cached_files();
+#ifdef __linux__
+    closes_files_once_loaded();
+#endif
+    bounds_the_file_cache();
+    return notiman::test::exit_code();
+}
@@ -0,0 +1,84 @@
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "mpsc_queue.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::MpscQueue;
+
+void rounds_capacity_to_a_power_of_two() {
+    CHECK(MpscQueue<int>(0).capacity() == 2);
+    CHECK(MpscQueue<int>(5).capacity() == 8);
+    CHECK(MpscQueue<int>(64).capacity() == 64);
+}
+
+// Items come out in order, a full queue refuses more, and slots are reused once popped.
+void keeps_order_and_bounds() {
+    MpscQueue<int> queue(4);
+    int out = 0;
+    CHECK(!queue.try_pop(out));
+    for (int i = 0; i < 4; ++i) {
+        CHECK(queue.try_push(int(i)));
+    }
+    CHECK(!queue.try_push(4));
+
+    for (int round = 0; round < 10; ++round) {
+        CHECK(queue.try_pop(out) && out == round);
+        CHECK(queue.try_push(round + 4));
+    }
+}
+
+// Every item pushed by concurrent producers is popped exactly once, each producer's
+// items in the order it pushed them.
+void delivers_from_many_producers() {
+    constexpr int kProducers = 4;
+    constexpr int kPerProducer = 20000;
+    MpscQueue<int> queue(64);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&queue, p] {
+            for (int i = 0; i < kPerProducer; ++i) {
+                int value = p * kPerProducer + i;
+                while (!queue.try_push(std::move(value))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    std::vector<int> next(kProducers, 0);
+    bool in_order = true;
+    for (int received = 0; received < kProducers * kPerProducer;) {
+        int value = 0;
+        if (!queue.try_pop(value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        const int producer = value / kPerProducer;
+        in_order = in_order && value % kPerProducer == next[static_cast<size_t>(producer)];
+        ++next[static_cast<size_t>(producer)];
+        ++received;
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    CHECK(in_order);
+    for (const int count : next) {
+        CHECK(count == kPerProducer);
+    }
+    int extra = 0;
+    CHECK(!queue.try_pop(extra));
+}
+
+}  // namespace
+
+int main() {
+    rounds_capacity_to_a_power_of_two();
+    keeps_order_and_bounds();
+    delivers_from_many_producers();
+    return notiman::test::exit_code();
+}
@@ -0,0 +1,139 @@
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "notification_dispatcher.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::NotificationDispatcher;
+using notiman::NotificationIcon;
+using notiman::ProxyNotification;
+
+// Titles delivered by a dispatcher with a window long enough to cover the whole test.
+struct Delivered {
+    std::mutex mutex;
+    std::vector<std::string> titles;
+
+    NotificationDispatcher::Sink sink() {
+        return [this](const ProxyNotification& notification) {
+            std::lock_guard lock(mutex);
+            titles.push_back(notification.title);
+        };
+    }
+
+    bool contains_prefix(const std::string& prefix) {
+        std::lock_guard lock(mutex);
+        for (const std::string& delivered : titles) {
+            if (delivered.starts_with(prefix)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool contains(const std::string& title) {
+        std::lock_guard lock(mutex);
+        for (const std::string& delivered : titles) {
+            if (delivered == title) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+notiman::NotificationDispatcherOptions long_window() {
+    notiman::NotificationDispatcherOptions options;
+    options.coalesce_window = std::chrono::seconds(60);
+    return options;
+}
+
+// Two different notifications for one route and severity both reach the host.
+void keeps_different_notifications_apart() {
+    Delivered delivered;
+    NotificationDispatcher dispatcher(long_window(), delivered.sink());
+    dispatcher.post(ProxyNotification{NotificationIcon::Warning, "Target ejected", "a", "health", "api"});
+    dispatcher.post(ProxyNotification{NotificationIcon::Warning, "Route slower than usual", "b", "latency-anomaly", "api"});
+    dispatcher.stop();
+
+    CHECK(delivered.contains("Target ejected"));
+    CHECK(delivered.contains("Route slower than usual"));
+    CHECK(dispatcher.coalesced() == 0);
+}
+
+// Repeats of one notification inside the window are folded into a "(+N more)" summary.
+void merges_repeats() {
+    Delivered delivered;
+    NotificationDispatcher dispatcher(long_window(), delivered.sink());
+    for (int i = 0; i < 3; ++i) {
+        dispatcher.post(ProxyNotification{NotificationIcon::Warning, "Target ejected", "a", "health", "api"});
+    }
+    dispatcher.stop();
+
+    CHECK(delivered.contains("Target ejected"));
+    CHECK(delivered.contains("Target ejected (+1 more)"));
+    CHECK(dispatcher.coalesced() == 2);
+}
+
+// Notifications that opt out of coalescing, such as circuit breaker transitions, are
+// each delivered as they are.
+void delivers_uncoalesced_notifications_on_their_own() {
+    Delivered delivered;
+    NotificationDispatcher dispatcher(long_window(), delivered.sink());
+    for (int i = 0; i < 2; ++i) {
+        ProxyNotification notification{
+            NotificationIcon::Error, "Circuit open", "5 failures in a row", "circuit-breaker", "api"};
+        notification.coalesce = false;
+        dispatcher.post(std::move(notification));
+    }
+    dispatcher.stop();
+
+    CHECK(!delivered.contains("Circuit open (+1 more)"));
+    CHECK(dispatcher.delivered() == 2);
+    CHECK(dispatcher.coalesced() == 0);
+}
+
+// A per-request report for project with the given status, aggregated over a long window.
+ProxyNotification request_report(const std::string& project, int status) {
+    ProxyNotification notification{NotificationIcon::Info, "GET /users", std::to_string(status), "request", project};
+    notification.request = notiman::RequestOutcome{status, std::chrono::milliseconds(12), std::chrono::seconds(60)};
+    return notification;
+}
+
+// A project's per-request reports are rolled up into one summary, server errors are also
+// delivered on their own, and a lone request is reported as itself.
+void rolls_up_request_reports() {
+    Delivered delivered;
+    NotificationDispatcher dispatcher(long_window(), delivered.sink());
+    for (int i = 0; i < 3; ++i) {
+        dispatcher.post(request_report("api", 200));
+    }
+    dispatcher.post(request_report("api", 503));
+    dispatcher.post(request_report("web", 200));
+    dispatcher.stop();
+
+    CHECK(delivered.contains_prefix("4 req, 1 error, p95 "));
+    CHECK(dispatcher.aggregated() == 3);
+    // The 503 on its own, the api summary and web's single request.
+    CHECK(dispatcher.delivered() == 3);
+    std::lock_guard lock(delivered.mutex);
+    int lone = 0;
+    for (const std::string& title : delivered.titles) {
+        lone += title == "GET /users";
+    }
+    CHECK(lone == 2);
+}
+
+}  // namespace
+
+int main() {
+    keeps_different_notifications_apart();
+    merges_repeats();
+    delivers_uncoalesced_notifications_on_their_own();
+    rolls_up_request_reports();
+    return notiman::test::exit_code();
+}
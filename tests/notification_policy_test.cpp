@@ -0,0 +1,120 @@
+#include <chrono>
+#include <cstdint>
+
+#include "notification_policy.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::NotificationPolicy;
+using notiman::NotificationPolicyOptions;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+constexpr uint8_t k4xx = 1u << 3;
+constexpr uint8_t k5xx = 1u << 4;
+
+// Without filters every request is reported.
+void reports_everything_by_default() {
+    NotificationPolicy policy({});
+    CHECK(policy.evaluate(200, microseconds(10)).report);
+    CHECK(policy.evaluate(500, milliseconds(10)).report);
+    CHECK(!policy.evaluate(200, microseconds(10)).anomaly);
+}
+
+// A request is reported when any filter matches it.
+void reports_matching_requests() {
+    NotificationPolicyOptions options;
+    options.slow = milliseconds(100);
+    options.status_classes = k4xx | k5xx;
+    NotificationPolicy policy(options);
+    CHECK(!policy.evaluate(200, milliseconds(50)).report);
+    CHECK(!policy.evaluate(301, milliseconds(100)).report);
+    CHECK(policy.evaluate(200, milliseconds(101)).report);
+    CHECK(policy.evaluate(404, milliseconds(1)).report);
+    CHECK(policy.evaluate(503, milliseconds(1)).report);
+    // Out-of-range statuses count as the nearest class.
+    CHECK(policy.evaluate(999, milliseconds(1)).report);
+}
+
+void samples_one_in_n() {
+    NotificationPolicyOptions options;
+    options.sample = 4;
+    NotificationPolicy policy(options);
+    int reported = 0;
+    for (int i = 0; i < 100; ++i) {
+        reported += policy.evaluate(200, milliseconds(1)).report;
+    }
+    CHECK(reported == 25);
+}
+
+// Feeds count requests of the given latency and returns how many raised an anomaly.
+int feed(NotificationPolicy& policy, int count, microseconds elapsed, int status = 200) {
+    int anomalies = 0;
+    for (int i = 0; i < count; ++i) {
+        anomalies += policy.evaluate(status, elapsed).anomaly.has_value();
+    }
+    return anomalies;
+}
+
+// A sustained rise alerts once, and again only after latency has come back down.
+void alerts_on_latency_anomalies() {
+    NotificationPolicyOptions options;
+    options.anomaly_factor = 3;
+    NotificationPolicy policy(options);
+
+    CHECK(feed(policy, NotificationPolicy::kWarmup + 50, milliseconds(10)) == 0);
+    // A single outlier is smoothed away.
+    CHECK(feed(policy, 1, milliseconds(100)) == 0);
+    CHECK(feed(policy, 20, milliseconds(10)) == 0);
+
+    auto verdict = policy.evaluate(200, milliseconds(100));
+    for (int i = 0; i < 20 && !verdict.anomaly; ++i) {
+        verdict = policy.evaluate(200, milliseconds(100));
+    }
+    CHECK(verdict.anomaly.has_value());
+    CHECK(verdict.anomaly && verdict.anomaly->recent > verdict.anomaly->usual * 3);
+    CHECK(feed(policy, 20, milliseconds(100)) == 0);
+
+    CHECK(feed(policy, 40, milliseconds(10)) == 0);
+    CHECK(feed(policy, 40, milliseconds(100)) == 1);
+}
+
+// Errors are left out of the latency averages, and rises under kMinRise never alert.
+void ignores_errors_and_small_rises() {
+    NotificationPolicyOptions options;
+    options.anomaly_factor = 2;
+    NotificationPolicy policy(options);
+    CHECK(feed(policy, NotificationPolicy::kWarmup + 50, microseconds(100)) == 0);
+    CHECK(feed(policy, 50, milliseconds(500), 503) == 0);
+    CHECK(feed(policy, 50, milliseconds(1)) == 0);
+    CHECK(feed(policy, 50, milliseconds(50)) == 1);
+}
+
+// Latency is tracked even when the request itself is filtered out.
+void tracks_latency_of_unreported_requests() {
+    NotificationPolicyOptions options;
+    options.anomaly_factor = 2;
+    options.status_classes = k5xx;
+    NotificationPolicy policy(options);
+    CHECK(feed(policy, NotificationPolicy::kWarmup + 50, milliseconds(10)) == 0);
+    int anomalies = 0;
+    for (int i = 0; i < 50; ++i) {
+        const auto verdict = policy.evaluate(200, milliseconds(100));
+        CHECK(!verdict.report);
+        anomalies += verdict.anomaly.has_value();
+    }
+    CHECK(anomalies == 1);
+}
+
+}  // namespace
+
+int main() {
+    reports_everything_by_default();
+    reports_matching_requests();
+    samples_one_in_n();
+    alerts_on_latency_anomalies();
+    ignores_errors_and_small_rises();
+    tracks_latency_of_unreported_requests();
+    return notiman::test::exit_code();
+}
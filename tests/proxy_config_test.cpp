@@ -0,0 +1,70 @@
+#include <string>
+#include <vector>
+
+#include "proxy_config.h"
+#include "test_support.h"
+
+namespace {
+
+// A route with fault delays, one with a queued concurrency limit and one with neither.
+notiman::ProxyConfig config_with_blocking_options(const std::string& engine) {
+    notiman::ProxyConfig config;
+    config.engine = engine;
+    notiman::ProxyRoute slow;
+    slow.name = "slow";
+    slow.fault_delay_ms = 200;
+    slow.fault_error_percent = 10;
+    config.routes.push_back(slow);
+    notiman::ProxyRoute limited;
+    limited.name = "limited";
+    limited.concurrency_limit = true;
+    limited.queue_size = 20;
+    config.routes.push_back(limited);
+    notiman::ProxyRoute plain;
+    plain.name = "plain";
+    config.routes.push_back(plain);
+    return config;
+}
+
+bool mentions(const std::vector<notiman::ConfigWarning>& warnings, const std::string& title, const std::string& route) {
+    for (const auto& warning : warnings) {
+        if (warning.title == title && warning.body.find(route) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The httplib engine loses what would hold a worker thread, but keeps the faults it can
+// answer at once and the limit itself.
+void disables_blocking_options_for_httplib() {
+    notiman::ProxyConfig config = config_with_blocking_options("httplib");
+    const auto warnings = config.disable_blocking_options();
+    CHECK(warnings.size() == 2);
+    CHECK(mentions(warnings, "Fault delays disabled", "slow"));
+    CHECK(mentions(warnings, "Concurrency queue disabled", "limited"));
+    CHECK(config.routes[0].fault_delay_ms == 0);
+    CHECK(config.routes[0].fault_error_percent == 10);
+    CHECK(config.routes[1].concurrency_limit);
+    CHECK(config.routes[1].queue_size == 0);
+    CHECK(config.routes[2].queue_size == notiman::ProxyRoute{}.queue_size);
+}
+
+void keeps_blocking_options_for_epoll() {
+    notiman::ProxyConfig config = config_with_blocking_options("epoll");
+#ifdef __linux__
+    CHECK(config.disable_blocking_options().empty());
+    CHECK(config.routes[0].fault_delay_ms == 200);
+    CHECK(config.routes[1].queue_size == 20);
+#else
+    CHECK(config.disable_blocking_options().size() == 2);
+#endif
+}
+
+}  // namespace
+
+int main() {
+    disables_blocking_options_for_httplib();
+    keeps_blocking_options_for_epoll();
+    return notiman::test::exit_code();
+}
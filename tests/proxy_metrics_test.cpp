@@ -0,0 +1,150 @@
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+
+#include "proxy_metrics.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::LatencyHistogram;
+using notiman::ProxyMetrics;
+using notiman::RequestSample;
+using std::chrono::microseconds;
+
+std::string normalized(std::string_view path) {
+    std::string out;
+    notiman::normalize_path_template(path, out);
+    return out;
+}
+
+RequestSample sample(std::string_view route, std::string_view path, int status, microseconds total) {
+    RequestSample result;
+    result.route = route;
+    result.path = path;
+    result.status = status;
+    result.total = total;
+    return result;
+}
+
+// Every bucket holds values within 1/16 of its upper bound, and buckets never overlap.
+void buckets_latencies() {
+    for (uint64_t micros = 0; micros < 100000; micros += 7) {
+        const size_t index = LatencyHistogram::bucket_index(micros);
+        const uint64_t upper = LatencyHistogram::bucket_upper_bound(index);
+        CHECK(micros <= upper);
+        CHECK(upper - micros <= upper / LatencyHistogram::kSubBuckets);
+        CHECK(index == 0 || micros > LatencyHistogram::bucket_upper_bound(index - 1));
+    }
+    CHECK(LatencyHistogram::bucket_index(UINT64_MAX) == LatencyHistogram::kBucketCount - 1);
+}
+
+void computes_percentiles() {
+    LatencyHistogram histogram;
+    CHECK(histogram.percentile_us(0.5) == 0);
+    for (uint64_t micros = 1; micros <= 1000; ++micros) {
+        histogram.record(micros);
+    }
+    const uint64_t p50 = histogram.percentile_us(0.5);
+    CHECK(p50 >= 500 && p50 <= 500 + 500 / 16);
+    CHECK(histogram.percentile_us(1.0) == 1000);
+    CHECK(histogram.count_at_or_below(15) == 15);
+    CHECK(histogram.max_us == 1000 && histogram.sum_us == 500500);
+
+    LatencyHistogram other;
+    other.record(5000);
+    histogram.merge(other);
+    CHECK(histogram.count == 1001 && histogram.max_us == 5000);
+}
+
+void normalizes_path_templates() {
+    CHECK(normalized("/users/42") == "/users/:id");
+    CHECK(normalized("/users/42/orders/7") == "/users/:id/orders/:id");
+    CHECK(normalized("/items/123e4567-e89b-12d3-a456-426614174000") == "/items/:uuid");
+    CHECK(normalized("/blobs/0123456789abcdef0") == "/blobs/:hash");
+    CHECK(normalized("/words/deadbeefdeadbeef") == "/words/deadbeefdeadbeef");
+    CHECK(normalized("/") == "/");
+    CHECK(normalized("/a/") == "/a/");
+}
+
+// Samples recorded on several threads merge into one series per route and template.
+void merges_shards() {
+    ProxyMetrics metrics;
+    std::thread other([&metrics] {
+        metrics.record(sample("api", "/users/1", 200, microseconds(100)));
+        metrics.record_connection(0);
+    });
+    other.join();
+    metrics.record(sample("api", "/users/2", 404, microseconds(300)));
+    metrics.record(sample("", "/whatever", 502, microseconds(10)));
+    metrics.record_connection(0);
+
+    const auto snapshot = metrics.snapshot();
+    CHECK(snapshot.paths.size() == 2);
+    CHECK(snapshot.listener_connections.size() == 1 && snapshot.listener_connections[0] == 2);
+    if (snapshot.paths.size() != 2) {
+        return;
+    }
+    CHECK(snapshot.paths[0].route == "-" && snapshot.paths[0].path == "/*");
+    const auto& users = snapshot.paths[1];
+    CHECK(users.route == "api" && users.path == "/users/:id");
+    CHECK(users.total.count == 2 && users.status_classes[1] == 1 && users.status_classes[3] == 1);
+}
+
+// Past kMaxTemplatesPerRoute distinct templates a route's paths share one series.
+void caps_templates_per_route() {
+    ProxyMetrics metrics;
+    for (size_t i = 0; i < ProxyMetrics::kMaxTemplatesPerRoute + 10; ++i) {
+        std::string path = "/page";
+        path += static_cast<char>('a' + i % 26);
+        path += std::to_string(i / 26);
+        path += 'x';
+        metrics.record(sample("web", path, 200, microseconds(1)));
+    }
+    const auto snapshot = metrics.snapshot();
+    CHECK(snapshot.paths.size() == ProxyMetrics::kMaxTemplatesPerRoute + 1);
+    bool found_other = false;
+    for (const auto& path : snapshot.paths) {
+        if (path.path == "/:other") {
+            found_other = true;
+            CHECK(path.total.count == 10);
+        }
+    }
+    CHECK(found_other);
+}
+
+void formats_both_outputs() {
+    ProxyMetrics metrics;
+    metrics.record(sample("api", "/users/1", 200, microseconds(2000)));
+    const auto snapshot = metrics.snapshot();
+
+    const std::string text = notiman::format_prometheus(snapshot);
+    CHECK(text.find("notiman_proxy_requests_total{route=\"api\",path=\"/users/:id\",code=\"2xx\"} 1\n") !=
+          std::string::npos);
+    CHECK(text.find("notiman_proxy_request_duration_seconds_bucket{route=\"api\",path=\"/users/:id\",le=\"0.0025\"} 1\n") !=
+          std::string::npos);
+
+    const auto json = nlohmann::json::parse(notiman::format_json(snapshot));
+    CHECK(json["routes"].size() == 1);
+    CHECK(json["routes"][0]["route"] == "api" && json["routes"][0]["requests"] == 1);
+    CHECK(json["routes"][0]["paths"][0]["path"] == "/users/:id");
+
+    CHECK(notiman::metrics_wants_json("format=json", ""));
+    CHECK(notiman::metrics_wants_json("", "application/json, text/plain"));
+    CHECK(!notiman::metrics_wants_json("", "text/plain"));
+}
+
+}  // namespace
+
+int main() {
+    buckets_latencies();
+    computes_percentiles();
+    normalizes_path_templates();
+    merges_shards();
+    caps_templates_per_route();
+    formats_both_outputs();
+    return notiman::test::exit_code();
+}
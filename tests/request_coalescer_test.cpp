@@ -0,0 +1,100 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "proxy_config.h"
+#include "request_coalescer.h"
+#include "test_support.h"
+
+namespace {
+
+using Coalescer = notiman::RequestCoalescer<std::string>;
+
+// Long enough for the waiter threads to have joined the flight before it lands.
+constexpr auto kJoinGrace = std::chrono::milliseconds(100);
+
+// Starts count requests for key on their own threads; each stores what it got.
+std::vector<std::thread> join_from_threads(Coalescer& coalescer,
+                                           const std::string& key,
+                                           std::vector<std::shared_ptr<const std::string>>& results) {
+    std::vector<std::thread> threads;
+    for (auto& result : results) {
+        threads.emplace_back([&coalescer, &key, &result] { result = coalescer.join(key).second; });
+    }
+    return threads;
+}
+
+// Requests joining a flight get the leader's response instead of going upstream.
+void shares_the_leaders_response() {
+    Coalescer coalescer;
+    auto [lead, none] = coalescer.join("GET /config");
+    CHECK(none == nullptr);
+
+    std::vector<std::shared_ptr<const std::string>> results(4);
+    auto threads = join_from_threads(coalescer, "GET /config", results);
+    std::this_thread::sleep_for(kJoinGrace);
+    lead.publish(std::make_shared<const std::string>("shared"));
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (const auto& result : results) {
+        CHECK(result && *result == "shared");
+    }
+
+    // The flight is over; the next request leads a new one.
+    CHECK(coalescer.join("GET /config").second == nullptr);
+}
+
+// A leader that gives up without a response releases its waiters empty-handed, so they
+// go upstream themselves.
+void releases_waiters_when_the_leader_fails() {
+    Coalescer coalescer;
+    std::vector<std::shared_ptr<const std::string>> results(3);
+    std::vector<std::thread> threads;
+    {
+        auto lead = coalescer.join("GET /flags").first;
+        threads = join_from_threads(coalescer, "GET /flags", results);
+        std::this_thread::sleep_for(kJoinGrace);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (const auto& result : results) {
+        CHECK(result == nullptr);
+    }
+}
+
+// The key tells apart routes, methods, targets and the route's coalesce_headers, and
+// nothing else.
+void keys_on_route_method_target_and_headers() {
+    notiman::ProxyRoute route;
+    route.name = "api";
+    route.coalesce_headers = {"Authorization"};
+    const auto header_of = [](std::string value) {
+        return [value](const std::string& name) { return name == "Authorization" ? value : "ignored-" + name; };
+    };
+
+    const std::string alice = notiman::coalescing_key(route, "GET", "/me", header_of("alice"));
+    CHECK(alice == notiman::coalescing_key(route, "GET", "/me", header_of("alice")));
+    CHECK(alice != notiman::coalescing_key(route, "GET", "/me", header_of("bob")));
+    CHECK(alice != notiman::coalescing_key(route, "HEAD", "/me", header_of("alice")));
+    CHECK(alice != notiman::coalescing_key(route, "GET", "/me?x=1", header_of("alice")));
+
+    notiman::ProxyRoute other = route;
+    other.name = "web";
+    CHECK(alice != notiman::coalescing_key(other, "GET", "/me", header_of("alice")));
+
+    CHECK(notiman::is_coalescable_method("GET") && notiman::is_coalescable_method("HEAD"));
+    CHECK(!notiman::is_coalescable_method("POST"));
+}
+
+}  // namespace
+
+int main() {
+    shares_the_leaders_response();
+    releases_waiters_when_the_leader_fails();
+    keys_on_route_method_target_and_headers();
+    return notiman::test::exit_code();
+}
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "response_cache.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::CacheHeaders;
+using notiman::CacheRequest;
+using notiman::CachedResponse;
+using notiman::ResponseCache;
+using Clock = std::chrono::steady_clock;
+using std::chrono::seconds;
+
+bool same_name(std::string_view a, std::string_view b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+// Header lookup over fixed fields, matching names without regard to case as HTTP does.
+notiman::CacheHeaderLookup lookup(CacheHeaders headers) {
+    return [headers = std::move(headers)](std::string_view name) -> std::string_view {
+        for (const auto& [key, value] : headers) {
+            if (same_name(key, name)) {
+                return value;
+            }
+        }
+        return {};
+    };
+}
+
+// A stored GET response with the given response headers, or null when it may not be stored.
+std::shared_ptr<CachedResponse> entry_for(CacheHeaders request_headers, CacheHeaders response_headers, int status = 200) {
+    const auto request_header = lookup(std::move(request_headers));
+    const CacheRequest request = notiman::cache_request("GET", request_header);
+    return notiman::make_cache_entry(request, request_header, status, "OK", std::move(response_headers), Clock::now());
+}
+
+void parses_cache_control() {
+    const auto control = notiman::parse_cache_control("public, Max-Age=60 , s-maxage=\"120\", must-revalidate");
+    CHECK(control.is_public && control.must_revalidate);
+    CHECK(control.max_age == 60 && control.s_maxage == 120);
+    CHECK(!notiman::parse_cache_control("max-age=-1").max_age);
+    CHECK(notiman::parse_cache_control("no-store").no_store);
+}
+
+// Only plain GETs and HEADs use the cache; no-cache and max-age=0 make them revalidate.
+void reads_requests() {
+    CHECK(notiman::cache_request("GET", lookup({})).usable);
+    CHECK(notiman::cache_request("HEAD", lookup({})).usable);
+    CHECK(!notiman::cache_request("POST", lookup({})).usable);
+    CHECK(!notiman::cache_request("GET", lookup({{"Range", "bytes=0-1"}})).usable);
+    CHECK(!notiman::cache_request("GET", lookup({{"Cache-Control", "no-store"}})).usable);
+    CHECK(notiman::cache_request("GET", lookup({{"Cache-Control", "no-cache"}})).revalidate);
+    CHECK(notiman::cache_request("GET", lookup({{"Cache-Control", "max-age=0"}})).revalidate);
+    CHECK(notiman::cache_request("GET", lookup({{"Pragma", "no-cache"}})).revalidate);
+    CHECK(notiman::cache_request("GET", lookup({{"Authorization", "Bearer x"}})).authorized);
+}
+
+// Responses a shared cache must not keep are never stored.
+void refuses_what_a_shared_cache_must_not_store() {
+    CHECK(entry_for({}, {{"Cache-Control", "max-age=60"}}) != nullptr);
+    CHECK(entry_for({}, {{"ETag", "\"v1\""}}) != nullptr);
+    CHECK(entry_for({}, {}) == nullptr);
+    CHECK(entry_for({}, {{"Cache-Control", "private, max-age=60"}}) == nullptr);
+    CHECK(entry_for({}, {{"Cache-Control", "no-store"}}) == nullptr);
+    CHECK(entry_for({}, {{"Cache-Control", "max-age=60"}, {"Set-Cookie", "id=1"}}) == nullptr);
+    CHECK(entry_for({}, {{"Cache-Control", "max-age=60"}, {"Vary", "*"}}) == nullptr);
+    CHECK(entry_for({}, {{"Cache-Control", "max-age=60"}}, 500) == nullptr);
+
+    const CacheHeaders authorized = {{"Authorization", "Bearer x"}};
+    CHECK(entry_for(authorized, {{"Cache-Control", "max-age=60"}}) == nullptr);
+    CHECK(entry_for(authorized, {{"Cache-Control", "public, max-age=60"}}) != nullptr);
+    CHECK(entry_for(authorized, {{"Cache-Control", "s-maxage=60"}}) != nullptr);
+}
+
+// Freshness counts the Age the upstream reported, and a client's max-age can cut it short.
+void judges_freshness() {
+    auto entry = entry_for({}, {{"Cache-Control", "max-age=60"}, {"Age", "50"}});
+    CHECK(entry && entry->initial_age == seconds(50) && entry->fresh_for == seconds(60));
+    const auto request = notiman::cache_request("GET", lookup({}));
+    CHECK(notiman::is_fresh(*entry, request, entry->stored_at + seconds(9)));
+    CHECK(!notiman::is_fresh(*entry, request, entry->stored_at + seconds(10)));
+
+    const auto strict = notiman::cache_request("GET", lookup({{"Cache-Control", "max-age=30"}}));
+    CHECK(!notiman::is_fresh(*entry, strict, entry->stored_at));
+
+    // s-maxage is the shared cache's own lifetime.
+    const auto shared = entry_for({}, {{"Cache-Control", "max-age=1, s-maxage=100"}});
+    CHECK(shared && shared->fresh_for == seconds(100));
+}
+
+// A 304 answering a revalidation refreshes the stored headers and restarts the clock.
+void refreshes_from_not_modified() {
+    auto stale = entry_for({}, {{"Cache-Control", "max-age=10"}, {"ETag", "\"v1\""}, {"X-Version", "1"}});
+    CHECK(stale != nullptr);
+    stale->body = "payload";
+    const auto later = stale->stored_at + seconds(100);
+    const auto fresh = notiman::refresh_cache_entry(*stale, {{"Cache-Control", "max-age=300"}, {"X-Version", "2"}}, later);
+    CHECK(fresh->body == "payload");
+    CHECK(fresh->etag == "\"v1\"");
+    CHECK(fresh->fresh_for == seconds(300));
+    CHECK(notiman::is_fresh(*fresh, notiman::cache_request("GET", lookup({})), later + seconds(1)));
+    int versions = 0;
+    for (const auto& [name, value] : fresh->headers) {
+        if (name == "X-Version") {
+            ++versions;
+            CHECK(value == "2");
+        }
+    }
+    CHECK(versions == 1);
+}
+
+void matches_etags_weakly() {
+    CHECK(notiman::matches_if_none_match("\"v1\"", "\"v1\""));
+    CHECK(notiman::matches_if_none_match("W/\"v1\"", "\"v1\""));
+    CHECK(notiman::matches_if_none_match("\"v0\", \"v1\"", "W/\"v1\""));
+    CHECK(notiman::matches_if_none_match("*", "\"v1\""));
+    CHECK(!notiman::matches_if_none_match("\"v2\"", "\"v1\""));
+    CHECK(!notiman::matches_if_none_match("", "\"v1\""));
+}
+
+// Each key keeps its variants apart by the request headers the response listed in Vary.
+void keeps_variants_apart() {
+    ResponseCache cache(1024 * 1024);
+    const CacheHeaders vary = {{"Cache-Control", "max-age=60"}, {"Vary", "Accept-Language"}};
+    auto english = entry_for({{"Accept-Language", "en"}}, vary);
+    english->body = "hello";
+    auto french = entry_for({{"Accept-Language", "fr"}}, vary);
+    french->body = "bonjour";
+    CHECK(cache.store("/greeting", english));
+    CHECK(cache.store("/greeting", french));
+
+    const auto en = cache.find("/greeting", lookup({{"Accept-Language", "en"}}));
+    const auto fr = cache.find("/greeting", lookup({{"Accept-Language", "fr"}}));
+    CHECK(en && en->body == "hello");
+    CHECK(fr && fr->body == "bonjour");
+    CHECK(cache.find("/greeting", lookup({{"Accept-Language", "de"}})) == nullptr);
+    CHECK(cache.find("/other", lookup({})) == nullptr);
+}
+
+// Entries too large for a shard are refused, and a full shard drops its least recently
+// used keys first.
+void evicts_least_recently_used() {
+    ResponseCache cache(ResponseCache::kShards * 4096);
+    auto big = entry_for({}, {{"Cache-Control", "max-age=60"}});
+    big->body.assign(cache.max_entry_bytes(), 'x');
+    CHECK(!cache.store("/big", big));
+
+    // Enough keys to overfill every shard several times over.
+    for (int i = 0; i < 200; ++i) {
+        auto entry = entry_for({}, {{"Cache-Control", "max-age=60"}});
+        entry->body.assign(512, 'x');
+        CHECK(cache.store("/item/" + std::to_string(i), entry));
+        CHECK(cache.find("/item/0", lookup({})) != nullptr);  // kept in use
+    }
+    CHECK(cache.bytes() <= cache.max_bytes());
+    CHECK(cache.find("/item/1", lookup({})) == nullptr);
+    CHECK(cache.find("/item/199", lookup({})) != nullptr);
+}
+
+}  // namespace
+
+int main() {
+    parses_cache_control();
+    reads_requests();
+    refuses_what_a_shared_cache_must_not_store();
+    judges_freshness();
+    refreshes_from_not_modified();
+    matches_etags_weakly();
+    keeps_variants_apart();
+    evicts_least_recently_used();
+    return notiman::test::exit_code();
+}
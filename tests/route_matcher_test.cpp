@@ -0,0 +1,104 @@
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "route_matcher.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::RouteMatcher;
+
+bool add(RouteMatcher& matcher, std::string_view name, size_t route) {
+    const auto pattern = notiman::parse_route_pattern(name);
+    return pattern && matcher.add(*pattern, route);
+}
+
+bool routes_to(const RouteMatcher& matcher, std::string_view host, std::string_view path, size_t route) {
+    return matcher.match(host, path) == std::optional<size_t>(route);
+}
+
+void parses_route_names() {
+    const auto pattern = notiman::parse_route_pattern("shop/api/users/**");
+    CHECK(pattern && pattern->host_labels.size() == 1 && pattern->host_labels[0] == "shop");
+    CHECK(pattern && pattern->path_prefix == "/api/users");
+    const auto nested = notiman::parse_route_pattern("**.eu.shop/");
+    CHECK(nested && nested->host_labels.size() == 3 && nested->path_prefix.empty());
+
+    CHECK(!notiman::parse_route_pattern(""));
+    CHECK(!notiman::parse_route_pattern("shop..api"));
+    CHECK(!notiman::parse_route_pattern("sh*p"));
+    CHECK(!notiman::parse_route_pattern("eu.**"));
+    CHECK(!notiman::parse_route_pattern("shop/api/*/users"));
+}
+
+// Hosts are matched without regard to case or port, and only under .localhost.
+void matches_hosts() {
+    RouteMatcher matcher;
+    CHECK(add(matcher, "api", 0));
+    CHECK(add(matcher, "eu.api", 1));
+    CHECK(routes_to(matcher, "api.localhost", "/", 0));
+    CHECK(routes_to(matcher, "API.Localhost:8080", "/users", 0));
+    CHECK(routes_to(matcher, "eu.api.localhost", "/", 1));
+    CHECK(!matcher.match("us.api.localhost", "/"));
+    CHECK(!matcher.match("api.example.com", "/"));
+    CHECK(!matcher.match("localhost", "/"));
+}
+
+// Exact labels beat "*", which beats "**", compared from the right.
+void prefers_the_most_specific_host() {
+    RouteMatcher matcher;
+    CHECK(add(matcher, "**.shop", 0));
+    CHECK(add(matcher, "*.shop", 1));
+    CHECK(add(matcher, "eu.shop", 2));
+    CHECK(routes_to(matcher, "eu.shop.localhost", "/", 2));
+    CHECK(routes_to(matcher, "us.shop.localhost", "/", 1));
+    CHECK(routes_to(matcher, "a.b.shop.localhost", "/", 0));
+    CHECK(!matcher.match("shop.localhost", "/"));
+}
+
+// The longest prefix wins, and only on whole path segments.
+void matches_path_prefixes() {
+    RouteMatcher matcher;
+    CHECK(add(matcher, "app", 0));
+    CHECK(add(matcher, "app/api", 1));
+    CHECK(add(matcher, "app/api/users/**", 2));
+    CHECK(routes_to(matcher, "app.localhost", "/", 0));
+    CHECK(routes_to(matcher, "app.localhost", "/api", 1));
+    CHECK(routes_to(matcher, "app.localhost", "/api/orders", 1));
+    CHECK(routes_to(matcher, "app.localhost", "/api/users", 2));
+    CHECK(routes_to(matcher, "app.localhost", "/api/users/7", 2));
+    CHECK(routes_to(matcher, "app.localhost", "/api/usersettings", 1));
+    CHECK(routes_to(matcher, "app.localhost", "/apiary", 0));
+}
+
+// A host with a matching pattern but no matching prefix falls back to a less specific host.
+void falls_back_to_a_wider_host() {
+    RouteMatcher matcher;
+    CHECK(add(matcher, "*.shop", 0));
+    CHECK(add(matcher, "eu.shop/admin", 1));
+    CHECK(routes_to(matcher, "eu.shop.localhost", "/admin/users", 1));
+    CHECK(routes_to(matcher, "eu.shop.localhost", "/cart", 0));
+}
+
+// Equal patterns are refused, spelled differently or not.
+void refuses_duplicates() {
+    RouteMatcher matcher;
+    CHECK(add(matcher, "app/api", 0));
+    CHECK(!add(matcher, "app/api/", 1));
+    CHECK(!add(matcher, "app/api/**", 2));
+    CHECK(routes_to(matcher, "app.localhost", "/api", 0));
+}
+
+}  // namespace
+
+int main() {
+    parses_route_names();
+    matches_hosts();
+    prefers_the_most_specific_host();
+    matches_path_prefixes();
+    falls_back_to_a_wider_host();
+    refuses_duplicates();
+    return notiman::test::exit_code();
+}
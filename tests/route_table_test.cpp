@@ -0,0 +1,127 @@
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "proxy_config.h"
+#include "route_table.h"
+#include "test_support.h"
+
+namespace {
+
+using notiman::ProxyConfig;
+using notiman::ProxyRoute;
+using notiman::RouteTable;
+
+ProxyRoute& add_route(ProxyConfig& config, const std::string& name, const std::string& target_url) {
+    ProxyRoute route;
+    route.name = name;
+    route.target_base_urls.push_back(target_url);
+    config.routes.push_back(std::move(route));
+    return config.routes.back();
+}
+
+// Routes are found by Host and path or by name; broken routes and duplicate patterns
+// are left out, the first of two equal patterns winning.
+void finds_routes() {
+    ProxyConfig config;
+    add_route(config, "api", "http://127.0.0.1:9001");
+    add_route(config, "api/v2", "http://127.0.0.1:9002");
+    add_route(config, "bad..name", "http://127.0.0.1:9003");
+    add_route(config, "api/v2/", "http://127.0.0.1:9004");
+    add_route(config, "broken", "ftp://127.0.0.1");
+    const auto table = RouteTable::build(config, nullptr);
+
+    CHECK(table->routes().size() == 3);
+    const auto* api = table->find("api.localhost:8080", "/users");
+    CHECK(api != nullptr && api->route.name == "api");
+    const auto* v2 = table->find("api.localhost", "/v2/users");
+    CHECK(v2 != nullptr && v2->route.target_base_urls[0] == "http://127.0.0.1:9002");
+    CHECK(table->find("web.localhost", "/") == nullptr);
+    CHECK(table->find_by_name("api") == api);
+    CHECK(table->find_by_name("bad..name") == nullptr);
+
+    // A route whose target does not parse is still found, with nothing to balance over.
+    const auto* broken = table->find_by_name("broken");
+    CHECK(broken != nullptr && broken->balancer.empty());
+}
+
+// Optional per-route state exists only when the route asks for it.
+void compiles_route_options() {
+    ProxyConfig config;
+    ProxyRoute& plain = add_route(config, "plain", "http://127.0.0.1:9001");
+    plain.breaker = false;
+    ProxyRoute& full = add_route(config, "full", "http://127.0.0.1:9002");
+    full.cache = true;
+    full.concurrency_limit = true;
+    full.hedge = true;
+    full.notify_slow_ms = 100;
+    full.fault_error_percent = 5;
+    const auto table = RouteTable::build(config, nullptr);
+
+    const auto* bare = table->find_by_name("plain");
+    CHECK(bare != nullptr && !bare->cache && !bare->breaker && !bare->limiter && !bare->hedge);
+    CHECK(bare != nullptr && !bare->notify_policy && !bare->faults.active());
+    const auto* rich = table->find_by_name("full");
+    CHECK(rich != nullptr && rich->cache && rich->breaker && rich->limiter && rich->hedge);
+    CHECK(rich != nullptr && rich->notify_policy && rich->faults.error_percent == 5);
+}
+
+// A reload keeps what did not change, with its state, and rebuilds what did.
+void carries_state_across_reloads() {
+    ProxyConfig config;
+    ProxyRoute& api = add_route(config, "api", "http://127.0.0.1:9001");
+    api.cache = true;
+    api.hedge = true;
+    add_route(config, "web", "http://127.0.0.1:9002");
+    const auto first = RouteTable::build(config, nullptr);
+
+    config.routes[0].hedge_min_ms = 50;
+    config.routes[1].target_base_urls = {"http://127.0.0.1:9003"};
+    const auto second = RouteTable::build(config, first.get());
+
+    const auto* old_api = first->find_by_name("api");
+    const auto* new_api = second->find_by_name("api");
+    CHECK(new_api->balancer.targets()[0] == old_api->balancer.targets()[0]);
+    CHECK(new_api->breaker == old_api->breaker);
+    CHECK(new_api->hedge != old_api->hedge);
+    // Any change to the route drops its cache, which may hold what the old settings allowed.
+    CHECK(new_api->cache != old_api->cache);
+
+    CHECK(second->find_by_name("web")->balancer.targets()[0] != first->find_by_name("web")->balancer.targets()[0]);
+
+    const auto third = RouteTable::build(config, second.get());
+    CHECK(third->find_by_name("api")->cache == new_api->cache);
+    CHECK(third->find_by_name("api")->hedge == new_api->hedge);
+}
+
+// Each thread sees a newly published table on its next lookup, while an older
+// snapshot it holds stays usable.
+void publishes_snapshots() {
+    ProxyConfig config;
+    add_route(config, "api", "http://127.0.0.1:9001");
+    notiman::RouteTablePublisher publisher;
+    publisher.publish(RouteTable::build(config, nullptr));
+    const auto held = publisher.snapshot();
+    CHECK(publisher.current().find_by_name("api") != nullptr);
+
+    add_route(config, "web", "http://127.0.0.1:9002");
+    publisher.publish(RouteTable::build(config, held.get()));
+    CHECK(publisher.current().find_by_name("web") != nullptr);
+    CHECK(held->find_by_name("web") == nullptr && held->find_by_name("api") != nullptr);
+
+    bool other_thread_sees_web = false;
+    std::thread([&publisher, &other_thread_sees_web] {
+        other_thread_sees_web = publisher.current().find_by_name("web") != nullptr;
+    }).join();
+    CHECK(other_thread_sees_web);
+}
+
+}  // namespace
+
+int main() {
+    finds_routes();
+    compiles_route_options();
+    carries_state_across_reloads();
+    publishes_snapshots();
+    return notiman::test::exit_code();
+}
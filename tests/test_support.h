@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdio>
+
+namespace notiman::test {
+
+// Failed checks so far; each test executable returns exit_code() from main.
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline void check(bool condition, const char* expression, const char* file, int line) {
+    if (!condition) {
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+        ++failures();
+    }
+}
+
+inline int exit_code() {
+    return failures() == 0 ? 0 : 1;
+}
+
+}  // namespace notiman::test
+
+#define CHECK(condition) ::notiman::test::check((condition), #condition, __FILE__, __LINE__)
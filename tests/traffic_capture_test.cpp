@@ -0,0 +1,132 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "test_support.h"
+#include "traffic_capture.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+using notiman::CapturedExchange;
+using notiman::CaptureRecordView;
+using notiman::TrafficCapture;
+
+// A capture file path in a fresh directory, removed again at the end of the test.
+struct CaptureFile {
+    fs::path directory;
+    fs::path path;
+
+    explicit CaptureFile(const std::string& name)
+        : directory(fs::temp_directory_path() / name), path(directory / "traffic.ntcap") {
+        fs::remove_all(directory);
+        fs::create_directories(directory);
+    }
+    ~CaptureFile() {
+        std::error_code error;
+        fs::remove_all(directory, error);
+    }
+
+    std::string contents() const {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+};
+
+CapturedExchange exchange(const std::string& target, int status) {
+    CapturedExchange result;
+    result.started_at = std::chrono::system_clock::now();
+    result.duration = std::chrono::microseconds(1500);
+    result.status = status;
+    result.method = "POST";
+    result.route = "api";
+    result.host = "api.localhost";
+    result.target = target;
+    result.headers = "Content-Type: text/plain\r\n";
+    result.request_body = "ping";
+    result.request_body_bytes = 4;
+    result.response_body = "pon";
+    result.response_body_bytes = 10;  // kept only in part
+    return result;
+}
+
+std::vector<CaptureRecordView> records_of(const std::string& file, bool& valid) {
+    std::vector<CaptureRecordView> records;
+    valid = notiman::read_capture(file, [&records](const CaptureRecordView& record) { records.push_back(record); });
+    return records;
+}
+
+// Exchanges come back from the file in order with every field, and a later capture
+// appends to the same file.
+void writes_and_reads_records() {
+    CaptureFile file("notiman-capture-test-roundtrip");
+    {
+        TrafficCapture capture({file.path, 4, 16});
+        CHECK(capture.ok());
+        CHECK(capture.record(exchange("/first?x=1", 201)));
+        CHECK(capture.record(exchange("/second", 404)));
+        capture.stop();
+        CHECK(capture.written() == 2 && capture.dropped() == 0);
+    }
+    {
+        TrafficCapture capture({file.path, 4, 16});
+        CHECK(capture.record(exchange("/third", 200)));
+    }
+
+    const std::string contents = file.contents();
+    bool valid = false;
+    const auto records = records_of(contents, valid);
+    CHECK(valid);
+    CHECK(records.size() == 3);
+    if (records.size() != 3) {
+        return;
+    }
+    const auto& first = records[0];
+    CHECK(first.header.status == 201 && first.header.duration_us == 1500);
+    CHECK(first.method == "POST" && first.route == "api" && first.host == "api.localhost");
+    CHECK(first.target == "/first?x=1" && first.headers == "Content-Type: text/plain\r\n");
+    CHECK(first.request_body == "ping" && first.response_body == "pon");
+    CHECK(first.header.response_body_bytes == 10);
+    CHECK((first.header.flags & notiman::kCaptureResponseBodyTruncated) != 0);
+    CHECK((first.header.flags & notiman::kCaptureRequestBodyTruncated) == 0);
+    CHECK(records[1].target == "/second" && records[2].target == "/third");
+    CHECK(first.header.record_bytes % 8 == 0);
+}
+
+// A record cut short by a crash is left out; a file from elsewhere is refused and never
+// appended to.
+void tolerates_torn_and_foreign_files() {
+    CaptureFile file("notiman-capture-test-torn");
+    {
+        TrafficCapture capture({file.path, 0, 16});
+        CHECK(capture.record(exchange("/whole", 200)));
+        CHECK(capture.record(exchange("/torn", 200)));
+    }
+    std::string contents = file.contents();
+    contents.resize(contents.size() - 5);
+    bool valid = false;
+    const auto records = records_of(contents, valid);
+    CHECK(valid && records.size() == 1);
+    CHECK(!records.empty() && records[0].target == "/whole");
+
+    CHECK(!notiman::read_capture("not a capture file", [](const CaptureRecordView&) {}));
+
+    std::ofstream(file.path, std::ios::binary | std::ios::trunc) << "some other file's contents";
+    TrafficCapture foreign({file.path, 0, 16});
+    CHECK(!foreign.ok());
+    CHECK(!foreign.record(exchange("/dropped", 200)));
+    CHECK(foreign.dropped() == 1);
+}
+
+}  // namespace
+
+int main() {
+    writes_and_reads_records();
+    tolerates_torn_and_foreign_files();
+    return notiman::test::exit_code();
+}
@@ -0,0 +1,164 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <httplib/httplib.h>
+
+#include "test_support.h"
+#include "upstream_pool.h"
+
+namespace {
+
+using notiman::UpstreamPool;
+using notiman::UpstreamPoolOptions;
+
+// Upstream answering "ok", or closing the connection after answering on /close.
+struct Upstream {
+    httplib::Server server;
+    std::thread thread;
+    int port = 0;
+
+    bool start() {
+        server.Get("/", [](const httplib::Request&, httplib::Response& res) { res.set_content("ok", "text/plain"); });
+        server.Get("/close", [](const httplib::Request&, httplib::Response& res) {
+            res.set_header("Connection", "close");
+            res.set_content("bye", "text/plain");
+        });
+        port = server.bind_to_any_port("127.0.0.1");
+        if (port <= 0) {
+            return false;
+        }
+        thread = std::thread([this] { server.listen_after_bind(); });
+        server.wait_until_ready();
+        return true;
+    }
+
+    void stop() {
+        server.stop();
+        thread.join();
+    }
+};
+
+std::shared_ptr<UpstreamPool> make_pool(int port, size_t max_idle, std::chrono::milliseconds idle_timeout) {
+    UpstreamPoolOptions options;
+    options.max_idle = max_idle;
+    options.idle_timeout = idle_timeout;
+    return std::make_shared<UpstreamPool>("127.0.0.1", port, options);
+}
+
+bool get(notiman::UpstreamLease& lease, const std::string& path = "/") {
+    const auto result = lease.client().Get(path);
+    return result && result->status == 200;
+}
+
+// A returned connection is handed out again without a new connect.
+void reuses_returned_connections() {
+    Upstream upstream;
+    CHECK(upstream.start());
+    auto pool = make_pool(upstream.port, 4, std::chrono::seconds(30));
+    {
+        auto lease = pool->acquire();
+        CHECK(!lease.reused());
+        CHECK(get(lease));
+        CHECK(lease.connect_time().count() >= 0);
+    }
+    CHECK(pool->stats().idle == 1);
+    {
+        auto lease = pool->acquire();
+        CHECK(lease.reused());
+        CHECK(get(lease));
+        CHECK(lease.connect_time().count() < 0);
+    }
+    const auto stats = pool->stats();
+    CHECK(stats.acquired == 2 && stats.reused == 1 && stats.connects == 1 && stats.idle == 1);
+
+    pool->retire();
+    upstream.stop();
+}
+
+// Connections closed by the upstream, discarded or over max_idle are not kept.
+void keeps_only_reusable_connections() {
+    Upstream upstream;
+    CHECK(upstream.start());
+    auto pool = make_pool(upstream.port, 1, std::chrono::seconds(30));
+    {
+        auto closing = pool->acquire();
+        CHECK(get(closing, "/close"));
+    }
+    CHECK(pool->stats().idle == 0);
+    {
+        auto discarded = pool->acquire();
+        CHECK(get(discarded));
+        discarded.discard();
+    }
+    CHECK(pool->stats().idle == 0);
+    {
+        auto first = pool->acquire();
+        auto second = pool->acquire();
+        CHECK(get(first) && get(second));
+    }
+    const auto stats = pool->stats();
+    CHECK(stats.idle == 1 && stats.evicted == 1);
+
+    pool->retire();
+    upstream.stop();
+}
+
+// Idle connections expire after idle_timeout, and a retired pool keeps none.
+void expires_and_retires() {
+    Upstream upstream;
+    CHECK(upstream.start());
+    auto pool = make_pool(upstream.port, 4, std::chrono::milliseconds(20));
+    {
+        auto lease = pool->acquire();
+        CHECK(get(lease));
+    }
+    CHECK(pool->evict_idle() == 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(pool->evict_idle() == 1);
+    CHECK(pool->stats().idle == 0);
+
+    {
+        auto lease = pool->acquire();
+        CHECK(!lease.reused());
+        CHECK(get(lease));
+        pool->retire();
+        CHECK(pool->retired());
+    }
+    CHECK(pool->stats().idle == 0);
+    upstream.stop();
+}
+
+// A kept connection the upstream has since closed is noticed before it is handed out.
+void skips_connections_closed_while_idle() {
+    Upstream upstream;
+    upstream.server.set_keep_alive_timeout(1);
+    CHECK(upstream.start());
+    auto pool = make_pool(upstream.port, 4, std::chrono::seconds(30));
+    {
+        auto lease = pool->acquire();
+        CHECK(get(lease));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    {
+        auto lease = pool->acquire();
+        CHECK(!lease.reused());
+        CHECK(get(lease));
+    }
+    const auto stats = pool->stats();
+    CHECK(stats.connects == 2 && stats.evicted == 1);
+
+    pool->retire();
+    upstream.stop();
+}
+
+}  // namespace
+
+int main() {
+    reuses_returned_connections();
+    keeps_only_reusable_connections();
+    expires_and_retires();
+    skips_connections_closed_while_idle();
+    return notiman::test::exit_code();
+}
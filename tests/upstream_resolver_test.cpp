@@ -0,0 +1,113 @@
+#include <chrono>
+#include <string>
+
+#include <httplib/httplib.h>
+
+#include "test_support.h"
+#include "upstream_resolver.h"
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using notiman::UpstreamResolver;
+using std::chrono::milliseconds;
+
+// Lookups are answered from the cache until the ttl runs out or a connect failed.
+void caches_addresses_for_the_ttl() {
+    UpstreamResolver resolver("127.0.0.1", 8080, milliseconds(1000));
+    const auto now = UpstreamResolver::Clock::now();
+    const auto first = resolver.resolve(now);
+    CHECK(!first.hit && !first.race);
+    CHECK(first.addresses->size() == 1 && first.addresses->front().family() == AF_INET);
+
+    CHECK(resolver.resolve(now + milliseconds(999)).hit);
+    CHECK(!resolver.resolve(now + milliseconds(1000)).hit);
+
+    resolver.failed();
+    CHECK(!resolver.resolve(now + milliseconds(1001)).hit);
+
+    UpstreamResolver uncached("127.0.0.1", 8080, milliseconds(0));
+    CHECK(!uncached.resolve(now).hit);
+    CHECK(!uncached.resolve(now).hit);
+}
+
+// A host with addresses of both families is raced until one family has connected, which
+// is then tried first. Only checked where localhost resolves to both.
+void prefers_the_family_that_connected() {
+    UpstreamResolver resolver("localhost", 8080, milliseconds(1000));
+    const auto now = UpstreamResolver::Clock::now();
+    if (!resolver.resolve(now).race) {
+        return;
+    }
+    resolver.connected(AF_INET);
+    const auto resolution = resolver.resolve(now);
+    CHECK(!resolution.race);
+    CHECK(resolution.addresses->front().family() == AF_INET);
+
+    resolver.failed();
+    CHECK(resolver.resolve(now).race);
+}
+
+#ifndef _WIN32
+int loopback_listener(int& port) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+    listen(fd, SOMAXCONN);
+    socklen_t length = sizeof(address);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+    port = ntohs(address.sin_port);
+    return fd;
+}
+
+// Connects to a listening port, and reports a refused one at once rather than as a timeout.
+void connects_to_resolved_addresses() {
+    int port = 0;
+    const int listen_fd = loopback_listener(port);
+    UpstreamResolver resolver("127.0.0.1", port, milliseconds(1000));
+    const auto connection = notiman::connect_resolved(resolver.resolve(UpstreamResolver::Clock::now()),
+                                                      milliseconds(1000));
+    CHECK(connection.sock != INVALID_SOCKET && connection.family == AF_INET);
+    if (connection.sock != INVALID_SOCKET) {
+        close(connection.sock);
+    }
+    close(listen_fd);
+
+    UpstreamResolver closed("127.0.0.1", port, milliseconds(1000));
+    const auto started = std::chrono::steady_clock::now();
+    const auto refused = notiman::connect_resolved(closed.resolve(UpstreamResolver::Clock::now()), milliseconds(2000));
+    CHECK(refused.sock == INVALID_SOCKET && !refused.timed_out);
+    CHECK(std::chrono::steady_clock::now() - started < milliseconds(1000));
+}
+
+// A Unix domain socket resolves to its path without a lookup, cached like any other.
+void resolves_unix_sockets() {
+    UpstreamResolver resolver("localhost", 80, milliseconds(1000), "/run/app.sock");
+    const auto now = UpstreamResolver::Clock::now();
+    const auto resolution = resolver.resolve(now);
+    CHECK(resolution.addresses->size() == 1 && resolution.addresses->front().family() == AF_UNIX);
+    CHECK(resolver.resolve(now).hit);
+
+    UpstreamResolver too_long("localhost", 80, milliseconds(1000), "/" + std::string(200, 'x'));
+    CHECK(too_long.resolve(now).addresses->empty());
+}
+#endif
+
+}  // namespace
+
+int main() {
+    caches_addresses_for_the_ttl();
+    prefers_the_family_that_connected();
+#ifndef _WIN32
+    connects_to_resolved_addresses();
+    resolves_unix_sockets();
+#endif
+    return notiman::test::exit_code();
+}
@@ -0,0 +1,149 @@
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "test_support.h"
+#include "upstream_target.h"
+
+namespace {
+
+using notiman::BalancePolicy;
+using notiman::TargetBalancer;
+using notiman::UpstreamTarget;
+
+// Targets on distinct ports; nothing connects to them.
+std::vector<std::shared_ptr<UpstreamTarget>> make_targets(int count) {
+    std::vector<std::shared_ptr<UpstreamTarget>> targets;
+    for (int i = 0; i < count; ++i) {
+        const std::string url = "http://127.0.0.1:" + std::to_string(9001 + i);
+        auto endpoint = *notiman::parse_target_endpoint(url);
+        auto pool = std::make_shared<notiman::UpstreamPool>(endpoint.host, endpoint.port, notiman::UpstreamPoolOptions{});
+        targets.push_back(std::make_shared<UpstreamTarget>(url, std::move(endpoint), std::move(pool)));
+    }
+    return targets;
+}
+
+// Ejects a healthy target with fall failed probes.
+void eject(UpstreamTarget& target) {
+    for (int i = 0; i < 3; ++i) {
+        target.record_probe(false, 3, 2);
+    }
+}
+
+void parses_http_targets() {
+    const auto endpoint = notiman::parse_target_endpoint("http://127.0.0.1:5173/base");
+    CHECK(endpoint && endpoint->scheme == "http");
+    CHECK(endpoint && endpoint->host == "127.0.0.1" && endpoint->port == 5173);
+    CHECK(endpoint && endpoint->base_path == "/base" && endpoint->socket_path.empty());
+
+    const auto plain = notiman::parse_target_endpoint("http://localhost");
+    CHECK(plain && plain->port == 80 && plain->base_path == "/");
+
+    CHECK(!notiman::parse_target_endpoint("https://localhost"));
+    CHECK(!notiman::parse_target_endpoint("localhost:80"));
+    CHECK(!notiman::parse_target_endpoint("http://:80"));
+    CHECK(!notiman::parse_target_endpoint("http://localhost:port"));
+}
+
+// unix:/path/to.sock[:/base] names a Unix domain socket, and is only understood on POSIX.
+void parses_unix_targets() {
+#ifdef _WIN32
+    CHECK(!notiman::parse_target_endpoint("unix:/run/app.sock"));
+#else
+    const auto endpoint = notiman::parse_target_endpoint("unix:/run/app.sock:/api");
+    CHECK(endpoint && endpoint->scheme == "unix");
+    CHECK(endpoint && endpoint->socket_path == "/run/app.sock");
+    CHECK(endpoint && endpoint->base_path == "/api" && endpoint->host == "localhost");
+
+    const auto plain = notiman::parse_target_endpoint("unix:/run/app.sock");
+    CHECK(plain && plain->base_path == "/");
+
+    CHECK(!notiman::parse_target_endpoint("unix:"));
+    CHECK(!notiman::parse_target_endpoint("unix:run/app.sock"));
+    CHECK(!notiman::parse_target_endpoint("unix:/run/app.sock:api"));
+    CHECK(!notiman::parse_target_endpoint("unix:/" + std::string(200, 'x') + ".sock"));
+#endif
+}
+
+void parses_balance_policies() {
+    CHECK(notiman::parse_balance_policy("round_robin") == BalancePolicy::RoundRobin);
+    CHECK(notiman::parse_balance_policy("least_outstanding") == BalancePolicy::LeastOutstanding);
+    CHECK(notiman::parse_balance_policy("p2c") == BalancePolicy::PowerOfTwoChoices);
+    CHECK(!notiman::parse_balance_policy("random"));
+}
+
+// fall failures in a row eject a target and rise passes in a row reinstate it; a result
+// agreeing with the current state resets the streak.
+void tracks_health_from_probes() {
+    auto target = make_targets(1)[0];
+    CHECK(target->healthy());
+    CHECK(!target->record_probe(false, 3, 2));
+    CHECK(!target->record_probe(false, 3, 2));
+    CHECK(!target->record_probe(true, 3, 2));
+    CHECK(!target->record_probe(false, 3, 2));
+    CHECK(!target->record_probe(false, 3, 2));
+    CHECK(target->record_probe(false, 3, 2) && !target->healthy());
+
+    CHECK(!target->record_probe(true, 3, 2));
+    CHECK(target->record_probe(true, 3, 2) && target->healthy());
+}
+
+// Round robin visits every healthy target in turn and skips ejected ones.
+void rotates_over_healthy_targets() {
+    const auto targets = make_targets(3);
+    const TargetBalancer balancer(targets, BalancePolicy::RoundRobin, true);
+    std::set<UpstreamTarget*> picked;
+    for (int i = 0; i < 3; ++i) {
+        picked.insert(balancer.pick().get());
+    }
+    CHECK(picked.size() == 3);
+
+    eject(*targets[1]);
+    for (int i = 0; i < 6; ++i) {
+        CHECK(balancer.pick() != targets[1]);
+    }
+
+    // Without health checks an ejected flag is ignored.
+    const TargetBalancer unchecked(targets, BalancePolicy::RoundRobin, false);
+    picked.clear();
+    for (int i = 0; i < 3; ++i) {
+        picked.insert(unchecked.pick().get());
+    }
+    CHECK(picked.size() == 3);
+}
+
+// The least busy healthy target wins; with every target ejected requests still go somewhere.
+void prefers_the_least_busy_target() {
+    const auto targets = make_targets(3);
+    const TargetBalancer balancer(targets, BalancePolicy::LeastOutstanding, true);
+    notiman::InFlightRequest busy_first(targets[0]);
+    notiman::InFlightRequest busy_third(targets[2]);
+    for (int i = 0; i < 4; ++i) {
+        CHECK(balancer.pick() == targets[1]);
+    }
+
+    const TargetBalancer p2c(targets, BalancePolicy::PowerOfTwoChoices, true);
+    eject(*targets[0]);
+    eject(*targets[2]);
+    for (int i = 0; i < 10; ++i) {
+        CHECK(p2c.pick() == targets[1]);
+    }
+
+    eject(*targets[1]);
+    for (int i = 0; i < 4; ++i) {
+        CHECK(balancer.pick() == targets[1]);
+    }
+}
+
+}  // namespace
+
+int main() {
+    parses_http_targets();
+    parses_unix_targets();
+    parses_balance_policies();
+    tracks_health_from_probes();
+    rotates_over_healthy_targets();
+    prefers_the_least_busy_target();
+    return notiman::test::exit_code();
+}